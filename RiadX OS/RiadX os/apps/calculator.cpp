@@ -1,5 +1,5 @@
 #include "calculator.h"
-#include <iostream>
+#include "../kernel/klog.h"
 #include <cmath>
 #include <sstream>
 #include <iomanip>
@@ -10,11 +10,11 @@ CalculatorApp::CalculatorApp()
       error_state(false), memory_value(0.0), max_history_size(50),
       show_history(true), scientific_mode(false), decimal_places(10) {
     
-    std::cout << "[CALCULATOR] Calculator initializing..." << std::endl;
+    KLOG_INFO << "[CALCULATOR] Calculator initializing...";
 }
 
 CalculatorApp::~CalculatorApp() {
-    std::cout << "[CALCULATOR] Calculator shutting down" << std::endl;
+    KLOG_INFO << "[CALCULATOR] Calculator shutting down";
 }
 
 bool CalculatorApp::initialize() {
@@ -25,7 +25,7 @@ bool CalculatorApp::initialize() {
     main_window = std::make_shared<Window>("Calculator", 200, 200, window_width, 480);
     
     if (!main_window) {
-        std::cerr << "[CALCULATOR] Failed to create main window" << std::endl;
+        KLOG_ERROR << "[CALCULATOR] Failed to create main window";
         return false;
     }
     
@@ -95,7 +95,7 @@ bool CalculatorApp::initialize() {
         }
     });
     
-    std::cout << "[CALCULATOR] Calculator initialized" << std::endl;
+    KLOG_INFO << "[CALCULATOR] Calculator initialized";
     return true;
 }
 
@@ -564,7 +564,7 @@ void CalculatorApp::add_to_history(const std::string& calculation) {
 void CalculatorApp::set_error_state(const std::string& error_message) {
     error_state = true;
     display_text = error_message;
-    std::cerr << "[CALCULATOR] Error: " << error_message << std::endl;
+    KLOG_ERROR << "[CALCULATOR] Error: " << error_message;
 }
 
 void CalculatorApp::clear_error_state() {
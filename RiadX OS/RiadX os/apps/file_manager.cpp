@@ -1,5 +1,5 @@
 #include "file_manager.h"
-#include <iostream>
+#include "../kernel/klog.h"
 #include <algorithm>
 #include <chrono>
 #include <cctype>
@@ -11,11 +11,11 @@ FileManagerApp::FileManagerApp(FileSystem* fs)
       show_hidden_files(false), list_view_mode(true), clipboard_cut(false),
       history_index(-1) {
     
-    std::cout << "[FILE_MANAGER] File Manager initializing..." << std::endl;
+    KLOG_INFO << "[FILE_MANAGER] File Manager initializing...";
 }
 
 FileManagerApp::~FileManagerApp() {
-    std::cout << "[FILE_MANAGER] File Manager shutting down" << std::endl;
+    KLOG_INFO << "[FILE_MANAGER] File Manager shutting down";
 }
 
 bool FileManagerApp::initialize() {
@@ -23,7 +23,7 @@ bool FileManagerApp::initialize() {
     main_window = std::make_shared<Window>("File Manager", 100, 100, 800, 600);
     
     if (!main_window) {
-        std::cerr << "[FILE_MANAGER] Failed to create main window" << std::endl;
+        KLOG_ERROR << "[FILE_MANAGER] Failed to create main window";
         return false;
     }
     
@@ -116,7 +116,7 @@ bool FileManagerApp::initialize() {
     // Initialize with current directory
     navigate_to("/");
     
-    std::cout << "[FILE_MANAGER] File Manager initialized" << std::endl;
+    KLOG_INFO << "[FILE_MANAGER] File Manager initialized";
     return true;
 }
 
@@ -164,7 +164,7 @@ void FileManagerApp::refresh_file_list() {
         main_window->invalidate();
     }
     
-    std::cout << "[FILE_MANAGER] Refreshed file list: " << current_files.size() << " items" << std::endl;
+    KLOG_DEBUG << "[FILE_MANAGER] Refreshed file list: " << current_files.size() << " items";
 }
 
 void FileManagerApp::navigate_to(const std::string& path) {
@@ -185,7 +185,7 @@ void FileManagerApp::navigate_to(const std::string& path) {
     current_path = path;
     refresh_file_list();
     
-    std::cout << "[FILE_MANAGER] Navigated to: " << current_path << std::endl;
+    KLOG_INFO << "[FILE_MANAGER] Navigated to: " << current_path;
 }
 
 void FileManagerApp::go_back() {
@@ -444,7 +444,7 @@ void FileManagerApp::handle_file_double_click(int file_index) {
 void FileManagerApp::handle_right_click(int x, int y) {
     // Show context menu
     // For now, just print debug info
-    std::cout << "[FILE_MANAGER] Right click at (" << x << ", " << y << ")" << std::endl;
+    KLOG_DEBUG << "[FILE_MANAGER] Right click at (" << x << ", " << y << ")";
 }
 
 std::string FileManagerApp::get_file_icon(const DirectoryEntry& entry) {
@@ -508,17 +508,17 @@ bool FileManagerApp::is_executable_file(const std::string& filename) {
 }
 
 bool FileManagerApp::open_file(const std::string& path) {
-    std::cout << "[FILE_MANAGER] Opening file: " << path << std::endl;
+    KLOG_INFO << "[FILE_MANAGER] Opening file: " << path;
     
     if (is_executable_file(path)) {
         return execute_file(path);
     } else if (is_text_file(path)) {
         // Launch text editor
-        std::cout << "[FILE_MANAGER] Opening text file in editor: " << path << std::endl;
+        KLOG_INFO << "[FILE_MANAGER] Opening text file in editor: " << path;
         return true;
     } else if (is_image_file(path)) {
         // Launch image viewer
-        std::cout << "[FILE_MANAGER] Opening image file: " << path << std::endl;
+        KLOG_INFO << "[FILE_MANAGER] Opening image file: " << path;
         return true;
     } else {
         show_error_message("Cannot open file: " + path);
@@ -527,13 +527,13 @@ bool FileManagerApp::open_file(const std::string& path) {
 }
 
 bool FileManagerApp::execute_file(const std::string& path) {
-    std::cout << "[FILE_MANAGER] Executing file: " << path << std::endl;
+    KLOG_INFO << "[FILE_MANAGER] Executing file: " << path;
     // In a real OS, this would launch the executable
     return true;
 }
 
 void FileManagerApp::show_error_message(const std::string& message) {
-    std::cerr << "[FILE_MANAGER] Error: " << message << std::endl;
+    KLOG_ERROR << "[FILE_MANAGER] Error: " << message;
     // In a real implementation, this would show a dialog box
 }
 
@@ -561,7 +561,7 @@ void FileManagerApp::copy_selected_file() {
     if (selected_file_index >= 0 && selected_file_index < static_cast<int>(current_files.size())) {
         clipboard_file = current_files[selected_file_index].full_path;
         clipboard_cut = false;
-        std::cout << "[FILE_MANAGER] Copied: " << clipboard_file << std::endl;
+        KLOG_DEBUG << "[FILE_MANAGER] Copied: " << clipboard_file;
     }
 }
 
@@ -569,7 +569,7 @@ void FileManagerApp::cut_selected_file() {
     if (selected_file_index >= 0 && selected_file_index < static_cast<int>(current_files.size())) {
         clipboard_file = current_files[selected_file_index].full_path;
         clipboard_cut = true;
-        std::cout << "[FILE_MANAGER] Cut: " << clipboard_file << std::endl;
+        KLOG_DEBUG << "[FILE_MANAGER] Cut: " << clipboard_file;
     }
 }
 
@@ -587,6 +587,7 @@ void FileManagerApp::paste_file() {
             show_error_message("Cannot move file");
         }
     } else {
+        // A reflink copy: the two share blocks until either is changed
         if (filesystem->copy_file(clipboard_file, dest_path)) {
             refresh_file_list();
         } else {
@@ -1,8 +1,9 @@
 #include "text_editor.h"
-#include <iostream>
+#include "../kernel/klog.h"
 #include <algorithm>
 #include <sstream>
 #include <cctype>
+#include <cstring>
 
 TextEditorApp::TextEditorApp(FileSystem* fs)
     : filesystem(fs), is_modified(false), is_read_only(false),
@@ -14,14 +15,14 @@ TextEditorApp::TextEditorApp(FileSystem* fs)
       find_case_sensitive(false), find_whole_word(false), find_current_match(-1),
       max_undo_levels(100) {
     
-    std::cout << "[TEXT_EDITOR] Text Editor initializing..." << std::endl;
+    KLOG_INFO << "[TEXT_EDITOR] Text Editor initializing...";
     
     // Initialize with empty document
     lines.push_back("");
 }
 
 TextEditorApp::~TextEditorApp() {
-    std::cout << "[TEXT_EDITOR] Text Editor shutting down" << std::endl;
+    KLOG_INFO << "[TEXT_EDITOR] Text Editor shutting down";
 }
 
 bool TextEditorApp::initialize() {
@@ -29,7 +30,7 @@ bool TextEditorApp::initialize() {
     main_window = std::make_shared<Window>("Text Editor", 150, 150, 800, 600);
     
     if (!main_window) {
-        std::cerr << "[TEXT_EDITOR] Failed to create main window" << std::endl;
+        KLOG_ERROR << "[TEXT_EDITOR] Failed to create main window";
         return false;
     }
     
@@ -77,7 +78,7 @@ bool TextEditorApp::initialize() {
         }
     });
     
-    std::cout << "[TEXT_EDITOR] Text Editor initialized" << std::endl;
+    KLOG_INFO << "[TEXT_EDITOR] Text Editor initialized";
     return true;
 }
 
@@ -128,7 +129,7 @@ void TextEditorApp::load_content(const std::string& content) {
         main_window->invalidate();
     }
     
-    std::cout << "[TEXT_EDITOR] Loaded content with " << text_lines.size() << " lines" << std::endl;
+    KLOG_INFO << "[TEXT_EDITOR] Loaded content with " << text_lines.size() << " lines";
 }
 
 void TextEditorApp::set_current_filename(const std::string& filename) {
@@ -140,24 +141,26 @@ void TextEditorApp::set_current_filename(const std::string& filename) {
         main_window->set_title(title);
     }
     
-    std::cout << "[TEXT_EDITOR] Set current filename: " << filename << std::endl;
+    KLOG_DEBUG << "[TEXT_EDITOR] Set current filename: " << filename;
 }
 
 bool TextEditorApp::load_file(const std::string& file_path) {
     if (!filesystem || !filesystem->file_exists(file_path)) {
-        std::cerr << "[TEXT_EDITOR] File does not exist: " << file_path << std::endl;
+        KLOG_ERROR << "[TEXT_EDITOR] File does not exist: " << file_path;
         return false;
     }
     
-    std::string content = filesystem->read_file(file_path);
+    FileBuffer content = filesystem->read_file_buffer(file_path);
     
-    // Split content into lines
+    // Split content into lines straight out of the shared buffer
     lines.clear();
-    std::stringstream ss(content);
-    std::string line;
-    
-    while (std::getline(ss, line)) {
-        lines.push_back(line);
+    const char* data = content.data();
+    size_t size = content.size();
+    for (size_t start = 0; start < size;) {
+        const char* newline = static_cast<const char*>(std::memchr(data + start, '\n', size - start));
+        size_t end = newline ? static_cast<size_t>(newline - data) : size;
+        lines.emplace_back(data + start, end - start);
+        start = end + 1;
     }
     
     if (lines.empty()) {
@@ -178,7 +181,7 @@ bool TextEditorApp::load_file(const std::string& file_path) {
     main_window->set_title(title);
     main_window->invalidate();
     
-    std::cout << "[TEXT_EDITOR] Loaded file: " << file_path << " (" << lines.size() << " lines)" << std::endl;
+    KLOG_INFO << "[TEXT_EDITOR] Loaded file: " << file_path << " (" << lines.size() << " lines)";
     return true;
 }
 
@@ -211,11 +214,11 @@ bool TextEditorApp::save_file_as(const std::string& file_path) {
         main_window->set_title(title);
         main_window->invalidate();
         
-        std::cout << "[TEXT_EDITOR] Saved file: " << file_path << std::endl;
+        KLOG_INFO << "[TEXT_EDITOR] Saved file: " << file_path;
         return true;
     }
     
-    std::cerr << "[TEXT_EDITOR] Failed to save file: " << file_path << std::endl;
+    KLOG_ERROR << "[TEXT_EDITOR] Failed to save file: " << file_path;
     return false;
 }
 
@@ -234,7 +237,7 @@ void TextEditorApp::new_document() {
     main_window->set_title("Text Editor - Untitled");
     main_window->invalidate();
     
-    std::cout << "[TEXT_EDITOR] New document created" << std::endl;
+    KLOG_INFO << "[TEXT_EDITOR] New document created";
 }
 
 void TextEditorApp::insert_text(const std::string& text) {
@@ -698,7 +701,7 @@ void TextEditorApp::clear_selection() {
 void TextEditorApp::copy_text() {
     if (has_selection) {
         clipboard_text = get_selected_text();
-        std::cout << "[TEXT_EDITOR] Copied text to clipboard" << std::endl;
+        KLOG_DEBUG << "[TEXT_EDITOR] Copied text to clipboard";
     }
 }
 
@@ -706,14 +709,14 @@ void TextEditorApp::cut_text() {
     if (has_selection) {
         clipboard_text = get_selected_text();
         delete_selection();
-        std::cout << "[TEXT_EDITOR] Cut text to clipboard" << std::endl;
+        KLOG_DEBUG << "[TEXT_EDITOR] Cut text to clipboard";
     }
 }
 
 void TextEditorApp::paste_text() {
     if (!clipboard_text.empty()) {
         insert_text(clipboard_text);
-        std::cout << "[TEXT_EDITOR] Pasted text from clipboard" << std::endl;
+        KLOG_DEBUG << "[TEXT_EDITOR] Pasted text from clipboard";
     }
 }
 
@@ -851,7 +854,7 @@ void TextEditorApp::clear_undo_history() {
 bool TextEditorApp::open_file(const std::string& file_path) {
     if (is_modified) {
         // Should show save changes dialog
-        std::cout << "[TEXT_EDITOR] Warning: Current document has unsaved changes" << std::endl;
+        KLOG_WARN << "[TEXT_EDITOR] Warning: Current document has unsaved changes";
     }
     
     return load_file(file_path);
@@ -860,7 +863,7 @@ bool TextEditorApp::open_file(const std::string& file_path) {
 bool TextEditorApp::create_new_file() {
     if (is_modified) {
         // Should show save changes dialog
-        std::cout << "[TEXT_EDITOR] Warning: Current document has unsaved changes" << std::endl;
+        KLOG_WARN << "[TEXT_EDITOR] Warning: Current document has unsaved changes";
     }
     
     new_document();
@@ -875,16 +878,16 @@ void TextEditorApp::handle_menu_click(int x, int y) {
     // Simple menu handling
     if (x >= 10 && x <= 50) {
         // File menu
-        std::cout << "[TEXT_EDITOR] File menu clicked" << std::endl;
+        KLOG_DEBUG << "[TEXT_EDITOR] File menu clicked";
     } else if (x >= 50 && x <= 90) {
         // Edit menu
-        std::cout << "[TEXT_EDITOR] Edit menu clicked" << std::endl;
+        KLOG_DEBUG << "[TEXT_EDITOR] Edit menu clicked";
     } else if (x >= 90 && x <= 130) {
         // View menu
-        std::cout << "[TEXT_EDITOR] View menu clicked" << std::endl;
+        KLOG_DEBUG << "[TEXT_EDITOR] View menu clicked";
     } else if (x >= 130 && x <= 170) {
         // Help menu
-        std::cout << "[TEXT_EDITOR] Help menu clicked" << std::endl;
+        KLOG_DEBUG << "[TEXT_EDITOR] Help menu clicked";
     }
 }
 
@@ -895,7 +898,7 @@ void TextEditorApp::handle_toolbar_click(int x, int y) {
             new_document();
         } else if (x >= 35 && x <= 59) {
             // Open button
-            std::cout << "[TEXT_EDITOR] Open button clicked" << std::endl;
+            KLOG_DEBUG << "[TEXT_EDITOR] Open button clicked";
         } else if (x >= 65 && x <= 89) {
             // Save button
             save_file();
@@ -924,6 +927,6 @@ void TextEditorApp::handle_text_area_click(int x, int y) {
 }
 
 void TextEditorApp::show_find_dialog() {
-    std::cout << "[TEXT_EDITOR] Find dialog requested" << std::endl;
+    KLOG_INFO << "[TEXT_EDITOR] Find dialog requested";
     // In a real implementation, this would show a find dialog
 }
@@ -1,9 +1,27 @@
 ; boot.asm - Boot sector assembly code for RiadX OS (with improvements)
 ; This is the first code that runs when the system boots
+;
+; Loads the kernel image written by tools/mkkernel (header sector followed
+; by an uncompressed payload) with INT 13h extended reads. Sectors are read
+; in batches into a bounce buffer below 1MB and copied to the kernel load
+; address with INT 15h AH=87h, so kernel size is not limited by real mode.
 
 [BITS 16]                       ; 16-bit real mode
 [ORG 0x7C00]                    ; Boot sector loads at 0x7C00
 
+BOUNCE_SEGMENT      equ 0x1000  ; Bounce buffer at 0x10000
+READ_BATCH_SECTORS  equ 64      ; Sectors per extended read (32KB)
+READ_RETRIES        equ 3       ; Attempts per batch before giving up
+
+KERNEL_IMAGE_MAGIC  equ 0x494B5852  ; "RXKI", see boot/kernel_image.h
+KERNEL_FLAG_LZ4     equ 0x0001
+
+; Loader state, kept below the boot sector
+boot_drive          equ 0x0600  ; byte
+sectors_left        equ 0x0604  ; dword
+copy_dest           equ 0x0608  ; dword
+kernel_entry        equ 0x060C  ; dword
+
 ; Boot sector entry point
 start:
     cli                         ; Disable interrupts
@@ -14,81 +32,166 @@ start:
     mov sp, 0x7C00              ; Set stack pointer just below boot sector
     sti                         ; Enable interrupts
 
+    mov [boot_drive], dl        ; BIOS passes the boot drive in DL
+
     ; Display boot message
     mov si, boot_msg
     call print_string
 
-    ; Load second stage bootloader
-    call load_stage2
+    ; Load the kernel image to its load address
+    call load_kernel
 
-    ; If we get here, something went wrong
-    mov si, error_msg
-    call print_string
-    jmp halt
+    ; Enable A20 line before protected mode
+    call enable_a20
 
-; Load second stage bootloader from disk
-load_stage2:
-    mov si, loading_msg
-    call print_string
+    ; Switch to protected mode
+    cli                       ; Disable interrupts
 
-    ; Reset disk system
-    mov ah, 0x00               ; Reset disk function
-    mov dl, 0x80               ; First hard disk
-    int 0x13                   ; Call BIOS disk services
-    jc disk_error              ; Jump if carry flag set (error)
-
-    ; Read sectors from disk
-    mov ah, 0x02               ; Read sectors function
-    mov al, 15                 ; Number of sectors to read
-    mov ch, 0                  ; Cylinder number
-    mov cl, 2                  ; Starting sector (sector 2)
-    mov dh, 0                  ; Head number
-    mov dl, 0x80               ; Drive number
-    mov bx, 0x1000             ; Buffer address (0x1000:0x0000)
-    mov es, bx
-    mov bx, 0x0000
-    int 0x13                   ; Call BIOS disk services
-    jc disk_error              ; Jump if error
-
-    ; Verify loaded code
-    mov ax, 0x1000
-    mov es, ax
-    mov bx, 0x0000
-    mov ax, [es:bx]            ; Read first word of loaded code
-    cmp ax, 0x5A4D             ; Check for valid signature
-    jne load_error
+    ; Load GDT
+    lgdt [gdt_descriptor]
 
-    ; Enable A20 line before protected mode
-    call enable_a20
+    ; Set PE bit in CR0
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
 
-    ; Display protected mode message
-    mov si, protected_msg
-    call print_string
+    ; Far jump to flush pipeline and enter protected mode
+    jmp 0x08:protected_mode_entry
 
-    ; Switch to protected mode
-    call enter_protected_mode
+[BITS 32]                     ; Now in 32-bit protected mode
+protected_mode_entry:
+    ; Set up segment registers
+    mov ax, 0x10              ; Data segment selector
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, 0x90000          ; Set up stack
+
+    ; Jump to the entry point from the image header
+    jmp [kernel_entry]
 
-    ; If we return, something went wrong
-    jmp halt
+[BITS 16]                     ; Back to 16-bit real mode
+
+lba_error:
+    mov si, lba_error_msg
+    jmp boot_error
 
 disk_error:
     mov si, disk_error_msg
-    call print_string
-    jmp halt
+    jmp boot_error
 
 load_error:
     mov si, load_error_msg
+
+; Print the message in SI and halt
+boot_error:
     call print_string
-    jmp halt
+halt:
+    cli                        ; Disable interrupts
+    hlt                        ; Halt processor
+    jmp halt                   ; Infinite loop
+
+; Load the kernel image from disk
+load_kernel:
+    ; Check for INT 13h extensions with disk address packet support
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc lba_error
+    cmp bx, 0xAA55
+    jne lba_error
+    test cl, 1
+    jz lba_error
+
+    ; Read and check the image header sector
+    mov eax, [kernel_lba]
+    mov [dap_lba], eax
+    mov cx, 1
+    call read_batch
+
+    mov ax, BOUNCE_SEGMENT
+    mov fs, ax
+    cmp dword [fs:0], KERNEL_IMAGE_MAGIC
+    jne load_error
+    test byte [fs:6], KERNEL_FLAG_LZ4 ; No decompressor in the boot sector
+    jnz load_error
+    mov eax, [fs:8]             ; payload_size
+    add eax, 511
+    shr eax, 9
+    mov [sectors_left], eax
+    mov eax, [fs:16]            ; load_address
+    mov [copy_dest], eax
+    mov eax, [fs:20]            ; entry_point
+    mov [kernel_entry], eax
+
+    inc dword [dap_lba]
+
+.next_batch:
+    mov ecx, [sectors_left]
+    test ecx, ecx
+    jz .done
+    cmp ecx, READ_BATCH_SECTORS
+    jbe .read
+    mov cx, READ_BATCH_SECTORS
+.read:
+    call read_batch
+    call copy_to_high_memory
+
+    movzx ecx, cx
+    add [dap_lba], ecx
+    sub [sectors_left], ecx
+    shl ecx, 9
+    add [copy_dest], ecx
+    jmp .next_batch
+
+.done:
+    ret
+
+; Read CX sectors at dap_lba into the bounce buffer, retrying on error
+read_batch:
+    mov di, READ_RETRIES
+.retry:
+    mov [dap_count], cx         ; BIOS rewrites this with sectors transferred
+    mov si, dap
+    mov ah, 0x42                ; Extended read
+    mov dl, [boot_drive]
+    int 0x13
+    jnc .ok
+
+    xor ah, ah                  ; Reset the drive before the next attempt
+    int 0x13
+    dec di
+    jnz .retry
+    jmp disk_error
+.ok:
+    ret
+
+; Copy CX sectors from the bounce buffer to copy_dest
+copy_to_high_memory:
+    push cx
+    mov eax, [copy_dest]
+    mov [move_dst + 2], ax      ; Base bits 0-15
+    shr eax, 16
+    mov [move_dst + 4], al      ; Base bits 16-23
+    mov [move_dst + 7], ah      ; Base bits 24-31
+
+    shl cx, 8                   ; Sectors to words
+    mov si, move_gdt
+    mov ah, 0x87                ; Move extended memory block
+    int 0x15
+    pop cx
+    jc disk_error
+    ret
 
 ; Print null-terminated string
 ; Input: SI = pointer to string
 print_string:
-    push ax
-    push bx
+    pusha
     mov ah, 0x0E               ; BIOS teletype function
-    mov bh, 0x00               ; Page number
-    mov bl, 0x07               ; Text attribute (light gray on black)
+    mov bx, 0x0007             ; Page 0, light gray on black
 .next_char:
     lodsb                      ; Load byte from [SI] into AL, increment SI
     cmp al, 0                  ; Check for null terminator
@@ -96,155 +199,21 @@ print_string:
     int 0x10                   ; Call BIOS video interrupt
     jmp .next_char
 .done:
-    pop bx
-    pop ax
-    ret
-
-; Print newline
-print_newline:
-    push ax
-    mov ah, 0x0E
-    mov al, 0x0D               ; Carriage return
-    int 0x10
-    mov al, 0x0A               ; Line feed
-    int 0x10
-    pop ax
+    popa
     ret
 
-; Halt system
-halt:
-    mov si, halt_msg
-    call print_string
-    cli                        ; Disable interrupts
-    hlt                        ; Halt processor
-    jmp halt                   ; Infinite loop
-
-; Enable A20 line using keyboard controller
+; Enable A20 line, through the BIOS if supported, else the fast A20 gate
 enable_a20:
-    push ax
-    push cx
-
-    ; Disable keyboard
-    call wait_8042_command
-    mov al, 0xAD
-    out 0x64, al
-
-    ; Read output port
-    call wait_8042_command
-    mov al, 0xD0
-    out 0x64, al
-    call wait_8042_data
-    in al, 0x60
-    push ax
-
-    ; Write output port with A20 enabled
-    call wait_8042_command
-    mov al, 0xD1
-    out 0x64, al
-    call wait_8042_command
-    pop ax
+    mov ax, 0x2401
+    int 0x15
+    jnc .done
+    in al, 0x92
     or al, 2                   ; Set A20 bit
-    out 0x60, al
-
-    ; Enable keyboard
-    call wait_8042_command
-    mov al, 0xAE
-    out 0x64, al
-
-    call wait_8042_command
-    pop cx
-    pop ax
-    ret
-
-; Wait for keyboard controller command ready
-wait_8042_command:
-    push ax
-.loop:
-    in al, 0x64
-    test al, 2
-    jnz .loop
-    pop ax
-    ret
-
-; Wait for keyboard controller data ready
-wait_8042_data:
-    push ax
-.loop:
-    in al, 0x64
-    test al, 1
-    jz .loop
-    pop ax
-    ret
-
-; Detect memory using BIOS INT 15h, EAX=E820h
-detect_memory:
-    push ebp
-    mov ebp, esp
-    pusha
-
-    mov di, memory_map         ; Destination buffer
-    xor ebx, ebx              ; Clear continuation value
-    mov edx, 0x534D4150       ; "SMAP" signature
-
-.loop:
-    mov eax, 0xE820           ; Function code
-    mov ecx, 24               ; Buffer size
-    int 0x15                  ; Call BIOS
-    jc .error                 ; Jump if error
-
-    cmp eax, 0x534D4150       ; Verify signature
-    jne .error
-
-    ; Store entry
-    add di, 24                ; Move to next entry
-    inc word [memory_map_count]
-
-    test ebx, ebx             ; Check if more entries
-    jnz .loop                 ; Continue if more entries
-
-    clc                       ; Clear carry (success)
-    jmp .done
-
-.error:
-    stc                       ; Set carry (error)
-
+    and al, 0xFE               ; Do not trigger a reset
+    out 0x92, al
 .done:
-    popa
-    mov esp, ebp
-    pop ebp
     ret
 
-; Switch to protected mode
-enter_protected_mode:
-    cli                       ; Disable interrupts
-
-    ; Load GDT
-    lgdt [gdt_descriptor]
-
-    ; Set PE bit in CR0
-    mov eax, cr0
-    or eax, 1
-    mov cr0, eax
-
-    ; Far jump to flush pipeline and enter protected mode
-    jmp 0x08:protected_mode_entry
-
-[BITS 32]                     ; Now in 32-bit protected mode
-protected_mode_entry:
-    ; Set up segment registers
-    mov ax, 0x10              ; Data segment selector
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    mov ss, ax
-    mov esp, 0x90000          ; Set up stack
-
-    ; Jump to kernel
-    jmp 0x100000              ; Jump to kernel at 1MB
-
-[BITS 16]                     ; Back to 16-bit for data
-
 ; Global Descriptor Table
 gdt_start:
     ; Null descriptor
@@ -273,52 +242,51 @@ gdt_descriptor:
     dw gdt_end - gdt_start - 1 ; Size
     dd gdt_start               ; Offset
 
+; INT 13h AH=42h disk address packet
+dap:
+    db 0x10                   ; Packet size
+    db 0x00                   ; Reserved
+dap_count:
+    dw 0                      ; Sectors to transfer
+    dw 0x0000                 ; Buffer offset
+    dw BOUNCE_SEGMENT         ; Buffer segment
+dap_lba:
+    dd 0                      ; Starting LBA (bits 0-31)
+    dd 0                      ; Starting LBA (bits 32-63)
+
+; INT 15h AH=87h descriptor table; the BIOS fills in the zeroed entries
+move_gdt:
+    times 16 db 0             ; Null and GDT descriptors
+
+    ; Source: the bounce buffer
+    dw 0xFFFF                 ; Limit
+    dw 0x0000                 ; Base (bits 0-15)
+    db BOUNCE_SEGMENT >> 12   ; Base (bits 16-23)
+    db 0x93                   ; Access byte
+    db 0x00
+    db 0x00                   ; Base (bits 24-31)
+
+move_dst:
+    ; Destination: set per batch by copy_to_high_memory
+    dw 0xFFFF                 ; Limit
+    dw 0x0000                 ; Base (bits 0-15)
+    db 0x00                   ; Base (bits 16-23)
+    db 0x93                   ; Access byte
+    db 0x00
+    db 0x00                   ; Base (bits 24-31)
+
+    times 16 db 0             ; BIOS code and stack descriptors
+
 ; Data section
-boot_msg        db 'RiadX OS Bootloader v1.0', 0x0D, 0x0A, 0
-loading_msg     db 'Loading kernel...', 0x0D, 0x0A, 0
-protected_msg   db 'Enabling A20 and entering protected mode...', 0x0D, 0x0A, 0
-jumping_msg     db 'Jumping to kernel...', 0x0D, 0x0A, 0
-error_msg       db 'Boot failed!', 0x0D, 0x0A, 0
-disk_error_msg  db 'Disk read error!', 0x0D, 0x0A, 0
-load_error_msg  db 'Invalid kernel!', 0x0D, 0x0A, 0
-halt_msg        db 'System halted.', 0x0D, 0x0A, 0
-
-; Memory map storage
-memory_map_count dw 0
-memory_map       times 512 db 0  ; Space for memory map entries
-
-; Padding and boot signature
-times 510-($-$$) db 0             ; Pad to 510 bytes
-dw 0xAA55                         ; Boot signature
+boot_msg        db 'RiadX OS', 0x0D, 0x0A, 0
+lba_error_msg   db 'No LBA support!', 0
+disk_error_msg  db 'Disk read error!', 0
+load_error_msg  db 'Invalid kernel!', 0
 
-; Second stage bootloader starts here (would be loaded from disk)
-second_stage:
-    ; This would contain the main bootloader code
-    ; For now, just a placeholder
-    mov si, kernel_msg
-    call print_string_32
-    jmp $
-
-kernel_msg db 'Kernel loading complete!', 0
-
-print_string_32:
-    ; 32-bit string printing routine
-    push eax
-    push ebx
-    mov ebx, 0xB8000          ; Video memory address
-    mov ah, 0x07              ; Attribute (light gray on black)
-.loop:
-    lodsb
-    cmp al, 0
-    je .done
-    mov [ebx], ax
-    add ebx, 2
-    jmp .loop
+; Padding, kernel location and boot signature
+times 506-($-$$) db 0             ; Pad to 506 bytes
 
-.done:
-    pop ebx
-    pop eax
-    ret
+; First sector of the kernel image; tools may patch this field
+kernel_lba      dd 1
 
-; Fill rest of sector
-times 1024-($-second_stage) db 0
+dw 0xAA55                         ; Boot signature
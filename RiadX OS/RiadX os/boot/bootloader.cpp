@@ -1,12 +1,25 @@
 #include "bootloader.h"
+#include "lz4.h"
+#include "crc32.h"
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 #include <thread>
 #include <chrono>
 
-Bootloader::Bootloader() : current_stage(STAGE_INIT), verbose_output(true) {
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+uint32_t Bootloader::cpu_features = 0;
+
+Bootloader::Bootloader() 
+    : current_stage(STAGE_INIT), verbose_output(true),
+      boot_disk_path("kernel.img"), kernel_start_sector(0), kernel_on_disk(false) {
     // Initialize system info structure
     std::memset(&system_info, 0, sizeof(SystemInfo));
+    std::memset(&kernel_header, 0, sizeof(KernelImageHeader));
+    std::memset(&load_stats, 0, sizeof(KernelLoadStats));
     std::strcpy(system_info.bootloader_name, "RiadX OS Bootloader v1.0");
     std::strcpy(system_info.kernel_cmdline, "quiet splash");
     
@@ -173,7 +186,11 @@ bool Bootloader::load_kernel_image() {
         return false;
     }
     
-    system_info.kernel_size = 2048 * 1024; // 2MB simulated kernel size
+    if (kernel_on_disk) {
+        system_info.kernel_size = kernel_image.size();
+    } else {
+        system_info.kernel_size = 2048 * 1024; // 2MB simulated kernel size
+    }
     
     if (verbose_output) {
         std::cout << "  - Kernel loaded at address 0x" << std::hex << KERNEL_LOAD_ADDRESS << std::dec << std::endl;
@@ -268,10 +285,25 @@ uint32_t Bootloader::get_total_memory() {
 }
 
 bool Bootloader::detect_cpu_features() {
+    cpu_features = 0;
+    
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        if (edx & 0x1)       cpu_features |= CPU_FEATURE_FPU;  // EDX bit 0
+        if (edx & bit_SSE2)   cpu_features |= CPU_FEATURE_SSE2;
+        if (ecx & bit_SSE4_2) cpu_features |= CPU_FEATURE_SSE42;
+    }
+#endif
+    select_memory_primitives();
+    
     if (verbose_output) {
         print_status("    - CPU: Intel/AMD x86 compatible");
         print_status("    - Protected mode support: Yes");
-        print_status("    - FPU support: Yes");
+        print_status(std::string("    - FPU support: ") + ((cpu_features & CPU_FEATURE_FPU) ? "Yes" : "No"));
+        print_status(std::string("    - SSE2 support: ") + ((cpu_features & CPU_FEATURE_SSE2) ? "Yes" : "No"));
+        print_status(std::string("    - SSE4.2 support: ") + ((cpu_features & CPU_FEATURE_SSE42) ? "Yes" : "No"));
+        print_status(std::string("    - Memory primitives: ") + get_memory_primitives_name());
     }
     return true;
 }
@@ -294,25 +326,169 @@ bool Bootloader::initialize_disk_subsystem() {
 }
 
 bool Bootloader::read_kernel_from_disk() {
+    std::ifstream disk(boot_disk_path, std::ios::binary);
+    if (!disk) {
+        // No boot disk image, fall back to the built-in simulated kernel
+        kernel_on_disk = false;
+        if (verbose_output) {
+            print_status("    - No kernel image at " + boot_disk_path + ", using built-in kernel");
+        }
+        return true;
+    }
+    
+    auto read_start = std::chrono::steady_clock::now();
+    
+    // The header occupies the first sector of the image
+    uint8_t header_sector[DISK_SECTOR_SIZE];
+    if (!read_sectors(disk, kernel_start_sector, 1, header_sector)) {
+        print_error("Cannot read kernel header sector");
+        return false;
+    }
+    memcpy_boot(&kernel_header, header_sector, sizeof(KernelImageHeader));
+    
+    if (kernel_header.magic != KERNEL_IMAGE_MAGIC) {
+        print_error("Bad kernel image magic");
+        return false;
+    }
+    
+    uint32_t payload_sectors = (kernel_header.payload_size + DISK_SECTOR_SIZE - 1) / DISK_SECTOR_SIZE;
+    kernel_payload.resize(static_cast<size_t>(payload_sectors) * DISK_SECTOR_SIZE);
+    
+    // Read the payload in large batches, as the BIOS extended read would
+    uint32_t sector = 0;
+    while (sector < payload_sectors) {
+        uint32_t batch = std::min<uint32_t>(KERNEL_READ_BATCH_SECTORS, payload_sectors - sector);
+        if (!read_sectors(disk, kernel_start_sector + 1 + sector, batch,
+                          kernel_payload.data() + static_cast<size_t>(sector) * DISK_SECTOR_SIZE)) {
+            print_error("Disk read failed at sector " + std::to_string(kernel_start_sector + 1 + sector));
+            return false;
+        }
+        sector += batch;
+    }
+    kernel_payload.resize(kernel_header.payload_size);
+    
+    auto read_end = std::chrono::steady_clock::now();
+    
+    kernel_on_disk = true;
+    load_stats.sectors_read = 1 + payload_sectors;
+    load_stats.raw_sectors = 1 + (kernel_header.image_size + DISK_SECTOR_SIZE - 1) / DISK_SECTOR_SIZE;
+    load_stats.payload_size = kernel_header.payload_size;
+    load_stats.image_size = kernel_header.image_size;
+    load_stats.read_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        read_end - read_start).count();
+    
     if (verbose_output) {
-        print_status("    - Reading kernel sectors from disk");
-        print_status("    - Kernel found at sector 100");
+        std::cout << "[BOOT]     - Read " << load_stats.sectors_read << " sectors from "
+                  << boot_disk_path << " in " << load_stats.read_time_us << " us" << std::endl;
+    }
+    return true;
+}
+
+bool Bootloader::read_sectors(std::ifstream& disk, uint32_t lba, uint32_t count, uint8_t* buffer) {
+    disk.seekg(static_cast<std::streamoff>(lba) * DISK_SECTOR_SIZE);
+    disk.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(count) * DISK_SECTOR_SIZE);
+    
+    // A short read at the end of the image is zero filled, like a padded disk
+    std::streamsize got = disk.gcount();
+    if (got <= 0) {
+        return false;
+    }
+    if (got < static_cast<std::streamsize>(count) * DISK_SECTOR_SIZE) {
+        memset_boot(buffer + got, 0, static_cast<size_t>(count) * DISK_SECTOR_SIZE - got);
+        disk.clear();
     }
     return true;
 }
 
 bool Bootloader::validate_kernel() {
+    if (!kernel_on_disk) {
+        if (verbose_output) {
+            print_status("    - Built-in kernel, nothing to validate");
+        }
+        return true;
+    }
+    
     if (verbose_output) {
         print_status("    - Checking kernel magic number");
-        print_status("    - Verifying kernel checksum");
+    }
+    
+    if (kernel_header.version != KERNEL_IMAGE_VERSION) {
+        print_error("Unsupported kernel image version " + std::to_string(kernel_header.version));
+        return false;
+    }
+    
+    if (kernel_header.image_size == 0 || kernel_header.payload_size == 0) {
+        print_error("Empty kernel image");
+        return false;
+    }
+    
+    if (!(kernel_header.flags & KERNEL_IMAGE_FLAG_LZ4) &&
+        kernel_header.payload_size != kernel_header.image_size) {
+        print_error("Uncompressed kernel payload size mismatch");
+        return false;
+    }
+    
+    // Checksum the payload as read, before decompression touches it
+    if (kernel_header.flags & KERNEL_IMAGE_FLAG_CRC32C) {
+        if (verbose_output) {
+            print_status("    - Verifying kernel checksum");
+        }
+        if (!verify_checksum(kernel_payload.data(), kernel_payload.size())) {
+            print_error("Kernel checksum mismatch");
+            return false;
+        }
+    } else if (verbose_output) {
+        print_status("    - Kernel image has no checksum");
+    }
+    
+    if (verbose_output) {
         print_status("    - Kernel validation passed");
     }
     return true;
 }
 
 bool Bootloader::decompress_kernel() {
+    if (!kernel_on_disk) {
+        return true;
+    }
+    
+    if (!(kernel_header.flags & KERNEL_IMAGE_FLAG_LZ4)) {
+        if (verbose_output) {
+            print_status("    - Kernel is not compressed, skipping decompression");
+        }
+        kernel_image.swap(kernel_payload);
+        return true;
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    kernel_image.resize(kernel_header.image_size);
+    int size = lz4_decompress_block(kernel_payload.data(), kernel_payload.size(),
+                                    kernel_image.data(), kernel_image.size());
+    
+    auto end = std::chrono::steady_clock::now();
+    load_stats.decompress_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        end - start).count();
+    
+    if (size != static_cast<int>(kernel_header.image_size)) {
+        print_error("LZ4 decompression produced " + std::to_string(size) + " bytes, expected " +
+                    std::to_string(kernel_header.image_size));
+        return false;
+    }
+    
+    // Free the compressed copy, only the image stays resident
+    std::vector<uint8_t>().swap(kernel_payload);
+    
     if (verbose_output) {
-        print_status("    - Kernel is not compressed, skipping decompression");
+        uint32_t saved = load_stats.raw_sectors > load_stats.sectors_read ?
+                         load_stats.raw_sectors - load_stats.sectors_read : 0;
+        uint64_t saved_us = saved * load_stats.read_time_us / load_stats.sectors_read;
+        
+        std::cout << "[BOOT]     - Decompressed " << (load_stats.payload_size / 1024) << " KB -> "
+                  << (load_stats.image_size / 1024) << " KB in "
+                  << load_stats.decompress_time_us << " us" << std::endl;
+        std::cout << "[BOOT]     - Saved " << saved << " sectors (~"
+                  << saved_us << " us of disk I/O)" << std::endl;
     }
     return true;
 }
@@ -332,6 +508,25 @@ bool Bootloader::setup_kernel_parameters() {
     return true;
 }
 
+bool Bootloader::verify_checksum(void* data, size_t size) {
+    bool use_hardware = (cpu_features & CPU_FEATURE_SSE42) != 0;
+    
+    auto start = std::chrono::steady_clock::now();
+    uint32_t crc = crc32c(data, size, use_hardware);
+    auto end = std::chrono::steady_clock::now();
+    
+    load_stats.checksum_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        end - start).count();
+    
+    if (verbose_output) {
+        std::cout << "[BOOT]     - CRC32C (" << (use_hardware ? "SSE4.2" : "slicing-by-8") << ") of "
+                  << (size / 1024) << " KB in " << load_stats.checksum_time_us << " us: 0x"
+                  << std::hex << crc << std::dec << std::endl;
+    }
+    
+    return crc == kernel_header.payload_crc32c;
+}
+
 void Bootloader::setup_interrupt_handlers() {
     if (verbose_output) {
         print_status("    - Installing basic interrupt handlers");
@@ -361,6 +556,11 @@ void Bootloader::set_kernel_cmdline(const std::string& cmdline) {
     system_info.kernel_cmdline[sizeof(system_info.kernel_cmdline) - 1] = '\0';
 }
 
+void Bootloader::set_boot_disk(const std::string& path, uint32_t start_sector) {
+    boot_disk_path = path;
+    kernel_start_sector = start_sector;
+}
+
 void Bootloader::dump_system_info() {
     std::cout << "\n=== System Information ===" << std::endl;
     std::cout << "Bootloader: " << system_info.bootloader_name << std::endl;
@@ -431,18 +631,6 @@ void Bootloader::outd(uint16_t port, uint32_t value) {
     // Simulate port write
 }
 
-void* Bootloader::memcpy_boot(void* dest, const void* src, size_t count) {
-    return std::memcpy(dest, src, count);
-}
-
-void* Bootloader::memset_boot(void* dest, int value, size_t count) {
-    return std::memset(dest, value, count);
-}
-
-int Bootloader::memcmp_boot(const void* buf1, const void* buf2, size_t count) {
-    return std::memcmp(buf1, buf2, count);
-}
-
 size_t Bootloader::strlen_boot(const char* str) {
     return std::strlen(str);
 }
@@ -0,0 +1,118 @@
+#include "crc32.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+#define CRC32C_POLYNOMIAL 0x82F63B78U
+
+// crc32c_table[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t crc32c_table[8][256];
+static bool crc32c_table_ready = false;
+
+static void crc32c_init_table() {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+        crc32c_table[0][b] = crc;
+    }
+
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = crc32c_table[0][b];
+        for (int k = 1; k < 8; k++) {
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc32c_table[k][b] = crc;
+        }
+    }
+
+    crc32c_table_ready = true;
+}
+
+uint32_t crc32c_software(const void* data, size_t size) {
+    if (!crc32c_table_ready) {
+        crc32c_init_table();
+    }
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFF;
+
+    // Align to 4 bytes so the main loop reads whole words
+    while (size > 0 && (reinterpret_cast<uintptr_t>(p) & 3) != 0) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+
+    // Slicing-by-8: eight table lookups per 8 bytes, no serial byte chain
+    while (size >= 8) {
+        uint32_t low = *reinterpret_cast<const uint32_t*>(p) ^ crc;
+        uint32_t high = *reinterpret_cast<const uint32_t*>(p + 4);
+        crc = crc32c_table[7][low & 0xFF] ^
+              crc32c_table[6][(low >> 8) & 0xFF] ^
+              crc32c_table[5][(low >> 16) & 0xFF] ^
+              crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xFF] ^
+              crc32c_table[2][(high >> 8) & 0xFF] ^
+              crc32c_table[1][(high >> 16) & 0xFF] ^
+              crc32c_table[0][high >> 24];
+        p += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware(const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        size--;
+    }
+
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const uint64_t*>(p));
+        p += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+#else
+    while (size >= 4) {
+        crc = _mm_crc32_u32(crc, *reinterpret_cast<const uint32_t*>(p));
+        p += 4;
+        size -= 4;
+    }
+#endif
+
+    while (size > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        size--;
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+#else
+
+uint32_t crc32c_hardware(const void* data, size_t size) {
+    return crc32c_software(data, size);
+}
+
+#endif
+
+uint32_t crc32c(const void* data, size_t size, bool use_hardware) {
+    return use_hardware ? crc32c_hardware(data, size) : crc32c_software(data, size);
+}
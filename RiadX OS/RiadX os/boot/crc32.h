@@ -0,0 +1,20 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <cstdint>
+#include <cstddef>
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78). This is the
+// polynomial implemented by the SSE4.2 crc32 instruction, so the software
+// and hardware paths produce identical checksums.
+
+// Portable slicing-by-8 implementation
+uint32_t crc32c_software(const void* data, size_t size);
+
+// SSE4.2 crc32 instruction; only call when the CPU reports SSE4.2
+uint32_t crc32c_hardware(const void* data, size_t size);
+
+// Picks the hardware path when available
+uint32_t crc32c(const void* data, size_t size, bool use_hardware);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef KERNEL_IMAGE_H
+#define KERNEL_IMAGE_H
+
+#include <cstdint>
+
+// On-disk kernel image layout, produced by tools/mkkernel:
+//   sector 0      KernelImageHeader (zero padded to one sector)
+//   sector 1..n   payload, optionally LZ4 block compressed
+#define KERNEL_IMAGE_MAGIC       0x494B5852  // "RXKI"
+#define KERNEL_IMAGE_VERSION     1
+#define KERNEL_IMAGE_SECTOR_SIZE 512
+
+// Header flags
+#define KERNEL_IMAGE_FLAG_LZ4    0x0001
+#define KERNEL_IMAGE_FLAG_CRC32C 0x0002  // payload_crc32c is valid
+
+struct KernelImageHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t payload_size;      // Bytes stored on disk after the header sector
+    uint32_t image_size;        // Bytes once decompressed
+    uint32_t load_address;
+    uint32_t entry_point;
+    uint32_t payload_crc32c;    // CRC-32C of the payload as stored on disk
+    uint32_t reserved;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,181 @@
+#include "lz4.h"
+#include "bootloader.h"
+
+// Format limits from the LZ4 block specification
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT      12
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_HASH_BITS     12
+
+static inline uint32_t lz4_read32(const uint8_t* p) {
+    uint32_t value;
+    Bootloader::memcpy_boot(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// Writes a length continuation (the part above 15) as a run of 255s
+static uint8_t* lz4_write_length(uint8_t* op, uint8_t* oend, size_t length) {
+    while (length >= 255) {
+        if (op >= oend) return nullptr;
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= oend) return nullptr;
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+static uint8_t* lz4_write_sequence(uint8_t* op, uint8_t* oend,
+                                   const uint8_t* literals, size_t literal_length,
+                                   size_t offset, size_t match_length) {
+    if (op >= oend) return nullptr;
+    uint8_t* token = op++;
+
+    *token = static_cast<uint8_t>((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15) {
+        op = lz4_write_length(op, oend, literal_length - 15);
+        if (!op) return nullptr;
+    }
+
+    if (static_cast<size_t>(oend - op) < literal_length) return nullptr;
+    Bootloader::memcpy_boot(op, literals, literal_length);
+    op += literal_length;
+
+    // The final sequence carries literals only
+    if (match_length == 0) return op;
+
+    if (oend - op < 2) return nullptr;
+    *op++ = static_cast<uint8_t>(offset & 0xFF);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+
+    size_t encoded_match = match_length - LZ4_MIN_MATCH;
+    *token |= static_cast<uint8_t>(encoded_match >= 15 ? 15 : encoded_match);
+    if (encoded_match >= 15) {
+        op = lz4_write_length(op, oend, encoded_match - 15);
+    }
+    return op;
+}
+
+size_t lz4_compress_bound(size_t input_size) {
+    return input_size + input_size / 255 + 16;
+}
+
+int lz4_compress_block(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+    size_t anchor = 0;
+
+    if (src_size >= LZ4_MF_LIMIT + 1) {
+        // Positions are stored +1 so that zero means "empty"
+        uint32_t hash_table[1 << LZ4_HASH_BITS];
+        Bootloader::memset_boot(hash_table, 0, sizeof(hash_table));
+
+        size_t match_limit = src_size - LZ4_MF_LIMIT;
+        size_t ip = 0;
+
+        while (ip < match_limit) {
+            uint32_t sequence = lz4_read32(src + ip);
+            uint32_t h = lz4_hash(sequence);
+            size_t candidate = hash_table[h];
+            hash_table[h] = static_cast<uint32_t>(ip + 1);
+
+            if (candidate == 0 || ip - (candidate - 1) > LZ4_MAX_OFFSET ||
+                lz4_read32(src + candidate - 1) != sequence) {
+                ip++;
+                continue;
+            }
+
+            size_t ref = candidate - 1;
+            size_t match_length = LZ4_MIN_MATCH;
+            while (ip + match_length < src_size - LZ4_LAST_LITERALS &&
+                   src[ref + match_length] == src[ip + match_length]) {
+                match_length++;
+            }
+
+            op = lz4_write_sequence(op, oend, src + anchor, ip - anchor, ip - ref, match_length);
+            if (!op) return -1;
+
+            ip += match_length;
+            anchor = ip;
+        }
+    }
+
+    op = lz4_write_sequence(op, oend, src + anchor, src_size - anchor, 0, 0);
+    if (!op) return -1;
+
+    return static_cast<int>(op - dst);
+}
+
+// Reads a length continuation; returns false if it runs past the input
+static bool lz4_read_length(const uint8_t*& ip, const uint8_t* iend, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip >= iend) return false;
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+int lz4_decompress_block(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        // Literals
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !lz4_read_length(ip, iend, literal_length)) {
+            return -1;
+        }
+        if (static_cast<size_t>(iend - ip) < literal_length ||
+            static_cast<size_t>(oend - op) < literal_length) {
+            return -1;
+        }
+        Bootloader::memcpy_boot(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        // The last sequence ends after its literals
+        if (ip >= iend) break;
+
+        // Match
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst)) {
+            return -1;
+        }
+
+        size_t match_length = token & 0x0F;
+        if (match_length == 15 && !lz4_read_length(ip, iend, match_length)) {
+            return -1;
+        }
+        match_length += LZ4_MIN_MATCH;
+        if (static_cast<size_t>(oend - op) < match_length) {
+            return -1;
+        }
+
+        const uint8_t* match = op - offset;
+        if (offset >= match_length) {
+            // Non-overlapping, take the fast block copy
+            Bootloader::memcpy_boot(op, match, match_length);
+            op += match_length;
+        } else {
+            // Overlapping copy repeats the last `offset` bytes
+            for (size_t i = 0; i < match_length; i++) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return static_cast<int>(op - dst);
+}
@@ -0,0 +1,18 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <cstdint>
+#include <cstddef>
+
+// LZ4 block format (no frame header), as used for the compressed kernel payload
+
+// Worst case compressed size for an input of the given size
+size_t lz4_compress_bound(size_t input_size);
+
+// Returns the compressed size, or -1 if dst is too small
+int lz4_compress_block(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity);
+
+// Returns the decompressed size, or -1 on malformed input or overflow of dst
+int lz4_decompress_block(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity);
+
+#endif
@@ -0,0 +1,350 @@
+// Memory primitives for the freestanding kernel. Each operation has a
+// portable word-at-a-time version, an x86 string instruction version and an
+// SSE2 version; select_memory_primitives() picks one set from the CPUID bits.
+// The hosted benchmark is in boot/memops_benchmark.cpp.
+
+#include "bootloader.h"
+#include "memops.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define MEMOPS_X86 1
+#endif
+
+// Stops GCC from turning the plain loops back into calls to memcpy/memset,
+// which do not exist in the -nostdlib kernel
+#define MEMOPS_NO_BUILTIN __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+// Copies and fills at least this large bypass the cache with streaming stores
+#define MEMOPS_STREAMING_THRESHOLD (256 * 1024)
+
+// Machine word that may alias anything and may be unaligned
+typedef uintptr_t __attribute__((__may_alias__, __aligned__(1))) memops_word;
+typedef uint32_t __attribute__((__may_alias__, __aligned__(1))) memops_dword;
+
+#define MEMOPS_WORD_SIZE sizeof(uintptr_t)
+
+// ---------------------------------------------------------------------------
+// Word-at-a-time versions, used on any CPU and for short tails
+// ---------------------------------------------------------------------------
+
+MEMOPS_NO_BUILTIN
+static void* memcpy_words(void* dest, const void* src, size_t count) {
+    uint8_t* d = static_cast<uint8_t*>(dest);
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+
+    // Align the destination; source alignment does not matter on x86
+    while (count > 0 && (reinterpret_cast<uintptr_t>(d) & (MEMOPS_WORD_SIZE - 1)) != 0) {
+        *d++ = *s++;
+        count--;
+    }
+
+    memops_word* dw = reinterpret_cast<memops_word*>(d);
+    const memops_word* sw = reinterpret_cast<const memops_word*>(s);
+    while (count >= 4 * MEMOPS_WORD_SIZE) {
+        dw[0] = sw[0];
+        dw[1] = sw[1];
+        dw[2] = sw[2];
+        dw[3] = sw[3];
+        dw += 4;
+        sw += 4;
+        count -= 4 * MEMOPS_WORD_SIZE;
+    }
+    while (count >= MEMOPS_WORD_SIZE) {
+        *dw++ = *sw++;
+        count -= MEMOPS_WORD_SIZE;
+    }
+
+    d = reinterpret_cast<uint8_t*>(dw);
+    s = reinterpret_cast<const uint8_t*>(sw);
+    while (count > 0) {
+        *d++ = *s++;
+        count--;
+    }
+    return dest;
+}
+
+MEMOPS_NO_BUILTIN
+static void* memset_words(void* dest, int value, size_t count) {
+    uint8_t* d = static_cast<uint8_t*>(dest);
+    uint8_t byte = static_cast<uint8_t>(value);
+
+    while (count > 0 && (reinterpret_cast<uintptr_t>(d) & (MEMOPS_WORD_SIZE - 1)) != 0) {
+        *d++ = byte;
+        count--;
+    }
+
+    uintptr_t pattern = static_cast<uintptr_t>(-1) / 0xFF * byte;
+    memops_word* dw = reinterpret_cast<memops_word*>(d);
+    while (count >= 4 * MEMOPS_WORD_SIZE) {
+        dw[0] = pattern;
+        dw[1] = pattern;
+        dw[2] = pattern;
+        dw[3] = pattern;
+        dw += 4;
+        count -= 4 * MEMOPS_WORD_SIZE;
+    }
+    while (count >= MEMOPS_WORD_SIZE) {
+        *dw++ = pattern;
+        count -= MEMOPS_WORD_SIZE;
+    }
+
+    d = reinterpret_cast<uint8_t*>(dw);
+    while (count > 0) {
+        *d++ = byte;
+        count--;
+    }
+    return dest;
+}
+
+MEMOPS_NO_BUILTIN
+static void* memset32_words(void* dest, uint32_t value, size_t count) {
+    memops_dword* d = static_cast<memops_dword*>(dest);
+    while (count >= 4) {
+        d[0] = value;
+        d[1] = value;
+        d[2] = value;
+        d[3] = value;
+        d += 4;
+        count -= 4;
+    }
+    while (count > 0) {
+        *d++ = value;
+        count--;
+    }
+    return dest;
+}
+
+MEMOPS_NO_BUILTIN
+static int memcmp_words(const void* buf1, const void* buf2, size_t count) {
+    const uint8_t* a = static_cast<const uint8_t*>(buf1);
+    const uint8_t* b = static_cast<const uint8_t*>(buf2);
+
+    // Skip equal words, then locate the differing byte
+    while (count >= MEMOPS_WORD_SIZE &&
+           *reinterpret_cast<const memops_word*>(a) == *reinterpret_cast<const memops_word*>(b)) {
+        a += MEMOPS_WORD_SIZE;
+        b += MEMOPS_WORD_SIZE;
+        count -= MEMOPS_WORD_SIZE;
+    }
+
+    while (count > 0) {
+        if (*a != *b) {
+            return *a - *b;
+        }
+        a++;
+        b++;
+        count--;
+    }
+    return 0;
+}
+
+#ifdef MEMOPS_X86
+
+// ---------------------------------------------------------------------------
+// x86 string instructions (rep movsd / rep stosd)
+// ---------------------------------------------------------------------------
+
+static void* memcpy_rep(void* dest, const void* src, size_t count) {
+    void* d = dest;
+    const void* s = src;
+    size_t dwords = count >> 2;
+    size_t tail = count & 3;
+
+    asm volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(dwords) : : "memory");
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(tail) : : "memory");
+    return dest;
+}
+
+static void* memset_rep(void* dest, int value, size_t count) {
+    void* d = dest;
+    uint32_t pattern = static_cast<uint8_t>(value) * 0x01010101U;
+    size_t dwords = count >> 2;
+    size_t tail = count & 3;
+
+    asm volatile("rep stosl" : "+D"(d), "+c"(dwords) : "a"(pattern) : "memory");
+    asm volatile("rep stosb" : "+D"(d), "+c"(tail) : "a"(pattern) : "memory");
+    return dest;
+}
+
+static void* memset32_rep(void* dest, uint32_t value, size_t count) {
+    void* d = dest;
+    asm volatile("rep stosl" : "+D"(d), "+c"(count) : "a"(value) : "memory");
+    return dest;
+}
+
+// ---------------------------------------------------------------------------
+// SSE2: streaming stores for buffers larger than the cache, 16-byte compares
+// ---------------------------------------------------------------------------
+
+// Below the streaming threshold rep movsd/stosd matches or beats 16-byte
+// moves on CPUs with fast string operations (see benchmark_memory_primitives)
+__attribute__((target("sse2")))
+static void* memcpy_sse2(void* dest, const void* src, size_t count) {
+    if (count < MEMOPS_STREAMING_THRESHOLD) {
+        return memcpy_rep(dest, src, count);
+    }
+
+    uint8_t* d = static_cast<uint8_t*>(dest);
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+
+    size_t head = (16 - (reinterpret_cast<uintptr_t>(d) & 15)) & 15;
+    memcpy_words(d, s, head);
+    d += head;
+    s += head;
+    count -= head;
+
+    while (count >= 64) {
+        __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+        __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+        __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d), x0);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), x1);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), x2);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), x3);
+        d += 64;
+        s += 64;
+        count -= 64;
+    }
+    _mm_sfence();
+
+    memcpy_words(d, s, count);
+    return dest;
+}
+
+// Streams 64-byte chunks past the cache; returns the bytes left over
+__attribute__((target("sse2")))
+static size_t sse2_stream_fill(uint8_t* d, __m128i pattern, size_t count) {
+    while (count >= 64) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d), pattern);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), pattern);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), pattern);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), pattern);
+        d += 64;
+        count -= 64;
+    }
+    _mm_sfence();
+    return count;
+}
+
+__attribute__((target("sse2")))
+static void* memset_sse2(void* dest, int value, size_t count) {
+    if (count < MEMOPS_STREAMING_THRESHOLD) {
+        return memset_rep(dest, value, count);
+    }
+
+    uint8_t* d = static_cast<uint8_t*>(dest);
+    size_t head = (16 - (reinterpret_cast<uintptr_t>(d) & 15)) & 15;
+    memset_rep(d, value, head);
+    d += head;
+    count -= head;
+
+    size_t tail = sse2_stream_fill(d, _mm_set1_epi8(static_cast<char>(value)), count);
+    memset_rep(d + count - tail, value, tail);
+    return dest;
+}
+
+__attribute__((target("sse2")))
+static void* memset32_sse2(void* dest, uint32_t value, size_t count) {
+    uint32_t* d = static_cast<uint32_t*>(dest);
+
+    // 16-byte alignment is only reachable from a 4-byte aligned pointer
+    if (count * 4 < MEMOPS_STREAMING_THRESHOLD || (reinterpret_cast<uintptr_t>(d) & 3) != 0) {
+        return memset32_rep(dest, value, count);
+    }
+
+    while ((reinterpret_cast<uintptr_t>(d) & 15) != 0) {
+        *d++ = value;
+        count--;
+    }
+
+    size_t tail = sse2_stream_fill(reinterpret_cast<uint8_t*>(d),
+                                   _mm_set1_epi32(static_cast<int>(value)), count * 4) / 4;
+    memset32_rep(d + count - tail, value, tail);
+    return dest;
+}
+
+__attribute__((target("sse2")))
+static int memcmp_sse2(const void* buf1, const void* buf2, size_t count) {
+    const uint8_t* a = static_cast<const uint8_t*>(buf1);
+    const uint8_t* b = static_cast<const uint8_t*>(buf2);
+
+    while (count >= 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (mask != 0xFFFF) {
+            int i = __builtin_ctz(~mask & 0xFFFF);
+            return a[i] - b[i];
+        }
+        a += 16;
+        b += 16;
+        count -= 16;
+    }
+
+    return memcmp_words(a, b, count);
+}
+
+#endif // MEMOPS_X86
+
+static const MemoryPrimitives primitives_words = {
+    "words", memcpy_words, memset_words, memset32_words, memcmp_words
+};
+
+#ifdef MEMOPS_X86
+static const MemoryPrimitives primitives_rep = {
+    "rep movsd/stosd", memcpy_rep, memset_rep, memset32_rep, memcmp_words
+};
+
+static const MemoryPrimitives primitives_sse2 = {
+    "sse2", memcpy_sse2, memset_sse2, memset32_sse2, memcmp_sse2
+};
+#endif
+
+// Until CPUID has been read only the portable versions are safe
+static const MemoryPrimitives* active_primitives = &primitives_words;
+
+void Bootloader::select_memory_primitives() {
+    active_primitives = &primitives_words;
+
+#ifdef MEMOPS_X86
+    if (cpu_features & CPU_FEATURE_SSE2) {
+        active_primitives = &primitives_sse2;
+    } else {
+        active_primitives = &primitives_rep;
+    }
+#endif
+}
+
+const char* Bootloader::get_memory_primitives_name() {
+    return active_primitives->name;
+}
+
+size_t memops_available_primitives(const MemoryPrimitives** sets) {
+    size_t count = 0;
+    sets[count++] = &primitives_words;
+#ifdef MEMOPS_X86
+    sets[count++] = &primitives_rep;
+    if (Bootloader::get_cpu_features() & CPU_FEATURE_SSE2) {
+        sets[count++] = &primitives_sse2;
+    }
+#endif
+    return count;
+}
+
+void* Bootloader::memcpy_boot(void* dest, const void* src, size_t count) {
+    return active_primitives->copy(dest, src, count);
+}
+
+void* Bootloader::memset_boot(void* dest, int value, size_t count) {
+    return active_primitives->fill(dest, value, count);
+}
+
+void* Bootloader::memset32_boot(void* dest, uint32_t value, size_t count) {
+    return active_primitives->fill32(dest, value, count);
+}
+
+int Bootloader::memcmp_boot(const void* buf1, const void* buf2, size_t count) {
+    return active_primitives->compare(buf1, buf2, count);
+}
@@ -0,0 +1,29 @@
+#ifndef MEMOPS_H
+#define MEMOPS_H
+
+#include <cstdint>
+#include <cstddef>
+
+// One implementation of each memory primitive; boot/memops.cpp has a
+// portable set and, on x86, string instruction and SSE2 sets.
+
+typedef void* (*memcpy_fn)(void*, const void*, size_t);
+typedef void* (*memset_fn)(void*, int, size_t);
+typedef void* (*memset32_fn)(void*, uint32_t, size_t);
+typedef int (*memcmp_fn)(const void*, const void*, size_t);
+
+struct MemoryPrimitives {
+    const char* name;
+    memcpy_fn copy;
+    memset_fn fill;
+    memset32_fn fill32;
+    memcmp_fn compare;
+};
+
+#define MEMOPS_MAX_VARIANTS 3
+
+// Stores every set this CPU can run, the portable one first, and returns
+// how many were stored (at most MEMOPS_MAX_VARIANTS)
+size_t memops_available_primitives(const MemoryPrimitives** sets);
+
+#endif
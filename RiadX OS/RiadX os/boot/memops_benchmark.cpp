@@ -0,0 +1,67 @@
+// Hosted microbenchmark for the memory primitives in boot/memops.cpp, run
+// with --benchmark. Kept out of memops.cpp so that file stays freestanding.
+
+#include "bootloader.h"
+#include "memops.h"
+#include "kernel/klog.h"
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+template <typename Op>
+static double measure_throughput(size_t bytes, Op op) {
+    // Repeat so every size moves about 256 MB
+    size_t iterations = std::max<size_t>(1, (256u << 20) / bytes);
+
+    op();  // Warm up caches and fault in the pages
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        op();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return seconds > 0 ? (bytes * static_cast<double>(iterations)) / seconds / (1024.0 * 1024.0) : 0.0;
+}
+
+void Bootloader::benchmark_memory_primitives() {
+    const MemoryPrimitives* candidates[MEMOPS_MAX_VARIANTS];
+    size_t candidate_count = memops_available_primitives(candidates);
+
+    // Page, block, framebuffer (1024x768x32) and memory pool sized buffers
+    const size_t sizes[] = { 4096, 64 * 1024, 1024 * 768 * 4, 16 * 1024 * 1024 };
+    const size_t max_size = 16 * 1024 * 1024;
+
+    std::vector<uint8_t> src(max_size + 64, 0x5A);
+    std::vector<uint8_t> dst(max_size + 64, 0x00);
+    std::vector<uint8_t> same(max_size + 64, 0x5A);
+
+    KLOG_INFO << "[BOOT] Memory primitive benchmark (MB/s), active: "
+              << get_memory_primitives_name();
+    KLOG_INFO << std::left << std::setw(18) << "Variant" << std::setw(10) << "Size"
+              << std::right << std::setw(10) << "memcpy" << std::setw(10) << "memset"
+              << std::setw(10) << "memset32" << std::setw(10) << "memcmp";
+
+    for (size_t c = 0; c < candidate_count; c++) {
+        const MemoryPrimitives* p = candidates[c];
+        for (size_t size : sizes) {
+            uint8_t* s = src.data();
+            uint8_t* d = dst.data();
+            uint8_t* e = same.data();
+
+            double copy = measure_throughput(size, [&]() { p->copy(d, s, size); });
+            double fill = measure_throughput(size, [&]() { p->fill(d, 0, size); });
+            double fill32 = measure_throughput(size, [&]() { p->fill32(d, 0xFF336699, size / 4); });
+            volatile int sink = 0;
+            double compare = measure_throughput(size, [&]() { sink = sink + p->compare(s, e, size); });
+
+            KLOG_INFO << std::left << std::setw(18) << p->name << std::setw(10)
+                      << (size >= 1024 * 1024 ? std::to_string(size / (1024 * 1024)) + "MB"
+                                              : std::to_string(size / 1024) + "KB")
+                      << std::right << std::fixed << std::setprecision(0)
+                      << std::setw(10) << copy << std::setw(10) << fill
+                      << std::setw(10) << fill32 << std::setw(10) << compare;
+        }
+    }
+}
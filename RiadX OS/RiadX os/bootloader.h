@@ -3,13 +3,22 @@
 
 #include <string>
 #include <vector>
+#include <fstream>
 #include <cstdint>
+#include "boot/kernel_image.h"
 
 // Boot sector constants
 #define BOOT_SECTOR_SIZE 512
 #define BOOT_SIGNATURE 0xAA55
 #define KERNEL_LOAD_ADDRESS 0x100000  // 1MB
 #define STACK_ADDRESS 0x90000         // 576KB
+#define DISK_SECTOR_SIZE 512
+#define KERNEL_READ_BATCH_SECTORS 64  // Sectors per BIOS read request
+
+// CPU feature bits reported by detect_cpu_features()
+#define CPU_FEATURE_FPU   0x0001
+#define CPU_FEATURE_SSE2  0x0002
+#define CPU_FEATURE_SSE42 0x0004
 
 // System information structure
 struct SystemInfo {
@@ -30,6 +39,17 @@ struct MemoryMapEntry {
     uint32_t attributes;
 };
 
+// Kernel load measurements
+struct KernelLoadStats {
+    uint32_t sectors_read;
+    uint32_t raw_sectors;        // Sectors an uncompressed image would need
+    uint32_t payload_size;
+    uint32_t image_size;
+    uint64_t read_time_us;
+    uint64_t decompress_time_us;
+    uint64_t checksum_time_us;
+};
+
 // Boot stages
 enum BootStage {
     STAGE_INIT,
@@ -49,6 +69,18 @@ private:
     BootStage current_stage;
     bool verbose_output;
     
+    // Kernel image on the boot disk
+    std::string boot_disk_path;
+    uint32_t kernel_start_sector;
+    bool kernel_on_disk;
+    KernelImageHeader kernel_header;
+    std::vector<uint8_t> kernel_payload;
+    std::vector<uint8_t> kernel_image;
+    KernelLoadStats load_stats;
+    
+    // Detected once at boot, shared by the static primitives
+    static uint32_t cpu_features;
+    
     // Boot process functions
     bool initialize_hardware();
     bool detect_memory();
@@ -73,6 +105,7 @@ private:
     bool decompress_kernel();
     bool relocate_kernel();
     bool setup_kernel_parameters();
+    bool read_sectors(std::ifstream& disk, uint32_t lba, uint32_t count, uint8_t* buffer);
     
     // Error handling
     void panic(const std::string& message);
@@ -94,11 +127,15 @@ public:
     // Configuration
     void set_verbose(bool verbose) { verbose_output = verbose; }
     void set_kernel_cmdline(const std::string& cmdline);
+    void set_boot_disk(const std::string& path, uint32_t start_sector = 0);
     
     // System information
     const SystemInfo& get_system_info() const { return system_info; }
     const std::vector<MemoryMapEntry>& get_memory_map() const { return memory_map; }
     BootStage get_current_stage() const { return current_stage; }
+    const KernelLoadStats& get_load_stats() const { return load_stats; }
+    static uint32_t get_cpu_features() { return cpu_features; }
+    const std::vector<uint8_t>& get_kernel_image() const { return kernel_image; }
     
     // Debugging
     void dump_system_info();
@@ -118,8 +155,14 @@ public:
     // Memory operations
     static void* memcpy_boot(void* dest, const void* src, size_t count);
     static void* memset_boot(void* dest, int value, size_t count);
+    static void* memset32_boot(void* dest, uint32_t value, size_t count);  // count in dwords
     static int memcmp_boot(const void* buf1, const void* buf2, size_t count);
     
+    // Picks the fastest memory primitives for cpu_features (boot/memops.cpp)
+    static void select_memory_primitives();
+    static const char* get_memory_primitives_name();
+    static void benchmark_memory_primitives();  // Hosted only (boot/memops_benchmark.cpp)
+    
     // String operations
     static size_t strlen_boot(const char* str);
     static char* strcpy_boot(char* dest, const char* src);
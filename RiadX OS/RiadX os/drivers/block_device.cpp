@@ -0,0 +1,118 @@
+#include "block_device.h"
+#include "../bootloader.h"
+#include "../kernel/klog.h"
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MemoryBlockDevice::MemoryBlockDevice(uint64_t block_count)
+    : storage(block_count * BLOCK_SIZE, 0), blocks(block_count) {
+}
+
+bool MemoryBlockDevice::read_block(uint64_t block, uint8_t* data) {
+    if (block >= blocks || !data) {
+        return false;
+    }
+    Bootloader::memcpy_boot(data, &storage[block * BLOCK_SIZE], BLOCK_SIZE);
+    blocks_read.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool MemoryBlockDevice::write_block(uint64_t block, const uint8_t* data) {
+    if (block >= blocks || !data) {
+        return false;
+    }
+    Bootloader::memcpy_boot(&storage[block * BLOCK_SIZE], data, BLOCK_SIZE);
+    blocks_written.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+MmapBlockDevice::MmapBlockDevice() : fd(-1), mapping(nullptr), blocks(0) {
+}
+
+MmapBlockDevice::~MmapBlockDevice() {
+    close();
+}
+
+bool MmapBlockDevice::open(const std::string& image_path, uint64_t create_blocks) {
+    close();
+    path = image_path;
+
+    fd = ::open(path.c_str(), create_blocks ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    if (fd < 0) {
+        KLOG_ERROR << "[DISK] Cannot open " << path << ": " << std::strerror(errno);
+        return false;
+    }
+
+    // ftruncate leaves the new space as a hole in the host file
+    if (create_blocks && ftruncate(fd, static_cast<off_t>(create_blocks * BLOCK_SIZE)) != 0) {
+        KLOG_ERROR << "[DISK] Cannot size " << path << ": " << std::strerror(errno);
+        close();
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BLOCK_SIZE) {
+        KLOG_ERROR << "[DISK] " << path << " is not a disk image";
+        close();
+        return false;
+    }
+    blocks = static_cast<uint64_t>(st.st_size) / BLOCK_SIZE;
+
+    void* mapped = mmap(nullptr, blocks * BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        KLOG_ERROR << "[DISK] Cannot map " << path << ": " << std::strerror(errno);
+        close();
+        return false;
+    }
+    mapping = static_cast<uint8_t*>(mapped);
+
+    KLOG_INFO << "[DISK] Mapped " << path << ", " << blocks << " blocks ("
+              << (blocks * BLOCK_SIZE / (1024 * 1024)) << "MB)";
+    return true;
+}
+
+void MmapBlockDevice::close() {
+    if (mapping) {
+        msync(mapping, blocks * BLOCK_SIZE, MS_SYNC);
+        munmap(mapping, blocks * BLOCK_SIZE);
+        mapping = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    blocks = 0;
+}
+
+bool MmapBlockDevice::read_block(uint64_t block, uint8_t* data) {
+    if (block >= blocks || !data) {
+        return false;
+    }
+    Bootloader::memcpy_boot(data, mapping + block * BLOCK_SIZE, BLOCK_SIZE);
+    blocks_read.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool MmapBlockDevice::write_block(uint64_t block, const uint8_t* data) {
+    if (block >= blocks || !data) {
+        return false;
+    }
+    Bootloader::memcpy_boot(mapping + block * BLOCK_SIZE, data, BLOCK_SIZE);
+    blocks_written.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool MmapBlockDevice::flush() {
+    if (!mapping) {
+        return false;
+    }
+    if (msync(mapping, blocks * BLOCK_SIZE, MS_SYNC) != 0) {
+        KLOG_ERROR << "[DISK] Flush of " << path << " failed: " << std::strerror(errno);
+        return false;
+    }
+    return true;
+}
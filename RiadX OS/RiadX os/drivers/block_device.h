@@ -0,0 +1,76 @@
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#define BLOCK_SIZE 4096
+
+// Fixed-size block storage under the filesystem. Implementations only move
+// whole blocks; caching is the buffer cache's job.
+class BlockDevice {
+protected:
+    std::atomic<uint64_t> blocks_read;
+    std::atomic<uint64_t> blocks_written;
+
+public:
+    BlockDevice() : blocks_read(0), blocks_written(0) {}
+    virtual ~BlockDevice() {}
+
+    BlockDevice(const BlockDevice&) = delete;
+    BlockDevice& operator=(const BlockDevice&) = delete;
+
+    virtual uint64_t block_count() const = 0;
+    virtual bool read_block(uint64_t block, uint8_t* data) = 0;
+    virtual bool write_block(uint64_t block, const uint8_t* data) = 0;
+
+    // Makes written blocks durable
+    virtual bool flush() { return true; }
+
+    uint64_t get_blocks_read() const { return blocks_read.load(std::memory_order_relaxed); }
+    uint64_t get_blocks_written() const { return blocks_written.load(std::memory_order_relaxed); }
+};
+
+// Volatile device in process memory
+class MemoryBlockDevice : public BlockDevice {
+private:
+    std::vector<uint8_t> storage;
+    uint64_t blocks;
+
+public:
+    explicit MemoryBlockDevice(uint64_t block_count);
+
+    uint64_t block_count() const override { return blocks; }
+    bool read_block(uint64_t block, uint8_t* data) override;
+    bool write_block(uint64_t block, const uint8_t* data) override;
+};
+
+// Host image file mapped shared into memory. The file is sparse and pages
+// are only faulted in when a block is first read or written, so a huge
+// image costs nothing until used.
+class MmapBlockDevice : public BlockDevice {
+private:
+    int fd;
+    uint8_t* mapping;
+    uint64_t blocks;
+    std::string path;
+
+public:
+    MmapBlockDevice();
+    ~MmapBlockDevice();
+
+    // Maps an existing image; with create_blocks, creates or resizes it
+    // to that many blocks first
+    bool open(const std::string& image_path, uint64_t create_blocks = 0);
+    void close();
+
+    uint64_t block_count() const override { return blocks; }
+    bool read_block(uint64_t block, uint8_t* data) override;
+    bool write_block(uint64_t block, const uint8_t* data) override;
+    bool flush() override;
+};
+
+#endif
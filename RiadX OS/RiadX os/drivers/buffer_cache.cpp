@@ -0,0 +1,432 @@
+#include "buffer_cache.h"
+#include "../kernel/klog.h"
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+static uint64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BufferRef& BufferRef::operator=(BufferRef&& other) {
+    if (this != &other) {
+        release();
+        cache = other.cache;
+        buffer = other.buffer;
+        other.buffer = nullptr;
+    }
+    return *this;
+}
+
+void BufferRef::release() {
+    if (buffer) {
+        cache->unpin(buffer);
+        buffer = nullptr;
+    }
+}
+
+void BufferRef::mark_dirty() {
+    if (buffer) {
+        cache->mark_dirty(buffer);
+    }
+}
+
+BufferCache::BufferCache()
+    : device(nullptr), capacity(0), dirty_count(0), flusher_stop(false),
+      writeback_interval_ms(BUFFER_WRITEBACK_INTERVAL_MS), dirty_expire_ms(BUFFER_DIRTY_EXPIRE_MS),
+      hits(0), misses(0), evictions(0), writebacks(0), prefetches(0), prefetch_hits(0),
+      prefetch_wasted(0), cluster_span(0) {
+}
+
+BufferCache::~BufferCache() {
+    shutdown();
+}
+
+bool BufferCache::initialize(BlockDevice* block_device, size_t capacity_blocks) {
+    shutdown();
+    if (!block_device || capacity_blocks == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    device = block_device;
+    capacity = capacity_blocks;
+    buffers.reserve(capacity);
+    hits = misses = evictions = writebacks = 0;
+    prefetches = prefetch_hits = prefetch_wasted = 0;
+    flusher_stop = false;
+    flusher = std::thread(&BufferCache::flusher_main, this);
+    prefetcher = std::thread(&BufferCache::prefetcher_main, this);
+
+    KLOG_INFO << "[BUFFER] Cache of " << capacity << " blocks ("
+              << (capacity * BLOCK_SIZE / 1024) << "KB) over " << device->block_count() << " blocks";
+    return true;
+}
+
+void BufferCache::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (!device) return;
+        flusher_stop = true;
+    }
+    flusher_wakeup.notify_one();
+    prefetch_wakeup.notify_one();
+    flusher.join();
+    prefetcher.join();
+
+    sync();
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (dirty_count > 0) {
+        KLOG_WARN << "[BUFFER] Dropping " << dirty_count << " pinned dirty buffers";
+    }
+    buffers.clear();
+    a1in.clear();
+    am.clear();
+    a1out.clear();
+    a1out_index.clear();
+    prefetch_queue.clear();
+    clusters.clear();
+    cluster_index.clear();
+    cluster_span = 0;
+    dirty_count = 0;
+    device = nullptr;
+}
+
+BufferRef BufferCache::read(uint64_t block) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return BufferRef(this, pin_block(block, true));
+}
+
+BufferRef BufferCache::get(uint64_t block) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return BufferRef(this, pin_block(block, false));
+}
+
+Buffer* BufferCache::pin_block(uint64_t block, bool read) {
+    if (!device || block >= device->block_count()) {
+        return nullptr;
+    }
+
+    auto it = buffers.find(block);
+    if (it != buffers.end()) {
+        Buffer* buffer = it->second.get();
+        if (buffer->queue == BUFFER_QUEUE_AM) {
+            am.splice(am.begin(), am, buffer->position);
+        }
+        if (buffer->prefetched) {
+            buffer->prefetched = false;
+            prefetch_hits += read ? 1 : 0;  // Not when it is overwritten
+        }
+        buffer->pins++;
+        hits++;
+        return buffer;
+    }
+
+    misses++;
+    Buffer* buffer = load_block(block, read, true);
+    if (buffer) {
+        buffer->pins = 1;
+    }
+    return buffer;
+}
+
+// Brings a block that is not cached into the cache, unpinned. Without grow,
+// fails rather than go over capacity when every buffer is pinned.
+Buffer* BufferCache::load_block(uint64_t block, bool read, bool grow) {
+    // Seen recently enough to be remembered: part of the working set.
+    // Checked before evicting, which can push out the oldest ghost.
+    auto ghost = a1out_index.find(block);
+    bool remembered = ghost != a1out_index.end();
+    if (remembered) {
+        a1out.erase(ghost->second);
+        a1out_index.erase(ghost);
+    }
+
+    std::unique_ptr<Buffer> buffer;
+    if (buffers.size() >= capacity) {
+        buffer = evict_buffer();
+    }
+    if (!buffer) {
+        // Below capacity, or everything is pinned
+        if (buffers.size() >= capacity && !grow) {
+            return nullptr;
+        }
+        buffer.reset(new Buffer());
+    }
+
+    if (read) {
+        if (!device->read_block(block, buffer->data.data())) {
+            KLOG_ERROR << "[BUFFER] Read error on block " << block;
+            return nullptr;
+        }
+    } else {
+        std::memset(buffer->data.data(), 0, BLOCK_SIZE);
+    }
+
+    buffer->block = block;
+    buffer->pins = 0;
+    buffer->dirty = false;
+    buffer->prefetched = false;
+
+    if (remembered) {
+        buffer->queue = BUFFER_QUEUE_AM;
+        am.push_front(buffer.get());
+        buffer->position = am.begin();
+    } else {
+        buffer->queue = BUFFER_QUEUE_A1IN;
+        a1in.push_front(buffer.get());
+        buffer->position = a1in.begin();
+    }
+
+    Buffer* loaded = buffer.get();
+    buffers.emplace(block, std::move(buffer));
+    return loaded;
+}
+
+// Takes an unpinned buffer out of the cache, written back if dirty.
+// A1in gives up its oldest while it is over its share, Am its least
+// recently used otherwise.
+std::unique_ptr<Buffer> BufferCache::evict_buffer() {
+    size_t a1in_limit = std::max<size_t>(1, capacity * BUFFER_A1IN_PERCENT / 100);
+    std::list<Buffer*>* queues[2] = { &am, &a1in };
+    if (a1in.size() > a1in_limit) {
+        std::swap(queues[0], queues[1]);
+    }
+
+    for (std::list<Buffer*>* queue : queues) {
+        for (auto it = queue->rbegin(); it != queue->rend(); ++it) {
+            Buffer* victim = *it;
+            if (victim->pins > 0 || (victim->dirty && !write_back(victim))) {
+                continue;
+            }
+            if (victim->prefetched) {
+                prefetch_wasted++;
+            }
+
+            if (victim->queue == BUFFER_QUEUE_A1IN) {
+                size_t a1out_limit = std::max<size_t>(1, capacity * BUFFER_A1OUT_PERCENT / 100);
+                a1out.push_front(victim->block);
+                a1out_index[victim->block] = a1out.begin();
+                if (a1out.size() > a1out_limit) {
+                    forget_ghost(a1out.back());
+                }
+            }
+
+            queue->erase(victim->position);
+            auto entry = buffers.find(victim->block);
+            std::unique_ptr<Buffer> buffer = std::move(entry->second);
+            buffers.erase(entry);
+            evictions++;
+            return buffer;
+        }
+    }
+    return nullptr;
+}
+
+void BufferCache::forget_ghost(uint64_t block) {
+    auto ghost = a1out_index.find(block);
+    if (ghost != a1out_index.end()) {
+        a1out.erase(ghost->second);
+        a1out_index.erase(ghost);
+    }
+}
+
+bool BufferCache::write_back(Buffer* buffer) {
+    if (!device->write_block(buffer->block, buffer->data.data())) {
+        KLOG_ERROR << "[BUFFER] Write error on block " << buffer->block;
+        return false;
+    }
+    buffer->dirty = false;
+    dirty_count--;
+    writebacks++;
+    return true;
+}
+
+void BufferCache::unpin(Buffer* buffer) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    buffer->pins--;
+}
+
+void BufferCache::mark_dirty(Buffer* buffer) {
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        drop_clusters(buffer->block);
+        if (!buffer->dirty) {
+            buffer->dirty = true;
+            buffer->dirty_since = steady_ms();
+            dirty_count++;
+            // Too much unwritten data; do not wait for it to expire
+            wake = dirty_count > capacity / 2;
+        }
+    }
+    if (wake) {
+        flusher_wakeup.notify_one();
+    }
+}
+
+bool BufferCache::sync(bool pinned) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (!device) return false;
+
+    bool ok = true;
+    for (auto& entry : buffers) {
+        Buffer* buffer = entry.second.get();
+        if (buffer->dirty && (pinned || buffer->pins == 0)) {
+            ok = write_back(buffer) && ok;
+        }
+    }
+    return device->flush() && ok;
+}
+
+// Pinned buffers may be changing, so they wait for the next round
+void BufferCache::flusher_main() {
+    std::unique_lock<std::mutex> lock(cache_mutex);
+    while (!flusher_stop) {
+        flusher_wakeup.wait_for(lock, std::chrono::milliseconds(writeback_interval_ms));
+        if (flusher_stop || dirty_count == 0) continue;
+
+        uint64_t now = steady_ms();
+        bool over_limit = dirty_count > capacity / 2;
+        for (auto& entry : buffers) {
+            Buffer* buffer = entry.second.get();
+            if (buffer->dirty && buffer->pins == 0 &&
+                (over_limit || now - buffer->dirty_since >= dirty_expire_ms)) {
+                write_back(buffer);
+            }
+        }
+    }
+}
+
+void BufferCache::prefetch(uint64_t block, uint64_t count) {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (!device) return;
+
+        size_t limit = std::max<size_t>(1, capacity * BUFFER_PREFETCH_PERCENT / 100);
+        for (uint64_t i = block; i < block + count && prefetch_queue.size() < limit; i++) {
+            if (i < device->block_count() && buffers.find(i) == buffers.end()) {
+                prefetch_queue.push_back(i);
+            }
+        }
+        if (prefetch_queue.empty()) return;
+    }
+    prefetch_wakeup.notify_one();
+}
+
+// Reads queued blocks one at a time, so demand reads get the cache in
+// between. A block read meanwhile is not read again.
+void BufferCache::prefetcher_main() {
+    std::unique_lock<std::mutex> lock(cache_mutex);
+    while (!flusher_stop) {
+        if (prefetch_queue.empty()) {
+            prefetch_wakeup.wait(lock);
+            continue;
+        }
+
+        uint64_t block = prefetch_queue.front();
+        prefetch_queue.pop_front();
+        if (buffers.find(block) == buffers.end()) {
+            Buffer* buffer = load_block(block, true, false);
+            if (buffer) {
+                buffer->prefetched = true;
+                prefetches++;
+            }
+        }
+
+        lock.unlock();
+        lock.lock();
+    }
+}
+
+ClusterData BufferCache::get_cluster(uint64_t block) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cluster_index.find(block);
+    if (it == cluster_index.end()) {
+        return ClusterData();
+    }
+    clusters.splice(clusters.begin(), clusters, it->second);
+    return it->second->second;
+}
+
+void BufferCache::put_cluster(uint64_t block, uint64_t block_count, ClusterData data) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (!device || cluster_index.count(block)) return;
+
+    cluster_span = std::max(cluster_span, block_count);
+    clusters.emplace_front(block, std::move(data));
+    cluster_index[block] = clusters.begin();
+    if (clusters.size() > BUFFER_CLUSTER_ENTRIES) {
+        cluster_index.erase(clusters.back().first);
+        clusters.pop_back();
+    }
+}
+
+// Any cluster that may be stored in block; callers hold cache_mutex
+void BufferCache::drop_clusters(uint64_t block) {
+    if (clusters.empty()) return;
+
+    uint64_t first = block >= cluster_span ? block - cluster_span + 1 : 0;
+    for (uint64_t start = first; start <= block; start++) {
+        auto it = cluster_index.find(start);
+        if (it != cluster_index.end()) {
+            clusters.erase(it->second);
+            cluster_index.erase(it);
+        }
+    }
+}
+
+void BufferCache::set_writeback(uint64_t interval_ms, uint64_t expire_ms) {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        writeback_interval_ms = std::max<uint64_t>(1, interval_ms);
+        dirty_expire_ms = expire_ms;
+    }
+    flusher_wakeup.notify_one();
+}
+
+uint64_t BufferCache::get_hits() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return hits;
+}
+
+uint64_t BufferCache::get_misses() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return misses;
+}
+
+double BufferCache::get_hit_ratio() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    uint64_t lookups = hits + misses;
+    return lookups ? static_cast<double>(hits) / lookups : 0.0;
+}
+
+uint64_t BufferCache::get_prefetches() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return prefetches;
+}
+
+uint64_t BufferCache::get_prefetch_hits() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return prefetch_hits;
+}
+
+uint64_t BufferCache::get_prefetch_wasted() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return prefetch_wasted;
+}
+
+void BufferCache::print_stats() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    uint64_t lookups = hits + misses;
+    KLOG_INFO << "[BUFFER] " << buffers.size() << "/" << capacity << " buffers ("
+              << a1in.size() << " A1in, " << am.size() << " Am), " << dirty_count << " dirty";
+    KLOG_INFO << "[BUFFER] " << hits << " hits, " << misses << " misses ("
+              << std::fixed << std::setprecision(1) << (lookups ? 100.0 * hits / lookups : 0.0)
+              << "% hit ratio), " << evictions << " evictions, " << writebacks << " writebacks";
+    KLOG_INFO << "[BUFFER] " << prefetches << " blocks read ahead, " << prefetch_hits << " used, "
+              << prefetch_wasted << " evicted unused";
+}
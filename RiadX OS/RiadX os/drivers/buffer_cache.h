@@ -0,0 +1,177 @@
+#ifndef BUFFER_CACHE_H
+#define BUFFER_CACHE_H
+
+#include "block_device.h"
+#include <cstdint>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#define BUFFER_CACHE_DEFAULT_BLOCKS  256   // 1MB of 4KB buffers
+#define BUFFER_WRITEBACK_INTERVAL_MS 500   // Flusher wakeup period
+#define BUFFER_DIRTY_EXPIRE_MS       3000  // Dirty buffers older than this are written back
+#define BUFFER_A1IN_PERCENT          25    // 2Q: share of the cache for blocks used once
+#define BUFFER_A1OUT_PERCENT         50    // 2Q: evicted blocks remembered, share of capacity
+#define BUFFER_PREFETCH_PERCENT      25    // Read-ahead blocks queued at most, share of capacity
+#define BUFFER_CLUSTER_ENTRIES       32    // Decompressed clusters kept
+
+// 2Q replacement: a block enters A1in on its first use and is evicted from
+// there in FIFO order, so one-off scans cannot push out the working set.
+// A block used again after leaving A1in is remembered in A1out and goes to
+// the Am LRU when it comes back.
+enum BufferQueue {
+    BUFFER_QUEUE_A1IN,
+    BUFFER_QUEUE_AM
+};
+
+struct Buffer {
+    uint64_t block;
+    std::vector<uint8_t> data;  // BLOCK_SIZE bytes
+    int pins;
+    bool dirty;
+    uint64_t dirty_since;       // Steady clock milliseconds
+    bool prefetched;            // Read ahead and not used yet
+    BufferQueue queue;
+    std::list<Buffer*>::iterator position;
+
+    Buffer() : block(0), data(BLOCK_SIZE, 0), pins(0), dirty(false), dirty_since(0),
+               prefetched(false), queue(BUFFER_QUEUE_A1IN) {}
+};
+
+class BufferCache;
+
+// Decompressed contents of a compressed cluster, shared with its readers
+typedef std::shared_ptr<const std::vector<uint8_t>> ClusterData;
+
+// A pinned cached block. The buffer is not evicted or written back while
+// pinned, so its data can be used in place. Call mark_dirty() after
+// modifying it.
+class BufferRef {
+private:
+    BufferCache* cache;
+    Buffer* buffer;
+
+public:
+    BufferRef() : cache(nullptr), buffer(nullptr) {}
+    BufferRef(BufferCache* owner, Buffer* pinned) : cache(owner), buffer(pinned) {}
+    BufferRef(BufferRef&& other) : cache(other.cache), buffer(other.buffer) {
+        other.buffer = nullptr;
+    }
+    BufferRef& operator=(BufferRef&& other);
+    ~BufferRef() { release(); }
+
+    BufferRef(const BufferRef&) = delete;
+    BufferRef& operator=(const BufferRef&) = delete;
+
+    void release();
+    void mark_dirty();
+
+    bool valid() const { return buffer != nullptr; }
+    uint64_t block() const { return buffer->block; }
+    const uint8_t* data() const { return buffer->data.data(); }
+    uint8_t* writable_data() { return buffer->data.data(); }
+};
+
+// Hashed cache of block buffers over a BlockDevice, with write-back of
+// dirty buffers by a background flusher
+class BufferCache {
+private:
+    BlockDevice* device;
+    size_t capacity;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Buffer>> buffers;
+    std::list<Buffer*> a1in;     // Newest first
+    std::list<Buffer*> am;       // Most recently used first
+    std::list<uint64_t> a1out;   // Newest first
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> a1out_index;
+    size_t dirty_count;
+    std::mutex cache_mutex;
+
+    std::thread flusher;
+    std::condition_variable flusher_wakeup;
+    bool flusher_stop;          // Stops the prefetcher too
+    uint64_t writeback_interval_ms;
+    uint64_t dirty_expire_ms;
+
+    // Blocks queued by prefetch(), read in by the prefetcher thread
+    std::deque<uint64_t> prefetch_queue;
+    std::thread prefetcher;
+    std::condition_variable prefetch_wakeup;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t prefetches;        // Blocks read ahead
+    uint64_t prefetch_hits;     // ... and used later
+    uint64_t prefetch_wasted;   // ... and evicted unused
+
+    // Decompressed clusters by the first block of their compressed data,
+    // most recently used first
+    std::list<std::pair<uint64_t, ClusterData>> clusters;
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, ClusterData>>::iterator> cluster_index;
+    uint64_t cluster_span;      // Most blocks a cluster has been stored in
+
+    // Callers hold cache_mutex
+    Buffer* pin_block(uint64_t block, bool read);
+    Buffer* load_block(uint64_t block, bool read, bool grow);
+    std::unique_ptr<Buffer> evict_buffer();
+    bool write_back(Buffer* buffer);
+    void forget_ghost(uint64_t block);
+    void drop_clusters(uint64_t block);
+    void flusher_main();
+    void prefetcher_main();
+
+    friend class BufferRef;
+    void unpin(Buffer* buffer);
+    void mark_dirty(Buffer* buffer);
+
+public:
+    BufferCache();
+    ~BufferCache();
+
+    bool initialize(BlockDevice* block_device, size_t capacity_blocks = BUFFER_CACHE_DEFAULT_BLOCKS);
+    void shutdown();  // Writes back and drops every buffer
+
+    // The block's buffer, read from the device on a miss. Invalid on I/O
+    // errors or past the end of the device.
+    BufferRef read(uint64_t block);
+
+    // The block's buffer for overwriting in full: a miss is not read from
+    // the device and starts zeroed
+    BufferRef get(uint64_t block);
+
+    // Queues count blocks from block to be read into the cache in the
+    // background. Blocks already cached are skipped, and requests are
+    // dropped while the queue is full.
+    void prefetch(uint64_t block, uint64_t count);
+
+    // Decompressed clusters, kept by the first of the block_count blocks
+    // holding their compressed data. Writing to any of those blocks drops
+    // the cluster.
+    ClusterData get_cluster(uint64_t block);
+    void put_cluster(uint64_t block, uint64_t block_count, ClusterData data);
+
+    // Writes back every dirty buffer that is not pinned and flushes the
+    // device. With pinned, pinned buffers are written too; only for callers
+    // that have every writer shut out, such as a journal commit, so a pin
+    // can only be a reader's.
+    bool sync(bool pinned = false);
+
+    void set_writeback(uint64_t interval_ms, uint64_t expire_ms);
+
+    uint64_t get_hits();
+    uint64_t get_misses();
+    double get_hit_ratio();
+    uint64_t get_prefetches();
+    uint64_t get_prefetch_hits();
+    uint64_t get_prefetch_wasted();
+    void print_stats();
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "display.h"
-#include <iostream>
+#include "../bootloader.h"
+#include "../kernel/klog.h"
 #include <cstring>
 #include <algorithm>
 #include <cmath>
@@ -33,10 +34,7 @@ Color PixelBuffer::get_pixel(int x, int y) const {
 void PixelBuffer::clear(const Color& color) {
     std::lock_guard<std::mutex> lock(buffer_mutex);
     
-    uint32_t color_value = color.to_uint32();
-    for (int i = 0; i < width * height; i++) {
-        buffer[i] = color_value;
-    }
+    Bootloader::memset32_boot(buffer, color.to_uint32(), static_cast<size_t>(width) * height);
 }
 
 void PixelBuffer::fill_rect(const Rect& rect, const Color& color) {
@@ -47,11 +45,13 @@ void PixelBuffer::fill_rect(const Rect& rect, const Color& color) {
     int x2 = std::min(width, rect.x + rect.width);
     int y2 = std::min(height, rect.y + rect.height);
     
+    if (x1 >= x2) {
+        return;
+    }
+    
     uint32_t color_value = color.to_uint32();
     for (int y = y1; y < y2; y++) {
-        for (int x = x1; x < x2; x++) {
-            buffer[y * width + x] = color_value;
-        }
+        Bootloader::memset32_boot(&buffer[y * width + x1], color_value, x2 - x1);
     }
 }
 
@@ -168,15 +168,19 @@ void PixelBuffer::copy_to(PixelBuffer& dest, int src_x, int src_y, int dest_x, i
     std::lock_guard<std::mutex> lock1(buffer_mutex);
     std::lock_guard<std::mutex> lock2(dest.buffer_mutex);
     
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            if (src_x + x >= 0 && src_x + x < width && src_y + y >= 0 && src_y + y < height &&
-                dest_x + x >= 0 && dest_x + x < dest.width && dest_y + y >= 0 && dest_y + y < dest.height) {
-                
-                dest.buffer[(dest_y + y) * dest.width + (dest_x + x)] = 
-                    buffer[(src_y + y) * width + (src_x + x)];
-            }
-        }
+    // Clip the rectangle against both buffers, then copy whole rows
+    int x0 = std::max({0, -src_x, -dest_x});
+    int x1 = std::min({w, width - src_x, dest.width - dest_x});
+    int y0 = std::max({0, -src_y, -dest_y});
+    int y1 = std::min({h, height - src_y, dest.height - dest_y});
+    if (x0 >= x1) {
+        return;
+    }
+    
+    for (int y = y0; y < y1; y++) {
+        Bootloader::memcpy_boot(&dest.buffer[(dest_y + y) * dest.width + (dest_x + x0)],
+                                &buffer[(src_y + y) * width + (src_x + x0)],
+                                static_cast<size_t>(x1 - x0) * sizeof(uint32_t));
     }
 }
 
@@ -187,7 +191,7 @@ DisplayDriver::DisplayDriver()
       bits_per_pixel(BITS_PER_PIXEL), refresh_rate(60),
       hardware_acceleration(false), initialized(false) {
     
-    std::cout << "[DISPLAY] Display driver initializing..." << std::endl;
+    KLOG_INFO << "[DISPLAY] Display driver initializing...";
 }
 
 DisplayDriver::~DisplayDriver() {
@@ -209,12 +213,12 @@ bool DisplayDriver::initialize() {
         clear_screen(Color(0, 0, 0)); // Black
         
         initialized = true;
-        std::cout << "[DISPLAY] Display driver initialized (" 
-                  << screen_width << "x" << screen_height << "x" << bits_per_pixel << ")" << std::endl;
+        KLOG_INFO << "[DISPLAY] Display driver initialized (" 
+                  << screen_width << "x" << screen_height << "x" << bits_per_pixel << ")";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[DISPLAY] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[DISPLAY] Exception during initialization: " << e.what();
         return false;
     }
 }
@@ -228,7 +232,7 @@ void DisplayDriver::shutdown() {
     backbuffer = nullptr;
     
     initialized = false;
-    std::cout << "[DISPLAY] Display driver shutdown complete" << std::endl;
+    KLOG_INFO << "[DISPLAY] Display driver shutdown complete";
 }
 
 bool DisplayDriver::set_display_mode(int width, int height, int bpp) {
@@ -253,7 +257,7 @@ bool DisplayDriver::set_display_mode(int width, int height, int bpp) {
         backbuffer = new PixelBuffer(screen_width, screen_height);
     }
     
-    std::cout << "[DISPLAY] Display mode set to " << width << "x" << height << "x" << bpp << std::endl;
+    KLOG_INFO << "[DISPLAY] Display mode set to " << width << "x" << height << "x" << bpp;
     return true;
 }
 
@@ -395,23 +399,23 @@ void DisplayDriver::handle_interrupt() {
 }
 
 void DisplayDriver::enable_vsync() {
-    std::cout << "[DISPLAY] VSync enabled" << std::endl;
+    KLOG_INFO << "[DISPLAY] VSync enabled";
 }
 
 void DisplayDriver::disable_vsync() {
-    std::cout << "[DISPLAY] VSync disabled" << std::endl;
+    KLOG_INFO << "[DISPLAY] VSync disabled";
 }
 
 void DisplayDriver::save_screenshot(const std::string& filename) {
-    std::cout << "[DISPLAY] Screenshot saved to " << filename << std::endl;
+    KLOG_INFO << "[DISPLAY] Screenshot saved to " << filename;
     // In a real implementation, this would save the framebuffer to a file
 }
 
 void DisplayDriver::print_display_info() {
-    std::cout << "[DISPLAY] Display Information:" << std::endl;
-    std::cout << "  Resolution: " << screen_width << "x" << screen_height << std::endl;
-    std::cout << "  Bits per pixel: " << bits_per_pixel << std::endl;
-    std::cout << "  Refresh rate: " << refresh_rate << "Hz" << std::endl;
-    std::cout << "  Double buffering: " << (double_buffering ? "Enabled" : "Disabled") << std::endl;
-    std::cout << "  Hardware acceleration: " << (hardware_acceleration ? "Enabled" : "Disabled") << std::endl;
+    KLOG_INFO << "[DISPLAY] Display Information:";
+    KLOG_INFO << "  Resolution: " << screen_width << "x" << screen_height;
+    KLOG_INFO << "  Bits per pixel: " << bits_per_pixel;
+    KLOG_INFO << "  Refresh rate: " << refresh_rate << "Hz";
+    KLOG_INFO << "  Double buffering: " << (double_buffering ? "Enabled" : "Disabled");
+    KLOG_INFO << "  Hardware acceleration: " << (hardware_acceleration ? "Enabled" : "Disabled");
 }
@@ -1,48 +1,74 @@
 #include "filesystem.h"
-#include <iostream>
+#include "../bootloader.h"
+#include "../boot/crc32.h"
+#include "../boot/lz4.h"
+#include "../kernel/snapshot.h"
+#include "../kernel/trace.h"
+#include "../kernel/klog.h"
+#include "../kernel/sim_clock.h"
 #include <sstream>
 #include <algorithm>
 #include <chrono>
+#include <iomanip>
 #include <cstring>
+#include <cstddef>
+#include <unordered_map>
+#include <unistd.h>
 
 FileSystem::FileSystem() 
-    : total_blocks(1024), free_blocks(1024), next_fd(3),
-      root_path("/"), current_directory("/") {
+    : inode_count(0), total_blocks(1024), superblock(), disk_image_blocks(FS_DEFAULT_IMAGE_BLOCKS),
+      compression(false), deduplication(false), next_fd(3), root_path("/"), current_directory("/"), current_directory_inode(ROOT_INODE) {
     
-    std::cout << "[FILESYSTEM] File system initializing..." << std::endl;
+    KLOG_INFO << "[FILESYSTEM] File system initializing...";
 }
 
 FileSystem::~FileSystem() {
     shutdown();
 }
 
+// CRC-32C, in hardware where the CPU has it
+static uint32_t fs_checksum(const void* data, size_t size) {
+    return crc32c(data, size, (Bootloader::get_cpu_features() & CPU_FEATURE_SSE42) != 0);
+}
+
 bool FileSystem::initialize() {
-    std::lock_guard<std::mutex> lock(fs_mutex);
-    
     try {
-        // Initialize disk blocks
-        disk_blocks.resize(total_blocks);
-        block_allocation_table.resize(total_blocks, false);
-        
-        // Create root directory
-        create_directory_entry("/", FILE_TYPE_DIRECTORY);
-        directory_contents["/"] = std::vector<std::string>();
+        bool mounted = false;
+        {
+            std::unique_lock<std::shared_mutex> lock(fs_lock);
+            
+            // An existing image is mounted as is
+            mounted = is_persistent() && access(disk_image_path.c_str(), F_OK) == 0;
+            if (!(mounted ? mount_locked() : format_locked())) {
+                return false;
+            }
+        }
         
-        // Create sample directory structure
-        create_sample_files();
+        if (!mounted) {
+            // Create sample directory structure
+            create_sample_files();
+            sync();
+        }
         
-        std::cout << "[FILESYSTEM] File system initialized with " 
-                  << total_blocks << " blocks (" << (total_blocks * BLOCK_SIZE / 1024) << "KB)" << std::endl;
+        KLOG_INFO << "[FILESYSTEM] File system initialized with " 
+                  << total_blocks << " blocks (" << (total_blocks * BLOCK_SIZE / 1024) << "KB)";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[FILESYSTEM] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[FILESYSTEM] Exception during initialization: " << e.what();
         return false;
     }
 }
 
 void FileSystem::shutdown() {
-    std::lock_guard<std::mutex> lock(fs_mutex);
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
+    
+    // Leave the image clean so the next mount needs no warning
+    if (device && is_persistent()) {
+        write_checkpoint(true);
+    }
+    journal.stop();
+    pending_frees.clear();
     
     // Close all open files
     for (auto& handle : open_files) {
@@ -52,515 +78,3152 @@ void FileSystem::shutdown() {
     }
     open_files.clear();
     
-    file_contents.clear();
-    file_attributes.clear();
-    directory_contents.clear();
-    disk_blocks.clear();
-    block_allocation_table.clear();
-    
-    std::cout << "[FILESYSTEM] File system shutdown complete" << std::endl;
+    // Deleted inodes still waiting out a grace period go first
+    rcu_synchronize();
+    inode_table.clear();
+    free_inodes.clear();
+    inode_count = 0;
+    dentry_cache.clear();
+    buffer_cache.shutdown();
+    device.reset();
+    block_bitmap.reset(0);
+    shared_extents.clear();
+    
+    KLOG_INFO << "[FILESYSTEM] File system shutdown complete";
 }
 
-std::string FileSystem::normalize_path(const std::string& path) {
-    if (path.empty()) return "/";
+void FileSystem::set_disk_image(const std::string& image_path, uint64_t block_count) {
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
+    disk_image_path = image_path;
+    disk_image_blocks = block_count;
+}
+
+bool FileSystem::sync() {
+    bool commit = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(fs_lock);
+        if (!device) return false;
+        if (!journal.active() && !is_persistent()) return true;
+        commit = journal.active() && !journal.needs_checkpoint();
+    }
     
-    std::string normalized = path;
+    // Waits without fs_lock so other operations can join the commit
+    if (commit && journal.commit()) {
+        return true;
+    }
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
+    return device && write_checkpoint(false);
+}
+
+void FileSystem::set_journal_commit(uint64_t interval_ms, uint32_t max_batch) {
+    journal.set_commit(interval_ms, max_batch);
+}
+
+void FileSystem::set_compression(bool enabled) {
+    compression = enabled;
+    KLOG_INFO << "[FILESYSTEM] Compression " << (enabled ? "enabled" : "disabled");
+}
+
+bool FileSystem::get_compression_stats(const std::string& path, CompressionStats& stats) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
     
-    // Convert to absolute path if relative
-    if (!is_absolute_path(normalized)) {
-        normalized = current_directory + "/" + normalized;
+    std::shared_lock<std::shared_mutex> inode_lock;
+    Inode* inode = lookup_locked(path, inode_lock);
+    if (!inode || inode->attributes.type == FILE_TYPE_DIRECTORY) {
+        return false;
     }
     
-    // Remove duplicate slashes
-    size_t pos = 0;
-    while ((pos = normalized.find("//", pos)) != std::string::npos) {
-        normalized.erase(pos, 1);
+    stats = CompressionStats();
+    stats.size = inode->attributes.size;
+    if (!inode->inline_data.empty()) {
+        stats.stored_bytes = inode->inline_data.size();
+        return true;
+    }
+    stats.stored_bytes = static_cast<uint64_t>(inode->extents.block_count()) * BLOCK_SIZE;
+    stats.clusters = static_cast<uint32_t>((stats.size + FS_CLUSTER_BYTES - 1) / FS_CLUSTER_BYTES);
+    stats.compressed_clusters = static_cast<uint32_t>(inode->extents.get_compressed().size());
+    return true;
+}
+
+void FileSystem::set_deduplication(bool enabled, size_t index_entries) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    size_t entries;
+    {
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        dedup_index.reset(enabled ? index_entries : 0, total_blocks);
+        entries = dedup_index.capacity();
     }
+    deduplication = entries > 0;
     
-    // Handle . and .. directories
-    std::vector<std::string> components;
-    std::stringstream ss(normalized);
-    std::string component;
+    if (entries) {
+        KLOG_INFO << "[FILESYSTEM] Deduplication enabled, index of " << entries << " blocks ("
+                  << (entries * 8 / 1024) << "KB)";
+    } else {
+        KLOG_INFO << "[FILESYSTEM] Deduplication disabled";
+    }
+}
+
+void FileSystem::get_dedup_stats(DedupStats& stats) {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    stats = dedup_stats;
+    stats.index_entries = dedup_index.capacity();
+}
+
+bool FileSystem::format_disk() {
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
+    return format_locked();
+}
+
+bool FileSystem::mount() {
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
+    if (!is_persistent()) {
+        KLOG_ERROR << "[FILESYSTEM] No disk image to mount";
+        return false;
+    }
+    return mount_locked();
+}
+
+// An empty tree: just the root directory
+void FileSystem::reset_inodes() {
+    // Deleted inodes still waiting out a grace period would return their
+    // numbers to the new table
+    rcu_synchronize();
+    
+    // Slot 0 stays empty so INVALID_INODE never resolves
+    inode_table.clear();
+    free_inodes.clear();
+    inode_count = 0;
+    dentry_cache.clear();
+    open_files.clear();
+    shared_extents.clear();
+    dedup_index.reset(dedup_index.capacity(), total_blocks);
     
-    while (std::getline(ss, component, '/')) {
-        if (component.empty() || component == ".") {
-            continue;
-        } else if (component == "..") {
-            if (!components.empty()) {
-                components.pop_back();
-            }
+    Inode* root = allocate_inode(FILE_TYPE_DIRECTORY);
+    root->parent = root->id;
+    current_directory = "/";
+    current_directory_inode = root->id;
+}
+
+void FileSystem::rebuild_free_inodes() {
+    free_inodes.clear();
+    inode_count = 0;
+    for (InodeId id = static_cast<InodeId>(inode_table.size()) - 1; id > INVALID_INODE; id--) {
+        if (inode_table.get(id)) {
+            inode_count++;
         } else {
-            components.push_back(component);
+            free_inodes.push_back(id);
         }
     }
-    
-    // Reconstruct path
-    if (components.empty()) {
-        return "/";
+}
+
+// Everything but the directory entries
+template <typename Writer>
+void FileSystem::write_inode_fields(Writer& writer, const Inode& inode) {
+    const FileAttributes& attr = inode.attributes;
+    writer.write_u32(inode.id);
+    writer.write_u32(attr.type);
+    writer.write_u64(attr.size);
+    writer.write_u64(attr.creation_time);
+    writer.write_u64(attr.modification_time);
+    writer.write_u64(inode.accessed.load(std::memory_order_relaxed));
+    writer.write_i32(attr.permissions);
+    writer.write_i32(attr.owner_id);
+    writer.write_i32(attr.group_id);
+    writer.write_u32(inode.parent);
+    
+    writer.write_u32(static_cast<uint32_t>(inode.extents.extent_count()));
+    for (const auto& extent : inode.extents.get_extents()) {
+        writer.write_u32(extent.first);
+        writer.write_u32(extent.second.start_block);
+        writer.write_u32(extent.second.block_count);
     }
-    
-    std::string result = "/";
-    for (size_t i = 0; i < components.size(); i++) {
-        result += components[i];
-        if (i < components.size() - 1) {
-            result += "/";
+    writer.write_u32(static_cast<uint32_t>(inode.extents.get_compressed().size()));
+    for (const auto& cluster : inode.extents.get_compressed()) {
+        writer.write_u32(cluster.first);
+        writer.write_u32(cluster.second);
+    }
+    writer.write_string(inode.inline_data);
+}
+
+template <typename Reader>
+void FileSystem::read_inode_fields(Reader& reader, Inode& inode) {
+    inode.id = reader.read_u32();
+    FileAttributes& attr = inode.attributes;
+    attr.type = static_cast<FileType>(reader.read_u32());
+    attr.size = reader.read_u64();
+    attr.creation_time = reader.read_u64();
+    attr.modification_time = reader.read_u64();
+    attr.access_time = reader.read_u64();
+    attr.permissions = reader.read_i32();
+    attr.owner_id = reader.read_i32();
+    attr.group_id = reader.read_i32();
+    inode.parent = reader.read_u32();
+    inode.accessed = attr.access_time;
+    
+    inode.extents.clear();
+    uint32_t extents = reader.read_u32();
+    for (uint32_t e = 0; e < extents && reader.good(); e++) {
+        uint32_t logical_block = reader.read_u32();
+        uint32_t start_block = reader.read_u32();
+        uint32_t block_count = reader.read_u32();
+        inode.extents.insert(logical_block, Extent(start_block, block_count));
+    }
+    uint32_t clusters = reader.read_u32();
+    for (uint32_t c = 0; c < clusters && reader.good(); c++) {
+        uint32_t cluster = reader.read_u32();
+        inode.extents.set_compressed(cluster, reader.read_u32());
+    }
+    inode.inline_data = reader.read_string();
+}
+
+// Inode numbers are kept so directory links stay valid
+template <typename Writer>
+void FileSystem::write_inode_table(Writer& writer) {
+    writer.write_u32(static_cast<uint32_t>(inode_table.size()));
+    writer.write_u32(static_cast<uint32_t>(inode_count));
+    for (InodeId id = 0; id < inode_table.size(); id++) {
+        const Inode* inode = inode_table.get(id);
+        if (!inode) continue;
+        
+        write_inode_fields(writer, *inode);
+        writer.write_u32(static_cast<uint32_t>(inode->children.size()));
+        uint64_t cursor = 0;
+        while (const DirectoryLink* link = inode->children.next(cursor)) {
+            writer.write_string(link->name);
+            writer.write_u32(link->inode);
         }
     }
-    
-    return result;
 }
 
-std::string FileSystem::get_parent_directory(const std::string& path) {
-    std::string normalized = normalize_path(path);
-    if (normalized == "/") return "/";
-    
-    size_t last_slash = normalized.find_last_of('/');
-    if (last_slash == 0) return "/";
+template <typename Reader>
+bool FileSystem::read_inode_table(Reader& reader) {
+    uint32_t table_size = reader.read_u32();
+    uint32_t inodes = reader.read_u32();
+    rcu_synchronize();
+    inode_table.clear();
+    dentry_cache.clear();
+    open_files.clear();
+    for (uint32_t i = 0; i < inodes && reader.good(); i++) {
+        std::unique_ptr<Inode> inode(new Inode());
+        read_inode_fields(reader, *inode);
+        
+        uint32_t children = reader.read_u32();
+        for (uint32_t c = 0; c < children && reader.good(); c++) {
+            std::string name = reader.read_string();
+            inode->children.insert(name, reader.read_u32());
+        }
+        
+        InodeId id = inode->id;
+        if (id == INVALID_INODE || id >= table_size || inode_table.get(id) ||
+            !inode_table.set(id, inode.get())) {
+            KLOG_ERROR << "[FILESYSTEM] Corrupt inode table";
+            return false;
+        }
+        inode.release();
+    }
+    rebuild_free_inodes();
     
-    return normalized.substr(0, last_slash);
+    if (!reader.good() || !get_inode(ROOT_INODE)) {
+        KLOG_ERROR << "[FILESYSTEM] Corrupt inode table";
+        return false;
+    }
+    return true;
 }
 
-std::string FileSystem::get_filename(const std::string& path) {
-    std::string normalized = normalize_path(path);
-    if (normalized == "/") return "";
+// Everything in use is reachable from the superblock: itself, the
+// checkpoint, and the extents of every file
+bool FileSystem::rebuild_block_bitmap() {
+    std::vector<Extent> used(superblock.checkpoint_extents,
+                             superblock.checkpoint_extents + superblock.checkpoint_extent_count);
+    used.push_back(Extent(FS_SUPERBLOCK_BLOCK, 1));
+    used.push_back(Extent(static_cast<uint32_t>(superblock.journal_start),
+                          static_cast<uint32_t>(superblock.journal_blocks)));
+    for (InodeId id = 0; id < inode_table.size(); id++) {
+        const Inode* inode = inode_table.get(id);
+        if (!inode) continue;
+        for (const auto& extent : inode->extents.get_extents()) {
+            used.push_back(extent.second);
+        }
+    }
     
-    size_t last_slash = normalized.find_last_of('/');
-    return normalized.substr(last_slash + 1);
+    block_bitmap.reset(total_blocks);
+    for (const Extent& extent : used) {
+        if (static_cast<uint64_t>(extent.start_block) + extent.block_count > total_blocks) {
+            KLOG_ERROR << "[FILESYSTEM] Extent at block " << extent.start_block << " is past the end of the disk";
+            return false;
+        }
+        block_bitmap.set_range(extent.start_block, extent.block_count);
+    }
+    rebuild_shared_extents();
+    return true;
 }
 
-bool FileSystem::is_absolute_path(const std::string& path) {
-    return !path.empty() && path[0] == '/';
+// Blocks mapped more than once were shared by reflink copies or deduplication
+void FileSystem::rebuild_shared_extents() {
+    shared_extents.clear();
+    dedup_index.reset(dedup_index.capacity(), total_blocks);
+    BlockBitmap seen;
+    seen.reset(total_blocks);
+    for (InodeId id = 0; id < inode_table.size(); id++) {
+        const Inode* inode = inode_table.get(id);
+        if (!inode) continue;
+        for (const auto& entry : inode->extents.get_extents()) {
+            const Extent& extent = entry.second;
+            size_t end = static_cast<size_t>(extent.start_block) + extent.block_count;
+            if (end > total_blocks) continue;
+            
+            // Runs seen in an earlier file are shared with it
+            for (size_t block = extent.start_block; block < end;) {
+                bool shared = seen.test(block);
+                size_t run_end = block + 1;
+                while (run_end < end && seen.test(run_end) == shared) {
+                    run_end++;
+                }
+                if (shared) {
+                    shared_extents.add(Extent(static_cast<uint32_t>(block),
+                                              static_cast<uint32_t>(run_end - block)));
+                }
+                block = run_end;
+            }
+            seen.set_range(extent.start_block, extent.block_count);
+        }
+    }
 }
 
-bool FileSystem::is_valid_filename(const std::string& filename) {
-    if (filename.empty() || filename.length() > MAX_FILENAME_LENGTH) {
+bool FileSystem::write_superblock() {
+    superblock.checksum = fs_checksum(&superblock, offsetof(Superblock, checksum));
+    
+    BufferRef buffer = buffer_cache.get(FS_SUPERBLOCK_BLOCK);
+    if (!buffer.valid()) {
         return false;
     }
-    
-    // Check for invalid characters
-    const std::string invalid_chars = "\\/:*?\"<>|";
-    return filename.find_first_of(invalid_chars) == std::string::npos;
+    std::memset(buffer.writable_data(), 0, BLOCK_SIZE);
+    Bootloader::memcpy_boot(buffer.writable_data(), &superblock, sizeof(superblock));
+    buffer.mark_dirty();
+    buffer.release();
+    return buffer_cache.sync();
 }
 
-bool FileSystem::create_file(const std::string& path) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
-    
-    std::string normalized_path = normalize_path(path);
-    
-    if (file_exists(normalized_path)) {
-        std::cerr << "[FILESYSTEM] File already exists: " << normalized_path << std::endl;
+bool FileSystem::start_journal() {
+    if (superblock.journal_blocks == 0) {
+        return true;
+    }
+    // Writers have drained when a transaction commits, so blocks still
+    // pinned are being read and are written out like the rest
+    return journal.start(device.get(), superblock.journal_start, superblock.journal_blocks,
+                         superblock.journal_sequence, [this] { return buffer_cache.sync(true); });
+}
+
+// The inode table goes to fresh blocks and the superblock is switched over
+// to it; the previous checkpoint's blocks are freed only after the switch.
+// The journal starts over once the new checkpoint is durable.
+bool FileSystem::write_checkpoint(bool clean) {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+    MemoryWriter writer;
+    write_inode_table(writer);
+    const std::vector<uint8_t>& checkpoint = writer.data();
+    
+    ExtentTree extents;
+    uint32_t blocks = static_cast<uint32_t>((checkpoint.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    if (!allocate_file_blocks(extents, blocks) || extents.extent_count() > FS_CHECKPOINT_EXTENTS) {
+        free_file_blocks(extents);
+        KLOG_ERROR << "[FILESYSTEM] No room for a checkpoint of " << checkpoint.size() << " bytes";
         return false;
     }
     
-    std::string parent_dir = get_parent_directory(normalized_path);
-    if (!is_directory(parent_dir)) {
-        std::cerr << "[FILESYSTEM] Parent directory does not exist: " << parent_dir << std::endl;
-        return false;
+    for (const auto& extent : extents.get_extents()) {
+        size_t offset = static_cast<size_t>(extent.first) * BLOCK_SIZE;
+        size_t length = std::min(static_cast<size_t>(extent.second.block_count) * BLOCK_SIZE,
+                                 checkpoint.size() - offset);
+        write_blocks(extent.second.start_block, checkpoint.data() + offset, length);
     }
     
-    // Create file entry
-    if (!create_directory_entry(normalized_path, FILE_TYPE_REGULAR)) {
-        return false;
+    bool journaled = journal.active();
+    Superblock previous = superblock;
+    superblock.clean = clean ? 1 : 0;
+    superblock.generation++;
+    superblock.checkpoint_bytes = checkpoint.size();
+    superblock.checkpoint_checksum = fs_checksum(checkpoint.data(), checkpoint.size());
+    superblock.checkpoint_extent_count = 0;
+    for (const auto& extent : extents.get_extents()) {
+        superblock.checkpoint_extents[superblock.checkpoint_extent_count++] = extent.second;
+    }
+    if (journaled) {
+        superblock.journal_sequence = journal.begin_checkpoint();
     }
     
-    file_contents[normalized_path] = "";
+    // The checkpoint has to be on disk before the superblock points to it
+    if (!buffer_cache.sync(true) || !write_superblock()) {
+        superblock = previous;
+        if (journaled) {
+            journal.end_checkpoint(false);
+        }
+        free_file_blocks(extents);
+        KLOG_ERROR << "[FILESYSTEM] Checkpoint failed";
+        return false;
+    }
     
-    // Add to parent directory
-    directory_contents[parent_dir].push_back(get_filename(normalized_path));
+    if (journaled) {
+        journal.end_checkpoint(true);
+    }
+    for (uint32_t i = 0; i < previous.checkpoint_extent_count; i++) {
+        free_extent(previous.checkpoint_extents[i]);
+    }
     
-    std::cout << "[FILESYSTEM] Created file: " << normalized_path << std::endl;
+    // Nothing committed before this point can be replayed any more
+    for (const auto& pending : pending_frees) {
+        block_bitmap.clear_range(pending.second.start_block, pending.second.block_count);
+    }
+    pending_frees.clear();
     return true;
 }
 
-bool FileSystem::delete_file(const std::string& path) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
-    
-    std::string normalized_path = normalize_path(path);
-    
-    if (!file_exists(normalized_path)) {
-        std::cerr << "[FILESYSTEM] File does not exist: " << normalized_path << std::endl;
-        return false;
+bool FileSystem::format_locked() {
+    journal.stop();
+    pending_frees.clear();
+    buffer_cache.shutdown();
+    device.reset();
+    
+    if (is_persistent()) {
+        std::unique_ptr<MmapBlockDevice> image(new MmapBlockDevice());
+        if (disk_image_blocks < 16 || disk_image_blocks > UINT32_MAX ||
+            !image->open(disk_image_path, disk_image_blocks)) {
+            KLOG_ERROR << "[FILESYSTEM] Cannot format " << disk_image_path;
+            return false;
+        }
+        device = std::move(image);
+    } else {
+        device.reset(new MemoryBlockDevice(total_blocks));
     }
-    
-    if (is_directory(normalized_path)) {
-        std::cerr << "[FILESYSTEM] Cannot delete directory with delete_file: " << normalized_path << std::endl;
+    total_blocks = device->block_count();
+    uint64_t journal_sequence = is_persistent() ? first_unused_sequence() : 1;
+    if (!buffer_cache.initialize(device.get())) {
         return false;
     }
     
-    // Remove from parent directory
-    std::string parent_dir = get_parent_directory(normalized_path);
-    auto& parent_contents = directory_contents[parent_dir];
-    std::string filename = get_filename(normalized_path);
+    superblock = Superblock();
+    superblock.magic = FS_MAGIC;
+    superblock.version = FS_VERSION;
+    superblock.block_size = BLOCK_SIZE;
+    superblock.block_count = total_blocks;
+    superblock.journal_sequence = journal_sequence;
+    
+    // A filesystem in memory has nothing to recover
+    if (is_persistent()) {
+        superblock.journal_start = FS_SUPERBLOCK_BLOCK + 1;
+        superblock.journal_blocks = std::min<uint64_t>(JOURNAL_DEFAULT_BLOCKS, total_blocks / 4);
+    }
     
-    parent_contents.erase(
-        std::remove(parent_contents.begin(), parent_contents.end(), filename),
-        parent_contents.end());
+    block_bitmap.reset(total_blocks);
+    block_bitmap.set_range(FS_SUPERBLOCK_BLOCK, 1);
+    block_bitmap.set_range(superblock.journal_start, superblock.journal_blocks);
+    reset_inodes();
     
-    // Remove file data
-    file_contents.erase(normalized_path);
-    file_attributes.erase(normalized_path);
+    if (!write_checkpoint(false) || !start_journal()) {
+        return false;
+    }
     
-    std::cout << "[FILESYSTEM] Deleted file: " << normalized_path << std::endl;
+    KLOG_INFO << "[FILESYSTEM] Formatted " << (is_persistent() ? disk_image_path : std::string("memory disk"))
+              << " with " << total_blocks << " blocks";
     return true;
 }
 
-bool FileSystem::file_exists(const std::string& path) {
-    std::string normalized_path = normalize_path(path);
-    return file_attributes.find(normalized_path) != file_attributes.end();
+// A filesystem formatted over leaves its transactions in the log, with
+// valid checksums. Its superblock has the sequence its log continued from
+// after the last checkpoint, and no more transactions than the log has
+// blocks can follow that, so the new filesystem starts past them. Without
+// a readable superblock the first log block is cleared instead.
+uint64_t FileSystem::first_unused_sequence() {
+    std::vector<uint8_t> block_data(BLOCK_SIZE);
+    Superblock previous;
+    if (device->read_block(FS_SUPERBLOCK_BLOCK, block_data.data())) {
+        std::memcpy(&previous, block_data.data(), sizeof(previous));
+        if (previous.magic == FS_MAGIC &&
+            previous.checksum == fs_checksum(&previous, offsetof(Superblock, checksum))) {
+            return previous.journal_sequence + previous.journal_blocks + 1;
+        }
+    }
+    
+    std::fill(block_data.begin(), block_data.end(), 0);
+    device->write_block(FS_SUPERBLOCK_BLOCK + 1, block_data.data());
+    return 1;
 }
 
-bool FileSystem::is_directory(const std::string& path) {
-    std::string normalized_path = normalize_path(path);
-    auto it = file_attributes.find(normalized_path);
-    return it != file_attributes.end() && it->second.type == FILE_TYPE_DIRECTORY;
+// Replays one journal record onto the inode table
+bool FileSystem::apply_journal_record(MemoryReader& reader) {
+    uint8_t type = reader.read_u8();
+    switch (type) {
+        case JOURNAL_RECORD_INODE: {
+            std::unique_ptr<Inode> inode(new Inode());
+            read_inode_fields(reader, *inode);
+            if (!reader.good() || inode->id == INVALID_INODE) {
+                return false;
+            }
+            
+            // Directory entries have records of their own
+            Inode* existing = inode_table.get(inode->id);
+            if (existing) {
+                existing->attributes = inode->attributes;
+                existing->parent = inode->parent.load();
+                existing->accessed = inode->accessed.load();
+                existing->extents = inode->extents;
+                existing->inline_data = inode->inline_data;
+            } else if (inode_table.set(inode->id, inode.get())) {
+                inode.release();
+            } else {
+                return false;
+            }
+            return true;
+        }
+        case JOURNAL_RECORD_LINK:
+        case JOURNAL_RECORD_UNLINK: {
+            Inode* directory = get_inode(reader.read_u32());
+            std::string name = reader.read_string();
+            InodeId child = type == JOURNAL_RECORD_LINK ? reader.read_u32() : INVALID_INODE;
+            if (!reader.good() || !directory || directory->attributes.type != FILE_TYPE_DIRECTORY) {
+                return false;
+            }
+            if (type == JOURNAL_RECORD_LINK) {
+                directory->children.insert(name, child);
+            } else {
+                directory->children.erase(name.data(), name.size());
+            }
+            return true;
+        }
+        case JOURNAL_RECORD_FREE: {
+            InodeId id = reader.read_u32();
+            if (!reader.good() || id == ROOT_INODE || !get_inode(id)) {
+                return false;
+            }
+            delete inode_table.take(id);
+            return true;
+        }
+        default:
+            return false;
+    }
 }
 
-bool FileSystem::create_directory(const std::string& path) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
-    
-    std::string normalized_path = normalize_path(path);
+bool FileSystem::mount_locked() {
+    std::unique_ptr<MmapBlockDevice> image(new MmapBlockDevice());
+    if (!image->open(disk_image_path)) {
+        return false;
+    }
     
-    if (file_exists(normalized_path)) {
-        std::cerr << "[FILESYSTEM] Directory already exists: " << normalized_path << std::endl;
+    // Read past the cache, which is not set up for this device yet
+    std::vector<uint8_t> block_data(BLOCK_SIZE);
+    Superblock loaded;
+    if (!image->read_block(FS_SUPERBLOCK_BLOCK, block_data.data())) {
+        return false;
+    }
+    std::memcpy(&loaded, block_data.data(), sizeof(loaded));
+    if (loaded.magic != FS_MAGIC || loaded.version != FS_VERSION || loaded.block_size != BLOCK_SIZE ||
+        loaded.checksum != fs_checksum(&loaded, offsetof(Superblock, checksum)) ||
+        loaded.block_count > image->block_count() || loaded.block_count > UINT32_MAX ||
+        loaded.checkpoint_extent_count > FS_CHECKPOINT_EXTENTS ||
+        loaded.journal_start + loaded.journal_blocks > loaded.block_count) {
+        KLOG_ERROR << "[FILESYSTEM] " << disk_image_path << " has no valid superblock";
         return false;
     }
     
-    std::string parent_dir = get_parent_directory(normalized_path);
-    if (parent_dir != normalized_path && !is_directory(parent_dir)) {
-        std::cerr << "[FILESYSTEM] Parent directory does not exist: " << parent_dir << std::endl;
+    std::vector<uint8_t> checkpoint;
+    for (uint32_t i = 0; i < loaded.checkpoint_extent_count; i++) {
+        const Extent& extent = loaded.checkpoint_extents[i];
+        for (uint32_t b = 0; b < extent.block_count; b++) {
+            if (!image->read_block(static_cast<uint64_t>(extent.start_block) + b, block_data.data())) {
+                KLOG_ERROR << "[FILESYSTEM] Cannot read checkpoint from " << disk_image_path;
+                return false;
+            }
+            checkpoint.insert(checkpoint.end(), block_data.begin(), block_data.end());
+        }
+    }
+    if (checkpoint.size() < loaded.checkpoint_bytes) {
+        KLOG_ERROR << "[FILESYSTEM] Checkpoint in " << disk_image_path << " is truncated";
+        return false;
+    }
+    checkpoint.resize(loaded.checkpoint_bytes);
+    if (fs_checksum(checkpoint.data(), checkpoint.size()) != loaded.checkpoint_checksum) {
+        KLOG_ERROR << "[FILESYSTEM] Checkpoint checksum mismatch in " << disk_image_path;
         return false;
     }
     
-    // Create directory entry
-    if (!create_directory_entry(normalized_path, FILE_TYPE_DIRECTORY)) {
+    journal.stop();
+    pending_frees.clear();
+    buffer_cache.shutdown();
+    device = std::move(image);
+    total_blocks = loaded.block_count;
+    superblock = loaded;
+    
+    // Committed changes since the checkpoint go on top of it
+    MemoryReader reader(checkpoint.data(), checkpoint.size());
+    uint32_t replayed = 0;
+    bool loaded_ok = read_inode_table(reader) &&
+        Journal::replay(device.get(), superblock.journal_start, superblock.journal_blocks,
+                        superblock.journal_sequence, replayed,
+                        [this](MemoryReader& records, uint32_t count) {
+                            for (uint32_t i = 0; i < count; i++) {
+                                if (!apply_journal_record(records)) return false;
+                            }
+                            return records.good();
+                        });
+    if (loaded_ok) {
+        rebuild_free_inodes();
+        dentry_cache.clear();
+    }
+    if (!loaded_ok || !get_inode(ROOT_INODE) || !rebuild_block_bitmap() ||
+        !buffer_cache.initialize(device.get()) || !start_journal()) {
+        KLOG_ERROR << "[FILESYSTEM] Cannot mount " << disk_image_path;
+        buffer_cache.shutdown();
+        device.reset();
         return false;
     }
+    current_directory = "/";
+    current_directory_inode = ROOT_INODE;
     
-    directory_contents[normalized_path] = std::vector<std::string>();
+    if (!superblock.clean) {
+        KLOG_WARN << "[FILESYSTEM] " << disk_image_path << " was not unmounted cleanly; replayed "
+                  << replayed << " journal transactions";
+    }
     
-    // Add to parent directory
-    if (parent_dir != normalized_path) {
-        directory_contents[parent_dir].push_back(get_filename(normalized_path));
+    // In use until the next clean checkpoint. A replayed journal is folded
+    // into a checkpoint right away.
+    superblock.clean = 0;
+    if (!(replayed ? write_checkpoint(false) : write_superblock())) {
+        return false;
     }
     
-    std::cout << "[FILESYSTEM] Created directory: " << normalized_path << std::endl;
+    KLOG_INFO << "[FILESYSTEM] Mounted " << disk_image_path << ": " << inode_count
+              << " inodes, checkpoint " << superblock.generation;
     return true;
 }
 
-bool FileSystem::delete_directory(const std::string& path) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
+bool FileSystem::save_snapshot(SnapshotWriter& writer) {
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
+    
+    writer.begin_section(SNAPSHOT_SECTION_FILESYSTEM);
+    writer.write_string(current_directory);
+    writer.write_i32(next_fd);
+    writer.write_bool(is_persistent());
+    
+    // The image holds everything else once it is checkpointed
+    if (is_persistent()) {
+        bool saved = write_checkpoint(false);
+        writer.end_section();
+        KLOG_INFO << "[FILESYSTEM] Checkpointed " << inode_count << " inodes to "
+                  << disk_image_path << " for snapshot";
+        return saved && writer.good();
+    }
     
-    std::string normalized_path = normalize_path(path);
+    write_inode_table(writer);
     
-    if (!is_directory(normalized_path)) {
-        std::cerr << "[FILESYSTEM] Not a directory: " << normalized_path << std::endl;
-        return false;
+    // Allocated disk blocks only, read past the cache once it is written back
+    buffer_cache.sync(true);
+    std::vector<uint8_t> block_data(BLOCK_SIZE);
+    writer.write_u64(total_blocks);
+    writer.write_u64(total_blocks - block_bitmap.free_count());
+    for (size_t i = 0; i < total_blocks; i++) {
+        if (block_bitmap.test(i)) {
+            device->read_block(i, block_data.data());
+            writer.write_u64(i);
+            writer.write_bytes(block_data.data(), BLOCK_SIZE);
+        }
     }
+    writer.end_section();
     
-    if (normalized_path == "/") {
-        std::cerr << "[FILESYSTEM] Cannot delete root directory" << std::endl;
-        return false;
-    }
+    KLOG_INFO << "[FILESYSTEM] Saved " << inode_count << " inodes to snapshot";
+    return writer.good();
+}
+
+bool FileSystem::restore_snapshot(SnapshotReader& reader) {
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
     
-    // Check if directory is empty
-    if (!directory_contents[normalized_path].empty()) {
-        std::cerr << "[FILESYSTEM] Directory not empty: " << normalized_path << std::endl;
+    if (!reader.enter_section(SNAPSHOT_SECTION_FILESYSTEM)) {
+        KLOG_ERROR << "[FILESYSTEM] Snapshot has no filesystem section";
         return false;
     }
     
-    // Remove from parent directory
-    std::string parent_dir = get_parent_directory(normalized_path);
-    auto& parent_contents = directory_contents[parent_dir];
-    std::string dirname = get_filename(normalized_path);
+    std::string saved_directory = reader.read_string();
+    next_fd = reader.read_i32();
     
-    parent_contents.erase(
-        std::remove(parent_contents.begin(), parent_contents.end(), dirname),
-        parent_contents.end());
+    if (reader.read_bool()) {
+        if (!is_persistent() || !mount_locked()) {
+            KLOG_ERROR << "[FILESYSTEM] Snapshot needs its disk image";
+            return false;
+        }
+    } else {
+        if (!read_inode_table(reader)) {
+            return false;
+        }
+        
+        total_blocks = reader.read_u64();
+        uint64_t used_blocks = reader.read_u64();
+        buffer_cache.shutdown();
+        device.reset(new MemoryBlockDevice(total_blocks));
+        block_bitmap.reset(total_blocks);
+        std::vector<uint8_t> block_data(BLOCK_SIZE);
+        for (uint64_t i = 0; i < used_blocks && reader.good(); i++) {
+            uint64_t block = reader.read_u64();
+            if (block >= total_blocks) {
+                KLOG_ERROR << "[FILESYSTEM] Corrupt filesystem section in snapshot";
+                return false;
+            }
+            reader.read_bytes(block_data.data(), BLOCK_SIZE);
+            device->write_block(block, block_data.data());
+            block_bitmap.set_range(block, 1);
+        }
+        
+        if (!reader.good()) {
+            KLOG_ERROR << "[FILESYSTEM] Corrupt filesystem section in snapshot";
+            return false;
+        }
+        
+        // The superblock came along with the other allocated blocks
+        device->read_block(FS_SUPERBLOCK_BLOCK, block_data.data());
+        std::memcpy(&superblock, block_data.data(), sizeof(superblock));
+        rebuild_shared_extents();
+        
+        if (!buffer_cache.initialize(device.get())) {
+            return false;
+        }
+    }
     
-    // Remove directory data
-    directory_contents.erase(normalized_path);
-    file_attributes.erase(normalized_path);
+    current_directory = saved_directory;
+    Inode* cwd = walk_path(get_inode(ROOT_INODE), current_directory.data(), current_directory.size());
+    if (!cwd || cwd->attributes.type != FILE_TYPE_DIRECTORY) {
+        cwd = get_inode(ROOT_INODE);
+        current_directory = "/";
+    }
+    current_directory_inode = cwd->id;
     
-    std::cout << "[FILESYSTEM] Deleted directory: " << normalized_path << std::endl;
+    KLOG_INFO << "[FILESYSTEM] File system restored " << inode_count
+              << " inodes from snapshot";
     return true;
 }
 
-std::vector<DirectoryEntry> FileSystem::list_directory(const std::string& path) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
-    
-    std::vector<DirectoryEntry> entries;
-    std::string normalized_path = normalize_path(path);
+// Single pass: components are appended to the result and ".." truncates it
+std::string FileSystem::normalize_path(const std::string& path) {
+    if (path.empty()) return "/";
     
-    if (!is_directory(normalized_path)) {
-        std::cerr << "[FILESYSTEM] Not a directory: " << normalized_path << std::endl;
-        return entries;
+    std::string result;
+    if (!is_absolute_path(path)) {
+        std::lock_guard<std::mutex> lock(cwd_mutex);
+        if (current_directory != "/") {
+            result = current_directory;
+        }
     }
+    result.reserve(result.size() + path.size() + 1);
     
-    auto it = directory_contents.find(normalized_path);
-    if (it != directory_contents.end()) {
-        for (const std::string& name : it->second) {
-            std::string full_path = normalized_path == "/" ? "/" + name : normalized_path + "/" + name;
-            FileAttributes attr;
-            if (get_file_attributes(full_path, attr)) {
-                entries.emplace_back(name, attr, full_path);
-            }
+    size_t pos = 0;
+    while (pos < path.size()) {
+        if (path[pos] == '/') {
+            pos++;
+            continue;
+        }
+        
+        size_t end = path.find('/', pos);
+        if (end == std::string::npos) end = path.size();
+        size_t length = end - pos;
+        
+        if (length == 1 && path[pos] == '.') {
+            // Current directory
+        } else if (length == 2 && path[pos] == '.' && path[pos + 1] == '.') {
+            size_t last_slash = result.find_last_of('/');
+            result.resize(last_slash == std::string::npos ? 0 : last_slash);
+        } else {
+            result += '/';
+            result.append(path, pos, length);
         }
+        pos = end;
     }
     
-    return entries;
+    return result.empty() ? "/" : result;
 }
 
-bool FileSystem::change_directory(const std::string& path) {
-    std::string normalized_path = normalize_path(path);
+std::string FileSystem::get_parent_directory(const std::string& path) {
+    std::string normalized = normalize_path(path);
+    if (normalized == "/") return "/";
     
-    if (!is_directory(normalized_path)) {
-        std::cerr << "[FILESYSTEM] Not a directory: " << normalized_path << std::endl;
-        return false;
-    }
+    size_t last_slash = normalized.find_last_of('/');
+    if (last_slash == 0) return "/";
     
-    current_directory = normalized_path;
-    std::cout << "[FILESYSTEM] Changed directory to: " << current_directory << std::endl;
-    return true;
+    return normalized.substr(0, last_slash);
 }
 
-std::string FileSystem::get_current_directory() {
-    return current_directory;
+std::string FileSystem::get_filename(const std::string& path) {
+    std::string normalized = normalize_path(path);
+    if (normalized == "/") return "";
+    
+    size_t last_slash = normalized.find_last_of('/');
+    return normalized.substr(last_slash + 1);
 }
 
-std::string FileSystem::read_file(const std::string& path) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
-    
-    std::string normalized_path = normalize_path(path);
-    
-    if (!file_exists(normalized_path)) {
-        std::cerr << "[FILESYSTEM] File does not exist: " << normalized_path << std::endl;
-        return "";
-    }
-    
-    if (is_directory(normalized_path)) {
-        std::cerr << "[FILESYSTEM] Cannot read directory as file: " << normalized_path << std::endl;
-        return "";
+bool FileSystem::is_absolute_path(const std::string& path) {
+    return !path.empty() && path[0] == '/';
+}
+
+// "/" (empty), "." and ".." name a directory without being a link of their own
+static bool is_special_name(const char* name, size_t length) {
+    return length == 0 || (length == 1 && name[0] == '.') ||
+           (length == 2 && name[0] == '.' && name[1] == '.');
+}
+
+bool FileSystem::is_valid_filename(const std::string& filename) {
+    if (filename.empty() || filename.length() > MAX_FILENAME_LENGTH) {
+        return false;
     }
     
-    update_file_times(normalized_path, true, false);
-    
-    auto it = file_contents.find(normalized_path);
-    return (it != file_contents.end()) ? it->second : "";
+    // Check for invalid characters
+    const std::string invalid_chars = "\\/:*?\"<>|";
+    return filename.find_first_of(invalid_chars) == std::string::npos;
 }
 
-bool FileSystem::write_file(const std::string& path, const std::string& content) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
-    
-    std::string normalized_path = normalize_path(path);
-    
-    // Create file if it doesn't exist
-    if (!file_exists(normalized_path)) {
-        if (!create_file(normalized_path)) {
-            return false;
-        }
-    }
+bool FileSystem::create_file(const std::string& path) {
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    JournalHandle update(journal);
     
-    if (is_directory(normalized_path)) {
-        std::cerr << "[FILESYSTEM] Cannot write to directory: " << normalized_path << std::endl;
+    if (!create_directory_entry(path, FILE_TYPE_REGULAR)) {
         return false;
     }
     
-    file_contents[normalized_path] = content;
+    KLOG_DEBUG << "[FILESYSTEM] Created file: " << normalize_path(path);
+    return true;
+}
+
+bool FileSystem::delete_file(const std::string& path) {
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    JournalHandle update(journal);
     
-    // Update file attributes
-    auto it = file_attributes.find(normalized_path);
-    if (it != file_attributes.end()) {
-        it->second.size = content.length();
-        update_file_times(normalized_path, false, true);
+    if (!remove_directory_entry(path, false)) {
+        return false;
     }
     
-    std::cout << "[FILESYSTEM] Wrote " << content.length() << " bytes to: " << normalized_path << std::endl;
+    KLOG_DEBUG << "[FILESYSTEM] Deleted file: " << normalize_path(path);
     return true;
 }
 
-bool FileSystem::get_file_attributes(const std::string& path, FileAttributes& attr) {
+bool FileSystem::file_exists(const std::string& path) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    Inode* inode = lookup_path(path);
+    return inode && !inode->unlinked;
+}
+
+bool FileSystem::is_directory(const std::string& path) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    Inode* inode = lookup_path(path);
+    return inode && !inode->unlinked && inode->attributes.type == FILE_TYPE_DIRECTORY;
+}
+
+bool FileSystem::create_directory(const std::string& path) {
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    JournalHandle update(journal);
+    
+    if (!create_directory_entry(path, FILE_TYPE_DIRECTORY)) {
+        return false;
+    }
+    
+    KLOG_DEBUG << "[FILESYSTEM] Created directory: " << normalize_path(path);
+    return true;
+}
+
+bool FileSystem::delete_directory(const std::string& path) {
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    JournalHandle update(journal);
+    
+    if (!remove_directory_entry(path, true)) {
+        return false;
+    }
+    
+    KLOG_DEBUG << "[FILESYSTEM] Deleted directory: " << normalize_path(path);
+    return true;
+}
+
+std::vector<DirectoryEntry> FileSystem::list_directory(const std::string& path) {
+    uint64_t cursor = 0;
+    return list_directory(path, cursor, SIZE_MAX);
+}
+
+std::vector<DirectoryEntry> FileSystem::list_directory(const std::string& path, uint64_t& cursor, size_t max_entries) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    
+    std::vector<DirectoryEntry> entries;
     std::string normalized_path = normalize_path(path);
+    std::shared_lock<std::shared_mutex> directory_lock;
+    Inode* directory = lookup_locked(path, directory_lock);
+    
+    if (!directory || directory->attributes.type != FILE_TYPE_DIRECTORY) {
+        KLOG_ERROR << "[FILESYSTEM] Not a directory: " << normalized_path;
+        return entries;
+    }
+    
+    std::string prefix = normalized_path == "/" ? "/" : normalized_path + "/";
+    entries.reserve(std::min(directory->children.size(), max_entries));
+    while (entries.size() < max_entries) {
+        const DirectoryLink* link = directory->children.next(cursor);
+        if (!link) break;
+        
+        Inode* child = get_inode(link->inode);
+        if (child) {
+            std::shared_lock<std::shared_mutex> child_lock(child->lock);
+            entries.emplace_back(link->name, get_attributes(child), prefix + link->name);
+        }
+    }
+    
+    return entries;
+}
+
+bool FileSystem::change_directory(const std::string& path) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    std::string normalized_path = normalize_path(path);
+    
+    // Held until it is the working directory, so it cannot be deleted first
+    std::shared_lock<std::shared_mutex> directory_lock;
+    Inode* inode = lookup_locked(path, directory_lock);
+    
+    if (!inode || inode->attributes.type != FILE_TYPE_DIRECTORY) {
+        KLOG_ERROR << "[FILESYSTEM] Not a directory: " << normalized_path;
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> cwd_lock(cwd_mutex);
+    current_directory = normalized_path;
+    current_directory_inode = inode->id;
+    KLOG_DEBUG << "[FILESYSTEM] Changed directory to: " << current_directory;
+    return true;
+}
+
+std::string FileSystem::get_current_directory() {
+    std::lock_guard<std::mutex> lock(cwd_mutex);
+    return current_directory;
+}
+
+std::string FileSystem::read_file(const std::string& path) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    TraceScope trace(TRACE_FS_READ);
+    
+    std::shared_lock<std::shared_mutex> inode_lock;
+    Inode* inode = lookup_readable(path, inode_lock);
+    if (!inode) {
+        return "";
+    }
+    
+    std::string content(inode->attributes.size, '\0');
+    read_file_data(inode, 0, content.size(), reinterpret_cast<uint8_t*>(&content[0]));
+    trace.result = content.size();
+    return content;
+}
+
+FileBuffer FileSystem::read_file_buffer(const std::string& path) {
+    return read_file_buffer(path, 0, SIZE_MAX);
+}
+
+// Only the blocks in the range are touched, and copied once
+FileBuffer FileSystem::read_file_buffer(const std::string& path, size_t offset, size_t length) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    TraceScope trace(TRACE_FS_READ, offset);
+    
+    std::shared_lock<std::shared_mutex> inode_lock;
+    Inode* inode = lookup_readable(path, inode_lock);
+    if (!inode) {
+        return FileBuffer();
+    }
+    
+    size_t size = inode->attributes.size;
+    offset = std::min(offset, size);
+    length = std::min(length, size - offset);
+    std::shared_ptr<char> bytes(new char[std::max<size_t>(length, 1)], std::default_delete<char[]>());
+    read_file_data(inode, offset, length, reinterpret_cast<uint8_t*>(bytes.get()));
+    trace.result = length;
+    return FileBuffer(std::move(bytes), length);
+}
+
+// A regular file at path, locked shared for reading, with its access time
+// updated. Callers hold fs_lock and are in an RCU read section.
+Inode* FileSystem::lookup_readable(const std::string& path, std::shared_lock<std::shared_mutex>& lock) {
+    Inode* inode = lookup_locked(path, lock);
+    
+    if (!inode) {
+        KLOG_ERROR << "[FILESYSTEM] File does not exist: " << normalize_path(path);
+        return nullptr;
+    }
+    
+    if (inode->attributes.type == FILE_TYPE_DIRECTORY) {
+        KLOG_ERROR << "[FILESYSTEM] Cannot read directory as file: " << normalize_path(path);
+        return nullptr;
+    }
+    
+    update_file_times(inode, true, false);
+    return inode;
+}
+
+int FileSystem::open_file(const std::string& path, int flags) {
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    JournalHandle update(journal);
+    
+    Inode* inode = lookup_path(path);
+    if (!inode && (flags & FS_OPEN_CREATE)) {
+        inode = create_directory_entry(path, FILE_TYPE_REGULAR, true);
+    }
+    if (!inode) {
+        KLOG_ERROR << "[FILESYSTEM] File does not exist: " << normalize_path(path);
+        return -1;
+    }
+    if (inode->attributes.type == FILE_TYPE_DIRECTORY) {
+        KLOG_ERROR << "[FILESYSTEM] Cannot open directory as file: " << normalize_path(path);
+        return -1;
+    }
+    
+    std::lock_guard<std::mutex> files_lock(files_mutex);
+    FileHandle handle;
+    handle.fd = next_fd++;
+    handle.path = normalize_path(path);
+    handle.inode = inode->id;
+    handle.flags = flags;
+    handle.is_open = true;
+    open_files.push_back(handle);
+    
+    KLOG_DEBUG << "[FILESYSTEM] Opened " << handle.path << " as fd " << handle.fd;
+    return handle.fd;
+}
+
+bool FileSystem::close_file(int fd) {
+    std::lock_guard<std::mutex> files_lock(files_mutex);
+    for (auto it = open_files.begin(); it != open_files.end(); ++it) {
+        if (it->fd == fd) {
+            open_files.erase(it);
+            return true;
+        }
+    }
+    KLOG_ERROR << "[FILESYSTEM] Bad file descriptor: " << fd;
+    return false;
+}
+
+ssize_t FileSystem::read_file_fd(int fd, void* buffer, size_t count) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    TraceScope trace(TRACE_FS_READ, count);
+    
+    // The inode is not reused before the RCU section ends
+    InodeId id = INVALID_INODE;
+    {
+        std::lock_guard<std::mutex> files_lock(files_mutex);
+        FileHandle* handle = find_open_file(fd);
+        if (handle) {
+            id = handle->inode;
+        }
+    }
+    Inode* inode = get_inode(id);
+    if (!inode) {
+        KLOG_ERROR << "[FILESYSTEM] Bad file descriptor: " << fd;
+        return -1;
+    }
+    
+    std::shared_lock<std::shared_mutex> inode_lock(inode->lock);
+    if (inode->unlinked) {
+        KLOG_ERROR << "[FILESYSTEM] File behind fd " << fd << " was deleted";
+        return -1;
+    }
+    
+    size_t size = inode->attributes.size;
+    size_t offset;
+    size_t length;
+    {
+        std::lock_guard<std::mutex> files_lock(files_mutex);
+        FileHandle* handle = find_open_file(fd);
+        if (!handle) {
+            return -1;
+        }
+        offset = std::min(handle->position, size);
+        length = std::min(count, size - offset);
+        handle->position = offset + length;
+        read_ahead(inode, handle->readahead, offset, length);
+    }
+    
+    read_file_data(inode, offset, length, static_cast<uint8_t*>(buffer));
+    update_file_times(inode, true, false);
+    trace.result = length;
+    return static_cast<ssize_t>(length);
+}
+
+ssize_t FileSystem::write_file_fd(int fd, const void* buffer, size_t count) {
+    reclaim_pending_space(size_after_write(fd, count));
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    TraceScope trace(TRACE_FS_WRITE, count);
+    JournalHandle update(journal);
+    
+    InodeId id = INVALID_INODE;
+    {
+        std::lock_guard<std::mutex> files_lock(files_mutex);
+        FileHandle* handle = find_open_file(fd);
+        if (handle) {
+            id = handle->inode;
+        }
+    }
+    Inode* inode = get_inode(id);
+    if (!inode) {
+        KLOG_ERROR << "[FILESYSTEM] Bad file descriptor: " << fd;
+        return -1;
+    }
+    
+    std::unique_lock<std::shared_mutex> inode_lock(inode->lock);
+    if (inode->unlinked) {
+        KLOG_ERROR << "[FILESYSTEM] File behind fd " << fd << " was deleted";
+        return -1;
+    }
+    
+    size_t position;
+    {
+        std::lock_guard<std::mutex> files_lock(files_mutex);
+        FileHandle* handle = find_open_file(fd);
+        if (!handle) {
+            return -1;
+        }
+        position = handle->position;
+    }
+    
+    if (!write_inode_range(inode, position, static_cast<const uint8_t*>(buffer), count)) {
+        KLOG_ERROR << "[FILESYSTEM] No space left for " << count << " bytes on fd " << fd;
+        return -1;
+    }
+    
+    std::lock_guard<std::mutex> files_lock(files_mutex);
+    FileHandle* handle = find_open_file(fd);
+    if (handle) {
+        handle->position = position + count;
+    }
+    trace.result = count;
+    return static_cast<ssize_t>(count);
+}
+
+// The file may have to be rewritten whole, so space is reclaimed for all
+// of it; the size is only a hint, taken before the write locks anything
+size_t FileSystem::size_after_write(int fd, size_t count) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    
+    InodeId id = INVALID_INODE;
+    size_t position = 0;
+    {
+        std::lock_guard<std::mutex> files_lock(files_mutex);
+        FileHandle* handle = find_open_file(fd);
+        if (handle) {
+            id = handle->inode;
+            position = handle->position;
+        }
+    }
+    Inode* inode = get_inode(id);
+    if (!inode) {
+        return count;
+    }
+    std::shared_lock<std::shared_mutex> inode_lock(inode->lock);
+    return std::max<size_t>(inode->attributes.size, position + count);
+}
+
+FileHandle* FileSystem::find_open_file(int fd) {
+    for (auto& handle : open_files) {
+        if (handle.fd == fd) {
+            return &handle;
+        }
+    }
+    return nullptr;
+}
+
+void FileSystem::read_ahead(Inode* inode, ReadAhead& state, size_t offset, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    
+    uint64_t first = offset / BLOCK_SIZE;
+    uint64_t last = (offset + length - 1) / BLOCK_SIZE;
+    uint64_t file_blocks = (inode->attributes.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    
+    // Carrying on from the last read, possibly in the same block
+    bool sequential = first == state.next_block || first + 1 == state.next_block;
+    state.next_block = last + 1;
+    
+    if (!sequential) {
+        state.window_blocks = 0;
+        return;
+    }
+    
+    uint64_t start;
+    uint64_t blocks;
+    if (state.window_blocks == 0) {
+        start = last + 1;
+        blocks = std::max<uint64_t>(FS_READAHEAD_MIN_BLOCKS, 2 * (last - first + 1));
+    } else if (last >= state.window_start) {
+        // Into the window read ahead last time: on to the next one
+        start = std::max(state.window_start + state.window_blocks, last + 1);
+        blocks = state.window_blocks * 2;
+    } else {
+        return;
+    }
+    
+    blocks = std::min<uint64_t>(blocks, FS_READAHEAD_MAX_BLOCKS);
+    state.window_start = start;
+    state.window_blocks = blocks;
+    
+    // Queued in runs of contiguous disk blocks; holes have nothing to read
+    uint64_t end = std::min(start + blocks, file_blocks);
+    uint64_t run_start = 0;
+    uint64_t run_length = 0;
+    for (uint64_t block = start; block < end; block++) {
+        uint32_t physical;
+        if (!inode->extents.lookup(static_cast<uint32_t>(block), physical)) {
+            continue;
+        }
+        if (run_length > 0 && physical == run_start + run_length) {
+            run_length++;
+            continue;
+        }
+        if (run_length > 0) {
+            buffer_cache.prefetch(run_start, run_length);
+        }
+        run_start = physical;
+        run_length = 1;
+    }
+    if (run_length > 0) {
+        buffer_cache.prefetch(run_start, run_length);
+    }
+}
+
+bool FileSystem::write_file(const std::string& path, const std::string& content) {
+    return write_file_bytes(path, reinterpret_cast<const uint8_t*>(content.data()), content.size());
+}
+
+bool FileSystem::write_file(const std::string& path, const FileBuffer& content) {
+    return write_file_bytes(path, reinterpret_cast<const uint8_t*>(content.data()), content.size());
+}
+
+bool FileSystem::write_file_bytes(const std::string& path, const uint8_t* data, size_t size) {
+    reclaim_pending_space(size);
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    TraceScope trace(TRACE_FS_WRITE, size);
+    JournalHandle update(journal);
+    
+    // Create file if it doesn't exist. Only the file stays locked while the
+    // data is written; one deleted before it is locked is looked up again.
+    std::unique_lock<std::shared_mutex> inode_lock;
+    Inode* inode = nullptr;
+    while (!inode) {
+        inode = lookup_path(path);
+        if (!inode) {
+            inode = create_directory_entry(path, FILE_TYPE_REGULAR, true);
+            if (!inode) {
+                return false;
+            }
+        }
+        inode_lock = std::unique_lock<std::shared_mutex>(inode->lock);
+        if (inode->unlinked) {
+            inode_lock.unlock();
+            inode = nullptr;
+        }
+    }
+    
+    if (inode->attributes.type == FILE_TYPE_DIRECTORY) {
+        KLOG_ERROR << "[FILESYSTEM] Cannot write to directory: " << normalize_path(path);
+        return false;
+    }
+    
+    if (!write_inode_data(inode, data, size)) {
+        KLOG_ERROR << "[FILESYSTEM] No space left for " << size
+                   << " bytes: " << normalize_path(path);
+        return false;
+    }
+    
+    KLOG_DEBUG << "[FILESYSTEM] Wrote " << size << " bytes to: " << normalize_path(path);
+    return true;
+}
+
+bool FileSystem::get_file_attributes(const std::string& path, FileAttributes& attr) {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    std::shared_lock<std::shared_mutex> inode_lock;
+    Inode* inode = lookup_locked(path, inode_lock);
+    if (inode) {
+        attr = get_attributes(inode);
+        return true;
+    }
+    return false;
+}
+
+bool FileSystem::set_file_attributes(const std::string& path, const FileAttributes& attr) {
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    JournalHandle update(journal);
+    
+    std::unique_lock<std::shared_mutex> inode_lock;
+    Inode* inode = lookup_locked(path, inode_lock);
+    if (!inode) {
+        return false;
+    }
+    
+    // Type and size describe the data on disk and are not settable
+    FileAttributes& current = inode->attributes;
+    current.creation_time = attr.creation_time;
+    current.modification_time = attr.modification_time;
+    current.permissions = attr.permissions;
+    current.owner_id = attr.owner_id;
+    current.group_id = attr.group_id;
+    inode->accessed = attr.access_time;
+    journal_inode(inode);
+    return true;
+}
+
+size_t FileSystem::get_file_size(const std::string& path) {
+    FileAttributes attr;
+    if (get_file_attributes(path, attr)) {
+        return attr.size;
+    }
+    return 0;
+}
+
+bool FileSystem::copy_file(const std::string& src, const std::string& dest, bool reflink) {
+    if (!reflink) {
+        FileBuffer content = read_file_buffer(src);
+        if (!content.valid()) {
+            return false;
+        }
+        return write_file(dest, content);
+    }
+    
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    RcuReadGuard rcu;
+    TraceScope trace(TRACE_FS_WRITE);
+    JournalHandle update(journal);
+    
+    // The source's blocks gain a reference before its lock is dropped, so
+    // they stay allocated whatever happens to it next
+    ExtentTree extents;
+    std::string inline_data;
+    uint64_t size;
+    {
+        std::shared_lock<std::shared_mutex> source_lock;
+        Inode* source = lookup_readable(src, source_lock);
+        if (!source) {
+            return false;
+        }
+        extents = source->extents;
+        inline_data = source->inline_data;
+        size = source->attributes.size;
+        
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        for (const auto& entry : extents.get_extents()) {
+            shared_extents.add(entry.second);
+        }
+    }
+    
+    std::unique_lock<std::shared_mutex> dest_lock;
+    Inode* inode = nullptr;
+    while (!inode) {
+        inode = lookup_path(dest);
+        if (!inode) {
+            inode = create_directory_entry(dest, FILE_TYPE_REGULAR, true);
+            if (!inode) {
+                break;
+            }
+        }
+        dest_lock = std::unique_lock<std::shared_mutex>(inode->lock);
+        if (inode->unlinked) {
+            dest_lock.unlock();
+            inode = nullptr;
+        }
+    }
+    
+    if (!inode || inode->attributes.type == FILE_TYPE_DIRECTORY) {
+        if (inode) {
+            KLOG_ERROR << "[FILESYSTEM] Cannot write to directory: " << normalize_path(dest);
+        }
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        free_file_blocks(extents);
+        return false;
+    }
+    
+    {
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        free_file_blocks(inode->extents);
+    }
+    inode->extents = extents;
+    inode->inline_data = inline_data;
+    inode->attributes.size = size;
+    update_file_times(inode, false, true);
+    journal_inode(inode);
+    
+    trace.result = size;
+    KLOG_DEBUG << "[FILESYSTEM] Reflinked " << normalize_path(src) << " to " << normalize_path(dest)
+               << " (" << extents.extent_count() << " extents)";
+    return true;
+}
+
+// Relinks the inode under its new name; no data is copied, and a directory
+// moves with everything below it. Moves are serialized by rename_mutex, so
+// the shape of the directory tree never changes under another move.
+bool FileSystem::move_file(const std::string& src, const std::string& dest) {
+    checkpoint_if_needed();
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    std::lock_guard<std::mutex> rename_lock(rename_mutex);
+    RcuReadGuard rcu;
+    JournalHandle update(journal);
+    
+    const char* src_name;
+    size_t src_length;
+    Inode* src_parent = lookup_parent(src, src_name, src_length);
+    if (!src_parent) {
+        KLOG_ERROR << "[FILESYSTEM] File does not exist: " << normalize_path(src);
+        return false;
+    }
+    
+    const char* dest_name;
+    size_t dest_length;
+    Inode* dest_parent = lookup_parent(dest, dest_name, dest_length);
+    if (!dest_parent) {
+        KLOG_ERROR << "[FILESYSTEM] Parent directory does not exist: "
+                   << get_parent_directory(normalize_path(dest));
+        return false;
+    }
+    std::string new_name(dest_name, dest_length);
+    if (!is_valid_filename(new_name) || new_name == "." || new_name == "..") {
+        KLOG_ERROR << "[FILESYSTEM] Invalid file name: " << new_name;
+        return false;
+    }
+    
+    // Keep the working directory path valid if it moves along
+    std::string src_path = normalize_path(src);
+    std::string dest_path = normalize_path(dest);
+    
+    // Both parents, an ancestor before its descendant. Only moves lock two
+    // directories that are not parent and child, and they are serialized.
+    Inode* first = is_ancestor(dest_parent, src_parent) ? dest_parent : src_parent;
+    Inode* second = first == src_parent ? dest_parent : src_parent;
+    std::unique_lock<std::shared_mutex> first_lock(first->lock);
+    std::unique_lock<std::shared_mutex> second_lock;
+    if (second != first) {
+        second_lock = std::unique_lock<std::shared_mutex>(second->lock);
+    }
+    
+    Inode* inode = src_parent->unlinked ? nullptr : find_child(src_parent, src_name, src_length);
+    if (!inode) {
+        KLOG_ERROR << "[FILESYSTEM] File does not exist: " << src_path;
+        return false;
+    }
+    if (dest_parent->unlinked) {
+        KLOG_ERROR << "[FILESYSTEM] Parent directory does not exist: " << get_parent_directory(dest_path);
+        return false;
+    }
+    
+    // A directory cannot move below itself
+    bool is_dir = inode->attributes.type == FILE_TYPE_DIRECTORY;
+    if (is_dir && is_ancestor(inode, dest_parent)) {
+        KLOG_ERROR << "[FILESYSTEM] Cannot move directory into itself: " << src_path;
+        return false;
+    }
+    
+    // An existing regular file at the destination is replaced
+    Inode* existing = find_child(dest_parent, dest_name, dest_length);
+    if (existing == inode) {
+        return true;
+    }
+    if (existing && (is_dir || existing->attributes.type == FILE_TYPE_DIRECTORY)) {
+        KLOG_ERROR << "[FILESYSTEM] Destination already exists: " << dest_path;
+        return false;
+    }
+    
+    std::shared_lock<std::shared_mutex> inode_lock(inode->lock);
+    if (existing) {
+        std::unique_lock<std::shared_mutex> existing_lock(existing->lock);
+        unlink_child(dest_parent, new_name);
+        existing->unlinked = true;
+        free_inode(existing);
+    }
+    
+    unlink_child(src_parent, std::string(src_name, src_length));
+    link_child(dest_parent, new_name, inode);
+    if (is_dir) {
+        inode->parent = dest_parent->id;
+        journal_inode(inode);
+        
+        std::lock_guard<std::mutex> cwd_lock(cwd_mutex);
+        if (current_directory == src_path ||
+            current_directory.compare(0, src_path.size() + 1, src_path + "/") == 0) {
+            current_directory = dest_path + current_directory.substr(src_path.size());
+        }
+    }
+    
+    KLOG_DEBUG << "[FILESYSTEM] Moved " << src_path << " to " << dest_path;
+    return true;
+}
+
+bool FileSystem::rename_file(const std::string& old_name, const std::string& new_name) {
+    return move_file(old_name, new_name);
+}
+
+size_t FileSystem::get_total_space() {
+    return total_blocks * BLOCK_SIZE;
+}
+
+size_t FileSystem::get_free_space() {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    return block_bitmap.free_count() * BLOCK_SIZE;
+}
+
+size_t FileSystem::get_used_space() {
+    return get_total_space() - get_free_space();
+}
+
+Inode* FileSystem::get_inode(InodeId id) {
+    return inode_table.get(id);
+}
+
+Inode* FileSystem::allocate_inode(FileType type) {
+    Inode* inode = new Inode();
+    inode->attributes.type = type;
+    inode->attributes.size = 0;
+    
+    uint64_t current_time = sim_now_ms() / 1000;
+    
+    inode->attributes.creation_time = current_time;
+    inode->attributes.modification_time = current_time;
+    inode->attributes.access_time = current_time;
+    inode->attributes.permissions = PERM_READ | PERM_WRITE;
+    inode->attributes.owner_id = 0;
+    inode->attributes.group_id = 0;
+    inode->accessed = current_time;
+    
+    {
+        std::lock_guard<std::mutex> lock(table_mutex);
+        inode->id = free_inodes.empty() ? static_cast<InodeId>(inode_table.size()) : free_inodes.back();
+        if (!inode_table.set(inode->id, inode)) {
+            delete inode;
+            return nullptr;
+        }
+        if (!free_inodes.empty()) {
+            free_inodes.pop_back();
+        }
+        inode_count++;
+    }
+    TRACE_EVENT(TRACE_FS_CREATE, type, inode->id);
+    return inode;
+}
+
+void FileSystem::free_inode(Inode* inode) {
+    InodeId id = inode->id;
+    {
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+        free_file_blocks(inode->extents);
+    }
+    journal_free(id);
+    {
+        std::lock_guard<std::mutex> lock(table_mutex);
+        inode_table.take(id);
+        inode_count--;
+    }
+    {
+        // Open descriptors do not keep the file
+        std::lock_guard<std::mutex> lock(files_mutex);
+        for (auto& handle : open_files) {
+            if (handle.inode == id) {
+                handle.inode = INVALID_INODE;
+            }
+        }
+    }
+    
+    // Lookups that found it before it was unlinked may still be looking at
+    // it; the number is only reused once they are done
+    rcu_retire([this, inode, id]() {
+        delete inode;
+        std::lock_guard<std::mutex> lock(table_mutex);
+        free_inodes.push_back(id);
+    });
+}
+
+FileAttributes FileSystem::get_attributes(Inode* inode) {
+    FileAttributes attr = inode->attributes;
+    attr.access_time = inode->accessed.load(std::memory_order_relaxed);
+    return attr;
+}
+
+Inode* FileSystem::find_child(Inode* directory, const char* name, size_t length) {
+    const DirectoryLink* link = directory->children.find(name, length);
+    return link ? get_inode(link->inode) : nullptr;
+}
+
+Inode* FileSystem::lookup_child(Inode* directory, const char* name, size_t length) {
+    InodeId cached;
+    if (dentry_cache.lookup(directory->id, name, length, cached)) {
+        return cached != INVALID_INODE ? get_inode(cached) : nullptr;
+    }
+    
+    // Links and unlinks hold the directory exclusive, so none can land
+    // between the search and filling in the cache
+    std::shared_lock<std::shared_mutex> lock(directory->lock);
+    const DirectoryLink* link = directory->children.find(name, length);
+    InodeId found = link ? link->inode : INVALID_INODE;
+    
+    // Misses are cached too, so repeated existence checks stay cheap
+    dentry_cache.insert(directory->id, name, length, found);
+    return found != INVALID_INODE ? get_inode(found) : nullptr;
+}
+
+// Walks one component at a time without building any strings; "." and ".."
+// follow the directory links
+Inode* FileSystem::walk_path(Inode* start, const char* path, size_t length) {
+    Inode* inode = start;
+    size_t pos = 0;
+    
+    while (inode && pos < length) {
+        if (path[pos] == '/') {
+            pos++;
+            continue;
+        }
+        
+        size_t end = pos;
+        while (end < length && path[end] != '/') end++;
+        
+        if (inode->attributes.type != FILE_TYPE_DIRECTORY) {
+            return nullptr;
+        }
+        
+        size_t component = end - pos;
+        if (component == 1 && path[pos] == '.') {
+            // Stay
+        } else if (component == 2 && path[pos] == '.' && path[pos + 1] == '.') {
+            inode = get_inode(inode->parent);
+        } else {
+            inode = lookup_child(inode, path + pos, component);
+        }
+        pos = end;
+    }
+    return inode;
+}
+
+Inode* FileSystem::lookup_path(const std::string& path) {
+    if (path.empty()) {
+        return get_inode(ROOT_INODE);
+    }
+    
+    Inode* start = get_inode(is_absolute_path(path) ? ROOT_INODE : current_directory_inode.load());
+    return walk_path(start, path.data(), path.size());
+}
+
+// Resolves the directory holding the last component; name and length point
+// into path. Returns nullptr if that directory does not exist.
+Inode* FileSystem::lookup_parent(const std::string& path, const char*& name, size_t& length) {
+    size_t end = path.size();
+    while (end > 0 && path[end - 1] == '/') end--;
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') start--;
+    
+    name = path.data() + start;
+    length = end - start;
+    
+    Inode* parent = get_inode(is_absolute_path(path) ? ROOT_INODE : current_directory_inode.load());
+    parent = walk_path(parent, path.data(), start);
+    if (!parent || parent->attributes.type != FILE_TYPE_DIRECTORY) {
+        return nullptr;
+    }
+    return parent;
+}
+
+// Resolves path and locks its inode. A lookup that raced with a delete is
+// retried and finds the name gone or taken by a new file.
+template <typename Lock>
+Inode* FileSystem::lookup_locked(const std::string& path, Lock& lock) {
+    for (;;) {
+        Inode* inode = lookup_path(path);
+        if (!inode) {
+            return nullptr;
+        }
+        lock = Lock(inode->lock);
+        if (!inode->unlinked) {
+            return inode;
+        }
+        lock.unlock();
+    }
+}
+
+// True if ancestor is inode or a directory above it; directories only
+// change parents under rename_mutex
+bool FileSystem::is_ancestor(Inode* ancestor, Inode* inode) {
+    while (inode) {
+        if (inode == ancestor) return true;
+        if (inode->id == ROOT_INODE) return false;
+        inode = get_inode(inode->parent);
+    }
+    return false;
+}
+
+void FileSystem::link_child(Inode* directory, const std::string& name, Inode* child) {
+    directory->children.insert(name, child->id);
+    dentry_cache.insert(directory->id, name.data(), name.size(), child->id);
+    journal_link(directory, name, child->id);
+}
+
+bool FileSystem::unlink_child(Inode* directory, const std::string& name) {
+    if (!directory->children.erase(name.data(), name.size())) {
+        return false;
+    }
+    dentry_cache.insert(directory->id, name.data(), name.size(), INVALID_INODE);
+    journal_unlink(directory, name);
+    return true;
+}
+
+// A full log is checkpointed first, between operations, so the change
+// has room. Operations call this before taking fs_lock.
+void FileSystem::checkpoint_if_needed() {
+    {
+        std::shared_lock<std::shared_mutex> lock(fs_lock);
+        if (!journal.active() || !journal.needs_checkpoint()) return;
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(fs_lock);
+    if (journal.active() && journal.needs_checkpoint()) {
+        write_checkpoint(false);
+    }
+}
+
+// Blocks freed by changes that have not committed yet come back with the
+// commit, so a write that needs them waits for it first
+void FileSystem::reclaim_pending_space(size_t bytes) {
+    uint64_t needed = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    {
+        std::shared_lock<std::shared_mutex> lock(fs_lock);
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        release_committed_blocks();
+        if (pending_frees.empty() || needed <= block_bitmap.free_count()) return;
+    }
+    sync();
+}
+
+void FileSystem::journal_inode(const Inode* inode) {
+    if (!journal.active()) return;
+    
+    MemoryWriter record;
+    record.write_u8(JOURNAL_RECORD_INODE);
+    write_inode_fields(record, *inode);
+    journal.append(record);
+}
+
+void FileSystem::journal_link(const Inode* directory, const std::string& name, InodeId child) {
+    if (!journal.active()) return;
+    
+    MemoryWriter record;
+    record.write_u8(JOURNAL_RECORD_LINK);
+    record.write_u32(directory->id);
+    record.write_string(name);
+    record.write_u32(child);
+    journal.append(record);
+}
+
+void FileSystem::journal_unlink(const Inode* directory, const std::string& name) {
+    if (!journal.active()) return;
+    
+    MemoryWriter record;
+    record.write_u8(JOURNAL_RECORD_UNLINK);
+    record.write_u32(directory->id);
+    record.write_string(name);
+    journal.append(record);
+}
+
+void FileSystem::journal_free(InodeId id) {
+    if (!journal.active()) return;
+    
+    MemoryWriter record;
+    record.write_u8(JOURNAL_RECORD_FREE);
+    record.write_u32(id);
+    journal.append(record);
+}
+
+// Until the change that freed them commits, the metadata on disk may still
+// point to pending blocks, so they cannot be handed out again. Callers hold
+// alloc_mutex.
+void FileSystem::release_committed_blocks() {
+    if (pending_frees.empty()) return;
+    
+    uint64_t committed = journal.get_committed_sequence();
+    size_t released = 0;
+    while (released < pending_frees.size() && pending_frees[released].first <= committed) {
+        const Extent& extent = pending_frees[released].second;
+        block_bitmap.clear_range(extent.start_block, extent.block_count);
+        released++;
+    }
+    pending_frees.erase(pending_frees.begin(), pending_frees.begin() + released);
+}
+
+Inode* FileSystem::create_directory_entry(const std::string& path, FileType type, bool open_existing) {
+    const char* name;
+    size_t length;
+    Inode* parent = lookup_parent(path, name, length);
+    if (!parent) {
+        KLOG_ERROR << "[FILESYSTEM] Parent directory does not exist: "
+                   << get_parent_directory(normalize_path(path));
+        return nullptr;
+    }
+    
+    std::unique_lock<std::shared_mutex> parent_lock(parent->lock);
+    if (parent->unlinked) {
+        KLOG_ERROR << "[FILESYSTEM] Parent directory does not exist: "
+                   << get_parent_directory(normalize_path(path));
+        return nullptr;
+    }
+    
+    // "/", "." and ".." always name an existing directory
+    Inode* existing = is_special_name(name, length) ? parent : find_child(parent, name, length);
+    if (existing) {
+        if (open_existing) {
+            return existing;
+        }
+        KLOG_ERROR << "[FILESYSTEM] File already exists: " << normalize_path(path);
+        return nullptr;
+    }
+    
+    Inode* inode = allocate_inode(type);
+    if (!inode) {
+        KLOG_ERROR << "[FILESYSTEM] No free inodes for " << normalize_path(path);
+        return nullptr;
+    }
+    if (type == FILE_TYPE_DIRECTORY) {
+        inode->parent = parent->id;
+    }
+    journal_inode(inode);
+    link_child(parent, std::string(name, length), inode);
+    return inode;
+}
+
+bool FileSystem::remove_directory_entry(const std::string& path, bool directory) {
+    const char* name;
+    size_t length;
+    Inode* parent = lookup_parent(path, name, length);
+    if (parent && is_special_name(name, length)) {
+        if (length == 0) {
+            KLOG_ERROR << "[FILESYSTEM] Cannot delete root directory";
+        } else {
+            KLOG_ERROR << "[FILESYSTEM] Invalid file name: " << std::string(name, length);
+        }
+        return false;
+    }
+    
+    std::unique_lock<std::shared_mutex> parent_lock;
+    Inode* inode = nullptr;
+    if (parent) {
+        parent_lock = std::unique_lock<std::shared_mutex>(parent->lock);
+        inode = parent->unlinked ? nullptr : find_child(parent, name, length);
+    }
+    if (!inode) {
+        KLOG_ERROR << "[FILESYSTEM] " << (directory ? "Not a directory: " : "File does not exist: ")
+                   << normalize_path(path);
+        return false;
+    }
+    
+    std::unique_lock<std::shared_mutex> inode_lock(inode->lock);
+    bool is_dir = inode->attributes.type == FILE_TYPE_DIRECTORY;
+    if (is_dir != directory) {
+        KLOG_ERROR << "[FILESYSTEM] " << (directory ? "Not a directory: " : "Cannot delete directory with delete_file: ")
+                   << normalize_path(path);
+        return false;
+    }
+    
+    if (is_dir) {
+        // Check if directory is empty
+        if (!inode->children.empty()) {
+            KLOG_ERROR << "[FILESYSTEM] Directory not empty: " << normalize_path(path);
+            return false;
+        }
+        
+        // The inode number is about to be reused
+        std::lock_guard<std::mutex> cwd_lock(cwd_mutex);
+        if (inode->id == current_directory_inode) {
+            current_directory = "/";
+            current_directory_inode = ROOT_INODE;
+        }
+    }
+    
+    unlink_child(parent, std::string(name, length));
+    inode->unlinked = true;
+    free_inode(inode);
+    return true;
+}
+
+// Small files are kept inline and take no blocks. A file that grows past
+// FS_INLINE_DATA_MAX moves to extents, and back when it shrinks.
+bool FileSystem::write_inode_data(Inode* inode, const uint8_t* data, size_t size) {
+    if (size <= FS_INLINE_DATA_MAX) {
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+        free_file_blocks(inode->extents);
+        inode->inline_data.assign(reinterpret_cast<const char*>(data), size);
+    } else if (write_file_data(inode->extents, data, size)) {
+        inode->inline_data = std::string();
+    } else {
+        return false;
+    }
+    inode->attributes.size = size;
+    update_file_times(inode, false, true);
+    journal_inode(inode);
+    return true;
+}
+
+// Writes count bytes at offset. Only the blocks the write touches are
+// rewritten, copy-on-write: they go to new blocks that are swapped into the
+// file, so blocks shared with other files are left alone and, with a
+// journal, the old data stays until the change commits. Blocks a write past
+// the end skips stay holes. With compression on, or in a file holding
+// compressed clusters, whole clusters are rewritten instead, each
+// recompressed like write_file_data() would. Inline files are rewritten
+// whole.
+bool FileSystem::write_inode_range(Inode* inode, size_t offset, const uint8_t* data, size_t count) {
+    size_t size = inode->attributes.size;
+    size_t new_size = std::max(size, offset + count);
+    ExtentTree& tree = inode->extents;
+    if (new_size <= FS_INLINE_DATA_MAX || !inode->inline_data.empty()) {
+        std::vector<uint8_t> content(new_size);
+        read_file_data(inode, 0, size, content.data());
+        Bootloader::memcpy_boot(content.data() + offset, data, count);
+        return write_inode_data(inode, content.data(), content.size());
+    }
+    
+    if (count > 0) {
+        bool clusters = compression || !tree.get_compressed().empty();
+        uint32_t unit = clusters ? FS_CLUSTER_BLOCKS : 1;
+        size_t unit_bytes = static_cast<size_t>(unit) * BLOCK_SIZE;
+        uint32_t first = static_cast<uint32_t>(offset / unit_bytes);
+        uint32_t units = static_cast<uint32_t>((offset + count - 1) / unit_bytes) - first + 1;
+        
+        // Units written in part keep the rest of their data
+        size_t staged_start = static_cast<size_t>(first) * unit_bytes;
+        size_t staged_end = std::min(staged_start + static_cast<size_t>(units) * unit_bytes,
+                                     (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+        std::vector<uint8_t> staged(staged_end - staged_start, 0);
+        if (staged_start < std::min(offset, size)) {
+            read_file_data(inode, staged_start, std::min(offset, size) - staged_start, staged.data());
+        }
+        size_t tail_start = offset + count;
+        size_t tail_end = std::min(staged_end, size);
+        if (tail_start < tail_end) {
+            read_file_data(inode, tail_start, tail_end - tail_start, staged.data() + (tail_start - staged_start));
+        }
+        Bootloader::memcpy_boot(staged.data() + (offset - staged_start), data, count);
+        
+        // A cluster is compressed if that saves a block
+        std::vector<std::vector<uint8_t>> packed(units);
+        std::vector<uint32_t> unit_blocks(units);
+        uint32_t needed = 0;
+        for (uint32_t u = 0; u < units; u++) {
+            size_t start = static_cast<size_t>(u) * unit_bytes;
+            size_t length = std::min(unit_bytes, new_size - staged_start - start);
+            unit_blocks[u] = static_cast<uint32_t>((length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+            if (clusters && compression && unit_blocks[u] > 1) {
+                packed[u].resize(lz4_compress_bound(length));
+                int bytes = lz4_compress_block(staged.data() + start, length, packed[u].data(), packed[u].size());
+                uint32_t blocks = bytes > 0 ? static_cast<uint32_t>((bytes + BLOCK_SIZE - 1) / BLOCK_SIZE) : 0;
+                if (bytes > 0 && blocks < unit_blocks[u]) {
+                    packed[u].resize(bytes);
+                    unit_blocks[u] = blocks;
+                } else {
+                    std::vector<uint8_t>().swap(packed[u]);
+                }
+            }
+            needed += unit_blocks[u];
+        }
+        
+        // Next to the block before, so appends stay contiguous
+        ExtentTree fresh;
+        {
+            std::lock_guard<std::mutex> lock(alloc_mutex);
+            uint32_t goal = 0;
+            if (first > 0 && tree.lookup(first * unit - 1, goal)) {
+                goal++;
+            }
+            if (!allocate_file_blocks(fresh, needed, goal)) {
+                free_file_blocks(fresh);
+                return false;
+            }
+        }
+        
+        // The new blocks were allocated back to back; a compressed cluster
+        // takes its share from the start of its range, leaving holes after it
+        std::vector<std::pair<uint32_t, uint32_t>> mapped;  // Logical, physical
+        mapped.reserve(needed);
+        uint32_t next = 0;
+        for (uint32_t u = 0; u < units; u++) {
+            const uint8_t* source = packed[u].empty() ? staged.data() + static_cast<size_t>(u) * unit_bytes : packed[u].data();
+            size_t length = packed[u].empty() ? static_cast<size_t>(unit_blocks[u]) * BLOCK_SIZE : packed[u].size();
+            for (uint32_t b = 0; b < unit_blocks[u]; b++) {
+                uint32_t physical;
+                fresh.lookup(next++, physical);
+                size_t in_unit = static_cast<size_t>(b) * BLOCK_SIZE;
+                write_blocks(physical, source + in_unit, std::min(static_cast<size_t>(BLOCK_SIZE), length - in_unit));
+                mapped.emplace_back((first + u) * unit + b, physical);
+            }
+        }
+        
+        std::vector<Extent> replaced;
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+        tree.remove(first * unit, units * unit, replaced);
+        for (const Extent& extent : replaced) {
+            free_extent(extent);
+        }
+        for (const auto& block : mapped) {
+            tree.insert(block.first, Extent(block.second, 1));
+        }
+        if (clusters) {
+            for (uint32_t u = 0; u < units; u++) {
+                tree.clear_compressed(first + u);
+                if (!packed[u].empty()) {
+                    tree.set_compressed(first + u, static_cast<uint32_t>(packed[u].size()));
+                }
+            }
+        }
+    }
+    
+    inode->attributes.size = new_size;
+    update_file_times(inode, false, true);
+    journal_inode(inode);
+    return true;
+}
+
+void FileSystem::update_file_times(Inode* inode, bool access, bool modify) {
+    uint64_t current_time = sim_now_ms() / 1000;
+    
+    // Readers only hold the inode shared, so the access time is kept apart
+    if (access) {
+        inode->accessed.store(current_time, std::memory_order_relaxed);
+    }
+    if (modify) {
+        inode->attributes.modification_time = current_time;
+    }
+}
+
+void FileSystem::print_file_system_info() {
+    std::shared_lock<std::shared_mutex> lock(fs_lock);
+    size_t files;
+    {
+        std::lock_guard<std::mutex> table_lock(table_mutex);
+        files = inode_count;
+    }
+    
+    KLOG_INFO << "[FILESYSTEM] File System Information:";
+    KLOG_INFO << "  Total space: " << (get_total_space() / 1024) << " KB";
+    KLOG_INFO << "  Used space: " << (get_used_space() / 1024) << " KB";
+    KLOG_INFO << "  Free space: " << (get_free_space() / 1024) << " KB";
+    KLOG_INFO << "  Total files: " << files;
+    KLOG_INFO << "  Dentry cache: " << dentry_cache.get_hits() << " hits, "
+              << dentry_cache.get_misses() << " misses";
+    KLOG_INFO << "  Buffer cache: " << buffer_cache.get_hits() << " hits, "
+              << buffer_cache.get_misses() << " misses, "
+              << static_cast<int>(buffer_cache.get_hit_ratio() * 100) << "% hit ratio";
+    {
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        KLOG_INFO << "  Shared blocks: " << shared_extents.shared_blocks();
+        if (dedup_stats.blocks_written) {
+            KLOG_INFO << "  Deduplication: " << dedup_stats.duplicate_blocks << " of "
+                      << dedup_stats.blocks_written << " blocks written were duplicates, "
+                      << std::fixed << std::setprecision(2) << dedup_stats.ratio() << "x, "
+                      << dedup_stats.false_positives << " false positives";
+        }
+    }
+    KLOG_INFO << "  Read-ahead: " << buffer_cache.get_prefetches() << " blocks, "
+              << buffer_cache.get_prefetch_hits() << " used, "
+              << buffer_cache.get_prefetch_wasted() << " wasted";
+    KLOG_INFO << "  Disk I/O: " << device->get_blocks_read() << " blocks read, "
+              << device->get_blocks_written() << " written";
+    if (journal.active()) {
+        journal.print_stats();
+    }
+    KLOG_INFO << "  Current directory: " << get_current_directory();
+}
+
+void FileSystem::print_directory_tree(const std::string& path, int depth) {
+    std::string indent(depth * 2, ' ');
+    std::string normalized_path = normalize_path(path);
+    
+    KLOG_INFO << indent << get_filename(normalized_path) << "/";
+    
+    auto entries = list_directory(normalized_path);
+    for (const auto& entry : entries) {
+        if (entry.attributes.type == FILE_TYPE_DIRECTORY) {
+            print_directory_tree(entry.full_path, depth + 1);
+        } else {
+            CompressionStats stats;
+            if (get_compression_stats(entry.full_path, stats) && stats.compressed_clusters > 0) {
+                KLOG_INFO << indent << "  " << entry.name << " (" << entry.attributes.size << " bytes, "
+                          << std::fixed << std::setprecision(2) << stats.ratio() << "x compressed)";
+            } else {
+                KLOG_INFO << indent << "  " << entry.name << " (" << entry.attributes.size << " bytes)";
+            }
+        }
+    }
+}
+
+void FileSystem::create_sample_files() {
+    // Create sample directory structure
+    create_directory("/home");
+    create_directory("/home/user");
+    create_directory("/home/user/documents");
+    create_directory("/home/user/pictures");
+    create_directory("/bin");
+    create_directory("/etc");
+    create_directory("/var");
+    create_directory("/tmp");
+    
+    // Create sample files
+    write_file("/home/user/readme.txt", "Welcome to MyOS!\nThis is a sample text file.\n");
+    write_file("/home/user/documents/note.txt", "Important notes:\n- Remember to save your work\n- Use the file manager to navigate\n");
+    write_file("/etc/config.conf", "# MyOS Configuration\nversion=1.0\ndebug=false\n");
+    write_file("/bin/calculator", "Calculator executable");
+    write_file("/bin/editor", "Text editor executable");
+    write_file("/bin/filemanager", "File manager executable");
+    
+    KLOG_INFO << "[FILESYSTEM] Created sample directory structure and files";
+}
+
+int FileSystem::allocate_block() {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    Extent extent;
+    if (!allocate_extent(1, 0, extent)) {
+        return -1; // No free blocks
+    }
+    return static_cast<int>(extent.start_block);
+}
+
+void FileSystem::free_block(int block_num) {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    if (block_num >= 0 && block_num < static_cast<int>(total_blocks)) {
+        block_bitmap.clear_range(block_num, 1);
+        dedup_index.forget(Extent(static_cast<uint32_t>(block_num), 1));
+    }
+}
+
+bool FileSystem::write_block(int block_num, const uint8_t* data) {
+    return block_num >= 0 && write_blocks(static_cast<uint32_t>(block_num), data, BLOCK_SIZE);
+}
+
+bool FileSystem::read_block(int block_num, uint8_t* data) {
+    return block_num >= 0 && read_blocks(static_cast<uint32_t>(block_num), data, BLOCK_SIZE);
+}
+
+// Sequential I/O over contiguous blocks; a partial last block is zero filled.
+// Whole blocks are overwritten in the cache without reading them first.
+bool FileSystem::write_blocks(uint32_t start_block, const uint8_t* data, size_t size) {
+    size_t block_count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (start_block + block_count > total_blocks || (size && !data)) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < block_count; i++) {
+        BufferRef buffer = buffer_cache.get(start_block + i);
+        if (!buffer.valid()) {
+            return false;
+        }
+        size_t length = std::min(static_cast<size_t>(BLOCK_SIZE), size - i * BLOCK_SIZE);
+        Bootloader::memcpy_boot(buffer.writable_data(), data + i * BLOCK_SIZE, length);
+        Bootloader::memset_boot(buffer.writable_data() + length, 0, BLOCK_SIZE - length);
+        buffer.mark_dirty();
+    }
+    return true;
+}
+
+bool FileSystem::read_blocks(uint32_t start_block, uint8_t* data, size_t size) {
+    size_t block_count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (start_block + block_count > total_blocks || (size && !data)) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < block_count; i++) {
+        BufferRef buffer = buffer_cache.read(start_block + i);
+        if (!buffer.valid()) {
+            return false;
+        }
+        size_t length = std::min(static_cast<size_t>(BLOCK_SIZE), size - i * BLOCK_SIZE);
+        Bootloader::memcpy_boot(data + i * BLOCK_SIZE, buffer.data(), length);
+    }
+    return true;
+}
+
+// First run long enough for the whole request at or after goal, otherwise
+// the longest free run so the caller can continue with the rest
+bool FileSystem::allocate_extent(uint32_t wanted_blocks, uint32_t goal, Extent& extent) {
+    size_t start;
+    size_t length;
+    if (wanted_blocks == 0 || !block_bitmap.find_free_run(goal, wanted_blocks, start, length)) {
+        return false;
+    }
+    
+    block_bitmap.set_range(start, length);
+    extent = Extent(static_cast<uint32_t>(start), static_cast<uint32_t>(length));
+    return true;
+}
+
+void FileSystem::free_extent(const Extent& extent) {
+    if (extent.start_block + static_cast<size_t>(extent.block_count) > total_blocks) {
+        return;
+    }
+    
+    std::vector<Extent> unshared;
+    shared_extents.release(extent, unshared);
+    for (const Extent& run : unshared) {
+        dedup_index.forget(run);
+        if (journal.active()) {
+            pending_frees.emplace_back(journal.get_running_sequence(), run);
+        } else {
+            block_bitmap.clear_range(run.start_block, run.block_count);
+        }
+    }
+}
+
+// Appends blocks to the file, right after its last block when possible
+bool FileSystem::allocate_file_blocks(ExtentTree& tree, uint32_t block_count, uint32_t goal) {
+    release_committed_blocks();
+    if (block_count > block_bitmap.free_count()) {
+        return false;
+    }
     
-    auto it = file_attributes.find(normalized_path);
-    if (it != file_attributes.end()) {
-        attr = it->second;
-        return true;
+    if (!tree.get_extents().empty()) {
+        const Extent& last = tree.get_extents().rbegin()->second;
+        goal = last.start_block + last.block_count;
     }
-    return false;
+    
+    uint32_t logical_block = tree.block_count();
+    uint32_t remaining = block_count;
+    while (remaining > 0) {
+        Extent extent;
+        if (!allocate_extent(remaining, goal, extent)) {
+            return false;
+        }
+        tree.insert(logical_block, extent);
+        logical_block += extent.block_count;
+        remaining -= extent.block_count;
+        goal = extent.start_block + extent.block_count;
+    }
+    return true;
 }
 
-bool FileSystem::set_file_attributes(const std::string& path, const FileAttributes& attr) {
-    std::lock_guard<std::mutex> lock(fs_mutex);
+void FileSystem::free_file_blocks(ExtentTree& tree) {
+    for (const auto& entry : tree.get_extents()) {
+        free_extent(entry.second);
+    }
+    tree.clear();
+}
+
+// Copies [offset, offset + length) of the file out of the buffer cache
+void FileSystem::read_file_data(const Inode* inode, size_t offset, size_t length, uint8_t* data) {
+    if (!inode->inline_data.empty()) {
+        Bootloader::memcpy_boot(data, inode->inline_data.data() + offset, length);
+        return;
+    }
     
-    std::string normalized_path = normalize_path(path);
+    const ExtentTree& tree = inode->extents;
+    size_t end = offset + length;
+    for (size_t position = offset; position < end;) {
+        uint32_t cluster = static_cast<uint32_t>(position / FS_CLUSTER_BYTES);
+        uint32_t compressed = tree.compressed_size(cluster);
+        if (compressed) {
+            size_t in_cluster = position % FS_CLUSTER_BYTES;
+            size_t chunk = std::min(static_cast<size_t>(FS_CLUSTER_BYTES) - in_cluster, end - position);
+            ClusterData plain = read_cluster(tree, cluster, compressed);
+            size_t available = plain && plain->size() > in_cluster ?
+                std::min(chunk, plain->size() - in_cluster) : 0;
+            if (available) {
+                Bootloader::memcpy_boot(data + (position - offset), plain->data() + in_cluster, available);
+            }
+            Bootloader::memset_boot(data + (position - offset) + available, 0, chunk - available);
+            position += chunk;
+            continue;
+        }
+        
+        uint32_t physical;
+        size_t in_block = position % BLOCK_SIZE;
+        size_t chunk = std::min(static_cast<size_t>(BLOCK_SIZE) - in_block, end - position);
+        BufferRef buffer;
+        if (tree.lookup(static_cast<uint32_t>(position / BLOCK_SIZE), physical)) {
+            buffer = buffer_cache.read(physical);
+        }
+        if (buffer.valid()) {
+            Bootloader::memcpy_boot(data + (position - offset), buffer.data() + in_block, chunk);
+        } else {
+            Bootloader::memset_boot(data + (position - offset), 0, chunk);
+        }
+        position += chunk;
+    }
+}
+
+// A compressed cluster, decompressed once into the buffer cache. Callers
+// hold the file's lock, so its blocks cannot change underneath.
+ClusterData FileSystem::read_cluster(const ExtentTree& tree, uint32_t cluster, uint32_t bytes) {
+    uint32_t first;
+    if (!tree.lookup(cluster * FS_CLUSTER_BLOCKS, first)) {
+        return ClusterData();
+    }
+    ClusterData cached = buffer_cache.get_cluster(first);
+    if (cached) {
+        return cached;
+    }
     
-    if (!file_exists(normalized_path)) {
-        return false;
+    uint32_t blocks = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<uint8_t> packed(static_cast<size_t>(blocks) * BLOCK_SIZE);
+    for (uint32_t b = 0; b < blocks; b++) {
+        uint32_t physical;
+        BufferRef buffer;
+        if (tree.lookup(cluster * FS_CLUSTER_BLOCKS + b, physical)) {
+            buffer = buffer_cache.read(physical);
+        }
+        if (!buffer.valid()) {
+            return ClusterData();
+        }
+        Bootloader::memcpy_boot(packed.data() + static_cast<size_t>(b) * BLOCK_SIZE, buffer.data(), BLOCK_SIZE);
     }
     
-    file_attributes[normalized_path] = attr;
-    return true;
+    std::shared_ptr<std::vector<uint8_t>> plain(new std::vector<uint8_t>(FS_CLUSTER_BYTES));
+    int size = lz4_decompress_block(packed.data(), bytes, plain->data(), plain->size());
+    if (size < 0) {
+        KLOG_ERROR << "[FILESYSTEM] Corrupt compressed cluster at block " << first;
+        return ClusterData();
+    }
+    plain->resize(size);
+    buffer_cache.put_cluster(first, blocks, plain);
+    return plain;
 }
 
-size_t FileSystem::get_file_size(const std::string& path) {
-    FileAttributes attr;
-    if (get_file_attributes(path, attr)) {
-        return attr.size;
+#define FINGERPRINT_PRIME1 0x9E3779B185EBCA87ULL
+#define FINGERPRINT_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+// 64-bit fingerprint of a block for deduplication, after xxHash64: four
+// lanes of 8-byte words are mixed independently, then folded together
+static uint64_t fingerprint_block(const uint8_t* data) {
+    uint64_t lanes[4] = { FINGERPRINT_PRIME1 + FINGERPRINT_PRIME2, FINGERPRINT_PRIME2, 0, ~FINGERPRINT_PRIME1 };
+    for (size_t offset = 0; offset < BLOCK_SIZE; offset += sizeof(lanes)) {
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            std::memcpy(&word, data + offset + lane * sizeof(word), sizeof(word));
+            uint64_t value = lanes[lane] + word * FINGERPRINT_PRIME2;
+            lanes[lane] = ((value << 31) | (value >> 33)) * FINGERPRINT_PRIME1;
+        }
     }
-    return 0;
+    
+    uint64_t hash = BLOCK_SIZE;
+    for (uint64_t lane : lanes) {
+        hash = (hash ^ lane) * FINGERPRINT_PRIME1 + FINGERPRINT_PRIME2;
+    }
+    hash ^= hash >> 29;
+    hash *= FINGERPRINT_PRIME2;
+    return hash ^ (hash >> 32);
 }
 
-bool FileSystem::copy_file(const std::string& src, const std::string& dest) {
-    std::string content = read_file(src);
-    if (content.empty() && get_file_size(src) == 0) {
-        if (!file_exists(src)) {
+// Replaces the file's blocks; the old data survives if the disk is too full.
+// With a journal the old blocks stay allocated until the change commits.
+bool FileSystem::write_file_data(ExtentTree& tree, const uint8_t* data, size_t size) {
+    // With compression on, a cluster is compressed if that saves a block
+    uint32_t clusters = static_cast<uint32_t>((size + FS_CLUSTER_BYTES - 1) / FS_CLUSTER_BYTES);
+    std::vector<std::vector<uint8_t>> packed(compression ? clusters : 0);
+    std::vector<uint32_t> cluster_blocks(clusters);
+    bool compressed = false;
+    uint32_t needed = 0;
+    for (uint32_t c = 0; c < clusters; c++) {
+        size_t start = static_cast<size_t>(c) * FS_CLUSTER_BYTES;
+        size_t length = std::min(static_cast<size_t>(FS_CLUSTER_BYTES), size - start);
+        cluster_blocks[c] = static_cast<uint32_t>((length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        if (!packed.empty() && cluster_blocks[c] > 1) {
+            packed[c].resize(lz4_compress_bound(length));
+            int bytes = lz4_compress_block(data + start, length, packed[c].data(), packed[c].size());
+            uint32_t blocks = bytes > 0 ? static_cast<uint32_t>((bytes + BLOCK_SIZE - 1) / BLOCK_SIZE) : 0;
+            if (bytes > 0 && blocks < cluster_blocks[c]) {
+                packed[c].resize(bytes);
+                cluster_blocks[c] = blocks;
+                compressed = true;
+            } else {
+                std::vector<uint8_t>().swap(packed[c]);
+            }
+        }
+        needed += cluster_blocks[c];
+    }
+    
+    // With deduplication on, blocks stored as they are are fingerprinted.
+    // A block the same as an earlier one in the file is mapped to it; the
+    // others are looked up in the index.
+    uint32_t blocks = static_cast<uint32_t>((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    std::vector<uint64_t> fingerprints(deduplication ? blocks : 0);
+    std::vector<uint32_t> repeats(fingerprints.size());     // Earlier block with the same data, else itself
+    std::vector<uint32_t> duplicates(fingerprints.size());  // Disk block with the same data, else 0
+    std::vector<uint8_t> last_block;                        // A partial last block, zero filled
+    auto block_data = [&](uint32_t b) {
+        return b + 1 < blocks || last_block.empty() ? data + static_cast<size_t>(b) * BLOCK_SIZE : last_block.data();
+    };
+    auto stored_plain = [&](uint32_t b) {
+        return packed.empty() || packed[b / FS_CLUSTER_BLOCKS].empty();
+    };
+    
+    uint32_t shared = 0;
+    uint64_t false_positives = 0;
+    std::vector<Extent> mismatched;
+    if (!fingerprints.empty()) {
+        if (size % BLOCK_SIZE) {
+            last_block.assign(BLOCK_SIZE, 0);
+            Bootloader::memcpy_boot(last_block.data(), data + (size - size % BLOCK_SIZE), size % BLOCK_SIZE);
+        }
+        std::unordered_map<uint64_t, uint32_t> first_blocks;
+        for (uint32_t b = 0; b < blocks; b++) {
+            repeats[b] = b;
+            if (!stored_plain(b)) continue;
+            fingerprints[b] = fingerprint_block(block_data(b));
+            auto first = first_blocks.emplace(fingerprints[b], b);
+            if (first.second) continue;
+            if (std::memcmp(block_data(first.first->second), block_data(b), BLOCK_SIZE) == 0) {
+                repeats[b] = first.first->second;
+                shared++;
+            } else {
+                false_positives++;
+            }
+        }
+        
+        // A block found is referenced before it is compared, so it cannot
+        // be freed and reused in between
+        {
+            std::lock_guard<std::mutex> lock(alloc_mutex);
+            for (uint32_t b = 0; b < blocks; b++) {
+                if (stored_plain(b) && repeats[b] == b && dedup_index.find(fingerprints[b], duplicates[b])) {
+                    shared_extents.add(Extent(duplicates[b], 1));
+                }
+            }
+        }
+        for (uint32_t b = 0; b < blocks; b++) {
+            if (!duplicates[b]) continue;
+            BufferRef buffer = buffer_cache.read(duplicates[b]);
+            if (buffer.valid() && std::memcmp(buffer.data(), block_data(b), BLOCK_SIZE) == 0) {
+                shared++;
+            } else {
+                mismatched.push_back(Extent(duplicates[b], 1));
+                duplicates[b] = 0;
+                false_positives++;
+            }
+        }
+        needed -= shared;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+        for (const Extent& extent : mismatched) {
+            free_extent(extent);
+        }
+        release_committed_blocks();
+        
+        // Blocks shared with another file are not written over
+        uint32_t reusable = 0;
+        if (!journal.active()) {
+            for (const auto& entry : tree.get_extents()) {
+                reusable += entry.second.block_count - shared_extents.shared_blocks(entry.second);
+            }
+        }
+        bool allocated = needed <= block_bitmap.free_count() + reusable;
+        if (allocated) {
+            // Rewrite in place where the file was
+            uint32_t goal = tree.get_extents().empty() ? 0 : tree.get_extents().begin()->second.start_block;
+            free_file_blocks(tree);
+            allocated = allocate_file_blocks(tree, needed, goal);
+        }
+        if (!allocated) {
+            for (uint32_t block : duplicates) {
+                if (block) free_extent(Extent(block, 1));
+            }
             return false;
         }
     }
     
-    return write_file(dest, content);
+    if (!compressed && shared == 0) {
+        for (const auto& entry : tree.get_extents()) {
+            size_t offset = static_cast<size_t>(entry.first) * BLOCK_SIZE;
+            size_t length = std::min(static_cast<size_t>(entry.second.block_count) * BLOCK_SIZE,
+                                     size - offset);
+            write_blocks(entry.second.start_block, data + offset, length);
+        }
+    } else {
+        // The blocks were allocated back to back. A compressed cluster takes
+        // its share from the start of its own logical range, leaving holes
+        // after it; a shared block takes none.
+        ExtentTree allocated;
+        std::swap(allocated, tree);
+        uint32_t next = 0;
+        for (uint32_t c = 0; c < clusters; c++) {
+            if (!stored_plain(c * FS_CLUSTER_BLOCKS)) {
+                for (uint32_t b = 0; b < cluster_blocks[c]; b++) {
+                    uint32_t physical;
+                    allocated.lookup(next++, physical);
+                    tree.insert(c * FS_CLUSTER_BLOCKS + b, Extent(physical, 1));
+                    write_blocks(physical, packed[c].data() + static_cast<size_t>(b) * BLOCK_SIZE,
+                                 std::min(static_cast<size_t>(BLOCK_SIZE), packed[c].size() - static_cast<size_t>(b) * BLOCK_SIZE));
+                }
+                tree.set_compressed(c, static_cast<uint32_t>(packed[c].size()));
+                continue;
+            }
+            
+            for (uint32_t b = c * FS_CLUSTER_BLOCKS; b < std::min(blocks, (c + 1) * FS_CLUSTER_BLOCKS); b++) {
+                uint32_t physical;
+                if (!duplicates.empty() && duplicates[b]) {
+                    physical = duplicates[b];
+                } else if (!repeats.empty() && repeats[b] != b) {
+                    tree.lookup(repeats[b], physical);
+                } else {
+                    allocated.lookup(next++, physical);
+                    write_blocks(physical, data + static_cast<size_t>(b) * BLOCK_SIZE,
+                                 std::min(static_cast<size_t>(BLOCK_SIZE), size - static_cast<size_t>(b) * BLOCK_SIZE));
+                }
+                tree.insert(b, Extent(physical, 1));
+            }
+        }
+    }
+    
+    // Repeated blocks take their reference now the tree maps them; new
+    // blocks go in the index once their data is in the cache
+    if (!fingerprints.empty()) {
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+        for (uint32_t b = 0; b < blocks; b++) {
+            if (!stored_plain(b)) continue;
+            dedup_stats.blocks_written++;
+            uint32_t physical;
+            if (duplicates[b] || !tree.lookup(b, physical)) continue;
+            if (repeats[b] != b) {
+                shared_extents.add(Extent(physical, 1));
+            } else {
+                dedup_index.insert(fingerprints[b], physical);
+            }
+        }
+        dedup_stats.duplicate_blocks += shared;
+        dedup_stats.false_positives += false_positives;
+    }
+    return true;
 }
 
-bool FileSystem::move_file(const std::string& src, const std::string& dest) {
-    if (copy_file(src, dest)) {
-        return delete_file(src);
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME        16777619u
+
+// FNV-1a, continuing from hash
+static uint32_t hash_bytes(uint32_t hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * FNV_PRIME;
     }
-    return false;
+    return hash;
 }
 
-bool FileSystem::rename_file(const std::string& old_name, const std::string& new_name) {
-    return move_file(old_name, new_name);
+#define DIRECTORY_BUCKET_DELETED 0xFFFFFFFFu
+
+size_t DirectoryIndex::find_bucket(uint32_t hash, const char* name, size_t length) const {
+    if (buckets.empty()) return SIZE_MAX;
+    
+    size_t mask = buckets.size() - 1;
+    for (size_t bucket = hash & mask; ; bucket = (bucket + 1) & mask) {
+        uint32_t slot = buckets[bucket];
+        if (slot == 0) return SIZE_MAX;
+        if (slot == DIRECTORY_BUCKET_DELETED) continue;
+        
+        const DirectoryLink& link = links[slot - 1];
+        if (link.hash == hash && link.name.size() == length &&
+            std::memcmp(link.name.data(), name, length) == 0) {
+            return bucket;
+        }
+    }
 }
 
-size_t FileSystem::get_total_space() {
-    return total_blocks * BLOCK_SIZE;
+// Drops tombstones and rehashes; creation order and cookies are kept
+void DirectoryIndex::rebuild(size_t bucket_count) {
+    links.erase(std::remove_if(links.begin(), links.end(),
+                               [](const DirectoryLink& link) { return link.inode == INVALID_INODE; }),
+                links.end());
+    
+    buckets.assign(bucket_count, 0);
+    size_t mask = bucket_count - 1;
+    for (size_t i = 0; i < links.size(); i++) {
+        size_t bucket = links[i].hash & mask;
+        while (buckets[bucket] != 0) bucket = (bucket + 1) & mask;
+        buckets[bucket] = static_cast<uint32_t>(i + 1);
+    }
+    used_buckets = links.size();
 }
 
-size_t FileSystem::get_free_space() {
-    return free_blocks * BLOCK_SIZE;
+const DirectoryLink* DirectoryIndex::find(const char* name, size_t length) const {
+    size_t bucket = find_bucket(hash_bytes(FNV_OFFSET_BASIS, name, length), name, length);
+    return bucket == SIZE_MAX ? nullptr : &links[buckets[bucket] - 1];
 }
 
-size_t FileSystem::get_used_space() {
-    return get_total_space() - get_free_space();
+bool DirectoryIndex::insert(const std::string& name, InodeId inode) {
+    uint32_t hash = hash_bytes(FNV_OFFSET_BASIS, name.data(), name.size());
+    if (find_bucket(hash, name.data(), name.size()) != SIZE_MAX) {
+        return false;
+    }
+    
+    // Keep the load factor, deleted markers included, under 3/4
+    if ((used_buckets + 1) * 4 > buckets.size() * 3) {
+        size_t bucket_count = DIRECTORY_INDEX_MIN_BUCKETS;
+        while ((live_count + 1) * 2 > bucket_count) bucket_count *= 2;
+        rebuild(bucket_count);
+    }
+    
+    links.emplace_back(name, inode, hash, next_cookie++);
+    
+    size_t mask = buckets.size() - 1;
+    size_t bucket = hash & mask;
+    while (buckets[bucket] != 0 && buckets[bucket] != DIRECTORY_BUCKET_DELETED) {
+        bucket = (bucket + 1) & mask;
+    }
+    if (buckets[bucket] == 0) used_buckets++;
+    buckets[bucket] = static_cast<uint32_t>(links.size());
+    live_count++;
+    return true;
 }
 
-bool FileSystem::create_directory_entry(const std::string& path, FileType type) {
-    FileAttributes attr;
-    attr.type = type;
-    attr.size = 0;
+bool DirectoryIndex::erase(const char* name, size_t length) {
+    size_t bucket = find_bucket(hash_bytes(FNV_OFFSET_BASIS, name, length), name, length);
+    if (bucket == SIZE_MAX) {
+        return false;
+    }
     
-    uint64_t current_time = std::chrono::duration_cast<std::chrono::seconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
+    DirectoryLink& link = links[buckets[bucket] - 1];
+    link.inode = INVALID_INODE;
+    std::string().swap(link.name);
+    buckets[bucket] = DIRECTORY_BUCKET_DELETED;
+    live_count--;
     
-    attr.creation_time = current_time;
-    attr.modification_time = current_time;
-    attr.access_time = current_time;
-    attr.permissions = PERM_READ | PERM_WRITE;
-    attr.owner_id = 0;
-    attr.group_id = 0;
+    if (links.size() - live_count > live_count && links.size() > DIRECTORY_INDEX_MIN_BUCKETS) {
+        size_t bucket_count = DIRECTORY_INDEX_MIN_BUCKETS;
+        while (live_count * 2 > bucket_count) bucket_count *= 2;
+        rebuild(bucket_count);
+    }
+    return true;
+}
+
+void DirectoryIndex::clear() {
+    links.clear();
+    buckets.clear();
+    live_count = 0;
+    used_buckets = 0;
+}
+
+const DirectoryLink* DirectoryIndex::next(uint64_t& cursor) const {
+    auto it = std::lower_bound(links.begin(), links.end(), cursor,
+                               [](const DirectoryLink& link, uint64_t value) { return link.cookie < value; });
+    while (it != links.end() && it->inode == INVALID_INODE) {
+        ++it;
+    }
+    if (it == links.end()) {
+        cursor = next_cookie;
+        return nullptr;
+    }
+    cursor = it->cookie + 1;
+    return &*it;
+}
+
+// Number 0 is INVALID_INODE and never set
+InodeTable::InodeTable() : chunks(new std::atomic<std::atomic<Inode*>*>[INODE_TABLE_CHUNKS]), slots(1) {
+    for (size_t i = 0; i < INODE_TABLE_CHUNKS; i++) {
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+InodeTable::~InodeTable() {
+    clear();
+}
+
+bool InodeTable::set(InodeId id, Inode* inode) {
+    if (id == INVALID_INODE || id >= INODE_TABLE_CHUNK * INODE_TABLE_CHUNKS) {
+        return false;
+    }
     
-    file_attributes[path] = attr;
+    std::atomic<Inode*>* chunk = chunks[id / INODE_TABLE_CHUNK].load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = new std::atomic<Inode*>[INODE_TABLE_CHUNK];
+        for (size_t i = 0; i < INODE_TABLE_CHUNK; i++) {
+            chunk[i].store(nullptr, std::memory_order_relaxed);
+        }
+        chunks[id / INODE_TABLE_CHUNK].store(chunk, std::memory_order_release);
+    }
+    chunk[id % INODE_TABLE_CHUNK].store(inode, std::memory_order_release);
+    if (id >= slots.load(std::memory_order_relaxed)) {
+        slots.store(id + 1, std::memory_order_release);
+    }
     return true;
 }
 
-void FileSystem::update_file_times(const std::string& path, bool access, bool modify) {
-    auto it = file_attributes.find(path);
-    if (it != file_attributes.end()) {
-        uint64_t current_time = std::chrono::duration_cast<std::chrono::seconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-        
-        if (access) {
-            it->second.access_time = current_time;
+Inode* InodeTable::take(InodeId id) {
+    if (id >= INODE_TABLE_CHUNK * INODE_TABLE_CHUNKS) return nullptr;
+    std::atomic<Inode*>* chunk = chunks[id / INODE_TABLE_CHUNK].load(std::memory_order_relaxed);
+    return chunk ? chunk[id % INODE_TABLE_CHUNK].exchange(nullptr, std::memory_order_acq_rel) : nullptr;
+}
+
+void InodeTable::clear() {
+    for (size_t c = 0; c < INODE_TABLE_CHUNKS; c++) {
+        std::atomic<Inode*>* chunk = chunks[c].exchange(nullptr, std::memory_order_relaxed);
+        if (!chunk) continue;
+        for (size_t i = 0; i < INODE_TABLE_CHUNK; i++) {
+            delete chunk[i].load(std::memory_order_relaxed);
         }
-        if (modify) {
-            it->second.modification_time = current_time;
+        delete[] chunk;
+    }
+    slots.store(1, std::memory_order_release);
+}
+
+DentryCache::DentryCache()
+    : entries(DENTRY_CACHE_SETS * DENTRY_CACHE_WAYS), set_locks(DENTRY_CACHE_SETS), hits(0), misses(0) {}
+
+uint32_t DentryCache::hash_name(InodeId parent, const char* name, size_t length) {
+    return hash_bytes((FNV_OFFSET_BASIS ^ parent) * FNV_PRIME, name, length);
+}
+
+DentryCache::Entry* DentryCache::find(uint32_t hash, InodeId parent, const char* name, size_t length) {
+    Entry* set = &entries[(hash & (DENTRY_CACHE_SETS - 1)) * DENTRY_CACHE_WAYS];
+    for (int way = 0; way < DENTRY_CACHE_WAYS; way++) {
+        Entry& entry = set[way];
+        if (entry.valid && entry.hash == hash && entry.parent == parent &&
+            entry.name.size() == length && std::memcmp(entry.name.data(), name, length) == 0) {
+            return &entry;
         }
     }
+    return nullptr;
 }
 
-void FileSystem::print_file_system_info() {
-    std::lock_guard<std::mutex> lock(fs_mutex);
+bool DentryCache::lookup(InodeId parent, const char* name, size_t length, InodeId& inode) {
+    uint32_t hash = hash_name(parent, name, length);
+    std::lock_guard<std::mutex> lock(set_locks[hash & (DENTRY_CACHE_SETS - 1)]);
+    Entry* entry = find(hash, parent, name, length);
+    if (!entry) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    hits.fetch_add(1, std::memory_order_relaxed);
+    inode = entry->inode;
+    return true;
+}
+
+void DentryCache::insert(InodeId parent, const char* name, size_t length, InodeId inode) {
+    uint32_t hash = hash_name(parent, name, length);
+    std::lock_guard<std::mutex> lock(set_locks[hash & (DENTRY_CACHE_SETS - 1)]);
+    Entry* entry = find(hash, parent, name, length);
+    
+    if (!entry) {
+        // Take a free way, otherwise evict one picked by the upper hash bits
+        Entry* set = &entries[(hash & (DENTRY_CACHE_SETS - 1)) * DENTRY_CACHE_WAYS];
+        entry = &set[(hash >> 28) % DENTRY_CACHE_WAYS];
+        for (int way = 0; way < DENTRY_CACHE_WAYS; way++) {
+            if (!set[way].valid) {
+                entry = &set[way];
+                break;
+            }
+        }
+        entry->valid = true;
+        entry->hash = hash;
+        entry->parent = parent;
+        entry->name.assign(name, length);
+    }
+    entry->inode = inode;
+}
+
+// Callers have the filesystem to themselves
+void DentryCache::clear() {
+    for (Entry& entry : entries) {
+        entry.valid = false;
+    }
+}
+
+void ExtentTree::insert(uint32_t logical_block, const Extent& extent) {
+    if (extent.block_count == 0) return;
+    
+    auto next = extents.lower_bound(logical_block);
+    if (next != extents.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second.block_count == logical_block &&
+            prev->second.start_block + prev->second.block_count == extent.start_block) {
+            prev->second.block_count += extent.block_count;
+            total_blocks += extent.block_count;
+            return;
+        }
+    }
     
-    std::cout << "[FILESYSTEM] File System Information:" << std::endl;
-    std::cout << "  Total space: " << (get_total_space() / 1024) << " KB" << std::endl;
-    std::cout << "  Used space: " << (get_used_space() / 1024) << " KB" << std::endl;
-    std::cout << "  Free space: " << (get_free_space() / 1024) << " KB" << std::endl;
-    std::cout << "  Total files: " << file_attributes.size() << std::endl;
-    std::cout << "  Current directory: " << current_directory << std::endl;
+    extents[logical_block] = extent;
+    total_blocks += extent.block_count;
 }
 
-void FileSystem::print_directory_tree(const std::string& path, int depth) {
-    std::string indent(depth * 2, ' ');
-    std::string normalized_path = normalize_path(path);
+void ExtentTree::remove(uint32_t logical_block, uint32_t block_count, std::vector<Extent>& removed) {
+    uint32_t end = logical_block + block_count;
+    auto it = extents.upper_bound(logical_block);
+    if (it != extents.begin()) --it;
+    
+    while (it != extents.end() && it->first < end) {
+        uint32_t first = it->first;
+        Extent extent = it->second;
+        uint32_t extent_end = first + extent.block_count;
+        if (extent_end <= logical_block) {
+            ++it;
+            continue;
+        }
+        
+        it = extents.erase(it);
+        total_blocks -= extent.block_count;
+        uint32_t cut_start = std::max(first, logical_block);
+        uint32_t cut_end = std::min(extent_end, end);
+        if (first < cut_start) {
+            insert(first, Extent(extent.start_block, cut_start - first));
+        }
+        if (cut_end < extent_end) {
+            insert(cut_end, Extent(extent.start_block + (cut_end - first), extent_end - cut_end));
+        }
+        removed.push_back(Extent(extent.start_block + (cut_start - first), cut_end - cut_start));
+    }
+}
+
+bool ExtentTree::lookup(uint32_t logical_block, uint32_t& physical_block) const {
+    auto it = extents.upper_bound(logical_block);
+    if (it == extents.begin()) return false;
+    --it;
     
-    std::cout << indent << get_filename(normalized_path) << "/" << std::endl;
+    if (logical_block - it->first >= it->second.block_count) return false;
+    physical_block = it->second.start_block + (logical_block - it->first);
+    return true;
+}
+
+// bits set from bit upwards; bit + bits <= BITMAP_WORD_BITS
+static uint64_t range_mask(size_t bit, size_t bits) {
+    uint64_t mask = bits == BITMAP_WORD_BITS ? ~0ULL : (1ULL << bits) - 1;
+    return mask << bit;
+}
+
+void BlockBitmap::reset(size_t blocks) {
+    size_t group_count = (blocks + BITMAP_GROUP_BLOCKS - 1) / BITMAP_GROUP_BLOCKS;
+    total_bits = blocks;
+    free_bits = blocks;
+    words.assign(group_count * BITMAP_GROUP_WORDS, 0);
+    groups.assign(group_count, GroupSummary());
+    
+    // Padding after the last block is never free
+    size_t word = blocks / BITMAP_WORD_BITS;
+    if (blocks % BITMAP_WORD_BITS) {
+        words[word++] = ~range_mask(0, blocks % BITMAP_WORD_BITS);
+    }
+    for (; word < words.size(); word++) {
+        words[word] = ~0ULL;
+    }
     
-    auto entries = list_directory(normalized_path);
-    for (const auto& entry : entries) {
-        if (entry.attributes.type == FILE_TYPE_DIRECTORY) {
-            print_directory_tree(entry.full_path, depth + 1);
-        } else {
-            std::cout << indent << "  " << entry.name << " (" << entry.attributes.size << " bytes)" << std::endl;
+    if (blocks > 0) {
+        update_groups(0, blocks - 1);
+    }
+}
+
+void BlockBitmap::set_range(size_t start, size_t count) {
+    if (count == 0) return;
+    
+    size_t end = start + count;
+    for (size_t block = start; block < end;) {
+        size_t bit = block % BITMAP_WORD_BITS;
+        size_t bits = std::min(BITMAP_WORD_BITS - bit, end - block);
+        uint64_t mask = range_mask(bit, bits);
+        uint64_t& word = words[block / BITMAP_WORD_BITS];
+        free_bits -= __builtin_popcountll(~word & mask);
+        word |= mask;
+        block += bits;
+    }
+    update_groups(start, end - 1);
+}
+
+void BlockBitmap::clear_range(size_t start, size_t count) {
+    if (count == 0) return;
+    
+    size_t end = start + count;
+    for (size_t block = start; block < end;) {
+        size_t bit = block % BITMAP_WORD_BITS;
+        size_t bits = std::min(BITMAP_WORD_BITS - bit, end - block);
+        uint64_t mask = range_mask(bit, bits);
+        uint64_t& word = words[block / BITMAP_WORD_BITS];
+        free_bits += __builtin_popcountll(word & mask);
+        word &= ~mask;
+        block += bits;
+    }
+    update_groups(start, end - 1);
+}
+
+void BlockBitmap::update_groups(size_t first_block, size_t last_block) {
+    for (size_t group = first_block / BITMAP_GROUP_BLOCKS; group <= last_block / BITMAP_GROUP_BLOCKS; group++) {
+        GroupSummary summary = GroupSummary();
+        uint32_t run = 0;
+        bool head = true;
+        
+        for (size_t w = group * BITMAP_GROUP_WORDS; w < (group + 1) * BITMAP_GROUP_WORDS; w++) {
+            uint64_t word = words[w];
+            if (word == 0) {
+                run += BITMAP_WORD_BITS;
+                summary.free_count += BITMAP_WORD_BITS;
+                continue;
+            }
+            
+            if (word == ~0ULL) {
+                if (head) summary.head_free = run;
+                head = false;
+                summary.longest_free = std::max(summary.longest_free, run);
+                run = 0;
+                continue;
+            }
+            
+            summary.free_count += __builtin_popcountll(~word);
+            for (size_t bit = 0; bit < BITMAP_WORD_BITS;) {
+                uint64_t rest = word >> bit;
+                if (rest & 1) {
+                    // Allocated blocks end the run; shifted-in zeros stop the count
+                    if (head) summary.head_free = run;
+                    head = false;
+                    summary.longest_free = std::max(summary.longest_free, run);
+                    run = 0;
+                    bit += __builtin_ctzll(~rest);
+                } else {
+                    size_t length = rest ? __builtin_ctzll(rest) : BITMAP_WORD_BITS - bit;
+                    run += static_cast<uint32_t>(length);
+                    bit += length;
+                }
+            }
         }
+        
+        if (head) summary.head_free = run;
+        summary.longest_free = std::max(summary.longest_free, run);
+        summary.tail_free = run;
+        groups[group] = summary;
     }
 }
 
-void FileSystem::create_sample_files() {
-    // Create sample directory structure
-    create_directory("/home");
-    create_directory("/home/user");
-    create_directory("/home/user/documents");
-    create_directory("/home/user/pictures");
-    create_directory("/bin");
-    create_directory("/etc");
-    create_directory("/var");
-    create_directory("/tmp");
+// Runs can cross groups: a group's tail continues into the next one's head
+size_t BlockBitmap::longest_free_run() const {
+    size_t longest = 0;
+    size_t open_run = 0;
+    for (const GroupSummary& group : groups) {
+        longest = std::max<size_t>(longest, std::max<size_t>(group.longest_free, open_run + group.head_free));
+        open_run = group.tail_free == BITMAP_GROUP_BLOCKS ? open_run + BITMAP_GROUP_BLOCKS : group.tail_free;
+    }
+    return longest;
+}
+
+size_t BlockBitmap::free_run_length(size_t start, size_t limit) const {
+    size_t length = 0;
+    for (size_t block = start; block < total_bits && length < limit;) {
+        size_t word = block / BITMAP_WORD_BITS;
+        uint64_t used = words[word] & ~range_mask(0, block % BITMAP_WORD_BITS);
+        size_t end = used ? word * BITMAP_WORD_BITS + __builtin_ctzll(used) : (word + 1) * BITMAP_WORD_BITS;
+        length += end - block;
+        if (used) break;
+        block = end;
+    }
+    return std::min(length, limit);
+}
+
+// First free run of at least wanted blocks starting in [from, to)
+bool BlockBitmap::find_run(size_t from, size_t to, size_t wanted, size_t& start) const {
+    size_t block = from;
+    size_t run_start = 0;
+    size_t run_length = 0;
+    
+    while (block < total_bits) {
+        size_t word = block / BITMAP_WORD_BITS;
+        
+        if (run_length == 0) {
+            if (block >= to) return false;
+            if (block % BITMAP_GROUP_BLOCKS == 0) {
+                // Too fragmented; only a run from its tail can be long enough
+                const GroupSummary& group = groups[block / BITMAP_GROUP_BLOCKS];
+                if (group.longest_free < wanted && group.tail_free < BITMAP_GROUP_BLOCKS) {
+                    block += BITMAP_GROUP_BLOCKS - group.tail_free;
+                    continue;
+                }
+            }
+            
+            uint64_t available = ~words[word] & ~range_mask(0, block % BITMAP_WORD_BITS);
+            if (available == 0) {
+                block = (word + 1) * BITMAP_WORD_BITS;
+                continue;
+            }
+            block = word * BITMAP_WORD_BITS + __builtin_ctzll(available);
+            if (block >= to) return false;
+            run_start = block;
+        }
+        
+        uint64_t used = words[word] & ~range_mask(0, block % BITMAP_WORD_BITS);
+        size_t end = used ? word * BITMAP_WORD_BITS + __builtin_ctzll(used) : (word + 1) * BITMAP_WORD_BITS;
+        run_length += end - block;
+        if (run_length >= wanted) {
+            start = run_start;
+            return true;
+        }
+        if (used) run_length = 0;
+        block = end;
+    }
+    return false;
+}
+
+bool BlockBitmap::find_free_run(size_t goal, size_t wanted, size_t& start, size_t& length) const {
+    if (free_bits == 0 || wanted == 0) {
+        return false;
+    }
+    if (goal >= total_bits) {
+        goal = 0;
+    }
     
-    // Create sample files
-    write_file("/home/user/readme.txt", "Welcome to MyOS!\nThis is a sample text file.\n");
-    write_file("/home/user/documents/note.txt", "Important notes:\n- Remember to save your work\n- Use the file manager to navigate\n");
-    write_file("/etc/config.conf", "# MyOS Configuration\nversion=1.0\ndebug=false\n");
-    write_file("/bin/calculator", "Calculator executable");
-    write_file("/bin/editor", "Text editor executable");
-    write_file("/bin/filemanager", "File manager executable");
+    if (!find_run(goal, total_bits, wanted, start) && !find_run(0, goal, wanted, start)) {
+        // Nothing long enough; settle for the longest run
+        if (!find_run(0, total_bits, longest_free_run(), start)) {
+            return false;
+        }
+    }
     
-    std::cout << "[FILESYSTEM] Created sample directory structure and files" << std::endl;
+    length = free_run_length(start, wanted);
+    return true;
 }
 
-int FileSystem::allocate_block() {
-    for (size_t i = 0; i < total_blocks; i++) {
-        if (!block_allocation_table[i]) {
-            block_allocation_table[i] = true;
-            disk_blocks[i].is_allocated = true;
-            free_blocks--;
-            return static_cast<int>(i);
+void SharedExtents::split(uint32_t block) {
+    auto it = runs.upper_bound(block);
+    if (it == runs.begin()) {
+        return;
+    }
+    --it;
+    uint32_t end = it->first + it->second.block_count;
+    if (it->first == block || end <= block) {
+        return;
+    }
+    SharedRun tail(end - block, it->second.extra_refs);
+    it->second.block_count = block - it->first;
+    runs.emplace(block, tail);
+}
+
+void SharedExtents::add(const Extent& extent) {
+    uint32_t end = extent.start_block + extent.block_count;
+    split(extent.start_block);
+    split(end);
+    
+    uint32_t block = extent.start_block;
+    auto it = runs.lower_bound(block);
+    while (block < end) {
+        if (it != runs.end() && it->first == block) {
+            it->second.extra_refs++;
+            block += it->second.block_count;
+            ++it;
+        } else {
+            uint32_t gap_end = (it != runs.end() && it->first < end) ? it->first : end;
+            runs.emplace_hint(it, block, SharedRun(gap_end - block, 1));
+            block = gap_end;
         }
     }
-    return -1; // No free blocks
 }
 
-void FileSystem::free_block(int block_num) {
-    if (block_num >= 0 && block_num < static_cast<int>(total_blocks)) {
-        if (block_allocation_table[block_num]) {
-            block_allocation_table[block_num] = false;
-            disk_blocks[block_num].is_allocated = false;
-            free_blocks++;
+void SharedExtents::release(const Extent& extent, std::vector<Extent>& unshared) {
+    uint32_t end = extent.start_block + extent.block_count;
+    split(extent.start_block);
+    split(end);
+    
+    uint32_t block = extent.start_block;
+    auto it = runs.lower_bound(block);
+    while (block < end) {
+        if (it != runs.end() && it->first == block) {
+            block += it->second.block_count;
+            if (--it->second.extra_refs == 0) {
+                it = runs.erase(it);
+            } else {
+                ++it;
+            }
+        } else {
+            uint32_t gap_end = (it != runs.end() && it->first < end) ? it->first : end;
+            unshared.push_back(Extent(block, gap_end - block));
+            block = gap_end;
         }
     }
 }
 
-bool FileSystem::write_block(int block_num, const uint8_t* data) {
-    if (block_num >= 0 && block_num < static_cast<int>(total_blocks) && data) {
-        std::memcpy(disk_blocks[block_num].data, data, BLOCK_SIZE);
-        return true;
+uint32_t SharedExtents::shared_blocks(const Extent& extent) const {
+    uint32_t end = extent.start_block + extent.block_count;
+    auto it = runs.upper_bound(extent.start_block);
+    if (it != runs.begin()) {
+        --it;
     }
-    return false;
+    
+    uint32_t shared = 0;
+    for (; it != runs.end() && it->first < end; ++it) {
+        uint32_t first = std::max(it->first, extent.start_block);
+        uint32_t last = std::min(it->first + it->second.block_count, end);
+        if (first < last) {
+            shared += last - first;
+        }
+    }
+    return shared;
 }
 
-bool FileSystem::read_block(int block_num, uint8_t* data) {
-    if (block_num >= 0 && block_num < static_cast<int>(total_blocks) && data) {
-        std::memcpy(data, disk_blocks[block_num].data, BLOCK_SIZE);
+uint64_t SharedExtents::shared_blocks() const {
+    uint64_t shared = 0;
+    for (const auto& run : runs) {
+        shared += run.second.block_count;
+    }
+    return shared;
+}
+
+void DedupIndex::reset(size_t entries, size_t blocks) {
+    size_t sets = 0;
+    if (entries >= FS_DEDUP_INDEX_WAYS) {
+        sets = 1;
+        while (sets * 2 * FS_DEDUP_INDEX_WAYS <= entries) sets *= 2;
+    }
+    slots.assign(sets * FS_DEDUP_INDEX_WAYS, Slot());
+    slots.shrink_to_fit();
+    set_mask = sets ? sets - 1 : 0;
+    indexed.reset(sets ? blocks : 0);
+}
+
+// The low bits of a fingerprint pick its set and the high ones are its tag
+DedupIndex::Slot* DedupIndex::find_set(uint64_t fingerprint) {
+    return slots.empty() ? nullptr : &slots[(fingerprint & set_mask) * FS_DEDUP_INDEX_WAYS];
+}
+
+bool DedupIndex::find(uint64_t fingerprint, uint32_t& block) {
+    Slot* set = find_set(fingerprint);
+    uint32_t tag = static_cast<uint32_t>(fingerprint >> 32);
+    for (size_t way = 0; set && way < FS_DEDUP_INDEX_WAYS; way++) {
+        if (!set[way].block || set[way].tag != tag) continue;
+        if (set[way].block >= indexed.size() || !indexed.test(set[way].block)) {
+            set[way] = Slot();
+            return false;
+        }
+        block = set[way].block;
         return true;
     }
     return false;
 }
+
+void DedupIndex::insert(uint64_t fingerprint, uint32_t block) {
+    Slot* set = find_set(fingerprint);
+    if (!set || block == 0 || block >= indexed.size()) {
+        return;
+    }
+    
+    // An entry with the same tag makes way, else an empty one or the oldest
+    uint32_t tag = static_cast<uint32_t>(fingerprint >> 32);
+    size_t way = 0;
+    while (way < FS_DEDUP_INDEX_WAYS - 1 && set[way].block && set[way].tag != tag) {
+        way++;
+    }
+    std::move_backward(set, set + way, set + way + 1);
+    set[0].tag = tag;
+    set[0].block = block;
+    indexed.set_range(block, 1);
+}
+
+void DedupIndex::forget(const Extent& extent) {
+    if (static_cast<size_t>(extent.start_block) + extent.block_count <= indexed.size()) {
+        indexed.clear_range(extent.start_block, extent.block_count);
+    }
+}
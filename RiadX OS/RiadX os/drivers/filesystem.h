@@ -5,12 +5,20 @@
 #include <vector>
 #include <map>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
 #include <memory>
+#include <algorithm>
 #include <fstream>
 #include <cstring>
+#include "buffer_cache.h"
+#include "journal.h"
+#include "../kernel/rcu.h"
 
-// File system constants
-#define BLOCK_SIZE 4096
+class SnapshotWriter;
+class SnapshotReader;
+
+// File system constants; BLOCK_SIZE comes from the block device
 #define MAX_FILENAME_LENGTH 255
 #define MAX_PATH_LENGTH 4096
 
@@ -55,45 +63,497 @@ struct DirectoryEntry {
         : name(n), attributes(attr), full_path(path) {}
 };
 
-// File handle
+// Immutable file contents shared by reference count. Copies and slices
+// share the bytes, so after the one copy out of the buffer cache nothing is
+// copied again. Invalid when the file could not be read.
+class FileBuffer {
+private:
+    std::shared_ptr<const char> storage;
+    size_t offset;
+    size_t length;
+    
+public:
+    FileBuffer() : offset(0), length(0) {}
+    FileBuffer(std::shared_ptr<const char> bytes, size_t size)
+        : storage(std::move(bytes)), offset(0), length(size) {}
+    
+    bool valid() const { return storage != nullptr; }
+    const char* data() const { return storage.get() + offset; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    
+    // Bytes [start, start + count) of this buffer, clamped to its end
+    FileBuffer slice(size_t start, size_t count) const {
+        FileBuffer part(*this);
+        part.offset += std::min(start, length);
+        part.length = std::min(count, length - std::min(start, length));
+        return part;
+    }
+};
+
+// A run of contiguous disk blocks holding part of a file
+struct Extent {
+    uint32_t start_block;  // First physical block
+    uint32_t block_count;
+    
+    Extent() : start_block(0), block_count(0) {}
+    Extent(uint32_t start, uint32_t count) : start_block(start), block_count(count) {}
+};
+
+#define FS_CLUSTER_BLOCKS 4  // Compression unit
+#define FS_CLUSTER_BYTES  (FS_CLUSTER_BLOCKS * BLOCK_SIZE)
+
+// Maps a file's logical blocks to extents, keyed by the first logical block
+// of each extent. A file written in one piece is usually a single extent.
+// Compression works on clusters of FS_CLUSTER_BLOCKS logical blocks: a
+// cluster stored compressed has its LZ4 data in its first blocks and holes
+// after them.
+class ExtentTree {
+private:
+    std::map<uint32_t, Extent> extents;
+    std::map<uint32_t, uint32_t> compressed;  // Cluster -> compressed bytes
+    uint32_t total_blocks;
+    
+public:
+    ExtentTree() : total_blocks(0) {}
+    
+    // Appends or inserts an extent, merging it with the one before when
+    // both logical and physical blocks are adjacent
+    void insert(uint32_t logical_block, const Extent& extent);
+    
+    // Physical block holding a logical block, or false for a hole
+    bool lookup(uint32_t logical_block, uint32_t& physical_block) const;
+    
+    // Unmaps block_count logical blocks, splitting extents that cross
+    // either end; the physical runs unmapped are appended to removed
+    void remove(uint32_t logical_block, uint32_t block_count, std::vector<Extent>& removed);
+    
+    // Compressed bytes in a cluster, 0 for one stored as it is
+    uint32_t compressed_size(uint32_t cluster) const {
+        if (compressed.empty()) return 0;
+        auto it = compressed.find(cluster);
+        return it == compressed.end() ? 0 : it->second;
+    }
+    void set_compressed(uint32_t cluster, uint32_t bytes) { compressed[cluster] = bytes; }
+    void clear_compressed(uint32_t cluster) { compressed.erase(cluster); }
+    
+    void clear() { extents.clear(); compressed.clear(); total_blocks = 0; }
+    uint32_t block_count() const { return total_blocks; }  // Mapped blocks
+    size_t extent_count() const { return extents.size(); }
+    const std::map<uint32_t, Extent>& get_extents() const { return extents; }
+    const std::map<uint32_t, uint32_t>& get_compressed() const { return compressed; }
+};
+
+#define BITMAP_WORD_BITS    64
+#define BITMAP_GROUP_WORDS  64  // Blocks summarized together: 4096
+#define BITMAP_GROUP_BLOCKS (BITMAP_GROUP_WORDS * BITMAP_WORD_BITS)
+
+// Block allocation bitmap, one bit per block packed in 64-bit words. Each
+// group of blocks keeps a summary of its free space so searches skip full
+// or fragmented groups without looking at their words.
+class BlockBitmap {
+private:
+    struct GroupSummary {
+        uint32_t free_count;
+        uint32_t longest_free;  // Longest free run inside the group
+        uint32_t head_free;     // Free run starting at the group's first block
+        uint32_t tail_free;     // Free run ending at the group's last block
+    };
+    
+    std::vector<uint64_t> words;  // Set bits are allocated, padding included
+    std::vector<GroupSummary> groups;
+    size_t total_bits;
+    size_t free_bits;
+    
+    void update_groups(size_t first_block, size_t last_block);
+    bool find_run(size_t from, size_t to, size_t wanted, size_t& start) const;
+    size_t free_run_length(size_t start, size_t limit) const;
+    size_t longest_free_run() const;
+    
+public:
+    BlockBitmap() : total_bits(0), free_bits(0) {}
+    
+    void reset(size_t blocks);
+    bool test(size_t block) const {
+        return (words[block / BITMAP_WORD_BITS] >> (block % BITMAP_WORD_BITS)) & 1;
+    }
+    void set_range(size_t start, size_t count);
+    void clear_range(size_t start, size_t count);
+    
+    // A free run for up to wanted blocks: the first run of wanted blocks at
+    // or after goal, wrapping around, else the longest run there is. False
+    // only when nothing is free.
+    bool find_free_run(size_t goal, size_t wanted, size_t& start, size_t& length) const;
+    
+    size_t size() const { return total_bits; }
+    size_t free_count() const { return free_bits; }
+};
+
+// Blocks shared by reflink copies and deduplication. Only shared blocks
+// are tracked, as runs keyed by their first block with the number of
+// references beyond the first, so sharing a file costs one run per extent.
+// Runs are split where a reference covers part of one.
+class SharedExtents {
+private:
+    struct SharedRun {
+        uint32_t block_count;
+        uint32_t extra_refs;
+        
+        SharedRun(uint32_t count, uint32_t refs) : block_count(count), extra_refs(refs) {}
+    };
+    
+    std::map<uint32_t, SharedRun> runs;
+    
+    void split(uint32_t block);  // Starts a run at block if one covers it
+    
+public:
+    // One more file uses every block of the extent
+    void add(const Extent& extent);
+    
+    // One file fewer uses every block of the extent. The parts no other
+    // file uses are appended to unshared, to be freed.
+    void release(const Extent& extent, std::vector<Extent>& unshared);
+    
+    uint32_t shared_blocks(const Extent& extent) const;
+    uint64_t shared_blocks() const;
+    void clear() { runs.clear(); }
+};
+
+#define FS_DEDUP_INDEX_ENTRIES 65536  // Default index size, 512KB
+#define FS_DEDUP_INDEX_WAYS    4
+
+// Fingerprints of the file blocks written since mount, for inline
+// deduplication. A fixed-size set-associative table of 8-byte entries
+// holding a 32-bit tag of each fingerprint; a full set drops its oldest
+// entry. A match is only a candidate to compare byte for byte: a set has
+// one entry per tag, so a lookup verifies one block at most, and a tag
+// collision costs that read about once in 2^30 lookups. Freed blocks are
+// struck off in a bitmap, so their entries only match again once the block
+// is indexed with other data, and the comparison catches that.
+class DedupIndex {
+private:
+    struct Slot {
+        uint32_t tag;
+        uint32_t block;  // 0 for an empty slot; block 0 is the superblock
+        
+        Slot() : tag(0), block(0) {}
+    };
+    
+    std::vector<Slot> slots;  // Sets of FS_DEDUP_INDEX_WAYS, newest first
+    BlockBitmap indexed;      // Blocks whose entries are current
+    size_t set_mask;
+    
+    Slot* find_set(uint64_t fingerprint);
+    
+public:
+    DedupIndex() : set_mask(0) {}
+    
+    // Empties the index, sized to about entries for a disk of the given
+    // size; 0 entries turns it off
+    void reset(size_t entries, size_t blocks);
+    
+    bool find(uint64_t fingerprint, uint32_t& block);
+    void insert(uint64_t fingerprint, uint32_t block);
+    void forget(const Extent& extent);
+    size_t capacity() const { return slots.size(); }
+};
+
+// On-disk layout. Block 0 holds the superblock; file data and the metadata
+// checkpoint (the serialized inode table) live in blocks allocated from the
+// bitmap, and the bitmap itself is rebuilt from their extents at mount.
+// A checkpoint is written to fresh blocks and only becomes current when the
+// superblock pointing to it is written, so an interrupted sync leaves the
+// previous one intact. Changes since the checkpoint are in the journal that
+// follows the superblock and are replayed at mount. Files of up to
+// FS_INLINE_DATA_MAX bytes take no blocks; their data is in the inode.
+#define FS_MAGIC                0x53465852u  // "RXFS"
+#define FS_VERSION              4
+#define FS_SUPERBLOCK_BLOCK     0
+#define FS_CHECKPOINT_EXTENTS   32       // Room in the superblock
+#define FS_DEFAULT_IMAGE_BLOCKS 262144   // 1GB, sparse on the host
+#define FS_INLINE_DATA_MAX      256      // Files up to this size live in the inode
+
+// Integers are little endian; no padding before checksum
+struct Superblock {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t clean;                 // Unmounted after the last checkpoint
+    uint64_t block_count;
+    uint64_t generation;            // Checkpoints written
+    uint64_t checkpoint_bytes;
+    uint32_t checkpoint_checksum;   // CRC-32C of the checkpoint
+    uint32_t checkpoint_extent_count;
+    Extent checkpoint_extents[FS_CHECKPOINT_EXTENTS];
+    uint64_t journal_start;
+    uint64_t journal_blocks;        // 0 without a journal
+    uint64_t journal_sequence;      // First transaction after the checkpoint
+    uint32_t checksum;              // CRC-32C of everything above
+    uint32_t reserved;
+};
+
+// Metadata journal records, replayed in order on top of the checkpoint.
+// Block allocations need no records of their own: the bitmap is rebuilt
+// from the inodes' extents.
+enum JournalRecordType {
+    JOURNAL_RECORD_INODE = 1,   // Attributes, parent and extents
+    JOURNAL_RECORD_LINK,        // Directory entry added
+    JOURNAL_RECORD_UNLINK,      // Directory entry removed
+    JOURNAL_RECORD_FREE         // Inode freed
+};
+
+// Inode numbers; 0 is never a valid inode
+typedef uint32_t InodeId;
+#define INVALID_INODE 0
+#define ROOT_INODE    1
+
+// Name to inode link inside a directory
+struct DirectoryLink {
+    std::string name;
+    InodeId inode;     // INVALID_INODE once erased
+    uint32_t hash;
+    uint64_t cookie;   // Creation order, used as the readdir cursor
+    
+    DirectoryLink(const std::string& n, InodeId id, uint32_t h, uint64_t c)
+        : name(n), inode(id), hash(h), cookie(c) {}
+};
+
+#define DIRECTORY_INDEX_MIN_BUCKETS 8  // Power of two
+
+// A directory's links, hashed by name. Lookup, insert and erase are O(1).
+// Links stay in creation order; erased ones are left as tombstones and
+// compacted away once they outnumber the live links. Iteration resumes from
+// a cookie, so a listing cursor stays valid while entries come and go.
+class DirectoryIndex {
+private:
+    std::vector<DirectoryLink> links;
+    std::vector<uint32_t> buckets;  // Link position + 1; 0 is empty
+    size_t live_count;
+    size_t used_buckets;            // Including deleted markers
+    uint64_t next_cookie;
+    
+    size_t find_bucket(uint32_t hash, const char* name, size_t length) const;
+    void rebuild(size_t bucket_count);
+    
+public:
+    DirectoryIndex() : live_count(0), used_buckets(0), next_cookie(1) {}
+    
+    const DirectoryLink* find(const char* name, size_t length) const;
+    bool insert(const std::string& name, InodeId inode);  // False if the name exists
+    bool erase(const char* name, size_t length);
+    void clear();
+    
+    size_t size() const { return live_count; }
+    bool empty() const { return live_count == 0; }
+    
+    // Next link at or after cursor, advancing cursor past it; nullptr at the
+    // end. Start with cursor 0.
+    const DirectoryLink* next(uint64_t& cursor) const;
+};
+
+// A file or directory. Paths only exist as chains of directory links, so
+// renaming anything, including a whole directory tree, moves one link.
+//
+// lock guards attributes, extents and children. The type never changes, so
+// it can be read without the lock; so can the atomics. Readers keep the
+// access time in accessed under a shared lock, outside attributes.
+struct Inode {
+    InodeId id;
+    FileAttributes attributes;
+    ExtentTree extents;                   // Regular files
+    std::string inline_data;              // Small regular files instead of extents
+    DirectoryIndex children;              // Directories
+    std::atomic<InodeId> parent;          // Directories, for ".." and move checks
+    std::atomic<uint64_t> accessed;       // Access time
+    std::atomic<bool> unlinked;           // Out of the tree; set with the lock held
+    std::shared_mutex lock;
+    
+    Inode() : id(INVALID_INODE), parent(INVALID_INODE), accessed(0), unlinked(false) {}
+};
+
+#define INODE_TABLE_CHUNK  1024   // Inodes per chunk
+#define INODE_TABLE_CHUNKS 16384  // Up to 16M inodes
+
+// Inodes by number, in fixed chunks that never move, so get() needs no
+// lock. Changes are serialized by the caller. Removed inodes may still be
+// in use by lookups and are freed by the caller after an RCU grace period.
+class InodeTable {
+private:
+    std::unique_ptr<std::atomic<std::atomic<Inode*>*>[]> chunks;
+    std::atomic<size_t> slots;  // One past the highest number ever set
+    
+public:
+    InodeTable();
+    ~InodeTable();
+    
+    InodeTable(const InodeTable&) = delete;
+    InodeTable& operator=(const InodeTable&) = delete;
+    
+    Inode* get(InodeId id) const {
+        if (id >= INODE_TABLE_CHUNK * INODE_TABLE_CHUNKS) return nullptr;
+        std::atomic<Inode*>* chunk = chunks[id / INODE_TABLE_CHUNK].load(std::memory_order_acquire);
+        return chunk ? chunk[id % INODE_TABLE_CHUNK].load(std::memory_order_acquire) : nullptr;
+    }
+    
+    bool set(InodeId id, Inode* inode);  // Takes ownership; false past the end
+    Inode* take(InodeId id);             // Gives up ownership
+    void clear();                        // Deletes every inode; nothing may be using them
+    size_t size() const { return slots.load(std::memory_order_acquire); }
+};
+
+#define DENTRY_CACHE_SETS 1024  // Power of two
+#define DENTRY_CACHE_WAYS 4
+
+// Caches directory lookups as (parent inode, name) -> inode. A cached
+// INVALID_INODE is a negative entry: the name is known not to exist.
+// Lookups compare in place and never allocate. Each set has its own lock,
+// so lookups only contend when they hash to the same set.
+//
+// Entries for a directory change only while its lock is held, shared for
+// filling in a miss and exclusive for links and unlinks, so a lookup never
+// caches a stale result over a newer one.
+class DentryCache {
+private:
+    struct Entry {
+        uint32_t hash;
+        InodeId parent;
+        InodeId inode;
+        bool valid;
+        std::string name;
+        
+        Entry() : hash(0), parent(INVALID_INODE), inode(INVALID_INODE), valid(false) {}
+    };
+    
+    std::vector<Entry> entries;  // DENTRY_CACHE_SETS sets of DENTRY_CACHE_WAYS
+    std::vector<std::mutex> set_locks;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    
+    static uint32_t hash_name(InodeId parent, const char* name, size_t length);
+    Entry* find(uint32_t hash, InodeId parent, const char* name, size_t length);
+    
+public:
+    DentryCache();
+    
+    // True on a hit; inode is INVALID_INODE for a negative entry
+    bool lookup(InodeId parent, const char* name, size_t length, InodeId& inode);
+    void insert(InodeId parent, const char* name, size_t length, InodeId inode);
+    void clear();
+    
+    uint64_t get_hits() const { return hits.load(std::memory_order_relaxed); }
+    uint64_t get_misses() const { return misses.load(std::memory_order_relaxed); }
+};
+
+#define FS_OPEN_CREATE 0x1  // open_file() creates a missing file
+
+#define FS_READAHEAD_MIN_BLOCKS 4   // First window after a sequential read
+#define FS_READAHEAD_MAX_BLOCKS 32  // Windows double up to this
+
+// Read-ahead for an open file. Reads that carry on from the last one are
+// sequential: the blocks after them are read into the buffer cache in the
+// background, one window ahead, and the window doubles each time the
+// reader reaches it. Any other read starts over.
+struct ReadAhead {
+    uint64_t next_block;    // Where a sequential read starts
+    uint64_t window_start;  // Last window read ahead
+    uint64_t window_blocks; // 0 until the reads look sequential
+    
+    ReadAhead() : next_block(0), window_start(0), window_blocks(0) {}
+};
+
+// File handle. Reads and writes go to the inode, wherever it is moved;
+// once the file is deleted inode is INVALID_INODE and they fail.
 struct FileHandle {
     int fd;
     std::string path;
+    InodeId inode;
     int flags;
     size_t position;
     bool is_open;
+    ReadAhead readahead;
     
-    FileHandle() : fd(-1), flags(0), position(0), is_open(false) {}
+    FileHandle() : fd(-1), inode(INVALID_INODE), flags(0), position(0), is_open(false) {}
 };
 
-// Disk block
-struct DiskBlock {
-    uint8_t data[BLOCK_SIZE];
-    bool is_allocated;
-    int next_block;
+// Disk space a file takes against its size
+struct CompressionStats {
+    uint64_t size;
+    uint64_t stored_bytes;          // Whole blocks, or the inline data
+    uint32_t clusters;
+    uint32_t compressed_clusters;
     
-    DiskBlock() : is_allocated(false), next_block(-1) {
-        memset(data, 0, BLOCK_SIZE);
+    CompressionStats() : size(0), stored_bytes(0), clusters(0), compressed_clusters(0) {}
+    double ratio() const { return stored_bytes ? static_cast<double>(size) / stored_bytes : 1.0; }
+};
+
+// Blocks written with deduplication on since mount
+struct DedupStats {
+    uint64_t blocks_written;
+    uint64_t duplicate_blocks;      // Shared with a block already on disk
+    uint64_t false_positives;       // Candidates that turned out different
+    uint64_t index_entries;
+    
+    DedupStats() : blocks_written(0), duplicate_blocks(0), false_positives(0), index_entries(0) {}
+    double ratio() const {
+        return blocks_written > duplicate_blocks ?
+            static_cast<double>(blocks_written) / (blocks_written - duplicate_blocks) : 1.0;
     }
 };
 
+// Locking. Every operation holds fs_lock shared; checkpoints, mount, format
+// and snapshots hold it exclusive. Inside, locks are taken in this order:
+//   rename_mutex (moves only)
+//   directory inode locks, parents before children
+//   file inode locks
+//   table_mutex, alloc_mutex, cwd_mutex, files_mutex, dentry cache sets (leaves)
+// Lookups run in an RCU read section and take no inode locks on dentry
+// cache hits; whoever then locks an inode checks it is not unlinked.
 class FileSystem {
 private:
-    std::map<std::string, std::string> file_contents;
-    std::map<std::string, FileAttributes> file_attributes;
-    std::map<std::string, std::vector<std::string>> directory_contents;
+    std::shared_mutex fs_lock;
+    std::mutex rename_mutex;
+    
+    // Inode numbers are reused once no lookup can still hold them;
+    // table_mutex guards changes to the table, free_inodes and inode_count
+    InodeTable inode_table;
+    std::vector<InodeId> free_inodes;
+    size_t inode_count;
+    std::mutex table_mutex;
+    DentryCache dentry_cache;
+    
+    // Open files; files_mutex guards them and next_fd
     std::vector<FileHandle> open_files;
-    std::mutex fs_mutex;
+    std::mutex files_mutex;
     
-    // Disk simulation
-    std::vector<DiskBlock> disk_blocks;
-    std::vector<bool> block_allocation_table;
+    // Disk; every block goes through the buffer cache. alloc_mutex guards
+    // the bitmap, shared_extents, the dedup index and pending_frees.
+    std::unique_ptr<BlockDevice> device;
+    BufferCache buffer_cache;
+    BlockBitmap block_bitmap;
+    SharedExtents shared_extents;
+    DedupIndex dedup_index;
+    DedupStats dedup_stats;
     size_t total_blocks;
-    size_t free_blocks;
+    Superblock superblock;
+    std::mutex alloc_mutex;
+    
+    // Metadata changes since the checkpoint. Blocks freed by a change stay
+    // allocated until it commits, tagged with its transaction.
+    Journal journal;
+    std::vector<std::pair<uint64_t, Extent>> pending_frees;
+    
+    // Persistent image, empty for a filesystem that lives in memory
+    std::string disk_image_path;
+    uint64_t disk_image_blocks;
+    
+    std::atomic<bool> compression;
+    std::atomic<bool> deduplication;
     
     int next_fd;
     std::string root_path;
-    std::string current_directory;
+    std::string current_directory;             // Guarded by cwd_mutex
+    std::atomic<InodeId> current_directory_inode;  // Changed under cwd_mutex
+    std::mutex cwd_mutex;
     
     // Internal utilities
     std::string normalize_path(const std::string& path);
@@ -107,19 +567,127 @@ private:
     void free_block(int block_num);
     bool write_block(int block_num, const uint8_t* data);
     bool read_block(int block_num, uint8_t* data);
+    bool write_blocks(uint32_t start_block, const uint8_t* data, size_t size);
+    bool read_blocks(uint32_t start_block, uint8_t* data, size_t size);
     
-    // File operations helpers
-    bool create_directory_entry(const std::string& path, FileType type);
-    bool remove_directory_entry(const std::string& path);
-    void update_file_times(const std::string& path, bool access = true, bool modify = false);
+    // Extent allocation, with alloc_mutex held. goal is the block the
+    // caller would like next, so a growing file stays contiguous. Freeing
+    // a block another file shares only drops a reference.
+    bool allocate_extent(uint32_t wanted_blocks, uint32_t goal, Extent& extent);
+    void free_extent(const Extent& extent);
+    bool allocate_file_blocks(ExtentTree& tree, uint32_t block_count, uint32_t goal = 0);
+    void free_file_blocks(ExtentTree& tree);
+    
+    // File data, inline in the inode or on disk; unmapped blocks read as zeros
+    void read_file_data(const Inode* inode, size_t offset, size_t length, uint8_t* data);
+    bool write_file_data(ExtentTree& tree, const uint8_t* data, size_t size);
+    ClusterData read_cluster(const ExtentTree& tree, uint32_t cluster, uint32_t bytes);
+    
+    // Inode table. free_inode() unlinks nothing; the inode is retired and
+    // its number reused after an RCU grace period.
+    Inode* get_inode(InodeId id);
+    Inode* allocate_inode(FileType type);
+    void free_inode(Inode* inode);
+    FileAttributes get_attributes(Inode* inode);  // Caller holds inode->lock
+    
+    // Directories and path resolution, inside an RCU read section. Paths
+    // are walked as given, relative to the working directory unless
+    // absolute; no normalization needed. find_child() is for callers that
+    // hold the directory's lock, lookup_child() takes it on a cache miss.
+    Inode* find_child(Inode* directory, const char* name, size_t length);
+    Inode* lookup_child(Inode* directory, const char* name, size_t length);
+    Inode* walk_path(Inode* start, const char* path, size_t length);
+    Inode* lookup_path(const std::string& path);
+    Inode* lookup_parent(const std::string& path, const char*& name, size_t& length);
+    template <typename Lock> Inode* lookup_locked(const std::string& path, Lock& lock);
+    bool is_ancestor(Inode* ancestor, Inode* inode);
+    void link_child(Inode* directory, const std::string& name, Inode* child);
+    bool unlink_child(Inode* directory, const std::string& name);
+    
+    // File operations helpers; callers hold fs_lock and have the journal
+    // handle open. They lock the inodes they change. With open_existing,
+    // creating an entry that exists returns it instead of failing.
+    Inode* create_directory_entry(const std::string& path, FileType type, bool open_existing = false);
+    bool remove_directory_entry(const std::string& path, bool directory);
+    Inode* lookup_readable(const std::string& path, std::shared_lock<std::shared_mutex>& lock);
+    bool write_file_bytes(const std::string& path, const uint8_t* data, size_t size);
+    bool write_inode_data(Inode* inode, const uint8_t* data, size_t size);
+    bool write_inode_range(Inode* inode, size_t offset, const uint8_t* data, size_t count);
+    void update_file_times(Inode* inode, bool access = true, bool modify = false);
+    
+    // Open files; callers hold files_mutex. read_ahead() also holds the
+    // inode's lock and queues whatever the read at offset calls for.
+    FileHandle* find_open_file(int fd);
+    void read_ahead(Inode* inode, ReadAhead& state, size_t offset, size_t length);
+    
+    // Metadata on disk; callers hold fs_lock exclusive
+    void reset_inodes();
+    void rebuild_free_inodes();
+    template <typename Writer> void write_inode_fields(Writer& writer, const Inode& inode);
+    template <typename Reader> void read_inode_fields(Reader& reader, Inode& inode);
+    template <typename Writer> void write_inode_table(Writer& writer);
+    template <typename Reader> bool read_inode_table(Reader& reader);
+    bool rebuild_block_bitmap();
+    void rebuild_shared_extents();
+    bool start_journal();
+    uint64_t first_unused_sequence();
+    bool write_superblock();
+    bool write_checkpoint(bool clean);
+    bool format_locked();
+    bool mount_locked();
+    
+    // Journaling. Every metadata change runs under a JournalHandle so its
+    // records commit together; a full log is checkpointed before taking
+    // fs_lock, between operations.
+    void checkpoint_if_needed();
+    void reclaim_pending_space(size_t bytes);
+    size_t size_after_write(int fd, size_t count);
+    void journal_inode(const Inode* inode);
+    void journal_link(const Inode* directory, const std::string& name, InodeId child);
+    void journal_unlink(const Inode* directory, const std::string& name);
+    void journal_free(InodeId id);
+    bool apply_journal_record(MemoryReader& reader);
+    void release_committed_blocks();
 
 public:
     FileSystem();
     ~FileSystem();
     
+    // Mounts the disk image if one is set and exists, otherwise formats a
+    // new filesystem with the sample files
     bool initialize();
     void shutdown();
     
+    // Persistent disk image, set before initialize(). Without one the
+    // filesystem lives in memory and is gone at shutdown.
+    void set_disk_image(const std::string& image_path, uint64_t block_count = FS_DEFAULT_IMAGE_BLOCKS);
+    bool is_persistent() const { return !disk_image_path.empty(); }
+    
+    // Makes every change so far durable: commits the journal, or writes a
+    // checkpoint to an image without one. Callers syncing at the same time
+    // share a commit.
+    bool sync();
+    
+    // Journal group commit: changes commit at least every interval_ms, or
+    // as soon as max_batch records are waiting
+    void set_journal_commit(uint64_t interval_ms, uint32_t max_batch);
+    
+    // Transparent compression of files written from now on. Each cluster
+    // is compressed with LZ4 if that saves a block and stored as it is
+    // otherwise; reads decompress it into the buffer cache.
+    void set_compression(bool enabled);
+    bool get_compression_stats(const std::string& path, CompressionStats& stats);
+    
+    // Inline deduplication of blocks written from now on. Each block is
+    // fingerprinted and, when the index finds a block with the same data,
+    // shared with it instead of written. The index takes 8 bytes an entry.
+    void set_deduplication(bool enabled, size_t index_entries = FS_DEDUP_INDEX_ENTRIES);
+    void get_dedup_stats(DedupStats& stats);
+    
+    // Hibernation; restore_snapshot() replaces initialize()
+    bool save_snapshot(SnapshotWriter& writer);
+    bool restore_snapshot(SnapshotReader& reader);
+    
     // File operations
     bool create_file(const std::string& path);
     bool delete_file(const std::string& path);
@@ -130,6 +698,9 @@ public:
     bool create_directory(const std::string& path);
     bool delete_directory(const std::string& path);
     std::vector<DirectoryEntry> list_directory(const std::string& path);
+    // Paged listing: up to max_entries from cursor (0 to start), in creation
+    // order. The cursor survives concurrent creates and deletes.
+    std::vector<DirectoryEntry> list_directory(const std::string& path, uint64_t& cursor, size_t max_entries);
     bool change_directory(const std::string& path);
     std::string get_current_directory();
     
@@ -138,6 +709,15 @@ public:
     bool close_file(int fd);
     std::string read_file(const std::string& path);
     bool write_file(const std::string& path, const std::string& content);
+    bool write_file(const std::string& path, const FileBuffer& content);
+    
+    // Zero-copy reads: the whole file, or up to length bytes from offset.
+    // A range past the end of the file is empty; a missing file invalid.
+    FileBuffer read_file_buffer(const std::string& path);
+    FileBuffer read_file_buffer(const std::string& path, size_t offset, size_t length);
+    
+    // At the descriptor's position, which they advance. -1 for a bad
+    // descriptor or a deleted file.
     ssize_t read_file_fd(int fd, void* buffer, size_t count);
     ssize_t write_file_fd(int fd, const void* buffer, size_t count);
     
@@ -147,7 +727,9 @@ public:
     size_t get_file_size(const std::string& path);
     
     // File operations
-    bool copy_file(const std::string& src, const std::string& dest);
+    // A reflink copy shares the source's blocks, copied on write by either
+    // file; otherwise the data is copied
+    bool copy_file(const std::string& src, const std::string& dest, bool reflink = true);
     bool move_file(const std::string& src, const std::string& dest);
     bool rename_file(const std::string& old_name, const std::string& new_name);
     
@@ -160,8 +742,11 @@ public:
     std::string resolve_path(const std::string& path);
     bool is_valid_path(const std::string& path);
     
-    // Disk operations
+    // Disk operations. format_disk() makes an empty filesystem (mkfs) on
+    // the image or in memory and mounts it; mount() maps the image and loads
+    // the filesystem its superblock points to.
     bool format_disk();
+    bool mount();
     bool check_disk();
     void defragment_disk();
     
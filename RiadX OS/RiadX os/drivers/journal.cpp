@@ -0,0 +1,330 @@
+#include "journal.h"
+#include "../bootloader.h"
+#include "../boot/crc32.h"
+#include "../kernel/klog.h"
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+
+static uint64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t journal_checksum(const void* data, size_t size) {
+    return crc32c(data, size, (Bootloader::get_cpu_features() & CPU_FEATURE_SSE42) != 0);
+}
+
+Journal::Journal()
+    : device(nullptr), start_block(0), block_count(0), head(0),
+      running_records(0), running_since(0), next_sequence(0), committed_sequence(0),
+      requested_sequence(0), checkpoint_sequence(0), open_handles(0),
+      committing(false), paused(false), full(false), handles_awaited(false), committer_stop(false),
+      commit_interval_ms(JOURNAL_COMMIT_INTERVAL_MS), max_batch_records(JOURNAL_MAX_BATCH),
+      transactions(0), records_committed(0), blocks_written(0) {
+}
+
+Journal::~Journal() {
+    stop();
+}
+
+bool Journal::start(BlockDevice* block_device, uint64_t first_block, uint64_t blocks,
+                    uint64_t sequence, std::function<bool()> before_commit) {
+    stop();
+    if (!block_device || blocks == 0 || first_block + blocks > block_device->block_count()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    device = block_device;
+    start_block = first_block;
+    block_count = blocks;
+    head = 0;
+    flush_data = before_commit;
+    running.clear();
+    running_records = 0;
+    next_sequence = sequence;
+    committed_sequence = sequence - 1;
+    requested_sequence = 0;
+    full = false;
+    paused = false;
+    transactions = records_committed = blocks_written = 0;
+    committer_stop = false;
+    committer = std::thread(&Journal::committer_main, this);
+
+    KLOG_INFO << "[JOURNAL] Logging to blocks " << start_block << "-" << (start_block + block_count - 1)
+              << " from transaction " << next_sequence;
+    return true;
+}
+
+void Journal::stop() {
+    {
+        std::lock_guard<std::mutex> lock(journal_mutex);
+        if (!device) return;
+        committer_stop = true;
+    }
+    commit_wakeup.notify_one();
+    committer.join();
+
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    if (running_records > 0) {
+        KLOG_WARN << "[JOURNAL] Dropping " << running_records << " uncommitted records";
+    }
+    running.clear();
+    running_records = 0;
+    device = nullptr;
+    commit_done.notify_all();
+}
+
+void Journal::begin_handle() {
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    // A stream of overlapping operations must not hold off a due commit
+    handles_resumed.wait(lock, [&] { return !handles_awaited; });
+    open_handles++;
+}
+
+void Journal::end_handle() {
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(journal_mutex);
+        open_handles--;
+        wake = open_handles == 0 && handles_awaited;
+    }
+    if (wake) {
+        commit_wakeup.notify_one();
+    }
+}
+
+void Journal::append(const MemoryWriter& record) {
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(journal_mutex);
+        if (!device) return;
+
+        // The first record starts the commit interval
+        if (running_records == 0) {
+            running_since = steady_ms();
+            wake = true;
+        }
+        running.write_bytes(record.data().data(), record.size());
+        running_records++;
+        wake = wake || running_records == max_batch_records;
+    }
+    if (wake) {
+        commit_wakeup.notify_one();
+    }
+}
+
+uint64_t Journal::get_running_sequence() {
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    return next_sequence;
+}
+
+uint64_t Journal::get_committed_sequence() {
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    return committed_sequence;
+}
+
+bool Journal::commit() {
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    if (!device || full) return false;
+
+    // An empty open transaction has nothing to wait for
+    uint64_t target = running_records ? next_sequence : next_sequence - 1;
+    if (committed_sequence >= target) return true;
+
+    requested_sequence = std::max(requested_sequence, target);
+    commit_wakeup.notify_one();
+    commit_done.wait(lock, [&] { return !device || full || committed_sequence >= target; });
+    return device && committed_sequence >= target;
+}
+
+bool Journal::needs_checkpoint() {
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    return full || head * 100 >= block_count * JOURNAL_CHECKPOINT_PERCENT;
+}
+
+uint64_t Journal::begin_checkpoint() {
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    paused = true;
+    commit_done.wait(lock, [&] { return !committing; });
+
+    // The open transaction's records are part of the checkpoint
+    checkpoint_sequence = running_records ? next_sequence + 1 : next_sequence;
+    return checkpoint_sequence;
+}
+
+void Journal::end_checkpoint(bool written) {
+    {
+        std::lock_guard<std::mutex> lock(journal_mutex);
+        paused = false;
+        if (written) {
+            running.clear();
+            running_records = 0;
+            next_sequence = checkpoint_sequence;
+            committed_sequence = checkpoint_sequence - 1;
+            head = 0;
+            full = false;
+        }
+    }
+    commit_done.notify_all();
+    commit_wakeup.notify_one();
+}
+
+// Writes out the open transaction, with journal_mutex released for the I/O.
+// No handle is open on entry, and none opens until the data is written, so
+// the data flush sees no block half written; appends during the log write
+// go to the next transaction.
+bool Journal::commit_locked(std::unique_lock<std::mutex>& lock) {
+    size_t bytes = sizeof(JournalHeader) + running.size();
+    uint64_t blocks = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (head + blocks > block_count) {
+        KLOG_WARN << "[JOURNAL] Log full, waiting for a checkpoint";
+        full = true;
+        commit_done.notify_all();
+        return false;
+    }
+
+    MemoryWriter records;
+    std::swap(records, running);
+    uint32_t record_count = running_records;
+    uint64_t sequence = next_sequence++;
+    uint64_t position = head;
+    running_records = 0;
+    head += blocks;
+    committing = true;
+    handles_awaited = true;
+    lock.unlock();
+
+    // Ordered: data blocks first, so committed metadata never points at
+    // blocks that were not written
+    bool ok = !flush_data || flush_data();
+    lock.lock();
+    handles_awaited = false;
+    lock.unlock();
+    handles_resumed.notify_all();
+
+    std::vector<uint8_t> image(blocks * BLOCK_SIZE, 0);
+    JournalHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.records = record_count;
+    header.sequence = sequence;
+    header.bytes = records.size();
+    Bootloader::memcpy_boot(image.data(), &header, sizeof(header));
+    Bootloader::memcpy_boot(image.data() + sizeof(header), records.data().data(), records.size());
+    header.checksum = journal_checksum(image.data(), bytes);
+    Bootloader::memcpy_boot(image.data(), &header, sizeof(header));
+
+    for (uint64_t i = 0; i < blocks && ok; i++) {
+        ok = device->write_block(start_block + position + i, image.data() + i * BLOCK_SIZE);
+    }
+    ok = ok && device->flush();
+
+    lock.lock();
+    committing = false;
+    if (ok) {
+        committed_sequence = sequence;
+        transactions++;
+        records_committed += record_count;
+        blocks_written += blocks;
+    } else {
+        // The records are still in memory; a checkpoint will cover them
+        KLOG_ERROR << "[JOURNAL] Commit of transaction " << sequence << " failed";
+        full = true;
+    }
+    commit_done.notify_all();
+    return ok;
+}
+
+void Journal::committer_main() {
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    while (!committer_stop) {
+        if (running_records == 0 || paused || full) {
+            commit_wakeup.wait(lock);
+            continue;
+        }
+
+        uint64_t now = steady_ms();
+        bool due = requested_sequence >= next_sequence || running_records >= max_batch_records ||
+                   now - running_since >= commit_interval_ms;
+        if (!due) {
+            commit_wakeup.wait_for(lock, std::chrono::milliseconds(running_since + commit_interval_ms - now));
+            continue;
+        }
+
+        // Operations halfway through their records finish first
+        if (open_handles > 0) {
+            handles_awaited = true;
+            commit_wakeup.wait(lock, [&] { return open_handles == 0 || committer_stop || paused; });
+            handles_awaited = false;
+            handles_resumed.notify_all();
+            continue;
+        }
+
+        commit_locked(lock);
+    }
+}
+
+void Journal::set_commit(uint64_t interval_ms, uint32_t max_batch) {
+    {
+        std::lock_guard<std::mutex> lock(journal_mutex);
+        commit_interval_ms = interval_ms;
+        max_batch_records = std::max<uint32_t>(1, max_batch);
+    }
+    commit_wakeup.notify_one();
+}
+
+void Journal::print_stats() {
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    KLOG_INFO << "[JOURNAL] " << transactions << " transactions, " << records_committed << " records ("
+              << (transactions ? records_committed / transactions : 0) << " per transaction), "
+              << blocks_written << " blocks written";
+    KLOG_INFO << "[JOURNAL] " << head << "/" << block_count << " log blocks in use, "
+              << running_records << " records pending";
+}
+
+bool Journal::replay(BlockDevice* block_device, uint64_t first_block, uint64_t blocks,
+                     uint64_t& sequence, uint32_t& replayed,
+                     const std::function<bool(MemoryReader&, uint32_t)>& apply) {
+    std::vector<uint8_t> image(BLOCK_SIZE);
+    uint64_t position = 0;
+    replayed = 0;
+
+    // A torn or stale transaction ends the log
+    while (position < blocks && block_device->read_block(first_block + position, image.data())) {
+        JournalHeader header;
+        std::memcpy(&header, image.data(), sizeof(header));
+        if (header.magic != JOURNAL_MAGIC || header.sequence != sequence ||
+            header.bytes > (blocks - position) * BLOCK_SIZE) {
+            break;
+        }
+
+        size_t bytes = sizeof(JournalHeader) + header.bytes;
+        uint64_t count = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (position + count > blocks) break;
+
+        image.resize(count * BLOCK_SIZE);
+        bool complete = true;
+        for (uint64_t i = 1; i < count && complete; i++) {
+            complete = block_device->read_block(first_block + position + i, image.data() + i * BLOCK_SIZE);
+        }
+        uint32_t checksum = header.checksum;
+        std::memset(image.data() + offsetof(JournalHeader, checksum), 0, sizeof(uint32_t));
+        if (!complete || journal_checksum(image.data(), bytes) != checksum) break;
+
+        MemoryReader reader(image.data() + sizeof(JournalHeader), header.bytes);
+        if (!apply(reader, header.records)) {
+            KLOG_ERROR << "[JOURNAL] Transaction " << sequence << " does not apply";
+            return false;
+        }
+
+        position += count;
+        sequence++;
+        replayed++;
+        image.resize(BLOCK_SIZE);
+    }
+    return true;
+}
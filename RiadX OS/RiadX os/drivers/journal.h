@@ -0,0 +1,133 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "block_device.h"
+#include "../kernel/snapshot.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#define JOURNAL_MAGIC               0x4C4E524Au  // "JRNL"
+#define JOURNAL_DEFAULT_BLOCKS      1024   // 4MB log
+#define JOURNAL_COMMIT_INTERVAL_MS  1000   // Longest a change waits to commit
+#define JOURNAL_MAX_BATCH           512    // Records that force an early commit
+#define JOURNAL_CHECKPOINT_PERCENT  75     // Log use that asks for a checkpoint
+
+// Each transaction starts on a block boundary with this header, followed by
+// its records
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t records;
+    uint64_t sequence;
+    uint64_t bytes;       // Record bytes after the header
+    uint32_t checksum;    // CRC-32C of header and records, taken with this zero
+    uint32_t reserved;
+};
+
+// Write-ahead log of metadata records with group commit. Records go into
+// the open transaction; a committer thread writes it out once the commit
+// interval has passed, the batch is full or someone waits for it, so any
+// number of operations share one transaction and one device flush.
+//
+// The log is linear. A checkpoint of the full metadata makes everything in
+// it redundant and starts it over; transactions carry increasing sequence
+// numbers so replay stops at the first one left from before.
+class Journal {
+private:
+    BlockDevice* device;
+    uint64_t start_block;
+    uint64_t block_count;
+    uint64_t head;                   // Blocks written since the last checkpoint
+    std::function<bool()> flush_data;
+
+    MemoryWriter running;            // Records of the open transaction
+    uint32_t running_records;
+    uint64_t running_since;          // Steady clock ms of its first record
+    uint64_t next_sequence;          // Sequence of the open transaction
+    uint64_t committed_sequence;     // Newest durable transaction
+    uint64_t requested_sequence;     // Newest one a caller waits for
+    uint64_t checkpoint_sequence;    // Where the log continues after a checkpoint
+    int open_handles;
+    bool committing;
+    bool paused;                     // Checkpoint in progress
+    bool full;                       // Nothing commits until a checkpoint
+    bool handles_awaited;            // The committer waits for end_handle()
+                                     // or writes the data ahead of a commit;
+                                     // new handles wait until it is done
+
+    std::mutex journal_mutex;
+    std::condition_variable commit_wakeup;
+    std::condition_variable commit_done;
+    std::condition_variable handles_resumed;
+    std::thread committer;
+    bool committer_stop;
+    uint64_t commit_interval_ms;
+    uint32_t max_batch_records;
+
+    uint64_t transactions;
+    uint64_t records_committed;
+    uint64_t blocks_written;
+
+    // Callers hold journal_mutex
+    bool commit_locked(std::unique_lock<std::mutex>& lock);
+    void committer_main();
+
+public:
+    Journal();
+    ~Journal();
+
+    // Starts logging into blocks [first_block, first_block + blocks) with
+    // the given sequence. before_commit runs ahead of each transaction so
+    // data reaches the disk before the metadata that points to it; no
+    // handle is open while it runs.
+    bool start(BlockDevice* block_device, uint64_t first_block, uint64_t blocks,
+               uint64_t sequence, std::function<bool()> before_commit);
+    void stop();  // Drops whatever is not committed
+    bool active() const { return device != nullptr; }
+
+    // Records between begin_handle() and end_handle() commit together
+    void begin_handle();
+    void end_handle();
+    void append(const MemoryWriter& record);
+
+    uint64_t get_running_sequence();
+    uint64_t get_committed_sequence();
+
+    // Commits everything appended so far and waits for it. False on write
+    // errors or when the log is full and needs a checkpoint.
+    bool commit();
+    bool needs_checkpoint();
+
+    // A checkpoint covers every record appended so far. begin_checkpoint()
+    // holds off commits and returns the sequence the log continues with;
+    // end_checkpoint(true) empties the log once the checkpoint is durable.
+    uint64_t begin_checkpoint();
+    void end_checkpoint(bool written);
+
+    void set_commit(uint64_t interval_ms, uint32_t max_batch);
+    void print_stats();
+
+    // Hands the records of each valid transaction, starting at sequence, to
+    // apply; sequence ends as the first one not found. False if apply fails.
+    static bool replay(BlockDevice* block_device, uint64_t first_block, uint64_t blocks,
+                       uint64_t& sequence, uint32_t& replayed,
+                       const std::function<bool(MemoryReader&, uint32_t)>& apply);
+};
+
+// Keeps one operation's records in a single transaction
+class JournalHandle {
+private:
+    Journal* journal;
+
+public:
+    explicit JournalHandle(Journal& owner) : journal(&owner) { journal->begin_handle(); }
+    JournalHandle(JournalHandle&& other) : journal(other.journal) { other.journal = nullptr; }
+    ~JournalHandle() { if (journal) journal->end_handle(); }
+
+    JournalHandle(const JournalHandle&) = delete;
+    JournalHandle& operator=(const JournalHandle&) = delete;
+};
+
+#endif
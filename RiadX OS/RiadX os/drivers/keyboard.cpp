@@ -1,6 +1,6 @@
 #include "keyboard.h"
-#include <iostream>
-#include <chrono>
+#include "../kernel/klog.h"
+#include "../kernel/sim_clock.h"
 #include <thread>
 #include <random>
 #include <cstring>
@@ -8,9 +8,9 @@
 KeyboardDriver::KeyboardDriver() 
     : shift_pressed(false), ctrl_pressed(false), alt_pressed(false),
       caps_lock(false), num_lock(true), scroll_lock(false),
-      hardware_initialized(false) {
+      hardware_initialized(false), input_active(false) {
     
-    std::cout << "[KEYBOARD] Keyboard driver initializing..." << std::endl;
+    KLOG_INFO << "[KEYBOARD] Keyboard driver initializing...";
     
     // Initialize key states
     std::memset(key_states, false, sizeof(key_states));
@@ -93,24 +93,24 @@ bool KeyboardDriver::initialize() {
     try {
         // Initialize hardware (simulated)
         hardware_initialized = true;
-        
-        // Start keyboard input simulation thread
-        std::thread input_thread(&KeyboardDriver::simulate_keyboard_input, this);
-        input_thread.detach();
+        interrupt_rng = sim_rng("keyboard.interrupt");
         
         // Set initial LED state
         update_leds();
         
-        std::cout << "[KEYBOARD] Keyboard driver initialized" << std::endl;
+        KLOG_INFO << "[KEYBOARD] Keyboard driver initialized";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[KEYBOARD] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[KEYBOARD] Exception during initialization: " << e.what();
         return false;
     }
 }
 
 void KeyboardDriver::shutdown() {
+    // Join the input thread before taking keyboard_mutex, it injects events under it
+    stop_input();
+    
     std::lock_guard<std::mutex> lock(keyboard_mutex);
     
     hardware_initialized = false;
@@ -121,21 +121,58 @@ void KeyboardDriver::shutdown() {
         event_queue.pop();
     }
     
-    std::cout << "[KEYBOARD] Keyboard driver shutdown complete" << std::endl;
+    KLOG_INFO << "[KEYBOARD] Keyboard driver shutdown complete";
+}
+
+bool KeyboardDriver::start_input() {
+    if (!hardware_initialized) {
+        KLOG_ERROR << "[KEYBOARD] Cannot start input before initialization";
+        return false;
+    }
+    
+    // Held until the thread is started, so a concurrent stop_input() either
+    // runs first or sees the new thread to join
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (input_active) {
+        return true;
+    }
+    
+    input_active = true;
+    sim_thread_starting();
+    input_thread = std::thread(&KeyboardDriver::simulate_keyboard_input, this);
+    KLOG_INFO << "[KEYBOARD] Input simulation started";
+    return true;
+}
+
+void KeyboardDriver::stop_input() {
+    // The join stays under input_mutex: the input thread never takes it, and
+    // a start_input() waiting on it must not replace a joinable thread
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (!input_active) return;
+    input_active = false;
+    sim_notify();
+    
+    if (input_thread.joinable()) {
+        input_thread.join();
+    }
+    KLOG_INFO << "[KEYBOARD] Input simulation stopped";
+}
+
+bool KeyboardDriver::wait_input_delay(int milliseconds) {
+    // Returns false as soon as stop_input() is called
+    return sim_sleep_ms(milliseconds, [this]() { return !input_active; });
 }
 
 void KeyboardDriver::handle_interrupt() {
     // In a real system, this would read from the keyboard controller
     // For simulation, we'll generate some events
     
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> key_dis(KEY_A, KEY_Z);
-    static std::uniform_int_distribution<> type_dis(0, 1);
+    std::uniform_int_distribution<> key_dis(KEY_A, KEY_Z);
+    std::uniform_int_distribution<> type_dis(0, 1);
     
-    if (gen() % 1000 < 5) { // 0.5% chance per interrupt
-        KeyCode key = static_cast<KeyCode>(key_dis(gen));
-        KeyEventType type = static_cast<KeyEventType>(type_dis(gen));
+    if (interrupt_rng() % 1000 < 5) { // 0.5% chance per interrupt
+        KeyCode key = static_cast<KeyCode>(key_dis(interrupt_rng));
+        KeyEventType type = static_cast<KeyEventType>(type_dis(interrupt_rng));
         inject_key_event(key, type);
     }
 }
@@ -178,8 +215,7 @@ void KeyboardDriver::process_scancode(uint8_t scancode) {
     event.ctrl_pressed = ctrl_pressed;
     event.alt_pressed = alt_pressed;
     event.ascii_char = keycode_to_ascii(keycode, shift_pressed, caps_lock);
-    event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
+    event.timestamp = sim_now_ms();
     
     // Add to event queue
     event_queue.push(event);
@@ -190,11 +226,12 @@ void KeyboardDriver::process_scancode(uint8_t scancode) {
     }
     
     if (!key_released) {
-        std::cout << "[KEYBOARD] Key pressed: " << keycode_to_string(keycode);
         if (event.ascii_char) {
-            std::cout << " ('" << event.ascii_char << "')";
+            KLOG_DEBUG << "[KEYBOARD] Key pressed: " << keycode_to_string(keycode)
+                       << " ('" << event.ascii_char << "')";
+        } else {
+            KLOG_DEBUG << "[KEYBOARD] Key pressed: " << keycode_to_string(keycode);
         }
-        std::cout << std::endl;
     }
 }
 
@@ -345,22 +382,22 @@ void KeyboardDriver::set_leds(bool caps, bool num, bool scroll) {
 
 void KeyboardDriver::update_leds() {
     // In a real system, this would send commands to the keyboard controller
-    std::cout << "[KEYBOARD] LEDs: CAPS=" << (caps_lock ? "ON" : "OFF")
+    KLOG_DEBUG << "[KEYBOARD] LEDs: CAPS=" << (caps_lock ? "ON" : "OFF")
               << " NUM=" << (num_lock ? "ON" : "OFF")
-              << " SCROLL=" << (scroll_lock ? "ON" : "OFF") << std::endl;
+              << " SCROLL=" << (scroll_lock ? "ON" : "OFF");
 }
 
 void KeyboardDriver::print_keyboard_state() {
     std::lock_guard<std::mutex> lock(keyboard_mutex);
     
-    std::cout << "[KEYBOARD] Keyboard State:" << std::endl;
-    std::cout << "  Shift: " << (shift_pressed ? "Pressed" : "Released") << std::endl;
-    std::cout << "  Ctrl: " << (ctrl_pressed ? "Pressed" : "Released") << std::endl;
-    std::cout << "  Alt: " << (alt_pressed ? "Pressed" : "Released") << std::endl;
-    std::cout << "  Caps Lock: " << (caps_lock ? "ON" : "OFF") << std::endl;
-    std::cout << "  Num Lock: " << (num_lock ? "ON" : "OFF") << std::endl;
-    std::cout << "  Scroll Lock: " << (scroll_lock ? "ON" : "OFF") << std::endl;
-    std::cout << "  Events in queue: " << event_queue.size() << std::endl;
+    KLOG_INFO << "[KEYBOARD] Keyboard State:";
+    KLOG_INFO << "  Shift: " << (shift_pressed ? "Pressed" : "Released");
+    KLOG_INFO << "  Ctrl: " << (ctrl_pressed ? "Pressed" : "Released");
+    KLOG_INFO << "  Alt: " << (alt_pressed ? "Pressed" : "Released");
+    KLOG_INFO << "  Caps Lock: " << (caps_lock ? "ON" : "OFF");
+    KLOG_INFO << "  Num Lock: " << (num_lock ? "ON" : "OFF");
+    KLOG_INFO << "  Scroll Lock: " << (scroll_lock ? "ON" : "OFF");
+    KLOG_INFO << "  Events in queue: " << event_queue.size();
 }
 
 void KeyboardDriver::inject_key_event(KeyCode keycode, KeyEventType type) {
@@ -383,21 +420,19 @@ void KeyboardDriver::inject_key_event(KeyCode keycode, KeyEventType type) {
 
 void KeyboardDriver::simulate_keyboard_input() {
     // Simulate periodic keyboard input for demonstration
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    SimThread sim_thread;
+    std::mt19937 gen = sim_rng("keyboard.input");
     std::uniform_int_distribution<> delay_dis(2000, 8000);
     std::uniform_int_distribution<> key_dis(KEY_A, KEY_Z);
     
-    while (hardware_initialized) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_dis(gen)));
-        
-        if (!hardware_initialized) break;
+    while (input_active) {
+        if (!wait_input_delay(delay_dis(gen))) break;
         
         // Simulate a key press and release
         KeyCode key = static_cast<KeyCode>(key_dis(gen));
         inject_key_event(key, KEY_PRESSED);
         
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        wait_input_delay(100);
         inject_key_event(key, KEY_RELEASED);
     }
 }
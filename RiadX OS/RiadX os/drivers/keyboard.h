@@ -5,6 +5,9 @@
 #include <queue>
 #include <string>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
 #include <functional>
 
 // Key codes
@@ -86,7 +89,12 @@ private:
     
     // Hardware simulation
     bool hardware_initialized;
+    std::atomic<bool> input_active;
+    std::thread input_thread;
+    std::mutex input_mutex;  // Serializes start_input() and stop_input()
+    std::mt19937 interrupt_rng;
     void simulate_keyboard_input();
+    bool wait_input_delay(int milliseconds);
 
 public:
     KeyboardDriver();
@@ -95,6 +103,11 @@ public:
     bool initialize();
     void shutdown();
     
+    // Input simulation, started on first open of the driver
+    bool start_input();
+    void stop_input();
+    bool is_input_active() const { return input_active; }
+    
     // Event handling
     void handle_interrupt();
     void process_scancode(uint8_t scancode);
@@ -1,6 +1,6 @@
 #include "mouse.h"
-#include <iostream>
-#include <chrono>
+#include "../kernel/klog.h"
+#include "../kernel/sim_clock.h"
 #include <thread>
 #include <random>
 #include <algorithm>
@@ -9,9 +9,9 @@ MouseDriver::MouseDriver()
     : current_x(0), current_y(0), 
       screen_width(1024), screen_height(768),
       sensitivity_x(1.0f), sensitivity_y(1.0f), acceleration_enabled(true),
-      hardware_initialized(false) {
+      hardware_initialized(false), input_active(false) {
     
-    std::cout << "[MOUSE] Mouse driver initializing..." << std::endl;
+    KLOG_INFO << "[MOUSE] Mouse driver initializing...";
     
     // Initialize button states
     for (int i = 0; i < 5; i++) {
@@ -33,22 +33,22 @@ bool MouseDriver::initialize() {
     try {
         // Initialize hardware (simulated)
         hardware_initialized = true;
+        interrupt_rng = sim_rng("mouse.interrupt");
         
-        // Start mouse input simulation thread
-        std::thread input_thread(&MouseDriver::simulate_mouse_input, this);
-        input_thread.detach();
-        
-        std::cout << "[MOUSE] Mouse driver initialized at position (" 
-                  << current_x << ", " << current_y << ")" << std::endl;
+        KLOG_INFO << "[MOUSE] Mouse driver initialized at position (" 
+                  << current_x << ", " << current_y << ")";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[MOUSE] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[MOUSE] Exception during initialization: " << e.what();
         return false;
     }
 }
 
 void MouseDriver::shutdown() {
+    // Join the input thread before taking mouse_mutex, it injects events under it
+    stop_input();
+    
     std::lock_guard<std::mutex> lock(mouse_mutex);
     
     hardware_initialized = false;
@@ -59,30 +59,67 @@ void MouseDriver::shutdown() {
         event_queue.pop();
     }
     
-    std::cout << "[MOUSE] Mouse driver shutdown complete" << std::endl;
+    KLOG_INFO << "[MOUSE] Mouse driver shutdown complete";
+}
+
+bool MouseDriver::start_input() {
+    if (!hardware_initialized) {
+        KLOG_ERROR << "[MOUSE] Cannot start input before initialization";
+        return false;
+    }
+    
+    // Held until the thread is started, so a concurrent stop_input() either
+    // runs first or sees the new thread to join
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (input_active) {
+        return true;
+    }
+    
+    input_active = true;
+    sim_thread_starting();
+    input_thread = std::thread(&MouseDriver::simulate_mouse_input, this);
+    KLOG_INFO << "[MOUSE] Input simulation started";
+    return true;
+}
+
+void MouseDriver::stop_input() {
+    // The join stays under input_mutex: the input thread never takes it, and
+    // a start_input() waiting on it must not replace a joinable thread
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (!input_active) return;
+    input_active = false;
+    sim_notify();
+    
+    if (input_thread.joinable()) {
+        input_thread.join();
+    }
+    KLOG_INFO << "[MOUSE] Input simulation stopped";
+}
+
+bool MouseDriver::wait_input_delay(int milliseconds) {
+    // Returns false as soon as stop_input() is called
+    return sim_sleep_ms(milliseconds, [this]() { return !input_active; });
 }
 
 void MouseDriver::handle_interrupt() {
     // In a real system, this would read from the mouse controller
     // For simulation, we'll generate some movement events
     
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> move_dis(-5, 5);
-    static std::uniform_int_distribution<> button_dis(0, 100);
+    std::uniform_int_distribution<> move_dis(-5, 5);
+    std::uniform_int_distribution<> button_dis(0, 100);
     
-    if (gen() % 100 < 10) { // 10% chance per interrupt
-        int delta_x = move_dis(gen);
-        int delta_y = move_dis(gen);
+    if (interrupt_rng() % 100 < 10) { // 10% chance per interrupt
+        int delta_x = move_dis(interrupt_rng);
+        int delta_y = move_dis(interrupt_rng);
         
         if (delta_x != 0 || delta_y != 0) {
             inject_mouse_event(MOUSE_MOVED, current_x + delta_x, current_y + delta_y);
         }
         
         // Occasional button events
-        if (button_dis(gen) > 95) {
+        if (button_dis(interrupt_rng) > 95) {
             inject_mouse_event(MOUSE_BUTTON_PRESSED, current_x, current_y, MOUSE_BUTTON_LEFT);
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            sim_sleep_ms(50);
             inject_mouse_event(MOUSE_BUTTON_RELEASED, current_x, current_y, MOUSE_BUTTON_LEFT);
         }
     }
@@ -132,8 +169,7 @@ void MouseDriver::process_mouse_packet(uint8_t packet[3]) {
         event.left_pressed = left_button;
         event.right_pressed = right_button;
         event.middle_pressed = middle_button;
-        event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        event.timestamp = sim_now_ms();
         
         event_queue.push(event);
         
@@ -169,8 +205,7 @@ void MouseDriver::create_button_event(MouseButton button, MouseEventType type) {
     event.left_pressed = button_states[MOUSE_BUTTON_LEFT];
     event.right_pressed = button_states[MOUSE_BUTTON_RIGHT];
     event.middle_pressed = button_states[MOUSE_BUTTON_MIDDLE];
-    event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
+    event.timestamp = sim_now_ms();
     
     event_queue.push(event);
     
@@ -179,9 +214,9 @@ void MouseDriver::create_button_event(MouseButton button, MouseEventType type) {
         callback(event);
     }
     
-    std::cout << "[MOUSE] Button " << static_cast<int>(button) 
+    KLOG_DEBUG << "[MOUSE] Button " << static_cast<int>(button) 
               << (type == MOUSE_BUTTON_PRESSED ? " pressed" : " released")
-              << " at (" << current_x << ", " << current_y << ")" << std::endl;
+              << " at (" << current_x << ", " << current_y << ")";
 }
 
 bool MouseDriver::has_events() {
@@ -221,7 +256,7 @@ void MouseDriver::set_position(int x, int y) {
     current_x = std::max(0, std::min(screen_width - 1, x));
     current_y = std::max(0, std::min(screen_height - 1, y));
     
-    std::cout << "[MOUSE] Position set to (" << current_x << ", " << current_y << ")" << std::endl;
+    KLOG_DEBUG << "[MOUSE] Position set to (" << current_x << ", " << current_y << ")";
 }
 
 bool MouseDriver::is_button_pressed(MouseButton button) {
@@ -239,7 +274,7 @@ void MouseDriver::set_sensitivity(float x_sens, float y_sens) {
     sensitivity_x = std::max(0.1f, std::min(5.0f, x_sens));
     sensitivity_y = std::max(0.1f, std::min(5.0f, y_sens));
     
-    std::cout << "[MOUSE] Sensitivity set to (" << sensitivity_x << ", " << sensitivity_y << ")" << std::endl;
+    KLOG_INFO << "[MOUSE] Sensitivity set to (" << sensitivity_x << ", " << sensitivity_y << ")";
 }
 
 void MouseDriver::get_sensitivity(float& x_sens, float& y_sens) {
@@ -251,7 +286,7 @@ void MouseDriver::get_sensitivity(float& x_sens, float& y_sens) {
 void MouseDriver::set_acceleration(bool enabled) {
     std::lock_guard<std::mutex> lock(mouse_mutex);
     acceleration_enabled = enabled;
-    std::cout << "[MOUSE] Acceleration " << (enabled ? "enabled" : "disabled") << std::endl;
+    KLOG_INFO << "[MOUSE] Acceleration " << (enabled ? "enabled" : "disabled");
 }
 
 bool MouseDriver::get_acceleration() {
@@ -268,7 +303,7 @@ void MouseDriver::set_screen_bounds(int width, int height) {
     // Clamp current position to new bounds
     clamp_position();
     
-    std::cout << "[MOUSE] Screen bounds set to " << width << "x" << height << std::endl;
+    KLOG_INFO << "[MOUSE] Screen bounds set to " << width << "x" << height;
 }
 
 void MouseDriver::clamp_position() {
@@ -297,28 +332,28 @@ void MouseDriver::remove_all_callbacks() {
 }
 
 void MouseDriver::show_cursor() {
-    std::cout << "[MOUSE] Cursor shown" << std::endl;
+    KLOG_DEBUG << "[MOUSE] Cursor shown";
 }
 
 void MouseDriver::hide_cursor() {
-    std::cout << "[MOUSE] Cursor hidden" << std::endl;
+    KLOG_DEBUG << "[MOUSE] Cursor hidden";
 }
 
 void MouseDriver::set_cursor_shape(int shape) {
-    std::cout << "[MOUSE] Cursor shape set to " << shape << std::endl;
+    KLOG_DEBUG << "[MOUSE] Cursor shape set to " << shape;
 }
 
 void MouseDriver::print_mouse_state() {
     std::lock_guard<std::mutex> lock(mouse_mutex);
     
-    std::cout << "[MOUSE] Mouse State:" << std::endl;
-    std::cout << "  Position: (" << current_x << ", " << current_y << ")" << std::endl;
-    std::cout << "  Left Button: " << (button_states[MOUSE_BUTTON_LEFT] ? "Pressed" : "Released") << std::endl;
-    std::cout << "  Right Button: " << (button_states[MOUSE_BUTTON_RIGHT] ? "Pressed" : "Released") << std::endl;
-    std::cout << "  Middle Button: " << (button_states[MOUSE_BUTTON_MIDDLE] ? "Pressed" : "Released") << std::endl;
-    std::cout << "  Sensitivity: (" << sensitivity_x << ", " << sensitivity_y << ")" << std::endl;
-    std::cout << "  Acceleration: " << (acceleration_enabled ? "Enabled" : "Disabled") << std::endl;
-    std::cout << "  Events in queue: " << event_queue.size() << std::endl;
+    KLOG_INFO << "[MOUSE] Mouse State:";
+    KLOG_INFO << "  Position: (" << current_x << ", " << current_y << ")";
+    KLOG_INFO << "  Left Button: " << (button_states[MOUSE_BUTTON_LEFT] ? "Pressed" : "Released");
+    KLOG_INFO << "  Right Button: " << (button_states[MOUSE_BUTTON_RIGHT] ? "Pressed" : "Released");
+    KLOG_INFO << "  Middle Button: " << (button_states[MOUSE_BUTTON_MIDDLE] ? "Pressed" : "Released");
+    KLOG_INFO << "  Sensitivity: (" << sensitivity_x << ", " << sensitivity_y << ")";
+    KLOG_INFO << "  Acceleration: " << (acceleration_enabled ? "Enabled" : "Disabled");
+    KLOG_INFO << "  Events in queue: " << event_queue.size();
 }
 
 void MouseDriver::inject_mouse_event(MouseEventType type, int x, int y, MouseButton button) {
@@ -326,8 +361,7 @@ void MouseDriver::inject_mouse_event(MouseEventType type, int x, int y, MouseBut
     
     MouseEvent event;
     event.type = type;
-    event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
+    event.timestamp = sim_now_ms();
     
     switch (type) {
         case MOUSE_MOVED:
@@ -378,16 +412,14 @@ void MouseDriver::inject_mouse_event(MouseEventType type, int x, int y, MouseBut
 
 void MouseDriver::simulate_mouse_input() {
     // Simulate periodic mouse input for demonstration
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    SimThread sim_thread;
+    std::mt19937 gen = sim_rng("mouse.input");
     std::uniform_int_distribution<> delay_dis(3000, 10000);
     std::uniform_int_distribution<> move_dis(-20, 20);
     std::uniform_int_distribution<> button_dis(0, 100);
     
-    while (hardware_initialized) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_dis(gen)));
-        
-        if (!hardware_initialized) break;
+    while (input_active) {
+        if (!wait_input_delay(delay_dis(gen))) break;
         
         // Simulate mouse movement
         int delta_x = move_dis(gen);
@@ -402,7 +434,7 @@ void MouseDriver::simulate_mouse_input() {
             MouseButton btn = static_cast<MouseButton>(button_dis(gen) % 3);
             inject_mouse_event(MOUSE_BUTTON_PRESSED, current_x, current_y, btn);
             
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            wait_input_delay(100);
             inject_mouse_event(MOUSE_BUTTON_RELEASED, current_x, current_y, btn);
         }
     }
@@ -4,6 +4,9 @@
 #include <queue>
 #include <vector>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
 #include <functional>
 
 // Mouse button constants
@@ -61,7 +64,12 @@ private:
     
     // Hardware simulation
     bool hardware_initialized;
+    std::atomic<bool> input_active;
+    std::thread input_thread;
+    std::mutex input_mutex;  // Serializes start_input() and stop_input()
+    std::mt19937 interrupt_rng;
     void simulate_mouse_input();
+    bool wait_input_delay(int milliseconds);
     
     // Utility functions
     void clamp_position();
@@ -74,6 +82,11 @@ public:
     bool initialize();
     void shutdown();
     
+    // Input simulation, started on first open of the driver
+    bool start_input();
+    void stop_input();
+    bool is_input_active() const { return input_active; }
+    
     // Event handling
     void handle_interrupt();
     void process_mouse_packet(uint8_t packet[3]);
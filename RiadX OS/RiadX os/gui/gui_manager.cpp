@@ -1,15 +1,17 @@
 #include "gui_manager.h"
-#include <iostream>
+#include "../kernel/snapshot.h"
+#include "../kernel/trace.h"
+#include "../kernel/klog.h"
 #include <algorithm>
 #include <chrono>
 
 GUIManager::GUIManager(DisplayDriver* display, KeyboardDriver* keyboard, MouseDriver* mouse)
     : display_driver(display), keyboard_driver(keyboard), mouse_driver(mouse),
-      show_desktop(true), show_taskbar(true), start_menu_open(false),
+      window_list(new WindowList()), show_desktop(true), show_taskbar(true), start_menu_open(false),
       last_mouse_x(0), last_mouse_y(0), mouse_dragging(false),
       drag_start_x(0), drag_start_y(0), gui_running(false) {
     
-    std::cout << "[GUI] GUI Manager initializing..." << std::endl;
+    KLOG_INFO << "[GUI] GUI Manager initializing...";
     
     // Initialize taskbar
     int screen_width, screen_height, bpp;
@@ -34,18 +36,22 @@ GUIManager::~GUIManager() {
     shutdown();
 }
 
+void GUIManager::setup_event_callbacks() {
+    keyboard_driver->add_event_callback([this](const KeyEvent& event) {
+        handle_keyboard_event(event);
+    });
+    
+    mouse_driver->add_event_callback([this](const MouseEvent& event) {
+        handle_mouse_event(event);
+    });
+}
+
 bool GUIManager::initialize() {
     std::lock_guard<std::mutex> lock(gui_mutex);
     
     try {
         // Set up event callbacks
-        keyboard_driver->add_event_callback([this](const KeyEvent& event) {
-            handle_keyboard_event(event);
-        });
-        
-        mouse_driver->add_event_callback([this](const MouseEvent& event) {
-            handle_mouse_event(event);
-        });
+        setup_event_callbacks();
         
         // Create desktop icons
         add_desktop_icon("Calculator", "/bin/calculator", 50, 50);
@@ -56,11 +62,11 @@ bool GUIManager::initialize() {
         create_sample_windows();
         
         gui_running = true;
-        std::cout << "[GUI] GUI Manager initialized" << std::endl;
+        KLOG_INFO << "[GUI] GUI Manager initialized";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[GUI] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[GUI] Exception during initialization: " << e.what();
         return false;
     }
 }
@@ -77,10 +83,147 @@ void GUIManager::shutdown() {
     
     // Close all windows
     windows.clear();
+    publish_windows();
+    window_apps.clear();
     focused_window.reset();
     dragging_window.reset();
     
-    std::cout << "[GUI] GUI Manager shutdown complete" << std::endl;
+    KLOG_INFO << "[GUI] GUI Manager shutdown complete";
+}
+
+static void write_color(SnapshotWriter& writer, const Color& color) {
+    writer.write_u8(color.r);
+    writer.write_u8(color.g);
+    writer.write_u8(color.b);
+    writer.write_u8(color.a);
+}
+
+static Color read_color(SnapshotReader& reader) {
+    uint8_t r = reader.read_u8();
+    uint8_t g = reader.read_u8();
+    uint8_t b = reader.read_u8();
+    uint8_t a = reader.read_u8();
+    return Color(r, g, b, a);
+}
+
+bool GUIManager::save_snapshot(SnapshotWriter& writer) {
+    std::lock_guard<std::mutex> lock(gui_mutex);
+    
+    writer.begin_section(SNAPSHOT_SECTION_GUI);
+    
+    const Color* theme_colors[] = {
+        &current_theme.desktop_background, &current_theme.window_title_active,
+        &current_theme.window_title_inactive, &current_theme.window_border_active,
+        &current_theme.window_border_inactive, &current_theme.menu_background,
+        &current_theme.menu_text, &current_theme.button_background, &current_theme.button_text
+    };
+    for (const Color* color : theme_colors) {
+        write_color(writer, *color);
+    }
+    writer.write_bool(show_desktop);
+    writer.write_bool(show_taskbar);
+    
+    writer.write_u32(static_cast<uint32_t>(desktop_icons.size()));
+    for (const auto& icon : desktop_icons) {
+        writer.write_string(icon.name);
+        writer.write_string(icon.executable_path);
+        writer.write_i32(icon.x);
+        writer.write_i32(icon.y);
+    }
+    
+    // Back to front, so recreating them in order restores the stacking
+    writer.write_u32(static_cast<uint32_t>(windows.size()));
+    for (const auto& window : windows) {
+        auto app = window_apps.find(window->get_id());
+        const Rect& bounds = window->get_bounds();
+        writer.write_string(app != window_apps.end() ? app->second : "");
+        writer.write_string(window->get_title());
+        writer.write_i32(bounds.x);
+        writer.write_i32(bounds.y);
+        writer.write_i32(bounds.width);
+        writer.write_i32(bounds.height);
+        writer.write_u32(window->get_state());
+        writer.write_bool(window->is_visible());
+        writer.write_bool(window == focused_window);
+        write_color(writer, window->get_background_color());
+    }
+    writer.end_section();
+    
+    KLOG_INFO << "[GUI] Saved " << windows.size() << " windows to snapshot";
+    return writer.good();
+}
+
+bool GUIManager::restore_snapshot(SnapshotReader& reader) {
+    if (!reader.enter_section(SNAPSHOT_SECTION_GUI)) {
+        KLOG_ERROR << "[GUI] Snapshot has no GUI section";
+        return false;
+    }
+    
+    setup_event_callbacks();
+    
+    Color* theme_colors[] = {
+        &current_theme.desktop_background, &current_theme.window_title_active,
+        &current_theme.window_title_inactive, &current_theme.window_border_active,
+        &current_theme.window_border_inactive, &current_theme.menu_background,
+        &current_theme.menu_text, &current_theme.button_background, &current_theme.button_text
+    };
+    for (Color* color : theme_colors) {
+        *color = read_color(reader);
+    }
+    show_desktop = reader.read_bool();
+    show_taskbar = reader.read_bool();
+    
+    uint32_t icons = reader.read_u32();
+    for (uint32_t i = 0; i < icons && reader.good(); i++) {
+        std::string name = reader.read_string();
+        std::string executable = reader.read_string();
+        int x = reader.read_i32();
+        int y = reader.read_i32();
+        add_desktop_icon(name, executable, x, y);
+    }
+    
+    // Window ids are reassigned; everything else comes back as saved
+    std::shared_ptr<Window> focus;
+    uint32_t count = reader.read_u32();
+    for (uint32_t i = 0; i < count && reader.good(); i++) {
+        std::string app = reader.read_string();
+        std::string title = reader.read_string();
+        int x = reader.read_i32();
+        int y = reader.read_i32();
+        int width = reader.read_i32();
+        int height = reader.read_i32();
+        WindowState state = static_cast<WindowState>(reader.read_u32());
+        bool visible = reader.read_bool();
+        bool focused = reader.read_bool();
+        Color background = read_color(reader);
+        if (!reader.good()) break;
+        
+        auto window = create_window(title, x, y, width, height);
+        window->set_background_color(background);
+        if (!app.empty()) {
+            attach_app_content(window, app);
+        }
+        if (visible) {
+            window->show();
+        }
+        window->set_state(state);
+        if (focused) {
+            focus = window;
+        }
+    }
+    
+    if (!reader.good()) {
+        KLOG_ERROR << "[GUI] Corrupt GUI section in snapshot";
+        return false;
+    }
+    
+    if (focus) {
+        focus_window(focus);
+    }
+    
+    gui_running = true;
+    KLOG_INFO << "[GUI] GUI Manager restored " << windows.size() << " windows from snapshot";
+    return true;
 }
 
 void GUIManager::run() {
@@ -88,7 +231,7 @@ void GUIManager::run() {
 }
 
 void GUIManager::gui_main_loop() {
-    std::cout << "[GUI] Starting GUI main loop" << std::endl;
+    KLOG_INFO << "[GUI] Starting GUI main loop";
     
     auto last_frame_time = std::chrono::high_resolution_clock::now();
     const auto target_frame_time = std::chrono::milliseconds(16); // ~60 FPS
@@ -110,10 +253,12 @@ void GUIManager::gui_main_loop() {
         last_frame_time = frame_end;
     }
     
-    std::cout << "[GUI] GUI main loop ended" << std::endl;
+    KLOG_INFO << "[GUI] GUI main loop ended";
 }
 
 void GUIManager::render_frame() {
+    TraceScope trace(TRACE_GUI_FRAME);
+    
     // Clear screen
     display_driver->clear_screen(current_theme.desktop_background);
     
@@ -174,8 +319,9 @@ void GUIManager::draw_taskbar() {
     display_driver->draw_text(start_button_rect.x + 10, start_button_rect.y + 8, "Start", current_theme.button_text);
     
     // Draw window buttons in taskbar
+    RcuReadGuard guard;
     int button_x = 100;
-    for (const auto& window : windows) {
+    for (const auto& window : *window_list.read()) {
         if (window->is_visible() && window->get_state() != WINDOW_MINIMIZED) {
             Rect button_rect(button_x, taskbar_rect.y + 5, 120, 30);
             Color button_color = (window == focused_window) ? Color(180, 180, 180) : current_theme.button_background;
@@ -216,13 +362,16 @@ void GUIManager::draw_start_menu() {
 }
 
 void GUIManager::composite_windows() {
-    // Sort windows by Z-order (back to front)
-    std::vector<std::shared_ptr<Window>> sorted_windows = windows;
+    // The published list is already in Z-order (back to front) and does not
+    // change under us, so no copy or lock is needed
+    RcuReadGuard guard;
+    TraceScope trace(TRACE_GUI_COMPOSITE);
     
     // Render windows from back to front
-    for (auto& window : sorted_windows) {
+    for (auto& window : *window_list.read()) {
         if (window->is_visible() && window->get_state() != WINDOW_MINIMIZED) {
             window->paint();
+            trace.result++;
             
             // Copy window buffer to display
             PixelBuffer* window_buffer = window->get_buffer();
@@ -360,9 +509,17 @@ void GUIManager::handle_keyboard_event(const KeyEvent& event) {
     }
 }
 
+// Called with gui_mutex held
+void GUIManager::publish_windows() {
+    window_list.publish(new WindowList(windows));
+}
+
 std::shared_ptr<Window> GUIManager::get_window_at_point(int x, int y) {
+    RcuReadGuard guard;
+    const WindowList* list = window_list.read();
+    
     // Search from front to back
-    for (auto it = windows.rbegin(); it != windows.rend(); ++it) {
+    for (auto it = list->rbegin(); it != list->rend(); ++it) {
         auto window = *it;
         if (window->is_visible() && window->get_state() != WINDOW_MINIMIZED && 
             window->contains_point(x, y)) {
@@ -377,6 +534,7 @@ void GUIManager::bring_window_to_front(std::shared_ptr<Window> window) {
     if (it != windows.end()) {
         windows.erase(it);
         windows.push_back(window);
+        publish_windows();
     }
 }
 
@@ -432,7 +590,7 @@ void GUIManager::handle_menu_click(int x, int y) {
 }
 
 void GUIManager::execute_menu_action(const std::string& action) {
-    std::cout << "[GUI] Executing menu action: " << action << std::endl;
+    KLOG_DEBUG << "[GUI] Executing menu action: " << action;
     
     if (action == "launch_calculator") {
         launch_application("/bin/calculator");
@@ -452,14 +610,33 @@ void GUIManager::execute_menu_action(const std::string& action) {
 }
 
 void GUIManager::launch_application(const std::string& executable_path) {
-    std::cout << "[GUI] Launching application: " << executable_path << std::endl;
+    KLOG_INFO << "[GUI] Launching application: " << executable_path;
     
     // Create appropriate window based on application
     std::shared_ptr<Window> app_window = nullptr;
     
     if (executable_path.find("calculator") != std::string::npos) {
         app_window = create_window("Calculator", 200, 200, 300, 400);
-        app_window->set_paint_callback([](PixelBuffer* buffer) {
+    } else if (executable_path.find("editor") != std::string::npos) {
+        app_window = create_window("Text Editor", 300, 150, 600, 500);
+    } else if (executable_path.find("filemanager") != std::string::npos) {
+        app_window = create_window("File Manager", 250, 100, 700, 600);
+    }
+    
+    if (app_window) {
+        attach_app_content(app_window, executable_path);
+        app_window->show();
+        focus_window(app_window);
+    }
+}
+
+// Window contents are code, not data, so windows remember which app drew
+// them and a resumed snapshot rebinds the painter from that name
+void GUIManager::attach_app_content(std::shared_ptr<Window> window, const std::string& app) {
+    PaintCallback painter;
+    
+    if (app.find("calculator") != std::string::npos) {
+        painter = [](PixelBuffer* buffer) {
             // Simple calculator interface
             buffer->fill_rect(Rect(10, 40, 280, 50), Color(255, 255, 255));
             buffer->draw_text(20, 60, "0", Color(0, 0, 0));
@@ -476,17 +653,15 @@ void GUIManager::launch_application(const std::string& executable_path) {
                 buffer->fill_rect(Rect(x, y, 65, 45), Color(220, 220, 220));
                 buffer->draw_text(x + 25, y + 20, buttons[i], Color(0, 0, 0));
             }
-        });
-    } else if (executable_path.find("editor") != std::string::npos) {
-        app_window = create_window("Text Editor", 300, 150, 600, 500);
-        app_window->set_paint_callback([](PixelBuffer* buffer) {
+        };
+    } else if (app.find("editor") != std::string::npos) {
+        painter = [](PixelBuffer* buffer) {
             // Simple text editor interface
             buffer->fill_rect(Rect(10, 40, 580, 450), Color(255, 255, 255));
             buffer->draw_text(20, 60, "Type your text here...", Color(128, 128, 128));
-        });
-    } else if (executable_path.find("filemanager") != std::string::npos) {
-        app_window = create_window("File Manager", 250, 100, 700, 600);
-        app_window->set_paint_callback([](PixelBuffer* buffer) {
+        };
+    } else if (app.find("filemanager") != std::string::npos) {
+        painter = [](PixelBuffer* buffer) {
             // Simple file manager interface
             buffer->fill_rect(Rect(10, 40, 680, 50), Color(240, 240, 240));
             buffer->draw_text(20, 60, "Path: /home/user", Color(0, 0, 0));
@@ -500,12 +675,24 @@ void GUIManager::launch_application(const std::string& executable_path) {
                 int y = 120 + i * 25;
                 buffer->draw_text(20, y, files[i], Color(0, 0, 0));
             }
-        });
+        };
+    } else if (app == "welcome") {
+        painter = [](PixelBuffer* buffer) {
+            buffer->draw_text(20, 60, "Welcome to MyOS!", Color(0, 0, 0));
+            buffer->draw_text(20, 90, "This is a demonstration operating system", Color(0, 0, 0));
+            buffer->draw_text(20, 120, "with a graphical user interface.", Color(0, 0, 0));
+            buffer->draw_text(20, 160, "Features:", Color(0, 0, 0));
+            buffer->draw_text(30, 190, "- Window management", Color(0, 0, 0));
+            buffer->draw_text(30, 210, "- File system", Color(0, 0, 0));
+            buffer->draw_text(30, 230, "- Process management", Color(0, 0, 0));
+            buffer->draw_text(30, 250, "- Device drivers", Color(0, 0, 0));
+            buffer->draw_text(20, 290, "Click on desktop icons to launch applications!", Color(0, 0, 0));
+        };
     }
     
-    if (app_window) {
-        app_window->show();
-        focus_window(app_window);
+    if (painter) {
+        window->set_paint_callback(painter);
+        window_apps[window->get_id()] = app;
     }
 }
 
@@ -552,6 +739,7 @@ std::shared_ptr<Window> GUIManager::create_window(const std::string& title, int
     
     auto window = std::make_shared<Window>(title, x, y, width, height, style);
     windows.push_back(window);
+    publish_windows();
     
     // Set up window event callbacks
     window->set_window_event_callback([this](const WindowEvent& event) {
@@ -560,7 +748,7 @@ std::shared_ptr<Window> GUIManager::create_window(const std::string& title, int
         }
     });
     
-    std::cout << "[GUI] Created window: " << title << std::endl;
+    KLOG_DEBUG << "[GUI] Created window: " << title;
     return window;
 }
 
@@ -576,6 +764,8 @@ void GUIManager::destroy_window(std::shared_ptr<Window> window) {
     }
     
     windows.erase(std::remove(windows.begin(), windows.end(), window), windows.end());
+    publish_windows();
+    window_apps.erase(window->get_id());
 }
 
 void GUIManager::close_window(int window_id) {
@@ -586,7 +776,8 @@ void GUIManager::close_window(int window_id) {
 }
 
 std::shared_ptr<Window> GUIManager::get_window(int window_id) {
-    for (auto& window : windows) {
+    RcuReadGuard guard;
+    for (auto& window : *window_list.read()) {
         if (window->get_id() == window_id) {
             return window;
         }
@@ -595,7 +786,8 @@ std::shared_ptr<Window> GUIManager::get_window(int window_id) {
 }
 
 std::vector<std::shared_ptr<Window>> GUIManager::get_all_windows() {
-    return windows;
+    RcuReadGuard guard;
+    return *window_list.read();
 }
 
 void GUIManager::add_desktop_icon(const std::string& name, const std::string& executable, int x, int y) {
@@ -612,17 +804,7 @@ void GUIManager::remove_desktop_icon(const std::string& name) {
 void GUIManager::create_sample_windows() {
     // Create a welcome window
     auto welcome_window = create_window("Welcome to MyOS", 100, 100, 500, 350);
-    welcome_window->set_paint_callback([](PixelBuffer* buffer) {
-        buffer->draw_text(20, 60, "Welcome to MyOS!", Color(0, 0, 0));
-        buffer->draw_text(20, 90, "This is a demonstration operating system", Color(0, 0, 0));
-        buffer->draw_text(20, 120, "with a graphical user interface.", Color(0, 0, 0));
-        buffer->draw_text(20, 160, "Features:", Color(0, 0, 0));
-        buffer->draw_text(30, 190, "- Window management", Color(0, 0, 0));
-        buffer->draw_text(30, 210, "- File system", Color(0, 0, 0));
-        buffer->draw_text(30, 230, "- Process management", Color(0, 0, 0));
-        buffer->draw_text(30, 250, "- Device drivers", Color(0, 0, 0));
-        buffer->draw_text(20, 290, "Click on desktop icons to launch applications!", Color(0, 0, 0));
-    });
+    attach_app_content(welcome_window, "welcome");
     welcome_window->show();
     focus_window(welcome_window);
 }
@@ -633,7 +815,8 @@ void GUIManager::show_task_manager() {
         buffer->draw_text(20, 60, "Running Processes:", Color(0, 0, 0));
         
         int y = 90;
-        for (const auto& window : windows) {
+        RcuReadGuard guard;
+        for (const auto& window : *window_list.read()) {
             if (window->is_visible()) {
                 std::string info = "Window: " + window->get_title() + " (ID: " + std::to_string(window->get_id()) + ")";
                 buffer->draw_text(30, y, info, Color(0, 0, 0));
@@ -685,10 +868,10 @@ void GUIManager::show_error_dialog(const std::string& title, const std::string&
 void GUIManager::print_gui_state() {
     std::lock_guard<std::mutex> lock(gui_mutex);
     
-    std::cout << "[GUI] GUI State:" << std::endl;
-    std::cout << "  Windows: " << windows.size() << std::endl;
-    std::cout << "  Desktop icons: " << desktop_icons.size() << std::endl;
-    std::cout << "  Start menu open: " << (start_menu_open ? "Yes" : "No") << std::endl;
-    std::cout << "  Focused window: " << (focused_window ? focused_window->get_title() : "None") << std::endl;
-    std::cout << "  Mouse dragging: " << (mouse_dragging ? "Yes" : "No") << std::endl;
+    KLOG_INFO << "[GUI] GUI State:";
+    KLOG_INFO << "  Windows: " << windows.size();
+    KLOG_INFO << "  Desktop icons: " << desktop_icons.size();
+    KLOG_INFO << "  Start menu open: " << (start_menu_open ? "Yes" : "No");
+    KLOG_INFO << "  Focused window: " << (focused_window ? focused_window->get_title() : "None");
+    KLOG_INFO << "  Mouse dragging: " << (mouse_dragging ? "Yes" : "No");
 }
@@ -12,6 +12,10 @@
 #include "../drivers/display.h"
 #include "../drivers/keyboard.h"
 #include "../drivers/mouse.h"
+#include "../kernel/rcu.h"
+
+class SnapshotWriter;
+class SnapshotReader;
 
 // Desktop wallpaper and theme
 struct Theme {
@@ -48,6 +52,9 @@ struct DesktopIcon {
         : name(n), executable_path(exec), x(x), y(y), width(64), height(64), selected(false) {}
 };
 
+// Window stack, back to front
+typedef std::vector<std::shared_ptr<Window>> WindowList;
+
 // System menu
 struct MenuItem {
     std::string text;
@@ -65,7 +72,9 @@ private:
     KeyboardDriver* keyboard_driver;
     MouseDriver* mouse_driver;
     
-    std::vector<std::shared_ptr<Window>> windows;
+    std::vector<std::shared_ptr<Window>> windows;  // Writer side, guarded by gui_mutex
+    RcuPointer<WindowList> window_list;            // Published copy for the render loop and queries
+    std::map<int, std::string> window_apps;  // Window id -> app that paints it
     std::shared_ptr<Window> focused_window;
     std::shared_ptr<Window> dragging_window;
     std::mutex gui_mutex;
@@ -91,10 +100,12 @@ private:
     std::thread gui_thread;
     
     // Event handling
+    void setup_event_callbacks();
     void handle_mouse_event(const MouseEvent& event);
     void handle_keyboard_event(const KeyEvent& event);
     
     // Window management
+    void publish_windows();
     std::shared_ptr<Window> get_window_at_point(int x, int y);
     void bring_window_to_front(std::shared_ptr<Window> window);
     void focus_window(std::shared_ptr<Window> window);
@@ -119,6 +130,7 @@ private:
     
     // Application launching
     void launch_application(const std::string& executable_path);
+    void attach_app_content(std::shared_ptr<Window> window, const std::string& app);
     void create_sample_windows();
     
     // Rendering
@@ -136,6 +148,10 @@ public:
     void shutdown();
     void run();
     
+    // Hibernation; restore_snapshot() replaces initialize()
+    bool save_snapshot(SnapshotWriter& writer);
+    bool restore_snapshot(SnapshotReader& reader);
+    
     // Window management
     std::shared_ptr<Window> create_window(const std::string& title, int x, int y, int width, int height, int style = WINDOW_STYLE_NORMAL);
     void destroy_window(std::shared_ptr<Window> window);
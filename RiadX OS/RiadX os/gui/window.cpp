@@ -1,7 +1,7 @@
 #include "window.h"
-#include <iostream>
+#include "../kernel/klog.h"
+#include "../kernel/sim_clock.h"
 #include <algorithm>
-#include <chrono>
 
 int Window::next_window_id = 1;
 
@@ -13,13 +13,13 @@ Window::Window(const std::string& title, int x, int y, int width, int height, in
     
     create_window_buffer();
     
-    std::cout << "[WINDOW] Created window " << window_id << " \"" << title << "\" at (" 
-              << x << ", " << y << ") size " << width << "x" << height << std::endl;
+    KLOG_DEBUG << "[WINDOW] Created window " << window_id << " \"" << title << "\" at (" 
+              << x << ", " << y << ") size " << width << "x" << height;
 }
 
 Window::~Window() {
     destroy_window_buffer();
-    std::cout << "[WINDOW] Destroyed window " << window_id << " \"" << title << "\"" << std::endl;
+    KLOG_DEBUG << "[WINDOW] Destroyed window " << window_id << " \"" << title << "\"";
 }
 
 void Window::create_window_buffer() {
@@ -40,8 +40,7 @@ void Window::set_title(const std::string& new_title) {
     WindowEvent event;
     event.type = WINDOW_MOVED; // Using moved as a generic change event
     event.window_id = window_id;
-    event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
+    event.timestamp = sim_now_ms();
     
     if (window_event_callback) {
         window_event_callback(event);
@@ -64,8 +63,7 @@ void Window::set_bounds(const Rect& new_bounds) {
         event.y = bounds.y;
         event.width = bounds.width;
         event.height = bounds.height;
-        event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        event.timestamp = sim_now_ms();
         
         if (window_event_callback) {
             window_event_callback(event);
@@ -78,8 +76,7 @@ void Window::set_bounds(const Rect& new_bounds) {
         event.y = bounds.y;
         event.width = bounds.width;
         event.height = bounds.height;
-        event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        event.timestamp = sim_now_ms();
         
         if (window_event_callback) {
             window_event_callback(event);
@@ -138,8 +135,7 @@ void Window::set_state(WindowState new_state) {
     event.y = bounds.y;
     event.width = bounds.width;
     event.height = bounds.height;
-    event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
+    event.timestamp = sim_now_ms();
     
     if (window_event_callback) {
         window_event_callback(event);
@@ -167,8 +163,7 @@ void Window::close() {
         WindowEvent event;
         event.type = WINDOW_CLOSED;
         event.window_id = window_id;
-        event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        event.timestamp = sim_now_ms();
         
         if (window_event_callback) {
             window_event_callback(event);
@@ -188,8 +183,7 @@ void Window::show() {
         event.y = bounds.y;
         event.width = bounds.width;
         event.height = bounds.height;
-        event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        event.timestamp = sim_now_ms();
         
         if (window_event_callback) {
             window_event_callback(event);
@@ -204,8 +198,7 @@ void Window::hide() {
         WindowEvent event;
         event.type = WINDOW_DEACTIVATED;
         event.window_id = window_id;
-        event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        event.timestamp = sim_now_ms();
         
         if (window_event_callback) {
             window_event_callback(event);
@@ -221,8 +214,7 @@ void Window::set_focus(bool focus) {
         WindowEvent event;
         event.type = focus ? WINDOW_ACTIVATED : WINDOW_DEACTIVATED;
         event.window_id = window_id;
-        event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        event.timestamp = sim_now_ms();
         
         if (window_event_callback) {
             window_event_callback(event);
@@ -419,12 +411,12 @@ void Window::set_parent_window(Window* parent) {
 
 void Window::bring_to_front() {
     // This would be implemented by the window manager
-    std::cout << "[WINDOW] Bringing window " << window_id << " to front" << std::endl;
+    KLOG_DEBUG << "[WINDOW] Bringing window " << window_id << " to front";
 }
 
 void Window::send_to_back() {
     // This would be implemented by the window manager
-    std::cout << "[WINDOW] Sending window " << window_id << " to back" << std::endl;
+    KLOG_DEBUG << "[WINDOW] Sending window " << window_id << " to back";
 }
 
 void Window::center_on_screen(int screen_width, int screen_height) {
@@ -459,11 +451,11 @@ Rect Window::get_title_bar_rect() const {
 }
 
 void Window::print_window_info() const {
-    std::cout << "[WINDOW] Window " << window_id << " \"" << title << "\":" << std::endl;
-    std::cout << "  Position: (" << bounds.x << ", " << bounds.y << ")" << std::endl;
-    std::cout << "  Size: " << bounds.width << "x" << bounds.height << std::endl;
-    std::cout << "  State: " << static_cast<int>(state) << std::endl;
-    std::cout << "  Visible: " << (visible ? "Yes" : "No") << std::endl;
-    std::cout << "  Focused: " << (focused ? "Yes" : "No") << std::endl;
-    std::cout << "  Child windows: " << child_windows.size() << std::endl;
+    KLOG_INFO << "[WINDOW] Window " << window_id << " \"" << title << "\":";
+    KLOG_INFO << "  Position: (" << bounds.x << ", " << bounds.y << ")";
+    KLOG_INFO << "  Size: " << bounds.width << "x" << bounds.height;
+    KLOG_INFO << "  State: " << static_cast<int>(state);
+    KLOG_INFO << "  Visible: " << (visible ? "Yes" : "No");
+    KLOG_INFO << "  Focused: " << (focused ? "Yes" : "No");
+    KLOG_INFO << "  Child windows: " << child_windows.size();
 }
@@ -0,0 +1,180 @@
+#include "driver_registry.h"
+#include "klog.h"
+
+DriverRegistry::DriverRegistry() : table_view(new DriverTableView()) {
+    KLOG_INFO << "[DRIVERS] Driver registry initialized";
+}
+
+DriverRegistry::~DriverRegistry() {
+    shutdown();
+}
+
+void DriverRegistry::shutdown() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    // Deactivate in reverse registration order
+    for (auto it = drivers.rbegin(); it != drivers.rend(); ++it) {
+        if (it->active && it->deactivate) {
+            it->deactivate();
+        }
+        it->active = false;
+        it->ref_count = 0;
+    }
+
+    drivers.clear();
+    name_index.clear();
+    publish_table();
+}
+
+// Called with registry_mutex held
+void DriverRegistry::publish_table() {
+    DriverTableView* view = new DriverTableView();
+    view->drivers.reserve(drivers.size());
+    for (const DriverEntry& entry : drivers) {
+        view->drivers.push_back(entry.driver);
+    }
+    view->name_index = name_index;
+    table_view.publish(view);
+}
+
+bool DriverRegistry::is_valid_handle(DriverHandle handle) const {
+    return handle >= 0 && handle < static_cast<int>(drivers.size()) &&
+           drivers[handle].driver != nullptr;
+}
+
+DriverHandle DriverRegistry::register_driver(const std::string& name, void* driver,
+                                             DriverActivateCallback activate,
+                                             DriverDeactivateCallback deactivate) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    if (!driver) {
+        KLOG_ERROR << "[DRIVERS] Refusing to register null driver: " << name;
+        return INVALID_DRIVER_HANDLE;
+    }
+
+    if (name_index.find(name) != name_index.end()) {
+        KLOG_ERROR << "[DRIVERS] Driver already registered: " << name;
+        return INVALID_DRIVER_HANDLE;
+    }
+
+    DriverEntry entry;
+    entry.name = name;
+    entry.driver = driver;
+    entry.activate = activate;
+    entry.deactivate = deactivate;
+
+    DriverHandle handle = static_cast<DriverHandle>(drivers.size());
+    drivers.push_back(entry);
+    name_index[name] = handle;
+    publish_table();
+
+    KLOG_INFO << "[DRIVERS] Registered driver: " << name << " (handle " << handle << ")";
+    return handle;
+}
+
+bool DriverRegistry::unregister_driver(DriverHandle handle) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    if (!is_valid_handle(handle)) {
+        return false;
+    }
+
+    DriverEntry& entry = drivers[handle];
+    if (entry.ref_count > 0) {
+        KLOG_ERROR << "[DRIVERS] Driver still in use: " << entry.name;
+        return false;
+    }
+
+    name_index.erase(entry.name);
+
+    // Keep the slot so that other handles stay valid
+    entry = DriverEntry();
+    publish_table();
+    return true;
+}
+
+DriverHandle DriverRegistry::find_driver(const std::string& name) {
+    RcuReadGuard guard;
+    const DriverTableView* view = table_view.read();
+    auto it = view->name_index.find(name);
+    return (it != view->name_index.end()) ? it->second : INVALID_DRIVER_HANDLE;
+}
+
+void* DriverRegistry::open_driver(DriverHandle handle) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    if (!is_valid_handle(handle)) {
+        return nullptr;
+    }
+
+    DriverEntry& entry = drivers[handle];
+    if (!entry.active) {
+        if (entry.activate && !entry.activate()) {
+            KLOG_ERROR << "[DRIVERS] Failed to activate driver: " << entry.name;
+            return nullptr;
+        }
+        entry.active = true;
+        KLOG_DEBUG << "[DRIVERS] Activated driver: " << entry.name;
+    }
+
+    entry.ref_count++;
+    return entry.driver;
+}
+
+void DriverRegistry::close_driver(DriverHandle handle) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    if (!is_valid_handle(handle)) {
+        return;
+    }
+
+    DriverEntry& entry = drivers[handle];
+    if (entry.ref_count == 0) {
+        return;
+    }
+
+    entry.ref_count--;
+    if (entry.ref_count == 0 && entry.active) {
+        if (entry.deactivate) {
+            entry.deactivate();
+        }
+        entry.active = false;
+        KLOG_DEBUG << "[DRIVERS] Deactivated driver: " << entry.name;
+    }
+}
+
+void* DriverRegistry::get_driver(DriverHandle handle) {
+    RcuReadGuard guard;
+    const DriverTableView* view = table_view.read();
+    return (handle >= 0 && handle < static_cast<int>(view->drivers.size())) ? view->drivers[handle] : nullptr;
+}
+
+int DriverRegistry::get_ref_count(DriverHandle handle) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    return is_valid_handle(handle) ? drivers[handle].ref_count : 0;
+}
+
+bool DriverRegistry::is_active(DriverHandle handle) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    return is_valid_handle(handle) && drivers[handle].active;
+}
+
+size_t DriverRegistry::get_driver_count() {
+    RcuReadGuard guard;
+    return table_view.read()->name_index.size();
+}
+
+void DriverRegistry::print_driver_table() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    KLOG_INFO << "[DRIVERS] Driver Table:";
+    KLOG_INFO << "Handle\tRefs\tActive\tName";
+
+    for (size_t i = 0; i < drivers.size(); i++) {
+        const DriverEntry& entry = drivers[i];
+        if (!entry.driver) continue;
+
+        KLOG_INFO << i << "\t" << entry.ref_count << "\t"
+                  << (entry.active ? "Yes" : "No") << "\t" << entry.name;
+    }
+}
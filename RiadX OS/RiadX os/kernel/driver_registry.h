@@ -0,0 +1,95 @@
+#ifndef DRIVER_REGISTRY_H
+#define DRIVER_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include "rcu.h"
+
+// Driver handles are indices into the registry table
+typedef int DriverHandle;
+#define INVALID_DRIVER_HANDLE -1
+
+// Built-in drivers are registered by the kernel in this order,
+// so their handles are known at compile time
+enum BuiltinDriver {
+    DRIVER_DISPLAY = 0,
+    DRIVER_KEYBOARD = 1,
+    DRIVER_MOUSE = 2,
+    DRIVER_FILESYSTEM = 3,
+    BUILTIN_DRIVER_COUNT
+};
+
+// Called on the first open / last close of a driver
+using DriverActivateCallback = std::function<bool()>;
+using DriverDeactivateCallback = std::function<void()>;
+
+struct DriverEntry {
+    std::string name;
+    void* driver;
+    DriverActivateCallback activate;
+    DriverDeactivateCallback deactivate;
+    int ref_count;
+    bool active;
+
+    DriverEntry() : driver(nullptr), ref_count(0), active(false) {}
+};
+
+// Immutable handle and name lookup tables for lock-free readers
+struct DriverTableView {
+    std::vector<void*> drivers;  // Indexed by handle, null for free slots
+    std::map<std::string, DriverHandle> name_index;
+};
+
+class DriverRegistry {
+private:
+    std::vector<DriverEntry> drivers;
+    std::map<std::string, DriverHandle> name_index;
+    std::mutex registry_mutex;
+
+    // Republished on register/unregister; open/close only touch drivers
+    RcuPointer<DriverTableView> table_view;
+    void publish_table();
+
+    bool is_valid_handle(DriverHandle handle) const;
+
+public:
+    DriverRegistry();
+    ~DriverRegistry();
+
+    void shutdown();
+
+    // Registration
+    DriverHandle register_driver(const std::string& name, void* driver,
+                                 DriverActivateCallback activate = nullptr,
+                                 DriverDeactivateCallback deactivate = nullptr);
+    bool unregister_driver(DriverHandle handle);
+
+    // Name resolution (slow path, resolve once and keep the handle)
+    DriverHandle find_driver(const std::string& name);
+
+    // Reference counted access; the first open activates the driver
+    void* open_driver(DriverHandle handle);
+    void close_driver(DriverHandle handle);
+
+    // O(1) lock-free lookup without touching the reference count
+    void* get_driver(DriverHandle handle);
+
+    template <typename T>
+    T* get_driver_as(DriverHandle handle) { return static_cast<T*>(get_driver(handle)); }
+
+    template <typename T>
+    T* open_driver_as(DriverHandle handle) { return static_cast<T*>(open_driver(handle)); }
+
+    // Driver information
+    int get_ref_count(DriverHandle handle);
+    bool is_active(DriverHandle handle);
+    size_t get_driver_count();
+
+    // Debug functions
+    void print_driver_table();
+};
+
+#endif
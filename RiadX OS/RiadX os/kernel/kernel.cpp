@@ -1,10 +1,13 @@
 #include "kernel.h"
-#include <iostream>
+#include "snapshot.h"
+#include "trace.h"
+#include "klog.h"
+#include "sim_clock.h"
 #include <thread>
 #include <chrono>
 
-RiadXOS::RiadXOS() : running(false) {
-    std::cout << "[KERNEL] Initializing kernel..." << std::endl;
+RiadXOS::RiadXOS() : running(false), fs_compression(false), fs_deduplication(false) {
+    KLOG_INFO << "[KERNEL] Initializing kernel...";
 }
 
 RiadXOS::~RiadXOS() {
@@ -13,19 +16,50 @@ RiadXOS::~RiadXOS() {
 
 bool RiadXOS::initialize() {
     std::lock_guard<std::mutex> lock(kernel_mutex);
+    return initialize_components(nullptr);
+}
+
+void RiadXOS::set_disk_image(const std::string& path) {
+    disk_image = path;
+}
+
+void RiadXOS::set_filesystem_compression(bool enabled) {
+    fs_compression = enabled;
+}
+
+void RiadXOS::set_filesystem_deduplication(bool enabled) {
+    fs_deduplication = enabled;
+}
+
+void RiadXOS::set_trace_export(const std::string& path) {
+    trace_path = path;
+}
+
+void RiadXOS::set_hibernate_on_shutdown(const std::string& path) {
+    hibernate_path = path;
+}
+
+// Brings up every subsystem. With a snapshot, stateful components restore
+// from it instead of building their default state from scratch.
+bool RiadXOS::initialize_components(SnapshotReader* snapshot) {
+    // Log writes leave the calling thread from here on
+    klog_start();
+    
+    // Cheap enough to stay on; exported at shutdown with set_trace_export()
+    trace_enable(true);
     
     try {
         // Initialize memory manager
         memory_manager = std::make_unique<MemoryManager>();
-        if (!memory_manager->initialize()) {
-            std::cerr << "[KERNEL] Failed to initialize memory manager" << std::endl;
+        if (!(snapshot ? memory_manager->restore_snapshot(*snapshot) : memory_manager->initialize())) {
+            KLOG_ERROR << "[KERNEL] Failed to initialize memory manager";
             return false;
         }
         
         // Initialize process manager
         process_manager = std::make_unique<ProcessManager>();
-        if (!process_manager->initialize()) {
-            std::cerr << "[KERNEL] Failed to initialize process manager" << std::endl;
+        if (!(snapshot ? process_manager->restore_snapshot(*snapshot) : process_manager->initialize())) {
+            KLOG_ERROR << "[KERNEL] Failed to initialize process manager";
             return false;
         }
         
@@ -34,14 +68,35 @@ bool RiadXOS::initialize() {
         keyboard_driver = std::make_unique<KeyboardDriver>();
         mouse_driver = std::make_unique<MouseDriver>();
         filesystem = std::make_unique<FileSystem>();
+        if (!disk_image.empty()) {
+            filesystem->set_disk_image(disk_image);
+        }
         
         if (!display_driver->initialize() ||
             !keyboard_driver->initialize() ||
             !mouse_driver->initialize() ||
-            !filesystem->initialize()) {
-            std::cerr << "[KERNEL] Failed to initialize drivers" << std::endl;
+            !(snapshot ? filesystem->restore_snapshot(*snapshot) : filesystem->initialize())) {
+            KLOG_ERROR << "[KERNEL] Failed to initialize drivers";
             return false;
         }
+        if (fs_compression) {
+            filesystem->set_compression(true);
+        }
+        if (fs_deduplication) {
+            filesystem->set_deduplication(true);
+        }
+        
+        // Register drivers; the order must match BuiltinDriver. Input drivers
+        // only start their hardware threads when first opened.
+        driver_registry = std::make_unique<DriverRegistry>();
+        driver_registry->register_driver("display", display_driver.get());
+        driver_registry->register_driver("keyboard", keyboard_driver.get(),
+            [this]() { return keyboard_driver->start_input(); },
+            [this]() { keyboard_driver->stop_input(); });
+        driver_registry->register_driver("mouse", mouse_driver.get(),
+            [this]() { return mouse_driver->start_input(); },
+            [this]() { mouse_driver->stop_input(); });
+        driver_registry->register_driver("filesystem", filesystem.get());
         
         // Initialize system calls
         syscalls = std::make_unique<SystemCalls>(this);
@@ -50,32 +105,89 @@ bool RiadXOS::initialize() {
         gui_manager = std::make_unique<GUIManager>(display_driver.get(), 
                                                    keyboard_driver.get(), 
                                                    mouse_driver.get());
-        if (!gui_manager->initialize()) {
-            std::cerr << "[KERNEL] Failed to initialize GUI manager" << std::endl;
+        if (!(snapshot ? gui_manager->restore_snapshot(*snapshot) : gui_manager->initialize())) {
+            KLOG_ERROR << "[KERNEL] Failed to initialize GUI manager";
             return false;
         }
         
         running = true;
-        std::cout << "[KERNEL] Kernel initialized successfully" << std::endl;
+        KLOG_INFO << "[KERNEL] Kernel initialized successfully";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[KERNEL] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[KERNEL] Exception during initialization: " << e.what();
+        return false;
+    }
+}
+
+bool RiadXOS::hibernate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(kernel_mutex);
+    
+    if (!running) return false;
+    return write_snapshot(path);
+}
+
+// Called with kernel_mutex held while running
+bool RiadXOS::write_snapshot(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    SnapshotWriter writer;
+    if (!writer.open(path) ||
+        !memory_manager->save_snapshot(writer) ||
+        !process_manager->save_snapshot(writer) ||
+        !filesystem->save_snapshot(writer) ||
+        !gui_manager->save_snapshot(writer) ||
+        !writer.finish()) {
+        KLOG_ERROR << "[KERNEL] Failed to write snapshot " << path;
         return false;
     }
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    KLOG_INFO << "[KERNEL] Hibernated to " << path << " in " << elapsed << "ms";
+    return true;
+}
+
+bool RiadXOS::resume(const std::string& path) {
+    std::lock_guard<std::mutex> lock(kernel_mutex);
+    
+    auto start = std::chrono::steady_clock::now();
+    SnapshotReader snapshot;
+    if (!snapshot.open(path)) {
+        return false;
+    }
+    
+    if (!initialize_components(&snapshot)) {
+        KLOG_ERROR << "[KERNEL] Failed to resume from " << path;
+        return false;
+    }
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    KLOG_INFO << "[KERNEL] Resumed from " << path << " in " << elapsed << "ms";
+    return true;
 }
 
 void RiadXOS::run() {
-    std::cout << "[KERNEL] Starting kernel main loop..." << std::endl;
+    KLOG_INFO << "[KERNEL] Starting kernel main loop...";
     
     // Start scheduler in separate thread
     std::thread scheduler_thread([this]() {
         while (running) {
             scheduler_tick();
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            // In deterministic mode the timer drives the virtual clock and
+            // runs as fast as the simulated work allows
+            if (sim_enabled()) {
+                sim_advance(10);
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
         }
     });
     
+    // The GUI consumes input, so the input drivers go live now
+    open_driver(DRIVER_KEYBOARD);
+    open_driver(DRIVER_MOUSE);
+    
     // Start GUI main loop
     gui_manager->run();
     
@@ -90,15 +202,27 @@ void RiadXOS::shutdown() {
     
     if (!running) return;
     
-    std::cout << "[KERNEL] Shutting down..." << std::endl;
+    KLOG_INFO << "[KERNEL] Shutting down...";
+    
+    // Saved while every component is still up
+    if (!hibernate_path.empty()) {
+        write_snapshot(hibernate_path);
+    }
     running = false;
     
     // Shutdown components in reverse order
     if (gui_manager) gui_manager->shutdown();
+    if (driver_registry) driver_registry->shutdown();
     if (process_manager) process_manager->shutdown();
     if (filesystem) filesystem->shutdown();
     
-    std::cout << "[KERNEL] Shutdown complete" << std::endl;
+    // Every traced thread has stopped by now
+    if (!trace_path.empty()) {
+        trace_export_chrome(trace_path);
+    }
+    
+    KLOG_INFO << "[KERNEL] Shutdown complete";
+    klog_stop();
 }
 
 void MyOS::scheduler_tick() {
@@ -124,7 +248,7 @@ void MyOS::handle_interrupt(int interrupt_id) {
             }
             break;
         default:
-            std::cout << "[KERNEL] Unknown interrupt: " << interrupt_id << std::endl;
+            KLOG_INFO << "[KERNEL] Unknown interrupt: " << interrupt_id;
     }
 }
 
@@ -135,19 +259,32 @@ int MyOS::system_call(int call_id, void* params) {
     return -1;
 }
 
-bool MyOS::register_driver(const std::string& name, void* driver) {
-    // Driver registration logic
-    std::cout << "[KERNEL] Registering driver: " << name << std::endl;
-    return true;
+bool RiadXOS::register_driver(const std::string& name, void* driver) {
+    if (!driver_registry) return false;
+    return driver_registry->register_driver(name, driver) != INVALID_DRIVER_HANDLE;
 }
 
-void* MyOS::get_driver(const std::string& name) {
-    // Driver lookup logic
-    if (name == "display") return display_driver.get();
-    if (name == "keyboard") return keyboard_driver.get();
-    if (name == "mouse") return mouse_driver.get();
-    if (name == "filesystem") return filesystem.get();
-    return nullptr;
+void* RiadXOS::get_driver(const std::string& name) {
+    // Slow path kept for compatibility; hot callers should keep a DriverHandle
+    return get_driver(find_driver(name));
+}
+
+DriverHandle RiadXOS::find_driver(const std::string& name) {
+    return driver_registry ? driver_registry->find_driver(name) : INVALID_DRIVER_HANDLE;
+}
+
+void* RiadXOS::get_driver(DriverHandle handle) {
+    return driver_registry ? driver_registry->get_driver(handle) : nullptr;
+}
+
+void* RiadXOS::open_driver(DriverHandle handle) {
+    return driver_registry ? driver_registry->open_driver(handle) : nullptr;
+}
+
+void RiadXOS::close_driver(DriverHandle handle) {
+    if (driver_registry) {
+        driver_registry->close_driver(handle);
+    }
 }
 
 int MyOS::create_process(const std::string& executable_path) {
@@ -198,6 +335,34 @@ std::string MyOS::read_file(const std::string& path) {
     return "";
 }
 
+int MyOS::open_file(const std::string& path, int flags) {
+    if (filesystem) {
+        return filesystem->open_file(path, flags);
+    }
+    return -1;
+}
+
+bool MyOS::close_file(int fd) {
+    if (filesystem) {
+        return filesystem->close_file(fd);
+    }
+    return false;
+}
+
+ssize_t MyOS::read_file_fd(int fd, void* buffer, size_t count) {
+    if (filesystem) {
+        return filesystem->read_file_fd(fd, buffer, count);
+    }
+    return -1;
+}
+
+ssize_t MyOS::write_file_fd(int fd, const void* buffer, size_t count) {
+    if (filesystem) {
+        return filesystem->write_file_fd(fd, buffer, count);
+    }
+    return -1;
+}
+
 bool MyOS::write_file(const std::string& path, const std::string& content) {
     if (filesystem) {
         return filesystem->write_file(path, content);
@@ -9,6 +9,8 @@
 #include "syscalls.h"
 #include "memory.h"
 #include "process.h"
+#include "driver_registry.h"
+#include "snapshot.h"
 #include "../drivers/display.h"
 #include "../drivers/keyboard.h"
 #include "../drivers/mouse.h"
@@ -25,9 +27,18 @@ private:
     std::unique_ptr<MouseDriver> mouse_driver;
     std::unique_ptr<FileSystem> filesystem;
     std::unique_ptr<GUIManager> gui_manager;
+    std::unique_ptr<DriverRegistry> driver_registry;
     
     bool running;
     std::mutex kernel_mutex;
+    std::string disk_image;
+    std::string trace_path;
+    std::string hibernate_path;
+    bool fs_compression;
+    bool fs_deduplication;
+    
+    bool initialize_components(SnapshotReader* snapshot);
+    bool write_snapshot(const std::string& path);
     
     // Interrupt handling
     void handle_interrupt(int interrupt_id);
@@ -41,12 +52,35 @@ public:
     void run();
     void shutdown();
     
+    // Hibernation: save the whole system to a host file, and bring it back
+    // instead of initialize()
+    bool hibernate(const std::string& path);
+    bool resume(const std::string& path);
+    
+    // Hibernates to path at the start of shutdown(); empty for none
+    void set_hibernate_on_shutdown(const std::string& path);
+    
+    // Host file holding the filesystem; set before initialize() or resume()
+    void set_disk_image(const std::string& path);
+    
+    // Compress or deduplicate file data written from boot on; set before
+    // initialize() or resume()
+    void set_filesystem_compression(bool enabled);
+    void set_filesystem_deduplication(bool enabled);
+    
+    // Chrome trace file written at shutdown; empty for none
+    void set_trace_export(const std::string& path);
+    
     // System call interface
     int system_call(int call_id, void* params);
     
     // Driver management
     bool register_driver(const std::string& name, void* driver);
     void* get_driver(const std::string& name);
+    DriverHandle find_driver(const std::string& name);
+    void* get_driver(DriverHandle handle);
+    void* open_driver(DriverHandle handle);
+    void close_driver(DriverHandle handle);
     
     // Process management
     int create_process(const std::string& executable_path);
@@ -60,6 +94,10 @@ public:
     bool create_file(const std::string& path);
     bool delete_file(const std::string& path);
     std::string read_file(const std::string& path);
+    int open_file(const std::string& path, int flags);
+    bool close_file(int fd);
+    ssize_t read_file_fd(int fd, void* buffer, size_t count);
+    ssize_t write_file_fd(int fd, const void* buffer, size_t count);
     bool write_file(const std::string& path, const std::string& content);
 };
 
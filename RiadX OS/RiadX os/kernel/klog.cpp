@@ -0,0 +1,294 @@
+#include "klog.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#define KLOG_RING_MASK    (KLOG_RING_SIZE - 1)
+#define KLOG_RECORD_ALIGN 16
+#define KLOG_WRAP_MARKER  0xFFFFFFFFu
+#define KLOG_MAX_MESSAGE  (KLOG_RING_SIZE / 4)
+#define KLOG_FULL_RETRIES 64  // Yields while waiting for the writer before dropping
+
+// Every record starts on a 16-byte boundary, so a wrap marker always fits
+// in front of the end of the ring
+struct KLogRecordHeader {
+    uint64_t sequence;  // Global order across threads
+    uint32_t length;    // Text bytes, or KLOG_WRAP_MARKER
+    uint32_t level;
+};
+
+struct KLogRing {
+    alignas(KLOG_RECORD_ALIGN) char buffer[KLOG_RING_SIZE];
+    std::atomic<uint64_t> head;   // Only the owning thread writes
+    std::atomic<uint64_t> tail;   // Only the drainer writes
+    std::atomic<bool> orphaned;   // Owning thread has exited
+
+    KLogRing() : head(0), tail(0), orphaned(false) {}
+};
+
+struct PendingLine {
+    uint64_t sequence;
+    KLogLevel level;
+    std::string text;
+};
+
+std::atomic<int> klog_runtime_level(KLOG_LEVEL_INFO);
+
+static std::atomic<uint64_t> next_sequence(0);
+static std::atomic<uint64_t> dropped_messages(0);
+static uint64_t reported_drops = 0;
+static std::atomic<bool> writer_running(false);
+
+static std::mutex rings_mutex;
+static std::vector<KLogRing*> rings;
+static std::mutex drain_mutex;  // Serializes drainers and synchronous writes
+
+static std::mutex writer_mutex;
+static std::condition_variable writer_wakeup;
+static std::thread writer_thread;
+static bool writer_stop = false;
+
+struct ThreadLogState {
+    KLogRing* ring;
+    std::ostringstream stream;
+    bool stream_busy;
+
+    ThreadLogState() : ring(nullptr), stream_busy(false) {}
+    ~ThreadLogState() {
+        // The writer frees the ring once it has been drained
+        if (ring) ring->orphaned.store(true, std::memory_order_release);
+    }
+};
+
+static thread_local ThreadLogState log_state;
+
+static size_t record_size(size_t length) {
+    return (sizeof(KLogRecordHeader) + length + KLOG_RECORD_ALIGN - 1) & ~static_cast<size_t>(KLOG_RECORD_ALIGN - 1);
+}
+
+static KLogRing* thread_ring() {
+    if (!log_state.ring) {
+        log_state.ring = new KLogRing();
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(log_state.ring);
+    }
+    return log_state.ring;
+}
+
+static uint64_t ring_used(KLogRing* ring) {
+    return ring->head.load(std::memory_order_relaxed) - ring->tail.load(std::memory_order_relaxed);
+}
+
+static bool ring_push(KLogRing* ring, uint64_t sequence, KLogLevel level, const std::string& text) {
+    size_t length = std::min(text.size(), static_cast<size_t>(KLOG_MAX_MESSAGE));
+    size_t total = record_size(length);
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    size_t offset = head & KLOG_RING_MASK;
+    size_t to_end = KLOG_RING_SIZE - offset;
+    size_t skip = (to_end < total) ? to_end : 0;
+
+    if (head + skip + total - tail > KLOG_RING_SIZE) {
+        return false;
+    }
+
+    KLogRecordHeader header;
+    if (skip) {
+        header.sequence = 0;
+        header.length = KLOG_WRAP_MARKER;
+        header.level = 0;
+        std::memcpy(ring->buffer + offset, &header, sizeof(header));
+        head += skip;
+        offset = 0;
+    }
+
+    header.sequence = sequence;
+    header.length = static_cast<uint32_t>(length);
+    header.level = level;
+    std::memcpy(ring->buffer + offset, &header, sizeof(header));
+    std::memcpy(ring->buffer + offset + sizeof(header), text.data(), length);
+
+    ring->head.store(head + total, std::memory_order_release);
+    return true;
+}
+
+static void ring_drain(KLogRing* ring, std::vector<PendingLine>& out) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+    while (tail != head) {
+        size_t offset = tail & KLOG_RING_MASK;
+        KLogRecordHeader header;
+        std::memcpy(&header, ring->buffer + offset, sizeof(header));
+
+        if (header.length == KLOG_WRAP_MARKER) {
+            tail += KLOG_RING_SIZE - offset;
+            continue;
+        }
+
+        out.push_back(PendingLine{header.sequence, static_cast<KLogLevel>(header.level),
+                                  std::string(ring->buffer + offset + sizeof(header), header.length)});
+        tail += record_size(header.length);
+    }
+
+    ring->tail.store(tail, std::memory_order_release);
+}
+
+// Warnings and errors go to stderr, everything else to stdout
+static void write_line(KLogLevel level, const std::string& text, bool& on_stderr) {
+    bool to_stderr = level >= KLOG_LEVEL_WARN;
+    if (to_stderr != on_stderr) {
+        (on_stderr ? std::cerr : std::cout).flush();
+        on_stderr = to_stderr;
+    }
+    std::ostream& out = to_stderr ? std::cerr : std::cout;
+    out.write(text.data(), text.size());
+    out.put('\n');
+}
+
+static void drain_rings() {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex);
+
+    std::vector<PendingLine> lines;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (auto it = rings.begin(); it != rings.end();) {
+            KLogRing* ring = *it;
+            // Read before draining: nothing is pushed after the owner exits
+            bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+            ring_drain(ring, lines);
+            if (orphaned) {
+                delete ring;
+                it = rings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::sort(lines.begin(), lines.end(), [](const PendingLine& a, const PendingLine& b) {
+        return a.sequence < b.sequence;
+    });
+
+    bool on_stderr = false;
+    for (const PendingLine& line : lines) {
+        write_line(line.level, line.text, on_stderr);
+    }
+
+    uint64_t drops = dropped_messages.load(std::memory_order_relaxed);
+    if (drops != reported_drops) {
+        write_line(KLOG_LEVEL_WARN, "[KLOG] Dropped " + std::to_string(drops - reported_drops) +
+                   " messages, staging ring full", on_stderr);
+        reported_drops = drops;
+    }
+
+    if (!lines.empty()) {
+        std::cout.flush();
+    }
+}
+
+static void writer_main() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while (!writer_stop) {
+        writer_wakeup.wait_for(lock, std::chrono::milliseconds(KLOG_FLUSH_INTERVAL));
+        lock.unlock();
+        drain_rings();
+        lock.lock();
+    }
+}
+
+KLogLine::KLogLine(KLogLevel line_level) : level(line_level) {
+    // A message whose arguments log themselves gets its own stream
+    if (!log_state.stream_busy) {
+        stream_ptr = &log_state.stream;
+        owns_stream = false;
+        log_state.stream_busy = true;
+        stream_ptr->str(std::string());
+        stream_ptr->clear();
+        // Manipulators from the previous message must not leak into this one
+        stream_ptr->flags(std::ios_base::dec | std::ios_base::skipws);
+        stream_ptr->precision(6);
+        stream_ptr->fill(' ');
+    } else {
+        stream_ptr = new std::ostringstream();
+        owns_stream = true;
+    }
+}
+
+KLogLine::~KLogLine() {
+    std::string text = stream_ptr->str();
+
+    if (writer_running.load(std::memory_order_acquire)) {
+        KLogRing* ring = thread_ring();
+        uint64_t sequence = next_sequence.fetch_add(1, std::memory_order_relaxed);
+
+        int retries = 0;
+        while (!ring_push(ring, sequence, level, text)) {
+            writer_wakeup.notify_one();
+            if (++retries > KLOG_FULL_RETRIES) {
+                dropped_messages.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            std::this_thread::yield();
+        }
+
+        // Errors go out promptly; bursts are drained before the ring fills
+        if (level >= KLOG_LEVEL_WARN || ring_used(ring) > KLOG_RING_SIZE / 2) {
+            writer_wakeup.notify_one();
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(drain_mutex);
+        bool on_stderr = false;
+        write_line(level, text, on_stderr);
+        std::cout.flush();
+    }
+
+    if (owns_stream) {
+        delete stream_ptr;
+    } else {
+        log_state.stream_busy = false;
+    }
+}
+
+void klog_start() {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (writer_running) return;
+
+    writer_stop = false;
+    writer_thread = std::thread(writer_main);
+    writer_running.store(true, std::memory_order_release);
+}
+
+void klog_stop() {
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        if (!writer_running) return;
+
+        // New messages are written synchronously from here on
+        writer_running.store(false, std::memory_order_release);
+        writer_stop = true;
+    }
+    writer_wakeup.notify_one();
+    writer_thread.join();
+    drain_rings();
+}
+
+void klog_flush() {
+    drain_rings();
+    std::cerr.flush();
+}
+
+void klog_set_level(KLogLevel level) {
+    klog_runtime_level.store(level, std::memory_order_relaxed);
+}
+
+uint64_t klog_dropped_count() {
+    return dropped_messages.load(std::memory_order_relaxed);
+}
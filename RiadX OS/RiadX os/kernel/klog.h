@@ -0,0 +1,78 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+
+// Kernel log.
+//
+//   KLOG_INFO << "[MEMORY] Allocated " << size << " bytes";
+//
+// Messages below KLOG_COMPILE_LEVEL are removed at compile time, including
+// the evaluation of their arguments. Messages below the runtime level cost
+// one relaxed load and a branch.
+//
+// A message is formatted on the calling thread and copied into that thread's
+// staging ring, which only that thread writes, so logging takes no lock. A
+// background writer drains all rings in sequence order and writes them out
+// in batches. Before klog_start() and after klog_stop() messages are written
+// synchronously. If a ring is full the message is dropped and counted.
+enum KLogLevel {
+    KLOG_LEVEL_DEBUG = 0,
+    KLOG_LEVEL_INFO = 1,
+    KLOG_LEVEL_WARN = 2,
+    KLOG_LEVEL_ERROR = 3,
+    KLOG_LEVEL_NONE = 4
+};
+
+#ifndef KLOG_COMPILE_LEVEL
+#define KLOG_COMPILE_LEVEL KLOG_LEVEL_INFO
+#endif
+
+#define KLOG_RING_SIZE      (64 * 1024)  // Staging bytes per thread, power of two
+#define KLOG_FLUSH_INTERVAL 10           // Writer wakeup period in milliseconds
+
+extern std::atomic<int> klog_runtime_level;
+
+class KLogLine {
+private:
+    KLogLevel level;
+    std::ostringstream* stream_ptr;
+    bool owns_stream;
+
+public:
+    explicit KLogLine(KLogLevel level);
+    ~KLogLine();
+
+    KLogLine(const KLogLine&) = delete;
+    KLogLine& operator=(const KLogLine&) = delete;
+
+    std::ostream& stream() { return *stream_ptr; }
+};
+
+// Turns the stream expression into void so both branches of ?: match
+struct KLogVoidify {
+    void operator&(std::ostream&) {}
+};
+
+#define KLOG(level) \
+    ((level) < KLOG_COMPILE_LEVEL || (level) < klog_runtime_level.load(std::memory_order_relaxed)) \
+        ? (void)0 : KLogVoidify() & KLogLine(level).stream()
+
+#define KLOG_DEBUG KLOG(KLOG_LEVEL_DEBUG)
+#define KLOG_INFO  KLOG(KLOG_LEVEL_INFO)
+#define KLOG_WARN  KLOG(KLOG_LEVEL_WARN)
+#define KLOG_ERROR KLOG(KLOG_LEVEL_ERROR)
+
+// Background writer
+void klog_start();
+void klog_stop();
+
+// Writes everything logged so far before returning
+void klog_flush();
+
+void klog_set_level(KLogLevel level);
+uint64_t klog_dropped_count();
+
+#endif
@@ -1,13 +1,17 @@
 #include "memory.h"
-#include <iostream>
+#include "snapshot.h"
+#include "trace.h"
+#include "../bootloader.h"
+#include "klog.h"
 #include <algorithm>
 #include <cstring>
 #include <cstdlib>
+#include <sys/mman.h>
 
 MemoryManager::MemoryManager() 
     : memory_pool(nullptr), pool_size(MEMORY_POOL_SIZE), 
-      next_free_offset(0), next_virtual_address(0x1000000) {
-    std::cout << "[MEMORY] Memory manager initializing..." << std::endl;
+      next_free_offset(0), pool_mapped(false), next_virtual_address(0x1000000) {
+    KLOG_INFO << "[MEMORY] Memory manager initializing...";
 }
 
 MemoryManager::~MemoryManager() {
@@ -18,15 +22,16 @@ bool MemoryManager::initialize() {
     std::lock_guard<std::mutex> lock(memory_mutex);
     
     try {
-        // Allocate memory pool
-        memory_pool = static_cast<uint8_t*>(std::malloc(pool_size));
+        // Allocate memory pool, page aligned so pool offsets keep their
+        // page alignment when a snapshot maps the pool elsewhere
+        memory_pool = static_cast<uint8_t*>(std::aligned_alloc(PAGE_SIZE, pool_size));
         if (!memory_pool) {
-            std::cerr << "[MEMORY] Failed to allocate memory pool" << std::endl;
+            KLOG_ERROR << "[MEMORY] Failed to allocate memory pool";
             return false;
         }
         
         // Initialize memory pool
-        std::memset(memory_pool, 0, pool_size);
+        Bootloader::memset_boot(memory_pool, 0, pool_size);
         
         // Create initial free block
         MemoryBlock initial_block;
@@ -44,12 +49,12 @@ bool MemoryManager::initialize() {
             entry.user_accessible = 1;
         }
         
-        std::cout << "[MEMORY] Memory manager initialized with " 
-                  << (pool_size / 1024) << "KB memory pool" << std::endl;
+        KLOG_INFO << "[MEMORY] Memory manager initialized with " 
+                  << (pool_size / 1024) << "KB memory pool";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[MEMORY] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[MEMORY] Exception during initialization: " << e.what();
         return false;
     }
 }
@@ -58,15 +63,152 @@ void MemoryManager::shutdown() {
     std::lock_guard<std::mutex> lock(memory_mutex);
     
     if (memory_pool) {
-        std::free(memory_pool);
+        if (pool_mapped) {
+            munmap(memory_pool, pool_size);
+        } else {
+            std::free(memory_pool);
+        }
         memory_pool = nullptr;
+        pool_mapped = false;
     }
     
     memory_blocks.clear();
     allocated_blocks.clear();
     page_table.clear();
     
-    std::cout << "[MEMORY] Memory manager shutdown complete" << std::endl;
+    KLOG_INFO << "[MEMORY] Memory manager shutdown complete";
+}
+
+bool MemoryManager::save_snapshot(SnapshotWriter& writer) {
+    std::lock_guard<std::mutex> lock(memory_mutex);
+    
+    if (!memory_pool) return false;
+    
+    // Pointers are stored as pool offsets so the pool can come back anywhere
+    writer.begin_section(SNAPSHOT_SECTION_MEMORY);
+    writer.write_u64(next_free_offset);
+    writer.write_u64(next_virtual_address);
+    
+    writer.write_u32(static_cast<uint32_t>(memory_blocks.size()));
+    for (const auto& block : memory_blocks) {
+        writer.write_u64(static_cast<uint8_t*>(block.address) - memory_pool);
+        writer.write_u64(block.size);
+        writer.write_bool(block.is_free);
+        writer.write_i32(block.process_id);
+    }
+    
+    writer.write_u32(static_cast<uint32_t>(allocated_blocks.size()));
+    for (const auto& entry : allocated_blocks) {
+        writer.write_u64(static_cast<uint8_t*>(entry.first) - memory_pool);
+        writer.write_u64(entry.second);
+    }
+    
+    // Only present pages; everything else is the initialize() default
+    uint32_t present_pages = 0;
+    for (const auto& entry : page_table) {
+        if (entry.present) present_pages++;
+    }
+    writer.write_u32(static_cast<uint32_t>(page_table.size()));
+    writer.write_u32(present_pages);
+    for (size_t i = 0; i < page_table.size(); i++) {
+        if (!page_table[i].present) continue;
+        uint64_t physical = static_cast<uint64_t>(page_table[i].physical_address) << 12;
+        writer.write_u32(static_cast<uint32_t>(i));
+        writer.write_u64(physical - reinterpret_cast<uint64_t>(memory_pool));
+        writer.write_bool(page_table[i].writable);
+        writer.write_bool(page_table[i].user_accessible);
+    }
+    
+    // Pool image, page aligned so resume can map it instead of reading it
+    writer.write_u64(pool_size);
+    writer.align(PAGE_SIZE);
+    size_t pages = writer.write_sparse_pages(memory_pool, pool_size, PAGE_SIZE);
+    writer.end_section();
+    
+    KLOG_INFO << "[MEMORY] Saved " << pages << " of " << (pool_size / PAGE_SIZE)
+              << " pool pages to snapshot";
+    return writer.good();
+}
+
+bool MemoryManager::restore_snapshot(SnapshotReader& reader) {
+    std::lock_guard<std::mutex> lock(memory_mutex);
+    
+    if (!reader.enter_section(SNAPSHOT_SECTION_MEMORY)) {
+        KLOG_ERROR << "[MEMORY] Snapshot has no memory section";
+        return false;
+    }
+    
+    next_free_offset = reader.read_u64();
+    next_virtual_address = reader.read_u64();
+    
+    // Block addresses are rebased once the pool is mapped
+    std::vector<std::pair<uint64_t, MemoryBlock>> saved_blocks(reader.read_u32());
+    for (auto& saved : saved_blocks) {
+        saved.first = reader.read_u64();
+        saved.second.size = reader.read_u64();
+        saved.second.is_free = reader.read_bool();
+        saved.second.process_id = reader.read_i32();
+    }
+    
+    std::vector<std::pair<uint64_t, size_t>> saved_allocations(reader.read_u32());
+    for (auto& saved : saved_allocations) {
+        saved.first = reader.read_u64();
+        saved.second = reader.read_u64();
+    }
+    
+    page_table.resize(reader.read_u32());
+    for (auto& entry : page_table) {
+        entry.present = 0;
+        entry.writable = 1;
+        entry.user_accessible = 1;
+    }
+    uint32_t present_pages = reader.read_u32();
+    std::vector<std::pair<uint32_t, uint64_t>> saved_pages;
+    for (uint32_t i = 0; i < present_pages && reader.good(); i++) {
+        uint32_t index = reader.read_u32();
+        uint64_t offset = reader.read_u64();
+        bool writable = reader.read_bool();
+        bool user_accessible = reader.read_bool();
+        if (index < page_table.size()) {
+            page_table[index].writable = writable;
+            page_table[index].user_accessible = user_accessible;
+            saved_pages.emplace_back(index, offset);
+        }
+    }
+    
+    pool_size = reader.read_u64();
+    reader.align(PAGE_SIZE);
+    
+    // Pages fault in from the snapshot file on first touch, so resume does
+    // not pay for the memset or for reading untouched memory
+    memory_pool = static_cast<uint8_t*>(reader.map_pages(pool_size));
+    if (!reader.good() || !memory_pool) {
+        KLOG_ERROR << "[MEMORY] Corrupt memory section in snapshot";
+        memory_pool = nullptr;
+        return false;
+    }
+    pool_mapped = true;
+    
+    memory_blocks.clear();
+    for (auto& saved : saved_blocks) {
+        saved.second.address = memory_pool + saved.first;
+        memory_blocks.push_back(saved.second);
+    }
+    
+    allocated_blocks.clear();
+    for (const auto& saved : saved_allocations) {
+        allocated_blocks[memory_pool + saved.first] = saved.second;
+    }
+    
+    for (const auto& saved : saved_pages) {
+        uint64_t physical = reinterpret_cast<uint64_t>(memory_pool) + saved.second;
+        page_table[saved.first].physical_address = physical >> 12;
+        page_table[saved.first].present = 1;
+    }
+    
+    KLOG_INFO << "[MEMORY] Memory manager restored " << (pool_size / 1024)
+              << "KB pool from snapshot";
+    return true;
 }
 
 void* MemoryManager::allocate(size_t size) {
@@ -80,9 +222,11 @@ void* MemoryManager::allocate(size_t size) {
     void* ptr = first_fit_allocate(size);
     if (ptr) {
         allocated_blocks[ptr] = size;
-        std::cout << "[MEMORY] Allocated " << size << " bytes at " << ptr << std::endl;
+        TRACE_EVENT(TRACE_MEM_ALLOC, ptr, size);
+        KLOG_DEBUG << "[MEMORY] Allocated " << size << " bytes at " << ptr;
     } else {
-        std::cerr << "[MEMORY] Failed to allocate " << size << " bytes" << std::endl;
+        TRACE_EVENT(TRACE_MEM_ALLOC_FAILED, size, 0);
+        KLOG_ERROR << "[MEMORY] Failed to allocate " << size << " bytes";
     }
     
     return ptr;
@@ -113,19 +257,20 @@ void MemoryManager::deallocate(void* ptr) {
     
     auto it = allocated_blocks.find(ptr);
     if (it == allocated_blocks.end()) {
-        std::cerr << "[MEMORY] Attempting to free unallocated pointer: " << ptr << std::endl;
+        KLOG_ERROR << "[MEMORY] Attempting to free unallocated pointer: " << ptr;
         return;
     }
     
     size_t size = it->second;
     allocated_blocks.erase(it);
+    TRACE_EVENT(TRACE_MEM_FREE, ptr, size);
     
     // Find the memory block and mark as free
     for (auto& block : memory_blocks) {
         if (block.address == ptr) {
             block.is_free = true;
             block.process_id = -1;
-            std::cout << "[MEMORY] Freed " << size << " bytes at " << ptr << std::endl;
+            KLOG_DEBUG << "[MEMORY] Freed " << size << " bytes at " << ptr;
             break;
         }
     }
@@ -137,19 +282,22 @@ void MemoryManager::deallocate(void* ptr) {
 void* MemoryManager::first_fit_allocate(size_t size) {
     for (auto& block : memory_blocks) {
         if (block.is_free && block.size >= size) {
-            if (block.size > size) {
+            // Claim the block before a split, the push_back may move it
+            void* address = block.address;
+            size_t remainder = block.size - size;
+            block.size = size;
+            block.is_free = false;
+            
+            if (remainder > 0) {
                 // Split the block
                 MemoryBlock new_block;
-                new_block.address = static_cast<uint8_t*>(block.address) + size;
-                new_block.size = block.size - size;
+                new_block.address = static_cast<uint8_t*>(address) + size;
+                new_block.size = remainder;
                 new_block.is_free = true;
                 new_block.process_id = -1;
                 memory_blocks.push_back(new_block);
             }
-            
-            block.size = size;
-            block.is_free = false;
-            return block.address;
+            return address;
         }
     }
     return nullptr;
@@ -252,7 +400,7 @@ void MemoryManager::deallocate_process_memory(int process_id) {
     }
     
     coalesce_free_blocks();
-    std::cout << "[MEMORY] Deallocated all memory for process " << process_id << std::endl;
+    KLOG_INFO << "[MEMORY] Deallocated all memory for process " << process_id;
 }
 
 void* MemoryManager::allocate_virtual_page() {
@@ -307,24 +455,24 @@ uint64_t MemoryManager::virtual_to_physical(uint64_t virtual_addr) {
 
 bool MemoryManager::protect_memory(void* ptr, size_t size, int protection) {
     // Implement memory protection
-    std::cout << "[MEMORY] Setting protection " << protection << " for " 
-              << size << " bytes at " << ptr << std::endl;
+    KLOG_DEBUG << "[MEMORY] Setting protection " << protection << " for " 
+              << size << " bytes at " << ptr;
     return true;
 }
 
 void MemoryManager::print_memory_map() {
     std::lock_guard<std::mutex> lock(memory_mutex);
     
-    std::cout << "[MEMORY] Memory Map:" << std::endl;
-    std::cout << "Total: " << (get_total_memory() / 1024) << "KB, "
+    KLOG_INFO << "[MEMORY] Memory Map:";
+    KLOG_INFO << "Total: " << (get_total_memory() / 1024) << "KB, "
               << "Used: " << (get_used_memory() / 1024) << "KB, "
-              << "Free: " << (get_free_memory() / 1024) << "KB" << std::endl;
+              << "Free: " << (get_free_memory() / 1024) << "KB";
     
     for (const auto& block : memory_blocks) {
-        std::cout << "  Block: " << block.address 
+        KLOG_INFO << "  Block: " << block.address 
                   << " Size: " << block.size 
                   << " Free: " << (block.is_free ? "Yes" : "No")
-                  << " PID: " << block.process_id << std::endl;
+                  << " PID: " << block.process_id;
     }
 }
 
@@ -7,6 +7,9 @@
 #include <mutex>
 #include <map>
 
+class SnapshotWriter;
+class SnapshotReader;
+
 // Memory management constants
 #define PAGE_SIZE 4096
 #define MEMORY_POOL_SIZE (1024 * 1024 * 16) // 16MB virtual memory pool
@@ -42,6 +45,7 @@ private:
     uint8_t* memory_pool;
     size_t pool_size;
     size_t next_free_offset;
+    bool pool_mapped;  // Pool is a copy-on-write mapping of a snapshot
     
     // Virtual memory management
     std::vector<PageTableEntry> page_table;
@@ -64,6 +68,10 @@ public:
     bool initialize();
     void shutdown();
     
+    // Hibernation; restore_snapshot() replaces initialize()
+    bool save_snapshot(SnapshotWriter& writer);
+    bool restore_snapshot(SnapshotReader& reader);
+    
     // Memory allocation
     void* allocate(size_t size);
     void* allocate_aligned(size_t size, size_t alignment);
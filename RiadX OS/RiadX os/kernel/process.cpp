@@ -1,4 +1,9 @@
 #include "process.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "sim_clock.h"
+#include "../bootloader.h"
+#include "klog.h"
 #include <iostream>
 #include <algorithm>
 #include <chrono>
@@ -6,8 +11,8 @@
 #include <cstring>
 
 ProcessManager::ProcessManager() 
-    : next_pid(1), current_process(nullptr), scheduler_running(false) {
-    std::cout << "[PROCESS] Process manager initializing..." << std::endl;
+    : table_view(new ProcessTableView()), next_pid(1), current_process(nullptr), scheduler_running(false) {
+    KLOG_INFO << "[PROCESS] Process manager initializing...";
 }
 
 ProcessManager::~ProcessManager() {
@@ -19,11 +24,11 @@ bool ProcessManager::initialize() {
     
     try {
         scheduler_running = true;
-        std::cout << "[PROCESS] Process manager initialized" << std::endl;
+        KLOG_INFO << "[PROCESS] Process manager initialized";
         return true;
         
     } catch (const std::exception& e) {
-        std::cerr << "[PROCESS] Exception during initialization: " << e.what() << std::endl;
+        KLOG_ERROR << "[PROCESS] Exception during initialization: " << e.what();
         return false;
     }
 }
@@ -37,17 +42,148 @@ void ProcessManager::shutdown() {
     for (auto& pcb : process_table) {
         if (pcb && pcb->state != PROCESS_TERMINATED) {
             pcb->should_terminate = true;
+            sim_notify();
             if (pcb->process_thread && pcb->process_thread->joinable()) {
                 pcb->process_thread->join();
             }
         }
     }
     
-    process_table.clear();
+    std::vector<std::unique_ptr<ProcessControlBlock>> old_table;
+    old_table.swap(process_table);
     pid_map.clear();
     current_process = nullptr;
+    publish_table();
     
-    std::cout << "[PROCESS] Process manager shutdown complete" << std::endl;
+    for (auto& pcb : old_table) {
+        retire_pcb(std::move(pcb));
+    }
+    
+    KLOG_INFO << "[PROCESS] Process manager shutdown complete";
+}
+
+// Called with process_mutex held
+void ProcessManager::publish_table() {
+    ProcessTableView* view = new ProcessTableView();
+    view->processes.reserve(process_table.size());
+    for (auto& pcb : process_table) {
+        view->processes.push_back(pcb.get());
+    }
+    view->pid_map = pid_map;
+    table_view.publish(view);
+}
+
+// Readers may still hold the PCB, so it is freed after a grace period
+void ProcessManager::retire_pcb(std::unique_ptr<ProcessControlBlock> pcb) {
+    ProcessControlBlock* retired = pcb.release();
+    rcu_retire([retired]() { delete retired; });
+}
+
+bool ProcessManager::save_snapshot(SnapshotWriter& writer) {
+    std::lock_guard<std::mutex> lock(process_mutex);
+    
+    std::vector<ProcessControlBlock*> live;
+    for (auto& pcb : process_table) {
+        if (pcb->state != PROCESS_TERMINATED) {
+            live.push_back(pcb.get());
+        }
+    }
+    
+    writer.begin_section(SNAPSHOT_SECTION_PROCESSES);
+    writer.write_i32(next_pid);
+    writer.write_i32(current_process ? current_process->pid : 0);
+    writer.write_u32(static_cast<uint32_t>(live.size()));
+    
+    for (ProcessControlBlock* pcb : live) {
+        writer.write_i32(pcb->pid);
+        writer.write_i32(pcb->parent_pid);
+        writer.write_u32(pcb->state);
+        writer.write_string(pcb->executable_path);
+        writer.write_i32(pcb->priority);
+        writer.write_u64(pcb->cpu_time);
+        writer.write_u64(pcb->start_time);
+        
+        writer.write_u32(static_cast<uint32_t>(pcb->environment.size()));
+        for (const auto& var : pcb->environment) {
+            writer.write_string(var.first);
+            writer.write_string(var.second);
+        }
+        
+        writer.write_u64(pcb->memory_base ? pcb->memory_size : 0);
+        if (pcb->memory_base) {
+            writer.write_bytes(pcb->memory_base, pcb->memory_size);
+        }
+    }
+    writer.end_section();
+    
+    KLOG_INFO << "[PROCESS] Saved " << live.size() << " processes to snapshot";
+    return writer.good();
+}
+
+bool ProcessManager::restore_snapshot(SnapshotReader& reader) {
+    std::lock_guard<std::mutex> lock(process_mutex);
+    
+    if (!reader.enter_section(SNAPSHOT_SECTION_PROCESSES)) {
+        KLOG_ERROR << "[PROCESS] Snapshot has no process section";
+        return false;
+    }
+    
+    next_pid = reader.read_i32();
+    int current_pid = reader.read_i32();
+    uint32_t count = reader.read_u32();
+    
+    for (uint32_t i = 0; i < count && reader.good(); i++) {
+        std::unique_ptr<ProcessControlBlock> pcb(new ProcessControlBlock());
+        pcb->pid = reader.read_i32();
+        pcb->parent_pid = reader.read_i32();
+        pcb->state = static_cast<ProcessState>(reader.read_u32());
+        pcb->executable_path = reader.read_string();
+        pcb->priority = reader.read_i32();
+        pcb->cpu_time = reader.read_u64();
+        pcb->start_time = reader.read_u64();
+        pcb->should_terminate = false;
+        
+        uint32_t variables = reader.read_u32();
+        for (uint32_t v = 0; v < variables && reader.good(); v++) {
+            std::string name = reader.read_string();
+            pcb->environment[name] = reader.read_string();
+        }
+        
+        pcb->memory_size = reader.read_u64();
+        pcb->memory_base = nullptr;
+        if (pcb->memory_size > 0) {
+            pcb->memory_base = std::malloc(pcb->memory_size);
+            if (!pcb->memory_base || !reader.read_bytes(pcb->memory_base, pcb->memory_size)) {
+                std::free(pcb->memory_base);
+                KLOG_ERROR << "[PROCESS] Failed to restore memory for process " << pcb->pid;
+                return false;
+            }
+        }
+        
+        pid_map[pcb->pid] = pcb.get();
+        if (pcb->pid == current_pid) {
+            current_process = pcb.get();
+        }
+        process_table.push_back(std::move(pcb));
+    }
+    
+    if (!reader.good()) {
+        KLOG_ERROR << "[PROCESS] Corrupt process section in snapshot";
+        return false;
+    }
+    
+    publish_table();
+    
+    // Threads start only once the whole table is back
+    for (auto& pcb : process_table) {
+        sim_thread_starting();
+        pcb->process_thread = std::make_unique<std::thread>(&ProcessManager::execute_process, this, pcb.get());
+    }
+    
+    scheduler_running = true;
+    KLOG_INFO << "[PROCESS] Process manager restored " << process_table.size()
+              << " processes from snapshot";
+    return true;
 }
 
 int ProcessManager::create_process(const std::string& executable_path) {
@@ -56,13 +192,13 @@ int ProcessManager::create_process(const std::string& executable_path) {
     // Create process control block
     auto pcb = create_pcb(executable_path);
     if (!pcb) {
-        std::cerr << "[PROCESS] Failed to create PCB for " << executable_path << std::endl;
+        KLOG_ERROR << "[PROCESS] Failed to create PCB for " << executable_path;
         return -1;
     }
     
     // Load executable
     if (!load_executable(pcb)) {
-        std::cerr << "[PROCESS] Failed to load executable " << executable_path << std::endl;
+        KLOG_ERROR << "[PROCESS] Failed to load executable " << executable_path;
         cleanup_process(pcb);
         return -1;
     }
@@ -70,11 +206,15 @@ int ProcessManager::create_process(const std::string& executable_path) {
     int pid = pcb->pid;
     pid_map[pid] = pcb;
     process_table.push_back(std::unique_ptr<ProcessControlBlock>(pcb));
+    publish_table();
+    
+    TRACE_EVENT(TRACE_PROCESS_CREATE, pid, 0);
     
     // Start process execution
+    sim_thread_starting();
     pcb->process_thread = std::make_unique<std::thread>(&ProcessManager::execute_process, this, pcb);
     
-    std::cout << "[PROCESS] Created process " << pid << " (" << executable_path << ")" << std::endl;
+    KLOG_INFO << "[PROCESS] Created process " << pid << " (" << executable_path << ")";
     return pid;
 }
 
@@ -83,13 +223,26 @@ bool ProcessManager::terminate_process(int pid) {
     
     auto it = pid_map.find(pid);
     if (it == pid_map.end()) {
-        std::cerr << "[PROCESS] Process " << pid << " not found" << std::endl;
+        KLOG_ERROR << "[PROCESS] Process " << pid << " not found";
         return false;
     }
     
     ProcessControlBlock* pcb = it->second;
     pcb->should_terminate = true;
     pcb->state = PROCESS_TERMINATED;
+    sim_notify();
+    
+    remove_process(it);
+    
+    KLOG_INFO << "[PROCESS] Terminated process " << pid;
+    return true;
+}
+
+// Called with process_mutex held. Joins the process thread, so this is the
+// only place a PCB's thread is joined outside shutdown().
+void ProcessManager::remove_process(std::map<int, ProcessControlBlock*>::iterator it) {
+    ProcessControlBlock* pcb = it->second;
+    int pid = pcb->pid;
     
     if (pcb->process_thread && pcb->process_thread->joinable()) {
         pcb->process_thread->join();
@@ -97,17 +250,19 @@ bool ProcessManager::terminate_process(int pid) {
     
     cleanup_process(pcb);
     pid_map.erase(it);
+    if (current_process == pcb) {
+        current_process = nullptr;
+    }
     
     // Remove from process table
-    process_table.erase(
-        std::remove_if(process_table.begin(), process_table.end(),
-                      [pid](const std::unique_ptr<ProcessControlBlock>& p) {
-                          return p->pid == pid;
-                      }),
-        process_table.end());
-    
-    std::cout << "[PROCESS] Terminated process " << pid << std::endl;
-    return true;
+    auto entry = std::find_if(process_table.begin(), process_table.end(),
+                              [pid](const std::unique_ptr<ProcessControlBlock>& p) {
+                                  return p->pid == pid;
+                              });
+    std::unique_ptr<ProcessControlBlock> removed = std::move(*entry);
+    process_table.erase(entry);
+    publish_table();
+    retire_pcb(std::move(removed));
 }
 
 bool ProcessManager::suspend_process(int pid) {
@@ -116,7 +271,7 @@ bool ProcessManager::suspend_process(int pid) {
     auto it = pid_map.find(pid);
     if (it != pid_map.end()) {
         it->second->state = PROCESS_BLOCKED;
-        std::cout << "[PROCESS] Suspended process " << pid << std::endl;
+        KLOG_INFO << "[PROCESS] Suspended process " << pid;
         return true;
     }
     return false;
@@ -128,7 +283,7 @@ bool ProcessManager::resume_process(int pid) {
     auto it = pid_map.find(pid);
     if (it != pid_map.end() && it->second->state == PROCESS_BLOCKED) {
         it->second->state = PROCESS_READY;
-        std::cout << "[PROCESS] Resumed process " << pid << std::endl;
+        KLOG_INFO << "[PROCESS] Resumed process " << pid;
         return true;
     }
     return false;
@@ -144,8 +299,7 @@ ProcessControlBlock* ProcessManager::create_pcb(const std::string& executable_pa
     pcb->memory_size = 0;
     pcb->priority = 1;
     pcb->cpu_time = 0;
-    pcb->start_time = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
+    pcb->start_time = sim_now_ms();
     pcb->should_terminate = false;
     
     // Set up environment variables
@@ -158,65 +312,73 @@ ProcessControlBlock* ProcessManager::create_pcb(const std::string& executable_pa
 
 bool ProcessManager::load_executable(ProcessControlBlock* pcb) {
     // Simulate loading an executable
-    std::cout << "[PROCESS] Loading executable: " << pcb->executable_path << std::endl;
+    KLOG_DEBUG << "[PROCESS] Loading executable: " << pcb->executable_path;
     
     // Allocate memory for the process (simulated)
     pcb->memory_size = 1024 * 64; // 64KB
     pcb->memory_base = std::malloc(pcb->memory_size);
     
     if (!pcb->memory_base) {
-        std::cerr << "[PROCESS] Failed to allocate memory for process" << std::endl;
+        KLOG_ERROR << "[PROCESS] Failed to allocate memory for process";
         return false;
     }
     
     // Initialize memory
-    memset(pcb->memory_base, 0, pcb->memory_size);
+    Bootloader::memset_boot(pcb->memory_base, 0, pcb->memory_size);
     
-    std::cout << "[PROCESS] Allocated " << (pcb->memory_size / 1024) 
-              << "KB memory at " << pcb->memory_base << std::endl;
+    KLOG_DEBUG << "[PROCESS] Allocated " << (pcb->memory_size / 1024) 
+              << "KB memory at " << pcb->memory_base;
     return true;
 }
 
 void ProcessManager::execute_process(ProcessControlBlock* pcb) {
-    pcb->state = PROCESS_RUNNING;
+    // In deterministic mode the work follows the virtual clock and a
+    // per-pid random stream
+    SimThread sim_thread;
+    
+    // A process suspended before hibernation stays suspended on resume
+    if (pcb->state != PROCESS_BLOCKED) {
+        pcb->state = PROCESS_RUNNING;
+    }
     
-    std::cout << "[PROCESS] Executing process " << pcb->pid 
-              << " (" << pcb->executable_path << ")" << std::endl;
+    KLOG_DEBUG << "[PROCESS] Executing process " << pcb->pid 
+              << " (" << pcb->executable_path << ")";
     
     // Simulate process execution
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen = sim_rng("process." + std::to_string(pcb->pid));
     std::uniform_int_distribution<> dis(1000, 5000);
+    auto terminating = [pcb]() { return pcb->should_terminate.load(); };
     
     while (!pcb->should_terminate && pcb->state != PROCESS_TERMINATED) {
         // Simulate CPU work
-        auto work_time = std::chrono::milliseconds(dis(gen));
-        std::this_thread::sleep_for(work_time);
+        int work_time = dis(gen);
+        if (!sim_sleep_ms(work_time, terminating)) break;
         
-        pcb->cpu_time += work_time.count();
+        pcb->cpu_time += work_time;
         
         // Check if process should yield
         if (pcb->state == PROCESS_BLOCKED) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            sim_sleep_ms(100, terminating);
         }
         
         // Simulate some output
         if (pcb->executable_path.find("calculator") != std::string::npos) {
-            std::cout << "[CALC-" << pcb->pid << "] Performing calculations..." << std::endl;
+            KLOG_DEBUG << "[CALC-" << pcb->pid << "] Performing calculations...";
         } else if (pcb->executable_path.find("editor") != std::string::npos) {
-            std::cout << "[EDITOR-" << pcb->pid << "] Text editing operations..." << std::endl;
+            KLOG_DEBUG << "[EDITOR-" << pcb->pid << "] Text editing operations...";
         } else {
-            std::cout << "[PROC-" << pcb->pid << "] Process running..." << std::endl;
+            KLOG_DEBUG << "[PROC-" << pcb->pid << "] Process running...";
         }
         
         // Random chance to terminate
         if (dis(gen) > 4500) {
-            std::cout << "[PROCESS] Process " << pcb->pid << " completed execution" << std::endl;
+            KLOG_INFO << "[PROCESS] Process " << pcb->pid << " completed execution";
             break;
         }
     }
     
     pcb->state = PROCESS_TERMINATED;
+    TRACE_EVENT(TRACE_PROCESS_EXIT, pcb->pid, 0);
 }
 
 void ProcessManager::cleanup_process(ProcessControlBlock* pcb) {
@@ -225,26 +387,35 @@ void ProcessManager::cleanup_process(ProcessControlBlock* pcb) {
         pcb->memory_base = nullptr;
     }
     
-    std::cout << "[PROCESS] Cleaned up process " << pcb->pid << std::endl;
+    KLOG_DEBUG << "[PROCESS] Cleaned up process " << pcb->pid;
 }
 
 void ProcessManager::schedule() {
     if (!scheduler_running) return;
     
+    // The PCBs picked here stay valid until the guard ends
+    RcuReadGuard guard;
     ProcessControlBlock* next_process = select_next_process();
-    if (next_process && next_process != current_process) {
+    if (!next_process || next_process == current_process) return;
+    
+    // The pick may have been removed since; current_process must never
+    // point at a retired PCB, so switch only if it is still in the table
+    std::lock_guard<std::mutex> lock(process_mutex);
+    auto it = pid_map.find(next_process->pid);
+    if (it != pid_map.end() && it->second == next_process) {
         context_switch(current_process, next_process);
     }
 }
 
+// Called inside a read section
 ProcessControlBlock* ProcessManager::select_next_process() {
     // Simple round-robin scheduler with priority
     ProcessControlBlock* best_process = nullptr;
     int highest_priority = -1;
     
-    for (auto& pcb : process_table) {
+    for (ProcessControlBlock* pcb : table_view.read()->processes) {
         if (pcb->state == PROCESS_READY && pcb->priority > highest_priority) {
-            best_process = pcb.get();
+            best_process = pcb;
             highest_priority = pcb->priority;
         }
     }
@@ -258,6 +429,7 @@ void ProcessManager::context_switch(ProcessControlBlock* old_proc, ProcessContro
     }
     
     if (new_proc) {
+        TRACE_EVENT(TRACE_SCHED_SWITCH, old_proc ? old_proc->pid : 0, new_proc->pid);
         current_process = new_proc;
         new_proc->state = PROCESS_RUNNING;
         // std::cout << "[SCHEDULER] Context switch to process " << new_proc->pid << std::endl;
@@ -270,21 +442,18 @@ void ProcessManager::set_process_priority(int pid, int priority) {
     auto it = pid_map.find(pid);
     if (it != pid_map.end()) {
         it->second->priority = priority;
-        std::cout << "[PROCESS] Set priority " << priority << " for process " << pid << std::endl;
+        KLOG_INFO << "[PROCESS] Set priority " << priority << " for process " << pid;
     }
 }
 
 ProcessControlBlock* ProcessManager::get_process(int pid) {
-    auto it = pid_map.find(pid);
-    return (it != pid_map.end()) ? it->second : nullptr;
+    const ProcessTableView* view = table_view.read();
+    auto it = view->pid_map.find(pid);
+    return (it != view->pid_map.end()) ? it->second : nullptr;
 }
 
 std::vector<ProcessControlBlock*> ProcessManager::get_all_processes() {
-    std::vector<ProcessControlBlock*> processes;
-    for (auto& pcb : process_table) {
-        processes.push_back(pcb.get());
-    }
-    return processes;
+    return table_view.read()->processes;
 }
 
 ProcessControlBlock* ProcessManager::get_current_process() {
@@ -296,7 +465,7 @@ bool ProcessManager::send_signal(int pid, int signal) {
     
     auto it = pid_map.find(pid);
     if (it != pid_map.end()) {
-        std::cout << "[PROCESS] Sending signal " << signal << " to process " << pid << std::endl;
+        KLOG_DEBUG << "[PROCESS] Sending signal " << signal << " to process " << pid;
         
         if (signal == 9) { // SIGKILL
             return terminate_process(pid);
@@ -312,22 +481,32 @@ bool ProcessManager::send_signal(int pid, int signal) {
 }
 
 bool ProcessManager::wait_for_process(int pid) {
-    auto it = pid_map.find(pid);
-    if (it != pid_map.end()) {
-        ProcessControlBlock* pcb = it->second;
-        if (pcb->process_thread && pcb->process_thread->joinable()) {
-            pcb->process_thread->join();
-            return true;
+    // Polls in short read sections rather than joining here: a waiter that
+    // held the PCB across the join would stall every RCU grace period, and
+    // one that let go could join a thread terminate_process() already joined
+    while (true) {
+        {
+            RcuReadGuard guard;
+            ProcessControlBlock* pcb = get_process(pid);
+            if (!pcb) return false;
+            if (pcb->state == PROCESS_TERMINATED) break;
         }
+        sim_sleep_ms(PROCESS_WAIT_POLL_MS);
     }
-    return false;
+    
+    // Reap the exited process; a concurrent waiter or terminate may win
+    std::lock_guard<std::mutex> lock(process_mutex);
+    auto it = pid_map.find(pid);
+    if (it == pid_map.end()) return false;
+    remove_process(it);
+    return true;
 }
 
 void ProcessManager::print_process_table() {
     std::lock_guard<std::mutex> lock(process_mutex);
     
-    std::cout << "[PROCESS] Process Table:" << std::endl;
-    std::cout << "PID\tParent\tState\t\tCPU Time\tExecutable" << std::endl;
+    KLOG_INFO << "[PROCESS] Process Table:";
+    KLOG_INFO << "PID\tParent\tState\t\tCPU Time\tExecutable";
     
     for (auto& pcb : process_table) {
         std::string state_str;
@@ -338,12 +517,13 @@ void ProcessManager::print_process_table() {
             case PROCESS_TERMINATED: state_str = "TERMINATED"; break;
         }
         
-        std::cout << pcb->pid << "\t" << pcb->parent_pid << "\t" 
+        KLOG_INFO << pcb->pid << "\t" << pcb->parent_pid << "\t" 
                   << state_str << "\t\t" << pcb->cpu_time << "ms\t\t" 
-                  << pcb->executable_path << std::endl;
+                  << pcb->executable_path;
     }
 }
 
 size_t ProcessManager::get_process_count() {
-    return process_table.size();
+    RcuReadGuard guard;
+    return table_view.read()->processes.size();
 }
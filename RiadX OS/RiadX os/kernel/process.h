@@ -8,6 +8,12 @@
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include "rcu.h"
+
+#define PROCESS_WAIT_POLL_MS 10  // How often wait_for_process() checks for exit
+
+class SnapshotWriter;
+class SnapshotReader;
 
 enum ProcessState {
     PROCESS_READY,
@@ -19,7 +25,7 @@ enum ProcessState {
 struct ProcessControlBlock {
     int pid;
     int parent_pid;
-    ProcessState state;
+    std::atomic<ProcessState> state;
     std::string executable_path;
     void* memory_base;
     size_t memory_size;
@@ -31,12 +37,24 @@ struct ProcessControlBlock {
     std::atomic<bool> should_terminate;
 };
 
+// Immutable copy of the process table for lock-free readers
+struct ProcessTableView {
+    std::vector<ProcessControlBlock*> processes;
+    std::map<int, ProcessControlBlock*> pid_map;
+};
+
 class ProcessManager {
 private:
+    // Writer side, guarded by process_mutex
     std::vector<std::unique_ptr<ProcessControlBlock>> process_table;
     std::map<int, ProcessControlBlock*> pid_map;
     std::mutex process_mutex;
     
+    // Reader side, republished after every change to the table
+    RcuPointer<ProcessTableView> table_view;
+    void publish_table();
+    void retire_pcb(std::unique_ptr<ProcessControlBlock> pcb);
+    
     int next_pid;
     ProcessControlBlock* current_process;
     bool scheduler_running;
@@ -46,6 +64,7 @@ private:
     bool load_executable(ProcessControlBlock* pcb);
     void execute_process(ProcessControlBlock* pcb);
     void cleanup_process(ProcessControlBlock* pcb);
+    void remove_process(std::map<int, ProcessControlBlock*>::iterator it);
     
     // Scheduling
     ProcessControlBlock* select_next_process();
@@ -58,6 +77,10 @@ public:
     bool initialize();
     void shutdown();
     
+    // Hibernation; restore_snapshot() replaces initialize()
+    bool save_snapshot(SnapshotWriter& writer);
+    bool restore_snapshot(SnapshotReader& reader);
+    
     // Process management
     int create_process(const std::string& executable_path);
     bool terminate_process(int pid);
@@ -68,13 +91,15 @@ public:
     void schedule();
     void set_process_priority(int pid, int priority);
     
-    // Process information
+    // Process information. The PCBs returned are only valid while the
+    // caller stays inside the RcuReadGuard it took before the call.
     ProcessControlBlock* get_process(int pid);
     std::vector<ProcessControlBlock*> get_all_processes();
     ProcessControlBlock* get_current_process();
     
     // Inter-process communication
     bool send_signal(int pid, int signal);
+    // Blocks until the process exits, then removes it from the table
     bool wait_for_process(int pid);
     
     // Debug functions
@@ -0,0 +1,227 @@
+#include "rcu.h"
+#include "klog.h"
+#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+
+struct RetiredItem {
+    uint64_t epoch;  // Global epoch when the item was unpublished
+    std::function<void()> reclaim;
+};
+
+static RcuReaderSlot reader_slots[RCU_MAX_READERS];
+static std::atomic<uint64_t> global_epoch(1);
+
+static std::mutex retire_mutex;
+static std::vector<RetiredItem> retired_items;
+
+// Each thread claims a reader slot on its first read section and
+// gives it back when it exits
+struct ThreadReaderState {
+    int slot;
+    int depth;
+
+    ThreadReaderState() : slot(-1), depth(0) {}
+    ~ThreadReaderState() {
+        if (slot >= 0) {
+            reader_slots[slot].epoch.store(0, std::memory_order_release);
+            reader_slots[slot].in_use.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local ThreadReaderState reader_state;
+
+static RcuReaderSlot& claim_reader_slot() {
+    if (reader_state.slot >= 0) {
+        return reader_slots[reader_state.slot];
+    }
+
+    for (;;) {
+        for (int i = 0; i < RCU_MAX_READERS; i++) {
+            bool expected = false;
+            if (reader_slots[i].in_use.compare_exchange_strong(expected, true)) {
+                reader_state.slot = i;
+                return reader_slots[i];
+            }
+        }
+        // More reader threads than slots; wait for one to exit
+        std::this_thread::yield();
+    }
+}
+
+// Oldest epoch any reader may still be using, or max if there are no readers
+static uint64_t oldest_reader_epoch() {
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (int i = 0; i < RCU_MAX_READERS; i++) {
+        uint64_t epoch = reader_slots[i].epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+RcuReadGuard::RcuReadGuard() {
+    if (reader_state.depth++ == 0) {
+        // seq_cst so the announcement is visible before the table pointer is
+        // loaded, pairing with the exchange in RcuPointer::publish()
+        RcuReaderSlot& slot = claim_reader_slot();
+        slot.epoch.store(global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+}
+
+RcuReadGuard::~RcuReadGuard() {
+    if (--reader_state.depth == 0) {
+        reader_slots[reader_state.slot].epoch.store(0, std::memory_order_release);
+    }
+}
+
+void rcu_retire(std::function<void()> reclaim) {
+    // Readers announcing a later epoch started after the unpublish, so they
+    // cannot see the retired data
+    uint64_t epoch = global_epoch.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        retired_items.push_back(RetiredItem{epoch, std::move(reclaim)});
+    }
+    rcu_reclaim();
+}
+
+void rcu_reclaim() {
+    std::vector<RetiredItem> ready;
+    {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        if (retired_items.empty()) return;
+
+        uint64_t oldest = oldest_reader_epoch();
+        auto split = std::stable_partition(retired_items.begin(), retired_items.end(),
+                                           [oldest](const RetiredItem& item) {
+                                               return item.epoch >= oldest;
+                                           });
+        ready.assign(std::make_move_iterator(split), std::make_move_iterator(retired_items.end()));
+        retired_items.erase(split, retired_items.end());
+    }
+
+    // Reclaim outside the lock; destructors may retire more data
+    for (auto& item : ready) {
+        item.reclaim();
+    }
+}
+
+void rcu_synchronize() {
+    // Must not be called from inside a read section, it would wait on itself
+    uint64_t target = global_epoch.fetch_add(1, std::memory_order_seq_cst);
+    while (oldest_reader_epoch() <= target) {
+        std::this_thread::yield();
+    }
+    rcu_reclaim();
+}
+
+size_t rcu_pending_count() {
+    std::lock_guard<std::mutex> lock(retire_mutex);
+    return retired_items.size();
+}
+
+// Benchmark
+#define RCU_BENCH_ENTRIES     256
+#define RCU_BENCH_DURATION_MS 250
+
+struct BenchTable {
+    std::vector<int> values;
+};
+
+static std::atomic<long> bench_sink(0);  // Keeps the reads from being optimized out
+
+struct BenchResult {
+    uint64_t reads;
+    uint64_t writes;
+};
+
+template <typename ReadFn, typename WriteFn>
+static BenchResult run_benchmark_round(int reader_count, ReadFn read_once, WriteFn write_once) {
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> reads(0);
+    uint64_t writes = 0;
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < reader_count; r++) {
+        readers.emplace_back([&, r]() {
+            uint64_t local = 0;
+            unsigned index = static_cast<unsigned>(r);
+            long sink = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                sink += read_once(index++ % RCU_BENCH_ENTRIES);
+                local++;
+            }
+            reads.fetch_add(local);
+            bench_sink.fetch_add(sink, std::memory_order_relaxed);
+        });
+    }
+
+    std::thread writer([&]() {
+        int value = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            write_once(value++);
+            writes++;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(RCU_BENCH_DURATION_MS));
+    stop = true;
+    for (auto& t : readers) t.join();
+    writer.join();
+
+    return BenchResult{reads.load(), writes};
+}
+
+void rcu_benchmark() {
+    int reader_count = std::max(2, std::min(8, static_cast<int>(std::thread::hardware_concurrency()) - 1));
+
+    // Baseline: one mutex shared by readers and the writer
+    BenchTable locked_table;
+    locked_table.values.assign(RCU_BENCH_ENTRIES, 0);
+    std::mutex table_mutex;
+
+    BenchResult locked = run_benchmark_round(reader_count,
+        [&](unsigned index) {
+            std::lock_guard<std::mutex> lock(table_mutex);
+            return locked_table.values[index];
+        },
+        [&](int value) {
+            std::lock_guard<std::mutex> lock(table_mutex);
+            locked_table.values[value % RCU_BENCH_ENTRIES] = value;
+        });
+
+    // RCU: copy, update, publish
+    BenchTable* initial = new BenchTable();
+    initial->values.assign(RCU_BENCH_ENTRIES, 0);
+    RcuPointer<BenchTable> rcu_table(initial);
+    std::mutex writer_mutex;
+
+    BenchResult rcu = run_benchmark_round(reader_count,
+        [&](unsigned index) {
+            RcuReadGuard guard;
+            return rcu_table.read()->values[index];
+        },
+        [&](int value) {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            BenchTable* next = new BenchTable(*rcu_table.read());
+            next->values[value % RCU_BENCH_ENTRIES] = value;
+            rcu_table.publish(next);
+        });
+    rcu_synchronize();
+
+    double seconds = RCU_BENCH_DURATION_MS / 1000.0;
+    KLOG_INFO << "[RCU] Benchmark: " << reader_count << " readers + 1 writer, "
+              << RCU_BENCH_ENTRIES << " entries, " << RCU_BENCH_DURATION_MS << "ms";
+    KLOG_INFO << "Table\t\tReads/s\t\tWrites/s";
+    KLOG_INFO << std::fixed << std::setprecision(0)
+              << "mutex\t\t" << locked.reads / seconds << "\t" << locked.writes / seconds;
+    KLOG_INFO << std::fixed << std::setprecision(0)
+              << "rcu\t\t" << rcu.reads / seconds << "\t" << rcu.writes / seconds;
+}
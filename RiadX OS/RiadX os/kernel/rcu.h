@@ -0,0 +1,74 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// Epoch-based read-copy-update for read-mostly kernel tables.
+//
+// Readers enter a read section with RcuReadGuard and load the current
+// version of a table through RcuPointer::read(). They never block and never
+// write shared cache lines other than their own reader slot.
+//
+// Writers serialize among themselves (each table keeps its own mutex), build
+// a new version of the table, and publish() it. The old version is retired
+// and freed once every reader that could still see it has left its read
+// section.
+#define RCU_MAX_READERS 64  // Threads that may be inside a read section at once
+
+struct alignas(64) RcuReaderSlot {
+    std::atomic<uint64_t> epoch;  // 0 when the owning thread is not reading
+    std::atomic<bool> in_use;
+};
+
+// Marks a read section; sections may nest
+class RcuReadGuard {
+public:
+    RcuReadGuard();
+    ~RcuReadGuard();
+
+    RcuReadGuard(const RcuReadGuard&) = delete;
+    RcuReadGuard& operator=(const RcuReadGuard&) = delete;
+};
+
+// Runs reclaim once no reader can still hold a reference to the retired data
+void rcu_retire(std::function<void()> reclaim);
+
+// Waits for all current readers, then runs every pending reclaim
+void rcu_synchronize();
+
+// Frees what can be freed without waiting; called from rcu_retire()
+void rcu_reclaim();
+
+size_t rcu_pending_count();
+
+// Reader vs. writer throughput of an RCU table against a mutex protected one
+void rcu_benchmark();
+
+template <typename T>
+class RcuPointer {
+private:
+    std::atomic<T*> current;
+
+public:
+    RcuPointer() : current(nullptr) {}
+    explicit RcuPointer(T* initial) : current(initial) {}
+    ~RcuPointer() { delete current.load(std::memory_order_relaxed); }
+
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    // Only valid inside a read section, or while holding the writer lock
+    const T* read() const { return current.load(std::memory_order_seq_cst); }
+
+    // Installs next and retires the previous version; caller holds the writer lock
+    void publish(T* next) {
+        T* previous = current.exchange(next, std::memory_order_seq_cst);
+        if (previous) {
+            rcu_retire([previous]() { delete previous; });
+        }
+    }
+};
+
+#endif
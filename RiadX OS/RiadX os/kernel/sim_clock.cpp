@@ -0,0 +1,184 @@
+#include "sim_clock.h"
+#include "klog.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+struct SimSleeper {
+    bool due;  // Set by sim_advance() when the deadline is reached
+};
+
+static std::atomic<bool> simulation(false);
+static uint64_t simulation_seed = 0;
+
+static std::mutex sim_mutex;
+static std::condition_variable sleepers_wakeup;  // Deadlines reached or wake() changed
+static std::condition_variable advance_wakeup;   // running dropped
+static uint64_t virtual_now = SIM_START_TIME_MS;
+static int running = 0;   // Joined and starting threads that are not sleeping
+static int starting = 0;  // Spawned threads that have not joined yet
+static std::multimap<uint64_t, SimSleeper*> sleepers;
+
+static thread_local bool thread_joined = false;
+
+static uint64_t mix64(uint64_t x) {
+    // splitmix64 finalizer
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+void sim_enable(uint64_t seed) {
+    {
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        simulation_seed = seed;
+        virtual_now = SIM_START_TIME_MS;
+    }
+    simulation.store(true);
+    KLOG_INFO << "[SIM] Deterministic mode enabled, seed " << seed;
+}
+
+void sim_disable() {
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    simulation.store(false);
+
+    // Release every virtual sleeper
+    for (auto& entry : sleepers) {
+        entry.second->due = true;
+        running++;
+    }
+    sleepers.clear();
+    sleepers_wakeup.notify_all();
+}
+
+bool sim_enabled() {
+    return simulation.load(std::memory_order_relaxed);
+}
+
+uint64_t sim_seed() {
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    return simulation_seed;
+}
+
+uint64_t sim_now_ms() {
+    if (sim_enabled()) {
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        return virtual_now;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::mt19937 sim_rng(const std::string& stream) {
+    if (!sim_enabled()) {
+        std::random_device rd;
+        return std::mt19937(rd());
+    }
+
+    // FNV-1a over the stream name, mixed with the seed
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (unsigned char c : stream) {
+        hash = (hash ^ c) * 0x100000001B3ULL;
+    }
+    uint64_t state = mix64(sim_seed() ^ mix64(hash));
+
+    std::seed_seq seq{static_cast<uint32_t>(state), static_cast<uint32_t>(state >> 32)};
+    return std::mt19937(seq);
+}
+
+bool sim_sleep_ms(uint64_t milliseconds, const std::function<bool()>& wake) {
+    std::unique_lock<std::mutex> lock(sim_mutex);
+
+    if (!thread_joined || !simulation.load()) {
+        if (!wake) {
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+            return true;
+        }
+        return !sleepers_wakeup.wait_for(lock, std::chrono::milliseconds(milliseconds), wake);
+    }
+
+    SimSleeper sleeper{false};
+    auto entry = sleepers.emplace(virtual_now + milliseconds, &sleeper);
+    if (--running == 0) {
+        advance_wakeup.notify_all();
+    }
+
+    sleepers_wakeup.wait(lock, [&]() { return sleeper.due || (wake && wake()); });
+
+    if (!sleeper.due) {
+        // Woken early; sim_advance() did not count this thread as running
+        sleepers.erase(entry);
+        running++;
+        return false;
+    }
+    return true;
+}
+
+void sim_notify() {
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    sleepers_wakeup.notify_all();
+}
+
+void sim_advance(uint64_t milliseconds) {
+    std::unique_lock<std::mutex> lock(sim_mutex);
+    uint64_t target = virtual_now + milliseconds;
+
+    for (;;) {
+        advance_wakeup.wait(lock, []() { return running == 0; });
+
+        if (sleepers.empty() || sleepers.begin()->first > target) {
+            virtual_now = target;
+            return;
+        }
+
+        // Jump to the next deadline and run everyone due at it
+        virtual_now = std::max(virtual_now, sleepers.begin()->first);
+        auto end = sleepers.upper_bound(virtual_now);
+        for (auto it = sleepers.begin(); it != end; ++it) {
+            it->second->due = true;
+            running++;
+        }
+        sleepers.erase(sleepers.begin(), end);
+        sleepers_wakeup.notify_all();
+    }
+}
+
+void sim_thread_starting() {
+    if (!sim_enabled()) return;
+
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    starting++;
+    running++;
+}
+
+SimThread::SimThread() : joined(false) {
+    if (thread_joined) return;
+
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    if (starting > 0) {
+        // Already counted as running by sim_thread_starting()
+        starting--;
+    } else if (simulation.load()) {
+        running++;
+    } else {
+        return;
+    }
+    joined = true;
+    thread_joined = true;
+}
+
+SimThread::~SimThread() {
+    if (!joined) return;
+
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    thread_joined = false;
+    if (--running == 0) {
+        advance_wakeup.notify_all();
+    }
+}
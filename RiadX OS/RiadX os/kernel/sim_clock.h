@@ -0,0 +1,69 @@
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <cstdint>
+#include <string>
+#include <random>
+#include <functional>
+
+// Deterministic simulation mode.
+//
+// Normally timestamps come from the wall clock, simulated work sleeps for
+// real and every random generator is seeded from std::random_device. After
+// sim_enable(seed) instead:
+//
+//   - sim_now_ms() returns a virtual clock that only moves in sim_advance()
+//   - sim_rng(stream) returns a generator seeded from the seed and the stream
+//     name, so each process and driver replays the same sequence every run
+//   - threads that joined the simulation (SimThread) sleep in virtual time
+//
+// sim_advance() steps the clock from one sleeper deadline to the next and
+// waits for the threads it woke to finish their work and sleep again before
+// moving on. Every run with the same seed therefore performs the same work
+// at the same virtual times, however fast or slow the host is. Threads woken
+// at the same virtual time still run concurrently.
+//
+// Enable it before RiadXOS::initialize(); the kernel's timer thread then
+// drives the clock instead of sleeping.
+#define SIM_START_TIME_MS 1700000000000ULL  // Virtual clock at sim_enable()
+
+void sim_enable(uint64_t seed);
+void sim_disable();
+bool sim_enabled();
+uint64_t sim_seed();
+
+// Milliseconds since the Unix epoch, virtual in simulation mode
+uint64_t sim_now_ms();
+
+// Generator for one named stream of decisions
+std::mt19937 sim_rng(const std::string& stream);
+
+// Sleeps for the given time, virtual if the calling thread joined the
+// simulation. Returns false if woken early because wake() became true;
+// whoever makes it true must call sim_notify().
+bool sim_sleep_ms(uint64_t milliseconds, const std::function<bool()>& wake = nullptr);
+void sim_notify();
+
+// Moves virtual time forward, running every sleeper that falls due. Must not
+// be called from a thread that joined the simulation.
+void sim_advance(uint64_t milliseconds);
+
+// Called before starting a thread that constructs a SimThread, so the clock
+// cannot move between the spawn and the thread joining
+void sim_thread_starting();
+
+// Joins the calling thread to the simulation for its lifetime. While it is
+// not sleeping, sim_advance() waits for it.
+class SimThread {
+private:
+    bool joined;
+
+public:
+    SimThread();
+    ~SimThread();
+
+    SimThread(const SimThread&) = delete;
+    SimThread& operator=(const SimThread&) = delete;
+};
+
+#endif
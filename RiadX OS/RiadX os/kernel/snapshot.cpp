@@ -0,0 +1,380 @@
+#include "snapshot.h"
+#include "../bootloader.h"
+#include "klog.h"
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// SnapshotWriter implementation
+SnapshotWriter::SnapshotWriter() : section_length_offset(0), in_section(false) {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    // An unfinished snapshot leaves the previous file in place
+    if (out.is_open()) {
+        out.close();
+        unlink(temp_path.c_str());
+    }
+}
+
+bool SnapshotWriter::open(const std::string& file_path) {
+    path = file_path;
+    temp_path = file_path + ".tmp";
+    out.open(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        KLOG_ERROR << "[SNAPSHOT] Cannot create " << temp_path;
+        return false;
+    }
+
+    out.write(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    write_u32(SNAPSHOT_VERSION);
+    return out.good();
+}
+
+bool SnapshotWriter::finish() {
+    write_u32(SNAPSHOT_SECTION_END);
+    write_u64(0);
+    out.close();
+    if (out.fail()) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    // Durable before it replaces the old snapshot. Mappings of the old file
+    // keep its pages after the rename.
+    int fd = ::open(temp_path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        KLOG_ERROR << "[SNAPSHOT] Cannot replace " << path;
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SnapshotWriter::begin_section(SnapshotSection tag) {
+    write_u32(tag);
+    section_length_offset = tell();
+    write_u64(0);  // Patched by end_section()
+    in_section = true;
+}
+
+void SnapshotWriter::end_section() {
+    if (!in_section) return;
+
+    uint64_t end = tell();
+    uint64_t length = end - section_length_offset - sizeof(uint64_t);
+    out.seekp(section_length_offset);
+    write_u64(length);
+    out.seekp(end);
+    in_section = false;
+}
+
+void SnapshotWriter::write_u8(uint8_t value) {
+    out.put(static_cast<char>(value));
+}
+
+void SnapshotWriter::write_u32(uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+    out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+void SnapshotWriter::write_u64(uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+    out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+void SnapshotWriter::write_string(const std::string& value) {
+    write_u32(static_cast<uint32_t>(value.size()));
+    out.write(value.data(), value.size());
+}
+
+void SnapshotWriter::write_bytes(const void* data, size_t size) {
+    out.write(static_cast<const char*>(data), size);
+}
+
+size_t SnapshotWriter::write_sparse_pages(const uint8_t* data, size_t size, size_t page_size) {
+    const std::vector<uint8_t> zero_page(page_size, 0);
+    size_t written = 0;
+
+    for (size_t offset = 0; offset < size; offset += page_size) {
+        size_t chunk = std::min(page_size, size - offset);
+        if (Bootloader::memcmp_boot(data + offset, zero_page.data(), chunk) == 0) {
+            out.seekp(chunk, std::ios::cur);  // Hole, reads back as zeros
+        } else {
+            out.write(reinterpret_cast<const char*>(data + offset), chunk);
+            written++;
+        }
+    }
+
+    // A trailing hole only exists once something is written past it
+    if (size > 0 && written * page_size < size) {
+        out.seekp(-1, std::ios::cur);
+        out.put(static_cast<char>(data[size - 1]));
+    }
+    return written;
+}
+
+void SnapshotWriter::align(size_t alignment) {
+    uint64_t position = tell();
+    uint64_t padding = (alignment - position % alignment) % alignment;
+    for (uint64_t i = 0; i < padding; i++) {
+        out.put(0);
+    }
+}
+
+uint64_t SnapshotWriter::tell() {
+    return static_cast<uint64_t>(out.tellp());
+}
+
+// SnapshotReader implementation
+SnapshotReader::SnapshotReader()
+    : fd(-1), data(nullptr), size(0), cursor(0), section_end(0), ok(false) {
+}
+
+SnapshotReader::~SnapshotReader() {
+    close();
+}
+
+bool SnapshotReader::open(const std::string& file_path) {
+    close();
+
+    fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        KLOG_ERROR << "[SNAPSHOT] Cannot open " << file_path;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_MAGIC_SIZE + 4) {
+        KLOG_ERROR << "[SNAPSHOT] Invalid snapshot " << file_path;
+        close();
+        return false;
+    }
+
+    size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        KLOG_ERROR << "[SNAPSHOT] Cannot map " << file_path;
+        data = nullptr;
+        close();
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+
+    if (std::memcmp(data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0) {
+        KLOG_ERROR << "[SNAPSHOT] Bad magic in " << file_path;
+        close();
+        return false;
+    }
+
+    ok = true;
+    cursor = SNAPSHOT_MAGIC_SIZE;
+    section_end = size;
+    if (read_u32() != SNAPSHOT_VERSION) {
+        KLOG_ERROR << "[SNAPSHOT] Unsupported snapshot version";
+        close();
+        return false;
+    }
+
+    // Index the section table; payloads are only touched when entered
+    while (ok) {
+        uint32_t tag = read_u32();
+        uint64_t length = read_u64();
+        if (!ok || tag == SNAPSHOT_SECTION_END) break;
+        if (length > size - cursor) {
+            ok = false;
+            break;
+        }
+        sections[tag] = std::make_pair(cursor, static_cast<size_t>(length));
+        cursor += length;
+    }
+
+    if (!ok) {
+        KLOG_ERROR << "[SNAPSHOT] Truncated snapshot " << file_path;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SnapshotReader::close() {
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), size);
+        data = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    sections.clear();
+    size = 0;
+    cursor = 0;
+    section_end = 0;
+    ok = false;
+}
+
+bool SnapshotReader::enter_section(SnapshotSection tag) {
+    auto it = sections.find(tag);
+    if (it == sections.end()) {
+        return false;
+    }
+
+    cursor = it->second.first;
+    section_end = it->second.first + it->second.second;
+    ok = true;
+    return true;
+}
+
+bool SnapshotReader::check(size_t bytes) {
+    if (!ok || bytes > section_end - cursor) {
+        ok = false;
+        return false;
+    }
+    return true;
+}
+
+uint8_t SnapshotReader::read_u8() {
+    if (!check(1)) return 0;
+    return data[cursor++];
+}
+
+uint32_t SnapshotReader::read_u32() {
+    if (!check(4)) return 0;
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= static_cast<uint32_t>(data[cursor + i]) << (i * 8);
+    }
+    cursor += 4;
+    return value;
+}
+
+uint64_t SnapshotReader::read_u64() {
+    if (!check(8)) return 0;
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= static_cast<uint64_t>(data[cursor + i]) << (i * 8);
+    }
+    cursor += 8;
+    return value;
+}
+
+std::string SnapshotReader::read_string() {
+    uint32_t length = read_u32();
+    if (!check(length)) return "";
+    std::string value(reinterpret_cast<const char*>(data + cursor), length);
+    cursor += length;
+    return value;
+}
+
+bool SnapshotReader::read_bytes(void* dest, size_t count) {
+    if (!check(count)) return false;
+    Bootloader::memcpy_boot(dest, data + cursor, count);
+    cursor += count;
+    return true;
+}
+
+void SnapshotReader::align(size_t alignment) {
+    size_t padding = (alignment - cursor % alignment) % alignment;
+    if (check(padding)) {
+        cursor += padding;
+    }
+}
+
+void* SnapshotReader::map_pages(size_t count) {
+    if (!check(count)) return nullptr;
+
+    void* mapping = mmap(nullptr, count, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                         static_cast<off_t>(cursor));
+    if (mapping == MAP_FAILED) {
+        ok = false;
+        return nullptr;
+    }
+    cursor += count;
+    return mapping;
+}
+
+// MemoryWriter implementation
+void MemoryWriter::write_u32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+void MemoryWriter::write_u64(uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        bytes.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+void MemoryWriter::write_string(const std::string& value) {
+    write_u32(static_cast<uint32_t>(value.size()));
+    bytes.insert(bytes.end(), value.begin(), value.end());
+}
+
+void MemoryWriter::write_bytes(const void* data, size_t size) {
+    const uint8_t* source = static_cast<const uint8_t*>(data);
+    bytes.insert(bytes.end(), source, source + size);
+}
+
+// MemoryReader implementation
+bool MemoryReader::check(size_t count) {
+    if (!ok || count > size - cursor) {
+        ok = false;
+        return false;
+    }
+    return true;
+}
+
+uint8_t MemoryReader::read_u8() {
+    if (!check(1)) return 0;
+    return data[cursor++];
+}
+
+uint32_t MemoryReader::read_u32() {
+    if (!check(4)) return 0;
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= static_cast<uint32_t>(data[cursor + i]) << (i * 8);
+    }
+    cursor += 4;
+    return value;
+}
+
+uint64_t MemoryReader::read_u64() {
+    if (!check(8)) return 0;
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= static_cast<uint64_t>(data[cursor + i]) << (i * 8);
+    }
+    cursor += 8;
+    return value;
+}
+
+std::string MemoryReader::read_string() {
+    uint32_t length = read_u32();
+    if (!check(length)) return "";
+    std::string value(reinterpret_cast<const char*>(data + cursor), length);
+    cursor += length;
+    return value;
+}
+
+bool MemoryReader::read_bytes(void* dest, size_t count) {
+    if (!check(count)) return false;
+    Bootloader::memcpy_boot(dest, data + cursor, count);
+    cursor += count;
+    return true;
+}
@@ -0,0 +1,152 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+// Snapshot file layout:
+//   "RXSNAP01" magic, u32 version
+//   sections: u32 tag, u64 length, payload
+//   SNAPSHOT_SECTION_END
+// Integers are little endian. Large page images inside a section are page
+// aligned in the file so they can be mapped directly on resume.
+#define SNAPSHOT_MAGIC       "RXSNAP01"
+#define SNAPSHOT_MAGIC_SIZE  8
+#define SNAPSHOT_VERSION     6
+
+enum SnapshotSection : uint32_t {
+    SNAPSHOT_SECTION_MEMORY     = 1,
+    SNAPSHOT_SECTION_PROCESSES  = 2,
+    SNAPSHOT_SECTION_FILESYSTEM = 3,
+    SNAPSHOT_SECTION_GUI        = 4,
+    SNAPSHOT_SECTION_END        = 0xFFFFFFFF
+};
+
+class SnapshotWriter {
+private:
+    std::ofstream out;
+    std::string path;
+    std::string temp_path;  // Written here, renamed over path by finish()
+    uint64_t section_length_offset;
+    bool in_section;
+
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();
+
+    // The file at file_path is only replaced once finish() succeeds, so a
+    // snapshot can be saved over the one the running system resumed from
+    // (its memory pool is still mapped from that file)
+    bool open(const std::string& file_path);
+    bool finish();
+    bool good() const { return out.good(); }
+
+    void begin_section(SnapshotSection tag);
+    void end_section();
+
+    void write_u8(uint8_t value);
+    void write_u32(uint32_t value);
+    void write_u64(uint64_t value);
+    void write_i32(int32_t value) { write_u32(static_cast<uint32_t>(value)); }
+    void write_bool(bool value) { write_u8(value ? 1 : 0); }
+    void write_string(const std::string& value);
+    void write_bytes(const void* data, size_t size);
+
+    // Writes a page image, leaving all-zero pages as holes in the file.
+    // Returns the number of pages actually written.
+    size_t write_sparse_pages(const uint8_t* data, size_t size, size_t page_size);
+
+    // Pads with zeros up to the next multiple of alignment in the file
+    void align(size_t alignment);
+    uint64_t tell();
+};
+
+class SnapshotReader {
+private:
+    int fd;
+    const uint8_t* data;
+    size_t size;
+    size_t cursor;
+    size_t section_end;
+    bool ok;
+    std::map<uint32_t, std::pair<size_t, size_t>> sections;  // tag -> (offset, length)
+
+    bool check(size_t bytes);
+
+public:
+    SnapshotReader();
+    ~SnapshotReader();
+
+    bool open(const std::string& file_path);
+    void close();
+
+    // Positions the cursor at the start of a section's payload
+    bool enter_section(SnapshotSection tag);
+    bool good() const { return ok; }
+
+    uint8_t read_u8();
+    uint32_t read_u32();
+    uint64_t read_u64();
+    int32_t read_i32() { return static_cast<int32_t>(read_u32()); }
+    bool read_bool() { return read_u8() != 0; }
+    std::string read_string();
+    bool read_bytes(void* dest, size_t count);
+    void align(size_t alignment);
+
+    // Maps count bytes at the cursor copy-on-write; pages are only read from
+    // the file when first touched. Release with munmap().
+    void* map_pages(size_t count);
+
+    size_t get_size() const { return size; }
+};
+
+// The same encoding into and out of memory, for metadata kept in disk blocks
+class MemoryWriter {
+private:
+    std::vector<uint8_t> bytes;
+
+public:
+    void write_u8(uint8_t value) { bytes.push_back(value); }
+    void write_u32(uint32_t value);
+    void write_u64(uint64_t value);
+    void write_i32(int32_t value) { write_u32(static_cast<uint32_t>(value)); }
+    void write_bool(bool value) { write_u8(value ? 1 : 0); }
+    void write_string(const std::string& value);
+    void write_bytes(const void* data, size_t size);
+    bool good() const { return true; }
+
+    const std::vector<uint8_t>& data() const { return bytes; }
+    size_t size() const { return bytes.size(); }
+    void clear() { bytes.clear(); }
+};
+
+class MemoryReader {
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t cursor;
+    bool ok;
+
+    bool check(size_t count);
+
+public:
+    MemoryReader(const uint8_t* bytes, size_t length) : data(bytes), size(length), cursor(0), ok(true) {}
+
+    bool good() const { return ok; }
+    bool at_end() const { return cursor == size; }
+    size_t position() const { return cursor; }
+
+    uint8_t read_u8();
+    uint32_t read_u32();
+    uint64_t read_u64();
+    int32_t read_i32() { return static_cast<int32_t>(read_u32()); }
+    bool read_bool() { return read_u8() != 0; }
+    std::string read_string();
+    bool read_bytes(void* dest, size_t count);
+};
+
+#endif
@@ -1,46 +1,65 @@
 #include "syscalls.h"
 #include "kernel.h"
+#include "trace.h"
+#include "klog.h"
 #include <iostream>
 #include <cstring>
 
 SystemCalls::SystemCalls(MyOS* kernel_instance) : kernel(kernel_instance) {
-    std::cout << "[SYSCALLS] System call handler initialized" << std::endl;
+    KLOG_INFO << "[SYSCALLS] System call handler initialized";
 }
 
 SystemCalls::~SystemCalls() {
-    std::cout << "[SYSCALLS] System call handler shutdown" << std::endl;
+    KLOG_INFO << "[SYSCALLS] System call handler shutdown";
 }
 
 int SystemCalls::handle_syscall(int syscall_num, void* params) {
     syscall_params* p = static_cast<syscall_params*>(params);
+    TraceScope trace(TRACE_SYSCALL, syscall_num);
+    int result;
     
     switch (syscall_num) {
         case SYS_READ:
-            return sys_read(p);
+            result = sys_read(p);
+            break;
         case SYS_WRITE:
-            return sys_write(p);
+            result = sys_write(p);
+            break;
         case SYS_OPEN:
-            return sys_open(p);
+            result = sys_open(p);
+            break;
         case SYS_CLOSE:
-            return sys_close(p);
+            result = sys_close(p);
+            break;
         case SYS_FORK:
-            return sys_fork(p);
+            result = sys_fork(p);
+            break;
         case SYS_EXEC:
-            return sys_exec(p);
+            result = sys_exec(p);
+            break;
         case SYS_EXIT:
-            return sys_exit(p);
+            result = sys_exit(p);
+            break;
         case SYS_MALLOC:
-            return sys_malloc(p);
+            result = sys_malloc(p);
+            break;
         case SYS_FREE:
-            return sys_free(p);
+            result = sys_free(p);
+            break;
         case SYS_GETPID:
-            return sys_getpid(p);
+            result = sys_getpid(p);
+            break;
         case SYS_KILL:
-            return sys_kill(p);
+            result = sys_kill(p);
+            break;
         default:
-            std::cerr << "[SYSCALLS] Unknown system call: " << syscall_num << std::endl;
-            return -1;
+            KLOG_ERROR << "[SYSCALLS] Unknown system call: " << syscall_num;
+            result = -1;
+            break;
     }
+    
+    trace.result = static_cast<uint64_t>(static_cast<int64_t>(result));
+    return result;
 }
 
 int SystemCalls::sys_read(syscall_params* params) {
@@ -48,7 +67,7 @@ int SystemCalls::sys_read(syscall_params* params) {
     void* buffer = params->ptr;
     size_t count = static_cast<size_t>(params->arg2);
     
-    std::cout << "[SYSCALLS] sys_read(fd=" << fd << ", count=" << count << ")" << std::endl;
+    KLOG_DEBUG << "[SYSCALLS] sys_read(fd=" << fd << ", count=" << count << ")";
     
     // Simulate file read
     if (fd == 0) { // stdin
@@ -56,13 +75,8 @@ int SystemCalls::sys_read(syscall_params* params) {
         return 0;
     }
     
-    // Read from file system
-    std::string content = kernel->read_file("file_" + std::to_string(fd));
-    if (content.empty()) return 0;
-    
-    size_t bytes_to_copy = std::min(count, content.length());
-    memcpy(buffer, content.c_str(), bytes_to_copy);
-    return static_cast<int>(bytes_to_copy);
+    // Read from file system at the descriptor's position
+    return static_cast<int>(kernel->read_file_fd(fd, buffer, count));
 }
 
 int SystemCalls::sys_write(syscall_params* params) {
@@ -77,36 +91,28 @@ int SystemCalls::sys_write(syscall_params* params) {
     }
     
     // Write to file
-    std::string content(static_cast<const char*>(buffer), count);
-    if (kernel->write_file("file_" + std::to_string(fd), content)) {
-        return static_cast<int>(count);
-    }
-    
-    return -1;
+    return static_cast<int>(kernel->write_file_fd(fd, buffer, count));
 }
 
 int SystemCalls::sys_open(syscall_params* params) {
     const char* pathname = params->str;
     int flags = static_cast<int>(params->arg1);
     
-    std::cout << "[SYSCALLS] sys_open(" << pathname << ", flags=" << flags << ")" << std::endl;
+    KLOG_DEBUG << "[SYSCALLS] sys_open(" << pathname << ", flags=" << flags << ")";
     
     // Create file if it doesn't exist
-    if (!kernel->read_file(pathname).empty() || kernel->create_file(pathname)) {
-        return 3; // Return a fake file descriptor
-    }
-    
-    return -1;
+    return kernel->open_file(pathname, FS_OPEN_CREATE);
 }
 
 int SystemCalls::sys_close(syscall_params* params) {
     int fd = static_cast<int>(params->arg1);
-    std::cout << "[SYSCALLS] sys_close(fd=" << fd << ")" << std::endl;
-    return 0; // Success
+    KLOG_DEBUG << "[SYSCALLS] sys_close(fd=" << fd << ")";
+    if (fd <= 2) return 0; // stdin, stdout and stderr stay open
+    return kernel->close_file(fd) ? 0 : -1;
 }
 
 int SystemCalls::sys_fork(syscall_params* params) {
-    std::cout << "[SYSCALLS] sys_fork()" << std::endl;
+    KLOG_DEBUG << "[SYSCALLS] sys_fork()";
     // Create a new process
     int pid = kernel->create_process("forked_process");
     return pid;
@@ -114,7 +120,7 @@ int SystemCalls::sys_fork(syscall_params* params) {
 
 int SystemCalls::sys_exec(syscall_params* params) {
     const char* pathname = params->str;
-    std::cout << "[SYSCALLS] sys_exec(" << pathname << ")" << std::endl;
+    KLOG_DEBUG << "[SYSCALLS] sys_exec(" << pathname << ")";
     
     // Replace current process with new executable
     int pid = kernel->create_process(pathname);
@@ -123,7 +129,7 @@ int SystemCalls::sys_exec(syscall_params* params) {
 
 int SystemCalls::sys_exit(syscall_params* params) {
     int status = static_cast<int>(params->arg1);
-    std::cout << "[SYSCALLS] sys_exit(status=" << status << ")" << std::endl;
+    KLOG_DEBUG << "[SYSCALLS] sys_exit(status=" << status << ")";
     
     // Terminate current process
     return 0;
@@ -150,7 +156,7 @@ int SystemCalls::sys_kill(syscall_params* params) {
     int pid = static_cast<int>(params->arg1);
     int signal = static_cast<int>(params->arg2);
     
-    std::cout << "[SYSCALLS] sys_kill(pid=" << pid << ", signal=" << signal << ")" << std::endl;
+    KLOG_DEBUG << "[SYSCALLS] sys_kill(pid=" << pid << ", signal=" << signal << ")";
     
     return kernel->terminate_process(pid) ? 0 : -1;
 }
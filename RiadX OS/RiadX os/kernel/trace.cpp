@@ -0,0 +1,180 @@
+#include "trace.h"
+#include "klog.h"
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+#define TRACE_RING_MASK (TRACE_RING_EVENTS - 1)
+
+struct TraceRing {
+    TraceRecord records[TRACE_RING_EVENTS];
+    std::atomic<uint64_t> head;     // Events ever written; the owner is the only writer
+    std::atomic<uint64_t> cleared;  // Export starts here, set by trace_clear()
+    uint32_t tid;
+
+    TraceRing(uint32_t id) : head(0), cleared(0), tid(id) {}
+};
+
+std::atomic<bool> trace_enabled(false);
+
+// Rings outlive their threads so events can be exported after a thread
+// exits. A ring freed by an exiting thread goes to the next thread that
+// starts tracing, so there are only as many rings as threads ever traced at
+// once; the old events stay exportable until the new owner overwrites them.
+static std::mutex rings_mutex;
+static std::vector<std::unique_ptr<TraceRing>> trace_rings;
+static std::vector<TraceRing*> free_rings;
+static std::atomic<uint32_t> next_trace_tid(1);
+
+// Hands the calling thread's ring back when the thread exits
+struct TraceRingOwner {
+    TraceRing* ring = nullptr;
+
+    ~TraceRingOwner() {
+        if (ring) {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            free_rings.push_back(ring);
+        }
+    }
+};
+
+static thread_local TraceRingOwner thread_ring;
+
+static const std::chrono::steady_clock::time_point trace_base = std::chrono::steady_clock::now();
+
+static const struct {
+    const char* name;
+    const char* category;
+} trace_event_info[TRACE_EVENT_COUNT] = {
+    { "sched_switch",      "sched" },
+    { "process_create",    "sched" },
+    { "process_exit",      "sched" },
+    { "mem_alloc",         "mem" },
+    { "mem_free",          "mem" },
+    { "mem_alloc_failed",  "mem" },
+    { "syscall",           "syscall" },
+    { "fs_create",         "fs" },
+    { "fs_read",           "fs" },
+    { "fs_write",          "fs" },
+    { "gui_frame",         "gui" },
+    { "gui_composite",     "gui" },
+};
+
+static TraceRing* register_thread_ring() {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    if (!free_rings.empty()) {
+        thread_ring.ring = free_rings.back();
+        free_rings.pop_back();
+        // Records carry their own tid, so the previous owner's still export
+        // under it
+        thread_ring.ring->tid = next_trace_tid++;
+    } else {
+        trace_rings.emplace_back(new TraceRing(next_trace_tid++));
+        thread_ring.ring = trace_rings.back().get();
+    }
+    return thread_ring.ring;
+}
+
+void trace_enable(bool enable) {
+    trace_enabled.store(enable, std::memory_order_relaxed);
+    KLOG_INFO << "[TRACE] Tracing " << (enable ? "enabled" : "disabled");
+}
+
+void trace_clear() {
+    // Moves the export window; the owners keep writing at their own head
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (auto& ring : trace_rings) {
+        ring->cleared.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+void trace_record(TraceEventId event, TracePhase phase, uint64_t arg0, uint64_t arg1) {
+    TraceRing* ring = thread_ring.ring ? thread_ring.ring : register_thread_ring();
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceRecord& record = ring->records[head & TRACE_RING_MASK];
+    record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_base).count();
+    record.event = event;
+    record.phase = phase;
+    record.reserved = 0;
+    record.tid = ring->tid;
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+
+    // Publishes the record to the exporter
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+const char* trace_event_name(TraceEventId event) {
+    return event < TRACE_EVENT_COUNT ? trace_event_info[event].name : "unknown";
+}
+
+// Copies the valid part of a ring. The owner may keep writing meanwhile, so
+// records that could have been overwritten during the copy are dropped.
+static void copy_ring(const TraceRing& ring, std::vector<TraceRecord>& out) {
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    first = std::max(first, ring.cleared.load(std::memory_order_relaxed));
+
+    std::vector<TraceRecord> copy;
+    copy.reserve(head - first);
+    for (uint64_t i = first; i < head; i++) {
+        copy.push_back(ring.records[i & TRACE_RING_MASK]);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t head_after = ring.head.load(std::memory_order_relaxed);
+    uint64_t safe_first = head_after >= TRACE_RING_EVENTS ? head_after - TRACE_RING_EVENTS + 1 : 0;
+
+    for (uint64_t i = first; i < head; i++) {
+        if (i >= safe_first) {
+            out.push_back(copy[i - first]);
+        }
+    }
+}
+
+long trace_export_chrome(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        KLOG_ERROR << "[TRACE] Cannot create " << path;
+        return -1;
+    }
+
+    std::vector<TraceRecord> records;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (const auto& ring : trace_rings) {
+            copy_ring(*ring, records);
+        }
+    }
+
+    out << "{\"traceEvents\":[\n";
+    char line[256];
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+        const char* name = trace_event_name(static_cast<TraceEventId>(record.event));
+        const char* category = record.event < TRACE_EVENT_COUNT ? trace_event_info[record.event].category : "unknown";
+
+        int length = std::snprintf(line, sizeof(line),
+            "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":0,\"tid\":%u,"
+            "\"args\":{\"arg0\":%llu,\"arg1\":%llu}%s}%s\n",
+            name, category, record.phase,
+            static_cast<unsigned long long>(record.timestamp_ns / 1000),
+            static_cast<unsigned long long>(record.timestamp_ns % 1000),
+            record.tid,
+            static_cast<unsigned long long>(record.arg0),
+            static_cast<unsigned long long>(record.arg1),
+            record.phase == TRACE_PHASE_INSTANT ? ",\"s\":\"t\"" : "",
+            i + 1 < records.size() ? "," : "");
+        out.write(line, length);
+    }
+    out << "],\"displayTimeUnit\":\"ns\"}\n";
+
+    KLOG_INFO << "[TRACE] Exported " << records.size() << " events to " << path;
+    return static_cast<long>(records.size());
+}
@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Kernel event tracing.
+//
+// Every CPU (in this hosted kernel, every kernel thread) records fixed-size
+// binary events into its own ring buffer. Only the owning thread writes its
+// ring, so recording is a timestamp read and a few stores with no locks or
+// shared cache lines. When the ring is full the oldest events are
+// overwritten. trace_export_chrome() converts all rings to the Chrome trace
+// JSON format (chrome://tracing, Perfetto).
+//
+// Tracepoints are TRACE_EVENT() and TraceScope below. With tracing disabled
+// they cost one relaxed load and a branch.
+#define TRACE_RING_EVENTS 8192  // Per thread, must be a power of two
+
+enum TraceEventId : uint16_t {
+    // Scheduler
+    TRACE_SCHED_SWITCH = 0,     // arg0 = previous pid, arg1 = next pid
+    TRACE_PROCESS_CREATE,       // arg0 = pid
+    TRACE_PROCESS_EXIT,         // arg0 = pid
+
+    // Allocator
+    TRACE_MEM_ALLOC,            // arg0 = address, arg1 = size
+    TRACE_MEM_FREE,             // arg0 = address, arg1 = size
+    TRACE_MEM_ALLOC_FAILED,     // arg0 = requested size
+
+    // System calls
+    TRACE_SYSCALL,              // Duration, arg0 = syscall number, arg1 = result
+
+    // Filesystem
+    TRACE_FS_CREATE,            // arg0 = FileType, arg1 = inode
+    TRACE_FS_READ,              // Duration, arg1 = bytes read
+    TRACE_FS_WRITE,             // Duration, arg0 = bytes
+
+    // Compositor
+    TRACE_GUI_FRAME,            // Duration
+    TRACE_GUI_COMPOSITE,        // Duration, arg1 = windows drawn
+
+    TRACE_EVENT_COUNT
+};
+
+enum TracePhase : uint8_t {
+    TRACE_PHASE_INSTANT = 'i',
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E'
+};
+
+// 32 bytes, two events per cache line
+struct TraceRecord {
+    uint64_t timestamp_ns;
+    uint16_t event;
+    uint8_t phase;
+    uint8_t reserved;
+    uint32_t tid;
+    uint64_t arg0;
+    uint64_t arg1;
+};
+
+extern std::atomic<bool> trace_enabled;
+
+void trace_enable(bool enable);
+void trace_clear();
+
+// Records one event in the calling thread's ring
+void trace_record(TraceEventId event, TracePhase phase, uint64_t arg0, uint64_t arg1);
+
+// Writes every ring as Chrome trace JSON; returns the number of events written
+// or -1 if the file cannot be created
+long trace_export_chrome(const std::string& path);
+
+const char* trace_event_name(TraceEventId event);
+
+#define TRACE_EVENT(event, arg0, arg1) \
+    do { \
+        if (trace_enabled.load(std::memory_order_relaxed)) \
+            trace_record((event), TRACE_PHASE_INSTANT, (uint64_t)(arg0), (uint64_t)(arg1)); \
+    } while (0)
+
+// Brackets a scope with begin/end events. The end event is only recorded if
+// the begin was, so toggling tracing never leaves unmatched pairs.
+class TraceScope {
+private:
+    TraceEventId event;
+    bool active;
+
+public:
+    uint64_t result;  // Reported as arg1 of the end event
+
+    TraceScope(TraceEventId id, uint64_t arg0 = 0)
+        : event(id), active(trace_enabled.load(std::memory_order_relaxed)), result(0) {
+        if (active) trace_record(event, TRACE_PHASE_BEGIN, arg0, 0);
+    }
+    ~TraceScope() {
+        if (active) trace_record(event, TRACE_PHASE_END, 0, result);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#endif
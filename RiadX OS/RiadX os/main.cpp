@@ -2,7 +2,11 @@
 #include <thread>
 #include <chrono>
 #include <signal.h>
+#include <cstring>
+#include <cstdlib>
 #include "kernel/kernel.h"
+#include "kernel/sim_clock.h"
+#include "kernel/rcu.h"
 #include "boot/bootloader.h"
 #include "gui/gui_manager.h"
 
@@ -17,11 +21,51 @@ void signal_handler(int signal) {
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
     // Register signal handlers for graceful shutdown
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    // --deterministic <seed>: virtual clock and seeded workloads, so runs
+    // can be replayed and compared
+    // --disk <image>: keep the filesystem in a host image file, created on
+    // first use
+    // --compress: compress file data as it is written
+    // --dedup: store identical blocks written from now on only once
+    // --trace <file>: write the kernel event trace as Chrome trace JSON at
+    // shutdown
+    // --hibernate <file>: save the whole system to a snapshot at shutdown
+    // --resume <file>: start from a snapshot instead of a fresh boot; use
+    // the same --disk as the run that hibernated
+    // --benchmark: measure the boot memory primitives and the RCU process
+    // table, then exit
+    const char* disk_image = nullptr;
+    const char* trace_file = nullptr;
+    const char* hibernate_file = nullptr;
+    const char* resume_file = nullptr;
+    bool compress = false;
+    bool dedup = false;
+    bool benchmark = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--deterministic") == 0 && i + 1 < argc) {
+            sim_enable(std::strtoull(argv[++i], nullptr, 0));
+        } else if (std::strcmp(argv[i], "--disk") == 0 && i + 1 < argc) {
+            disk_image = argv[++i];
+        } else if (std::strcmp(argv[i], "--compress") == 0) {
+            compress = true;
+        } else if (std::strcmp(argv[i], "--dedup") == 0) {
+            dedup = true;
+        } else if (std::strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = true;
+        } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (std::strcmp(argv[i], "--hibernate") == 0 && i + 1 < argc) {
+            hibernate_file = argv[++i];
+        } else if (std::strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resume_file = argv[++i];
+        }
+    }
+
     std::cout << "=== MyOS Bootloader ===" << std::endl;
     std::cout << "Starting boot sequence..." << std::endl;
 
@@ -31,12 +75,35 @@ int main() {
         std::cerr << "Boot failed!" << std::endl;
         return 1;
     }
+    
+    // Runs against the primitives boot() just selected
+    if (benchmark) {
+        Bootloader::benchmark_memory_primitives();
+        rcu_benchmark();
+        return 0;
+    }
 
     // Initialize operating system
     MyOS os;
     os_instance = &os;
+    if (disk_image) {
+        os.set_disk_image(disk_image);
+    }
+    os.set_filesystem_compression(compress);
+    os.set_filesystem_deduplication(dedup);
+    if (trace_file) {
+        os.set_trace_export(trace_file);
+    }
+    if (hibernate_file) {
+        os.set_hibernate_on_shutdown(hibernate_file);
+    }
     
-    if (!os.initialize()) {
+    if (resume_file) {
+        if (!os.resume(resume_file)) {
+            std::cerr << "OS resume failed!" << std::endl;
+            return 1;
+        }
+    } else if (!os.initialize()) {
         std::cerr << "OS initialization failed!" << std::endl;
         return 1;
     }
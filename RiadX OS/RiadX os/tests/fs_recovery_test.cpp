@@ -0,0 +1,254 @@
+// Crash recovery: remounts, journal replay of images copied while mounted,
+// reformats over an old journal, and fd writes that need space still held
+// by uncommitted frees.
+#include "tests/test_util.h"
+#include "drivers/filesystem.h"
+#include "kernel/klog.h"
+
+static std::string pattern(size_t size, int seed) {
+    std::string data(size, 0);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>('a' + (i * 7 + seed) % 26);
+    }
+    return data;
+}
+
+// Committed metadata and data come back from the journal; what was never
+// synced is gone
+static void journal_replay() {
+    std::string image = test_image("replay");
+    std::string crashed = test_image("replay-crash");
+    std::string big = pattern(300000, 0);
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image, 65536);
+        CHECK(fs.initialize());
+        CHECK(fs.create_directory("/data"));
+        CHECK(fs.write_file("/data/big", big));
+        for (int i = 0; i < 500; i++) {
+            CHECK(fs.write_file("/data/f" + std::to_string(i), "v" + std::to_string(i)));
+        }
+        CHECK(fs.sync());
+
+        CHECK(fs.delete_file("/data/f5"));
+        CHECK(fs.move_file("/data/f6", "/data/g6"));
+        CHECK(fs.move_file("/data/f7", "/data/f8"));
+        CHECK(fs.create_directory("/d2"));
+        CHECK(fs.move_file("/data/f9", "/d2/x"));
+        CHECK(fs.move_file("/d2", "/data/d2"));
+        CHECK(fs.write_file("/data/big", big.substr(0, 5000)));
+        FileAttributes attributes;
+        CHECK(fs.get_file_attributes("/data/f10", attributes));
+        attributes.permissions = 7;
+        CHECK(fs.set_file_attributes("/data/f10", attributes));
+
+        // Only an explicit sync commits from here on
+        fs.set_journal_commit(100000, 100000);
+        CHECK(fs.sync());
+        CHECK(fs.write_file("/data/unsynced", "z"));
+        crash_copy(image, crashed);
+    }
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(crashed);
+        CHECK(fs.initialize());
+        CHECK(fs.read_file("/data/big") == big.substr(0, 5000));
+        CHECK(!fs.file_exists("/data/f5"));
+        CHECK(fs.read_file("/data/g6") == "v6");
+        CHECK(fs.read_file("/data/f8") == "v7");
+        CHECK(fs.read_file("/data/d2/x") == "v9");
+        CHECK(fs.read_file("/data/f499") == "v499");
+        FileAttributes attributes;
+        CHECK(fs.get_file_attributes("/data/f10", attributes));
+        CHECK(attributes.permissions == 7);
+        CHECK(!fs.file_exists("/data/unsynced"));
+    }
+
+    unlink(image.c_str());
+    unlink(crashed.c_str());
+}
+
+// The log wraps through many checkpoints; the last synced version survives
+static void journal_wrap() {
+    std::string image = test_image("wrap");
+    std::string crashed = test_image("wrap-crash");
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image, 65536);
+        CHECK(fs.initialize());
+        for (int i = 0; i < 3000; i++) {
+            CHECK(fs.write_file("/w" + std::to_string(i % 50), std::string(5000, 'a' + i % 26)));
+            if (i % 3 == 0) {
+                CHECK(fs.sync());
+            }
+        }
+        CHECK(fs.sync());
+        crash_copy(image, crashed);
+    }
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(crashed);
+        CHECK(fs.initialize());
+        for (int i = 2950; i < 3000; i++) {
+            CHECK(fs.read_file("/w" + std::to_string(i % 50)) == std::string(5000, 'a' + i % 26));
+        }
+    }
+
+    unlink(image.c_str());
+    unlink(crashed.c_str());
+}
+
+// A reformat must not let the old journal replay over the new filesystem
+static void reformat_replay() {
+    std::string image = test_image("reformat");
+    std::string crashed = test_image("reformat-crash");
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image, 4096);
+        CHECK(fs.initialize());
+        for (int i = 0; i < 5; i++) {
+            CHECK(fs.write_file("/old" + std::to_string(i), "x"));
+            CHECK(fs.sync());
+        }
+    }
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image);
+        CHECK(fs.initialize());
+        CHECK(fs.format_disk());
+        CHECK(fs.write_file("/new", "y"));
+        CHECK(fs.sync());
+        crash_copy(image, crashed);
+    }
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(crashed);
+        CHECK(fs.initialize());
+        for (int i = 0; i < 5; i++) {
+            CHECK(!fs.file_exists("/old" + std::to_string(i)));
+        }
+        CHECK(fs.read_file("/new") == "y");
+    }
+
+    unlink(image.c_str());
+    unlink(crashed.c_str());
+}
+
+// fd appends, overwrites and copy-on-write of reflinked blocks, then a
+// remount; with compression the touched clusters are recompressed
+static void fd_writes(bool compressed) {
+    std::string image = test_image(compressed ? "fd-lz4" : "fd");
+    std::string log;
+    std::string copy;
+    std::string small;
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image, 65536);
+        CHECK(fs.initialize());
+        fs.set_compression(compressed);
+
+        int fd = fs.open_file("/log", FS_OPEN_CREATE);
+        CHECK(fd >= 0);
+        for (int i = 0; i < 4000; i++) {
+            std::string chunk(512, static_cast<char>('a' + i % 26));
+            chunk[0] = static_cast<char>('0' + i % 10);
+            CHECK(fs.write_file_fd(fd, chunk.data(), chunk.size()) == 512);
+            log += chunk;
+        }
+        fs.close_file(fd);
+        CHECK(fs.read_file("/log") == log);
+        CompressionStats stats;
+        CHECK(fs.get_compression_stats("/log", stats));
+        CHECK((stats.compressed_clusters > 0) == compressed);
+
+        // Overwrite the start, ending inside a block
+        fd = fs.open_file("/log", 0);
+        std::string head(10000, 'M');
+        CHECK(fs.write_file_fd(fd, head.data(), head.size()) == static_cast<ssize_t>(head.size()));
+        log.replace(0, head.size(), head);
+        fs.close_file(fd);
+        CHECK(fs.read_file("/log") == log);
+
+        // A reflinked copy keeps its data when the original is written
+        CHECK(fs.copy_file("/log", "/copy"));
+        copy = log;
+        fd = fs.open_file("/log", 0);
+        CHECK(fs.write_file_fd(fd, "ZZZZ", 4) == 4);
+        fs.close_file(fd);
+        log.replace(0, 4, "ZZZZ");
+        CHECK(fs.read_file("/copy") == copy);
+        CHECK(fs.read_file("/log") == log);
+
+        // A small file grows out of inline data
+        fd = fs.open_file("/small", FS_OPEN_CREATE);
+        for (int i = 0; i < 100; i++) {
+            std::string chunk(37, static_cast<char>('A' + i % 26));
+            CHECK(fs.write_file_fd(fd, chunk.data(), chunk.size()) == 37);
+            small += chunk;
+        }
+        fs.close_file(fd);
+        CHECK(fs.sync());
+    }
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image);
+        CHECK(fs.initialize());
+        CHECK(fs.read_file("/log") == log);
+        CHECK(fs.read_file("/copy") == copy);
+        CHECK(fs.read_file("/small") == small);
+    }
+
+    unlink(image.c_str());
+}
+
+// An fd append to a large file on a nearly full disk: the space the write
+// needs is free, but a whole-file rewrite would need space that only frees
+// once a delete commits
+static void fd_append_near_full() {
+    std::string image = test_image("enospc");
+
+    FileSystem fs;
+    fs.set_disk_image(image, 4096);
+    CHECK(fs.initialize());
+    fs.set_journal_commit(100000, 100000);
+
+    int fd = fs.open_file("/log", FS_OPEN_CREATE);
+    CHECK(fd >= 0);
+    std::string log = pattern(4 << 20, 1);
+    CHECK(fs.write_file_fd(fd, log.data(), log.size()) == static_cast<ssize_t>(log.size()));
+    CHECK(fs.write_file("/filler", std::string(fs.get_free_space() - 64 * BLOCK_SIZE, 'f')));
+    CHECK(fs.sync());
+    CHECK(fs.delete_file("/filler"));
+
+    std::string chunk = pattern(32 * BLOCK_SIZE, 2);
+    CHECK(fs.write_file_fd(fd, chunk.data(), chunk.size()) == static_cast<ssize_t>(chunk.size()));
+    fs.close_file(fd);
+    log += chunk;
+    CHECK(fs.read_file("/log") == log);
+
+    fs.shutdown();
+    unlink(image.c_str());
+}
+
+int main() {
+    klog_set_level(KLOG_LEVEL_NONE);
+
+    journal_replay();
+    journal_wrap();
+    reformat_replay();
+    fd_writes(false);
+    fd_writes(true);
+    fd_append_near_full();
+
+    std::printf("fs_recovery_test: ok\n");
+    return 0;
+}
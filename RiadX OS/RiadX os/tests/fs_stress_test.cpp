@@ -0,0 +1,161 @@
+// Concurrency stress for the filesystem's per-inode locking: threads mix
+// reads, writes, creates, deletes, renames and fd appends on private and
+// shared names, then everything is checked again after a remount.
+#include "tests/test_util.h"
+#include "drivers/filesystem.h"
+#include "kernel/klog.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define STRESS_THREADS 8
+#define STRESS_ITERATIONS 300
+#define STRESS_FILES 20       // Private files per thread
+#define APPEND_THREADS 4
+#define APPEND_CHUNKS 200
+
+static std::string private_value(int thread, int iteration) {
+    return "v" + std::to_string(thread) + "_" + std::to_string(iteration);
+}
+
+static void mixed_operations(FileSystem& fs) {
+    std::vector<std::thread> threads;
+    std::atomic<int> errors(0);
+
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        threads.emplace_back([&fs, &errors, t]() {
+            std::string mine = "/w/t" + std::to_string(t);
+            if (!fs.create_directory(mine)) errors++;
+
+            for (int i = 0; i < STRESS_ITERATIONS; i++) {
+                // Private files must always read back what was written
+                std::string path = mine + "/f" + std::to_string(i % STRESS_FILES);
+                std::string value = private_value(t, i);
+                if (!fs.write_file(path, value)) errors++;
+                if (fs.read_file(path) != value) errors++;
+
+                // Shared names: races may make these fail, never corrupt
+                std::string shared = "/w/shared" + std::to_string(i % 5);
+                switch ((i + t) % 7) {
+                    case 0: fs.write_file(shared, value); break;
+                    case 1: fs.read_file(shared); break;
+                    case 2: fs.delete_file(shared); break;
+                    case 3: fs.move_file(shared, "/w/shared" + std::to_string((i + 1) % 5)); break;
+                    case 4: fs.list_directory("/w"); break;
+                    case 5: {
+                        FileAttributes attributes;
+                        if (fs.get_file_attributes(shared, attributes)) {
+                            attributes.permissions = i;
+                            fs.set_file_attributes(shared, attributes);
+                        }
+                        break;
+                    }
+                    case 6: {
+                        // Directory moves across other threads' trees
+                        std::string dir = "/w/dir" + std::to_string(i % 3);
+                        fs.create_directory(dir);
+                        fs.move_file(dir, "/w/t" + std::to_string((t + 1) % STRESS_THREADS) +
+                                          "/moved" + std::to_string(t));
+                        fs.delete_directory(mine + "/moved" +
+                                            std::to_string((t + STRESS_THREADS - 1) % STRESS_THREADS));
+                        break;
+                    }
+                }
+
+                if (i % 50 == 0) {
+                    fs.file_exists(path);
+                    fs.is_directory(mine);
+                    fs.get_free_space();
+                }
+                if (i % 100 == 0) {
+                    fs.sync();
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(errors == 0);
+}
+
+// fd appends from several threads, each to its own file, while another
+// thread keeps reflinking one of them
+static void concurrent_appends(FileSystem& fs) {
+    std::vector<std::thread> threads;
+    std::atomic<int> errors(0);
+
+    for (int t = 0; t < APPEND_THREADS; t++) {
+        threads.emplace_back([&fs, &errors, t]() {
+            std::string path = "/a" + std::to_string(t);
+            int fd = fs.open_file(path, FS_OPEN_CREATE);
+            if (fd < 0) {
+                errors++;
+                return;
+            }
+            std::string chunk(1000, static_cast<char>('a' + t));
+            for (int i = 0; i < APPEND_CHUNKS; i++) {
+                if (fs.write_file_fd(fd, chunk.data(), chunk.size()) != static_cast<ssize_t>(chunk.size())) {
+                    errors++;
+                }
+            }
+            fs.close_file(fd);
+        });
+    }
+    threads.emplace_back([&fs]() {
+        for (int i = 0; i < 20; i++) {
+            fs.copy_file("/a0", "/a0-copy");
+        }
+    });
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(errors == 0);
+}
+
+static void check_contents(FileSystem& fs) {
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        std::string mine = "/w/t" + std::to_string(t);
+        for (int f = 0; f < STRESS_FILES; f++) {
+            // The last iteration that wrote file f
+            int last = STRESS_ITERATIONS - 1 - ((STRESS_ITERATIONS - 1 - f) % STRESS_FILES);
+            CHECK(fs.read_file(mine + "/f" + std::to_string(f)) == private_value(t, last));
+        }
+    }
+    for (int t = 0; t < APPEND_THREADS; t++) {
+        CHECK(fs.read_file("/a" + std::to_string(t)) ==
+              std::string(1000 * APPEND_CHUNKS, static_cast<char>('a' + t)));
+    }
+}
+
+int main() {
+    klog_set_level(KLOG_LEVEL_NONE);
+    std::string image = test_image("stress");
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image, 65536);
+        CHECK(fs.initialize());
+        // Frequent small commits, so checkpoints run while the threads do
+        fs.set_journal_commit(5, 64);
+
+        CHECK(fs.create_directory("/w"));
+        mixed_operations(fs);
+        concurrent_appends(fs);
+        CHECK(fs.sync());
+        check_contents(fs);
+    }
+
+    {
+        FileSystem fs;
+        fs.set_disk_image(image);
+        CHECK(fs.initialize());
+        check_contents(fs);
+    }
+
+    unlink(image.c_str());
+    std::printf("fs_stress_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Hibernation: a system resumed from a snapshot saves a new one over the
+// same file while its memory pool is still mapped from it.
+#include "tests/test_util.h"
+#include "kernel/memory.h"
+#include "kernel/snapshot.h"
+#include "kernel/klog.h"
+#include <cstring>
+
+#define BLOCK_BYTES (64 * 1024)
+
+static bool save(MemoryManager& memory, const std::string& path) {
+    SnapshotWriter writer;
+    return writer.open(path) && memory.save_snapshot(writer) && writer.finish();
+}
+
+static bool restore(MemoryManager& memory, const std::string& path) {
+    SnapshotReader reader;
+    return reader.open(path) && memory.restore_snapshot(reader);
+}
+
+// First fit hands the freed probe block out again, which locates the data
+// block in a restored pool: it sits a fixed distance before the probe
+static uint8_t* find_block(MemoryManager& memory, ptrdiff_t distance) {
+    uint8_t* probe = static_cast<uint8_t*>(memory.allocate(8));
+    CHECK(probe);
+    memory.deallocate(probe);
+    return probe - distance;
+}
+
+int main() {
+    klog_set_level(KLOG_LEVEL_NONE);
+    std::string path = test_image("snapshot");
+
+    ptrdiff_t distance;
+    {
+        MemoryManager memory;
+        CHECK(memory.initialize());
+        uint8_t* block = static_cast<uint8_t*>(memory.allocate(BLOCK_BYTES));
+        CHECK(block);
+        for (size_t i = 0; i < BLOCK_BYTES; i++) {
+            block[i] = static_cast<uint8_t>(i * 7);
+        }
+        uint8_t* probe = static_cast<uint8_t*>(memory.allocate(8));
+        CHECK(probe);
+        distance = probe - block;
+        memory.deallocate(probe);
+        CHECK(save(memory, path));
+    }
+
+    // Resume, touch part of the pool, hibernate to the same path; most of
+    // the pool is still backed by the file being replaced
+    {
+        MemoryManager memory;
+        CHECK(restore(memory, path));
+        uint8_t* block = find_block(memory, distance);
+        for (size_t i = 0; i < BLOCK_BYTES; i++) {
+            CHECK(block[i] == static_cast<uint8_t>(i * 7));
+        }
+        std::memset(block, 0xAB, 100);
+        CHECK(save(memory, path));
+        CHECK(access((path + ".tmp").c_str(), F_OK) != 0);
+    }
+
+    {
+        MemoryManager memory;
+        CHECK(restore(memory, path));
+        uint8_t* block = find_block(memory, distance);
+        for (size_t i = 0; i < BLOCK_BYTES; i++) {
+            CHECK(block[i] == (i < 100 ? 0xAB : static_cast<uint8_t>(i * 7)));
+        }
+    }
+
+    // A snapshot abandoned before finish() leaves the last one in place
+    {
+        MemoryManager memory;
+        CHECK(restore(memory, path));
+        SnapshotWriter writer;
+        CHECK(writer.open(path));
+    }
+    {
+        MemoryManager memory;
+        CHECK(restore(memory, path));
+    }
+
+    unlink(path.c_str());
+    std::printf("snapshot_test: ok\n");
+    return 0;
+}
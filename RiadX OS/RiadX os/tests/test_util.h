@@ -0,0 +1,38 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <unistd.h>
+
+// Shared helpers for the host tests built by `make test`
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+// Disk images go to $TMPDIR, or /tmp; any old image of the same name is removed
+inline std::string test_image(const std::string& name) {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/riadx-" + name + "-" +
+                       std::to_string(getpid()) + ".img";
+    unlink(path.c_str());
+    return path;
+}
+
+// Copies an image while the filesystem on it is still mounted, which is what
+// the disk would hold if the machine lost power at that moment
+inline void crash_copy(const std::string& from, const std::string& to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+    CHECK(in && out);
+}
+
+#endif
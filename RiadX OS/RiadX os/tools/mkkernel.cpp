@@ -0,0 +1,99 @@
+// mkkernel - wraps a flat kernel binary into a bootable RiadX kernel image
+// Usage: mkkernel [--lz4] <kernel.bin> <kernel.img>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include "bootloader.h"
+#include "boot/kernel_image.h"
+#include "boot/lz4.h"
+#include "boot/crc32.h"
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    bool compress = false;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--lz4") == 0) {
+            compress = true;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.size() != 2) {
+        std::cerr << "Usage: mkkernel [--lz4] <kernel.bin> <kernel.img>" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> kernel;
+    if (!read_file(paths[0], kernel)) {
+        std::cerr << "[MKKERNEL] Cannot read " << paths[0] << std::endl;
+        return 1;
+    }
+
+    KernelImageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = KERNEL_IMAGE_MAGIC;
+    header.version = KERNEL_IMAGE_VERSION;
+    header.image_size = static_cast<uint32_t>(kernel.size());
+    header.load_address = KERNEL_LOAD_ADDRESS;
+    header.entry_point = KERNEL_LOAD_ADDRESS;
+
+    std::vector<uint8_t> payload = kernel;
+    if (compress) {
+        std::vector<uint8_t> compressed(lz4_compress_bound(kernel.size()));
+        int compressed_size = lz4_compress_block(kernel.data(), kernel.size(),
+                                                 compressed.data(), compressed.size());
+        if (compressed_size < 0) {
+            std::cerr << "[MKKERNEL] Compression failed" << std::endl;
+            return 1;
+        }
+
+        // Only keep the compressed payload if it saves disk sectors
+        size_t raw_sectors = (kernel.size() + KERNEL_IMAGE_SECTOR_SIZE - 1) / KERNEL_IMAGE_SECTOR_SIZE;
+        size_t lz4_sectors = (compressed_size + KERNEL_IMAGE_SECTOR_SIZE - 1) / KERNEL_IMAGE_SECTOR_SIZE;
+        if (lz4_sectors < raw_sectors) {
+            compressed.resize(compressed_size);
+            payload.swap(compressed);
+            header.flags |= KERNEL_IMAGE_FLAG_LZ4;
+        } else {
+            std::cout << "[MKKERNEL] Kernel does not compress, storing uncompressed" << std::endl;
+        }
+    }
+    header.payload_size = static_cast<uint32_t>(payload.size());
+    header.payload_crc32c = crc32c_software(payload.data(), payload.size());
+    header.flags |= KERNEL_IMAGE_FLAG_CRC32C;
+
+    std::vector<uint8_t> header_sector(KERNEL_IMAGE_SECTOR_SIZE, 0);
+    std::memcpy(header_sector.data(), &header, sizeof(header));
+
+    // Pad the payload to whole sectors so the loader can read it in batches
+    size_t padded = (payload.size() + KERNEL_IMAGE_SECTOR_SIZE - 1) / KERNEL_IMAGE_SECTOR_SIZE
+                    * KERNEL_IMAGE_SECTOR_SIZE;
+    payload.resize(padded, 0);
+
+    std::ofstream out(paths[1], std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "[MKKERNEL] Cannot write " << paths[1] << std::endl;
+        return 1;
+    }
+    out.write(reinterpret_cast<const char*>(header_sector.data()), header_sector.size());
+    out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+
+    std::cout << "[MKKERNEL] " << paths[1] << ": " << kernel.size() << " bytes -> "
+              << header.payload_size << " bytes"
+              << ((header.flags & KERNEL_IMAGE_FLAG_LZ4) ? " (lz4)" : "")
+              << ", " << (1 + padded / KERNEL_IMAGE_SECTOR_SIZE) << " sectors"
+              << ", crc32c 0x" << std::hex << header.payload_crc32c << std::dec << std::endl;
+    return 0;
+}